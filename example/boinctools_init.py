@@ -1,17 +1,25 @@
 from sys import path
 import os
 import dag.util as dag_utils
-path.append(dag_utils.project_path)
+# This file is run for every validation, so add the path only once.
+if not dag_utils.project_path in path:
+    path.append(dag_utils.project_path)
 
 from validators.trident_validator import validate as tvalidator
 from validators.trident_validator import clean as tcleaner
 from validators.trident_validator import assimilator as tassimilator
+from validators.trident_validator import continue_children as tcontinue
 
 trident_id = '11'
 
 validators = {}
 validators[trident_id] = 'tvalidator'
 
+# Validate the jobs that most of a DAG waits on first
+from boinctools import dag_successor_count
+validation_priorities = {}
+validation_priorities[trident_id] = 'dag_successor_count'
+
 
 cleaners = {}
 cleaners[trident_id] = 'tcleaner'
@@ -20,5 +28,8 @@ validators['42'] = validators[trident_id]
 cleaners['42'] = cleaners[trident_id]
 cleaners['123'] = cleaners[trident_id]
 
+continue_children = {}
+continue_children[trident_id] = 'tcontinue'
+
 assimilators = {}
 assimilators[trident_id] = 'tassimilator'
@@ -1,28 +1,27 @@
 def update_dag_job_state(result,is_valid):
 	import dag.boinc
 	from dag import States,strstate
-	import dag
+	import boinctools
 
-	root_dag = dag.boinc.result_to_dag(result.name)
+	# The DAG is cached and the state is appended to its journal, so
+	# that the DAG file is not read and rewritten for every result.
+	wuname = dag.boinc.name_result2workunit(result.name)
+	root_dag = boinctools.load_dag(wuname)
 	if not root_dag:
 		print("Could not get DAG file for %s" % result.name)
 		return
-	wuname = dag.boinc.name_result2workunit(result.name)
 	proc = root_dag.get_process(wuname)
 	if not proc:
 		print("In dag %s, could not find workunit %s" % (root_dag.filename, wuname))
 		return
 
 	if is_valid:
-		proc.state = States.SUCCESS
+		state = States.SUCCESS
 	else:
-		proc.state = States.FAIL
-	print("Marking %s as %s" % (result.name, strstate(proc.state)))
-	try:
-		root_dag.save()
-	except dag.DagException as de:
-		print("Could not save dag file '%s'" % root_dag.filename)
-		raise de
+		state = States.FAIL
+	print("Marking %s as %s" % (result.name, strstate(state)))
+	boinctools.update_dag_job_state(wuname,state)
+	proc.state = state
 
 def validate(result1, result2):
 	import dag.util as dagu
@@ -136,7 +135,6 @@ def clean(result):
 	import dag.util as dag_utils
 	import boinctools
 	import dag,dag.boinc
-	import shutil
 	import stat
 	from os import path as OP
 	import os
@@ -154,7 +152,7 @@ def clean(result):
 		return None
 	wuname = wuname[0]
 	try:
-		the_dag = dag.boinc.result_to_dag(result.name)
+		the_dag = boinctools.load_dag(wuname)
 	except dag_utils.NoDagMarkerException as ndme:
 		print("Warning: Missing dag")
 		print("Skipping clean up" )
@@ -209,32 +207,57 @@ def clean(result):
 		print("Output file not found: '%s'" % upload_path)
 		return False
 
-	if not OP.isfile(dest_file):
-		# Copy file. If it does not exist, move it to the invalid_results directory
-		print("Copying {0} to {1}.".format(upload_path,dest_file))
-		try:
-			shutil.copy(upload_path,dest_file)
-			OP.os.chmod(dest_file,stat.S_IRUSR | stat.S_IWUSR | stat.S_IRGRP | stat.S_IWGRP)
-		except Exception as e:
-			dag.boinc.save_bad_res_output(upload_path,wuname)
-			print("ERROR - Could not copy result output file to data directory, %s. It was copied to invalid_results/%s" % (dagdir,wuname))
-			print("ERROR - Message:\n%s" % e.message)
-			if isinstance(e,IOError):
-				print(e.strerror)
-			raise e
-	else: #output already exists, append.
+	# Copies the file if dest_file does not exist, otherwise appends. If
+	# that fails, the output is moved to the invalid_results directory.
+	print("Appending {0} to {1}.".format(upload_path,dest_file))
+	try:
+		boinctools.append_output(upload_path,dest_file,"\n",stat.S_IRUSR | stat.S_IWUSR | stat.S_IRGRP | stat.S_IWGRP)
+	except Exception as e:
+		dag.boinc.save_bad_res_output(upload_path,wuname)
+		print("ERROR - Could not copy result output file to data directory, %s. It was copied to invalid_results/%s" % (dagdir,wuname))
+		print("ERROR - Message:\n%s" % e.message)
+		if isinstance(e,IOError):
+			print(e.strerror)
+		raise e
+	return True
+
+def continue_children(results):
+	import boinctools
+	import dag,dag.boinc
+	from os import path as OP
+
+	# Group the finished jobs by DAG, so that each DAG is looked at and
+	# its new jobs are submitted once per pass of the validator.
+	dags = {}
+	for result in results:
+		wuname = dag.boinc.name_result2workunit(result.name)
 		try:
-			with open(dest_file,"a") as old_file:
-				old_file.write("\n")
-				old_file.write(open(upload_path,"r").read())
+			the_dag = boinctools.load_dag(wuname)
 		except Exception as e:
-			dag.boinc.save_bad_res_output(upload_path,wuname)
-			print("ERROR - Could not copy result output file to data directory, %s. It was copied to invalid_results/%s" % (dagdir,wuname))
-			print("ERROR - Message:\n%s" % e.message)
-			if isinstance(e,IOError):
-				print(e.strerror)
-			raise e
-	return True
+			print("Could not load dag of %s: %s" % (wuname, e))
+			continue
+		proc = the_dag.get_process(wuname) if the_dag else None
+		if not proc:
+			continue
+		if not the_dag.filename in dags:
+			dags[the_dag.filename] = (the_dag,[])
+		dags[the_dag.filename][1].append(proc)
+
+	started = [dag.States.SUCCESS,dag.States.RUNNING,dag.States.FAIL]
+	for (dagpath,(the_dag,procs)) in dags.items():
+		children = boinctools.runnable_children(procs,lambda parent: parent.state == dag.States.SUCCESS)
+		children = [child for child in children if child.state not in started]
+		if not children:
+			continue
+		# Only the children are submitted. Each is recorded as running
+		# once it is, so that a retry after an error does not submit
+		# it again.
+		print("Submitting %d jobs of %s" % (len(children), dagpath))
+		dagdir = OP.split(dagpath)[0]
+		for child in children:
+			dag.boinc.schedule_work(child,dagdir)
+			boinctools.update_dag_job_state(child.workunit_name,dag.States.RUNNING)
+			child.state = dag.States.RUNNING
 
 def assimilator(results, canonical_result):
 
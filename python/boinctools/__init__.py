@@ -11,6 +11,12 @@ This python module provides interface between BOINC C API and Python user code.
 
 from local_boinc_settings import project_path
 
+try:
+    from boinctools import _native
+except ImportError:
+    # Extension module was not built. Pure Python versions are used.
+    _native = None
+
 class BoincException(Exception):
     """
     General Exception Class used in boinctools routines.
@@ -33,6 +39,25 @@ class BoincResult():
     def add_output_file(self,path,logical_name):
         file_tuple = (path,logical_name)
         self.output_files.append(file_tuple)
+
+    def xml_fields(self, tags, source = "stderr_out"):
+        """
+        Values of the XML elements named in tags, found in the text
+        attribute source by boinctools.xml_fields. As with the
+        BoincResult of the validator, values are kept for later calls.
+        """
+        cache = self.__dict__.setdefault("_xml_fields", {}).setdefault(source, {})
+        missing = [tag for tag in tags if tag not in cache]
+        if missing:
+            cache.update(xml_fields(getattr(self, source, ""), missing))
+        return dict((tag, cache[tag]) for tag in tags)
+
+    def artifact(self, path):
+        """
+        Artifact cache entry of the output file at path, as with the
+        BoincResult of the assimilator. See artifact_cache_get.
+        """
+        return artifact_cache_get(self.id, path.split("/")[-1])
   
 
 def dump_traceback(e):
@@ -65,20 +90,38 @@ def dump_traceback(e):
     print("*** tb_lineno:", exc_traceback.tb_lineno)
 
 
-def dir_hier_path(original_filename):
-    """
-    Wrapper for BOINC dir_hier_path.
+_download_hierarchy = None
 
-    @param original_filename: representation of the filename
-    @type original_filename: String
-    
-    @return: UTF-8 representation of the full path to file under the download hierarchy tree
+def download_hierarchy():
+    """
+    Reads the download directory and its fan out from the project's
+    config.xml. The file is only read once per process.
 
-    @raise BoincException: if dir_hier_path fails.
+    @return: Tuple of the download directory and uldl_dir_fanout
+    @rtype: tuple
     """
+    global _download_hierarchy
+    if _download_hierarchy is None:
+        import os.path as OP
+        from xml.dom import minidom
+
+        config = minidom.parse(OP.join(project_path,"config.xml"))
+        def config_value(tag,default):
+            nodes = config.getElementsByTagName(tag)
+            if not nodes or not nodes[0].firstChild:
+                return default
+            return nodes[0].firstChild.data.strip()
+        download_dir = config_value("download_dir",OP.join(project_path,"download"))
+        fanout = int(config_value("uldl_dir_fanout",0))
+        _download_hierarchy = (download_dir,fanout)
+    return _download_hierarchy
+
+def _native_dir_hier_path():
+    return _native is not None and hasattr(_native,"dir_hier_paths")
+
+def _dir_hier_path_subprocess(original_filename):
     import subprocess as SP
     import os
-    from os import path as OP
     orig_pwd = os.getcwd()
     os.chdir(project_path)
 
@@ -86,13 +129,52 @@ def dir_hier_path(original_filename):
     (tmpl_path,errmsg) = retval.communicate()
     os.chdir(orig_pwd)
     if retval.wait() != 0:
-            
-        raise BoincException("Error calling dir_hier_path for file \"%s\"\nError Message: %s" % (file.physical_name,errmsg))
+        raise BoincException("Error calling dir_hier_path for file \"%s\"\nError Message: %s" % (original_filename,errmsg))
     return tmpl_path.decode('utf-8').strip()
+
+def dir_hier_path(original_filename):
+    """
+    Wrapper for BOINC dir_hier_path. As with bin/dir_hier_path, the
+    directory of the file is created if needed.
+
+    If boinctools._native was built against BOINC, dir_hier_path is
+    called directly. Otherwise bin/dir_hier_path is run.
+
+    @param original_filename: representation of the filename
+    @type original_filename: String
+    
+    @return: UTF-8 representation of the full path to file under the download hierarchy tree
+
+    @raise BoincException: if dir_hier_path fails.
+    """
+    return dir_hier_paths([original_filename])[0]
+
+def dir_hier_paths(filenames):
+    """
+    dir_hier_path for each of a list of files, in one call.
+
+    @param filenames: names of files within the download hierarchy
+    @type filenames: list
+    
+    @return: List of full paths, in the same order as filenames
+
+    @raise BoincException: if dir_hier_path fails.
+    """
+    if not _native_dir_hier_path():
+        return [_dir_hier_path_subprocess(filename) for filename in filenames]
+    (download_dir,fanout) = download_hierarchy()
+    try:
+        return [path.decode('utf-8') for path in _native.dir_hier_paths([str(filename) for filename in filenames],download_dir,fanout,True)]
+    except (OSError,IOError) as e:
+        raise BoincException("Error calling dir_hier_path: %s" % e)
         
-def stage_files(input_files,source_dir = None, set_grp_perms = True, overwrite = True):
+def stage_files(input_files,source_dir = None, set_grp_perms = True, overwrite = True, hard_link = False, threads = 4):
     """
     Stages files to the downloads directory of the BOINC server, using dir_hier_path
+
+    If boinctools._native is built, all of the files are copied in one
+    call on a pool of threads, by reflink where the file system supports
+    it and otherwise by copy_file_range. Otherwise cp is run for each file.
     
     @type input_files: dict
     @param input_files: Dictionary that maps physical filename (full path) to the name of the file within the downloads directory (i.e. name used by server).
@@ -102,6 +184,12 @@ def stage_files(input_files,source_dir = None, set_grp_perms = True, overwrite =
     @type set_grp_perms: Boolean
     @param overwrite: Whether or not files should be overwritten (Default: True)
     @type overwrite: Boolean
+    @param hard_link: Hard link files instead of copying them, where possible. The staged file then shares its contents and permissions with the source, so the source must not be changed afterwards. Only used by boinctools._native (Default: False)
+    @type hard_link: Boolean
+    @param threads: Number of files copied at once by boinctools._native (Default: 4)
+    @type threads: int
+
+    @raise BoincException: if any file could not be staged. With boinctools._native, the other files are still staged.
     """
     import os.path as OP
     import os
@@ -112,19 +200,29 @@ def stage_files(input_files,source_dir = None, set_grp_perms = True, overwrite =
         source_dir = os.getcwd()
     orig_pwd = os.getcwd()
     os.chdir(project_path)
-    for source_path in input_files:
-        physical_name = OP.basename(source_path)
-        unique_name = input_files[source_path]
-        tmpl_path = dir_hier_path(unique_name)
-        if not overwrite and OP.exists(tmpl_path):
-            continue
-        retval = SP.Popen("cp {0} {1}".format(source_path,tmpl_path).split(),stdout=SP.PIPE,stderr=SP.PIPE)
-        if retval.wait() != 0:
-            errmsg = retval.communicate()[1]
-            raise BoincException("Could not copy file {0} to {1}.\nError Message: {2}".format(source_path,tmpl_path,errmsg))
-        if set_grp_perms:
-            os.chmod(tmpl_path,stat.S_IRUSR|stat.S_IWUSR|stat.S_IRGRP|stat.S_IWGRP)
-    os.chdir(orig_pwd)
+    try:
+        source_paths = list(input_files)
+        tmpl_paths = dir_hier_paths([input_files[source_path] for source_path in source_paths])
+        if _native:
+            # Relative source paths are relative to the project, as with cp above.
+            pairs = [(OP.join(project_path,source_path),OP.join(project_path,tmpl_path)) for (source_path,tmpl_path) in zip(source_paths,tmpl_paths)]
+            results = _native.stage_files(pairs,overwrite = overwrite,set_grp_perms = set_grp_perms,hard_link = hard_link,threads = threads)
+            failures = ["{0} to {1}: {2}".format(source,destination,os.strerror(error)) for ((source,destination),(method,error)) in zip(pairs,results) if method == "failed"]
+            if failures:
+                raise BoincException("Could not stage {0} of {1} files.\n{2}".format(len(failures),len(pairs),"\n".join(failures)))
+            return
+        for (source_path,tmpl_path) in zip(source_paths,tmpl_paths):
+            physical_name = OP.basename(source_path)
+            if not overwrite and OP.exists(tmpl_path):
+                continue
+            retval = SP.Popen("cp {0} {1}".format(source_path,tmpl_path).split(),stdout=SP.PIPE,stderr=SP.PIPE)
+            if retval.wait() != 0:
+                errmsg = retval.communicate()[1]
+                raise BoincException("Could not copy file {0} to {1}.\nError Message: {2}".format(source_path,tmpl_path,errmsg))
+            if set_grp_perms:
+                os.chmod(tmpl_path,stat.S_IRUSR|stat.S_IWUSR|stat.S_IRGRP|stat.S_IWGRP)
+    finally:
+        os.chdir(orig_pwd)
 
 def cancel_workunits(workunit_names):
     """
@@ -191,6 +289,71 @@ def schedule_work(cmd,workunit_name,wu_tmpl,res_tmpl,input_filenames,delay_bound
         raise BoincException("Could not create work.\nRan: %s\n\nError Message: %s\n" % (" ".join(cmd_list), errmsg.decode('utf-8')))
     os.chdir(orig_pwd)
 
+def schedule_work_batch(jobs):
+    """
+    Creates many workunits at once. Instead of one create_work process
+    per workunit, as with schedule_work, jobs that share an application,
+    templates and delay bound are streamed to a single create_work
+    process in its --stdin bulk mode.
+
+    Jobs are checked before create_work is run, so that one bad job
+    does not fail the others. If create_work itself fails, each job of
+    its group gets the error, since create_work stops at the first job
+    it cannot create and does not say which one that was.
+
+    @param jobs: schedule_work arguments for each workunit, i.e. (cmd, workunit_name, wu_tmpl, res_tmpl, input_filenames[, delay_bounds]) tuples
+    @type jobs: List of tuples
+    @return: For each job, None if it was created and otherwise an error message
+    @rtype: List
+    """
+    import os.path as OP
+    import subprocess as SP
+
+    errors = [None] * len(jobs)
+    groups = {}
+    names = set()
+    for (index,job) in enumerate(jobs):
+        (cmd,workunit_name,wu_tmpl,res_tmpl,input_filenames) = job[:5]
+        delay_bounds = job[5] if len(job) > 5 else None
+        if [token for token in [workunit_name] + list(input_filenames) if len(token.split()) != 1 or token.startswith("-")]:
+            errors[index] = "Workunit and input file names may not be empty, start with '-' or contain white space."
+        elif workunit_name in names:
+            errors[index] = "Workunit name {0} is used more than once in the batch.".format(workunit_name)
+        else:
+            missing = [tmpl for tmpl in (wu_tmpl,res_tmpl) if not OP.isfile(OP.join(project_path,"templates",tmpl))]
+            if missing:
+                errors[index] = "Missing template(s): {0}".format(", ".join(missing))
+        if errors[index]:
+            continue
+        names.add(workunit_name)
+        groups.setdefault((cmd,wu_tmpl,res_tmpl,delay_bounds),[]).append(index)
+
+    # create_work needs the input files to be staged. Checking costs one
+    # process per file without the native dir_hier_path, so only then.
+    if _native_dir_hier_path():
+        for indices in groups.values():
+            for index in list(indices):
+                missing = [path for path in dir_hier_paths(jobs[index][4]) if not OP.isfile(path)]
+                if missing:
+                    errors[index] = "Input file(s) not staged: {0}".format(", ".join(missing))
+                    indices.remove(index)
+
+    for ((cmd,wu_tmpl,res_tmpl,delay_bounds),indices) in groups.items():
+        if not indices:
+            continue
+        cmd_list = [OP.join(project_path,"bin","create_work"),"--appname",cmd,"--wu_template","templates/" + wu_tmpl,"--result_template","templates/" + res_tmpl]
+        if delay_bounds != None:
+            cmd_list.extend(["--delay_bound",str(delay_bounds)])
+        cmd_list.append("--stdin")
+        job_lines = "".join(["--wu_name {0} {1}\n".format(jobs[index][1]," ".join(jobs[index][4])) for index in indices])
+        process = SP.Popen(cmd_list,stdin=SP.PIPE,stdout=SP.PIPE,stderr=SP.PIPE,cwd=project_path)
+        errmsg = process.communicate(job_lines)[1]
+        if process.returncode != 0:
+            message = "Could not create work. Some of the {0} workunits in this batch may have been created.\nRan: {1}\n\nError Message: {2}\n".format(len(indices)," ".join(cmd_list),errmsg.decode('utf-8'))
+            for index in indices:
+                errors[index] = message
+    return errors
+
 def save_bad_res_output(filename,wuname):
     """
     Copies a result output file and saves it to the invalid_results
@@ -225,6 +388,890 @@ def save_bad_res_output(filename,wuname):
     else:
         raise BoincException("'invalid_results' directory does not exist. Data lost.")
 
+def output_writer_settings():
+    """
+    Reads the output writer settings from the output_writer dict of the
+    project init file. The dict has the key 'sync_interval', the number
+    of seconds between group syncs of the destinations of append_output
+    (Default: 1.0). 0 syncs after every append and a negative value only
+    when flush_outputs is called.
+
+    @return: Sync interval in seconds
+    """
+    import os.path as OP
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    if OP.isfile(init_filename):
+        execfile(init_filename, variables)
+
+    settings = variables.get('output_writer', {})
+    return float(settings.get('sync_interval', 1.0))
+
+_output_writer_ready = False
+
+def append_output(source, destination, separator = "\n", mode = 0660):
+    """
+    Appends the contents of a result output file to a destination file,
+    such as the aggregate output of a DAG process. If the destination
+    does not exist, it is created with the given mode. Otherwise, the
+    separator is written before the contents. The destination is locked
+    with flock while appending.
+
+    With the native extension, the contents are copied in the kernel,
+    destinations stay open between calls and are synced to disk as a
+    group on the sync interval of output_writer_settings. Call
+    flush_outputs to sync them sooner; it is also called at exit.
+
+    @param source: Path of the file to append
+    @type source: String
+    @param destination: Path of the destination file
+    @type destination: String
+    @param separator: Written between the existing contents and the new
+    @type separator: String
+    @param mode: Permissions of a new destination (Default: user and group read/write)
+    @type mode: Integer
+    @raise IOError: if source cannot be read or destination cannot be written. A failed append is truncated from the destination.
+    """
+    global _output_writer_ready
+    if _native:
+        if not _output_writer_ready:
+            import atexit
+            _native.set_output_sync_interval(output_writer_settings())
+            atexit.register(flush_outputs)
+            _output_writer_ready = True
+        _native.append_output(source, destination, separator, mode)
+        return
+
+    import os
+    import fcntl
+    import shutil
+
+    with open(source, "rb") as infile:
+        created = True
+        try:
+            fd = os.open(destination, os.O_WRONLY | os.O_CREAT | os.O_EXCL, mode)
+            os.fchmod(fd, mode)
+        except OSError as ose:
+            import errno
+            if ose.errno != errno.EEXIST:
+                raise IOError(ose.errno, ose.strerror, destination)
+            fd = os.open(destination, os.O_WRONLY)
+            created = False
+        with os.fdopen(fd, "ab") as outfile:
+            fcntl.flock(outfile, fcntl.LOCK_EX)
+            outfile.seek(0, os.SEEK_END)
+            start = outfile.tell()
+            try:
+                if not created:
+                    outfile.write(separator)
+                shutil.copyfileobj(infile, outfile)
+                outfile.flush()
+            except:
+                outfile.truncate(start)
+                raise
+
+def flush_outputs():
+    """
+    Syncs and closes the destinations of append_output.
+    """
+    if _native:
+        _native.close_outputs()
+
+def _compression(path):
+    """
+    Returns 'gzip' or 'zstd' if the file starts with the magic bytes of
+    that format, or None.
+    """
+    with open(path, "rb") as file:
+        magic = file.read(4)
+    if magic[:2] == "\x1f\x8b":
+        return 'gzip'
+    if magic == "\x28\xb5\x2f\xfd":
+        return 'zstd'
+    return None
+
+def _can_decompress(compression):
+    if compression == 'zstd':
+        try:
+            import zstandard
+        except ImportError:
+            return False
+    return True
+
+def _open_output(path, mode = "r"):
+    """
+    Opens an output file for reading, decompressing it if it is gzip or
+    zstd compressed. zstd needs the zstandard module.
+
+    @raise IOError: if the file cannot be read or decompressed.
+    """
+    compression = _compression(path)
+    if compression == 'gzip':
+        import gzip
+        return gzip.open(path, "rb")
+    if compression == 'zstd':
+        import errno
+        try:
+            import zstandard
+        except ImportError:
+            raise IOError(errno.ENOTSUP, "zstd compressed and the zstandard module is not installed", path)
+        import io
+        return io.BufferedReader(zstandard.ZstdDecompressor().stream_reader(open(path, "rb"), closefd = True))
+    return open(path, mode)
+
+def files_equal(path1, path2):
+    """
+    Compares two files byte for byte. File sizes are compared first and
+    the contents are then streamed in fixed size chunks, so memory use
+    does not depend on file size. gzip or zstd compressed files are
+    compared by their decompressed contents.
+
+    @param path1: Path of first file
+    @type path1: String
+    @param path2: Path of second file
+    @type path2: String
+    @return: True if the files have identical contents
+    @rtype: Boolean
+    @raise IOError: if either file cannot be read.
+    """
+    if _native:
+        return _native.files_equal(path1,path2)
+
+    import os.path as OP
+    chunk_size = 1 << 20
+    # As natively, files that cannot be decompressed are compared as
+    # they are.
+    compressions = (_compression(path1), _compression(path2))
+    decompress = any(compressions) and all(_can_decompress(c) for c in compressions)
+    if not decompress and OP.getsize(path1) != OP.getsize(path2):
+        return False
+    opener = _open_output if decompress else open
+    with opener(path1,"rb") as file1:
+        with opener(path2,"rb") as file2:
+            while True:
+                chunk1 = file1.read(chunk_size)
+                chunk2 = file2.read(chunk_size)
+                if chunk1 != chunk2:
+                    return False
+                if not chunk1:
+                    return True
+
+def _normalize_tolerance(tolerance):
+    """
+    Converts a numeric tolerance dict, of the form
+    {'abs_tol': a, 'rel_tol': r, 'columns': {column: {'abs_tol': a, 'rel_tol': r}}},
+    into the tuple (abs_tol, rel_tol, [(column, abs_tol, rel_tol), ...])
+    used by the native code. Missing values are taken from the enclosing
+    level, with 0 at the top level.
+    """
+    if not tolerance:
+        tolerance = {}
+    abs_tol = float(tolerance.get('abs_tol', 0.0))
+    rel_tol = float(tolerance.get('rel_tol', 0.0))
+    columns = []
+    for (column, column_tolerance) in tolerance.get('columns', {}).items():
+        columns.append((int(column),
+                        float(column_tolerance.get('abs_tol', abs_tol)),
+                        float(column_tolerance.get('rel_tol', rel_tol))))
+    return (abs_tol, rel_tol, columns)
+
+def _parse_number(token):
+    # As in the native parser, a number needs a digit, so that "nan" and
+    # "inf" are text, which must match exactly.
+    if not any(c.isdigit() for c in token):
+        return None
+    try:
+        return float(token)
+    except ValueError:
+        return None
+
+def numeric_files_equal(path1, path2, tolerance = None):
+    """
+    Compares two text files of whitespace separated tokens. Tokens that
+    are numbers in both files must agree within the tolerance of their
+    column, i.e. |a - b| <= abs_tol or |a - b| <= rel_tol * max(|a|,|b|).
+    Other tokens must match exactly. Blank lines are ignored. gzip or
+    zstd compressed files are decompressed as they are read.
+
+    @param path1: Path of first file
+    @type path1: String
+    @param path2: Path of second file
+    @type path2: String
+    @param tolerance: dict with optional keys 'abs_tol', 'rel_tol' and 'columns'. 'columns' maps the zero based column index to a dict of 'abs_tol' and 'rel_tol' for that column.
+    @type tolerance: dict
+    @return: True if the files agree
+    @rtype: Boolean
+    @raise IOError: if either file cannot be read.
+    """
+    (abs_tol, rel_tol, columns) = _normalize_tolerance(tolerance)
+    if _native:
+        return _native.numeric_files_equal(path1, path2, abs_tol, rel_tol, columns)
+
+    column_tolerances = dict([(column, (a, r)) for (column, a, r) in columns])
+    def tokens(path):
+        with _open_output(path) as file:
+            for line in file:
+                fields = line.split()
+                if fields:
+                    yield fields
+    import itertools
+    for (line1, line2) in itertools.izip_longest(tokens(path1), tokens(path2)):
+        if line1 is None or line2 is None or len(line1) != len(line2):
+            return False
+        for (column, (token1, token2)) in enumerate(zip(line1, line2)):
+            (value1, value2) = (_parse_number(token1), _parse_number(token2))
+            if value1 is None or value2 is None:
+                if token1 != token2:
+                    return False
+                continue
+            (a, r) = column_tolerances.get(column, (abs_tol, rel_tol))
+            diff = abs(value1 - value2)
+            if not (value1 == value2 or diff <= a or diff <= r * max(abs(value1), abs(value2))):
+                return False
+    return True
+
+def _normalized_lines(path):
+    with _open_output(path) as file:
+        for line in file:
+            line = " ".join(line.split())
+            if line:
+                yield line
+
+def line_set_similarity(path1, path2, num_hashes = 256):
+    """
+    Estimates the Jaccard similarity, |A & B| / |A | B|, of the sets of
+    lines of two text files. Lines are normalized as in line_sets_equal.
+
+    If boinctools._native is built, the estimate is made by MinHash from
+    the num_hashes smallest line hashes of each file, and is exact if
+    neither file has more than num_hashes distinct lines. Otherwise the
+    sets are compared whole.
+
+    @param path1: Path of first file
+    @type path1: String
+    @param path2: Path of second file
+    @type path2: String
+    @param num_hashes: Size of the sketch of each file
+    @type num_hashes: Integer
+    @return: Similarity between 0 and 1. Two files without lines are identical.
+    @rtype: Float
+    @raise IOError: if either file cannot be read.
+    """
+    if _native:
+        return _native.line_set_similarity(path1, path2, num_hashes)
+    lines1 = set(_normalized_lines(path1))
+    lines2 = set(_normalized_lines(path2))
+    if not lines1 and not lines2:
+        return 1.0
+    return float(len(lines1 & lines2)) / len(lines1 | lines2)
+
+def line_sets_equal(path1, path2, min_similarity = 1.0, num_hashes = 256):
+    """
+    Compares the lines of two text files regardless of their order, e.g.
+    hit lists written by several threads. Leading and trailing white
+    space is ignored, runs of white space are compared as one space and
+    blank lines are skipped. gzip or zstd compressed files are
+    decompressed as they are read.
+
+    If min_similarity is 1, the files must hold the same lines, as many
+    times each. Otherwise line_set_similarity must be at least
+    min_similarity.
+
+    If boinctools._native is built, each file is streamed and only the
+    64 bit hash of each line is kept, or for a similarity threshold only
+    num_hashes of them.
+
+    @param path1: Path of first file
+    @type path1: String
+    @param path2: Path of second file
+    @type path2: String
+    @param min_similarity: Least Jaccard similarity of the sets of lines
+    @type min_similarity: Float
+    @param num_hashes: Size of the sketch of each file
+    @type num_hashes: Integer
+    @return: True if the files agree
+    @rtype: Boolean
+    @raise IOError: if either file cannot be read.
+    """
+    if _native:
+        return _native.line_sets_equal(path1, path2, min_similarity, num_hashes)
+    if min_similarity < 1:
+        return line_set_similarity(path1, path2, num_hashes) >= min_similarity
+    return sorted(_normalized_lines(path1)) == sorted(_normalized_lines(path2))
+
+def _xml_field(text, tag):
+    import re
+    match = re.search(r"<%s(?:\s[^>]*)?(?:/>|>(.*?)</%s>)" % (re.escape(tag), re.escape(tag)), text, re.DOTALL)
+    if match is None:
+        return None
+    value = (match.group(1) or "").strip()
+    if value.startswith("<![CDATA[") and value.endswith("]]>"):
+        return value[9:-3]
+    for (entity, char) in (("&lt;", "<"), ("&gt;", ">"), ("&quot;", '"'), ("&apos;", "'"), ("&amp;", "&")):
+        value = value.replace(entity, char)
+    return value
+
+def xml_fields(text, tags):
+    """
+    Finds the values of several XML elements in a document, such as the
+    stderr_out or xml_doc_out of a result, which need not be well formed.
+    The value of an element is the text between its first start tag and
+    the following end tag, stripped of white space, CDATA and entities.
+
+    If boinctools._native is built, the document is scanned once for all
+    of the tags. The BoincResult passed to validators has an xml_fields
+    method that also keeps the values, e.g.
+    result.xml_fields(["exit_code", "wall_time"], source = "stderr_out").
+
+    @param text: XML document
+    @type text: String
+    @param tags: Element names
+    @type tags: List of Strings
+    @return: Value of each tag, or None if it was not found
+    @rtype: Dict
+    """
+    if _native:
+        return _native.xml_fields(text, tags)
+    return dict((tag, _xml_field(text, tag)) for tag in tags)
+
+def numeric_tolerance(appid):
+    """
+    Looks up the tolerances used by the numeric_text native validator
+    for an application. These are listed in the numeric_tolerances dict
+    of the project init file, which maps appid (as a String) to a
+    tolerance dict as described in numeric_files_equal.
+
+    @param appid: Application ID
+    @type appid: Integer
+    @return: Tuple of (abs_tol, rel_tol, [(column, abs_tol, rel_tol), ...])
+    """
+    import os.path as OP
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    execfile(init_filename, variables)
+
+    if not 'numeric_tolerances' in variables:
+        return _normalize_tolerance(None)
+    return _normalize_tolerance(variables['numeric_tolerances'].get(str(appid)))
+
+def line_set_config(appid):
+    """
+    Looks up the settings of the line_set native validator for an
+    application. These are listed in the line_sets dict of the project
+    init file, which maps appid (as a String) to a dict with the
+    optional keys 'min_similarity' (default 1, i.e. the same lines) and
+    'num_hashes' (default 256), as in line_sets_equal.
+
+    @param appid: Application ID
+    @type appid: Integer
+    @return: Tuple of (min_similarity, num_hashes)
+    """
+    import os.path as OP
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    execfile(init_filename, variables)
+
+    settings = variables.get('line_sets', {}).get(str(appid)) or {}
+    return (float(settings.get('min_similarity', 1.0)), int(settings.get('num_hashes', 256)))
+
+def native_validator(appid):
+    """
+    Looks up the native comparator that the validator should use for an
+    application. These are listed in the native_validators dict of the
+    project init file, which maps appid (as a String) to a comparator
+    name, e.g. 'files_equal'.
+
+    @param appid: Application ID
+    @type appid: Integer
+    @return: Name of the native comparator or None if Python code validates the application
+    """
+    import os.path as OP
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    execfile(init_filename, variables)
+
+    if not 'native_validators' in variables:
+        return None
+    return variables['native_validators'].get(str(appid))
+
+def validation_priority(appid):
+    """
+    Looks up the function that orders the workunits of an application
+    for validation. These are listed in the validation_priorities dict
+    of the project init file, which maps appid (as a String) to the name
+    of a function. The function is given a list of workunit names and
+    returns a score for each, as a list in the same order or as a dict
+    of name to score. Workunits with higher scores are validated first.
+    dag_successor_count is such a function.
+
+    @param appid: Application ID
+    @type appid: Integer
+    @return: Name of the function or None if workunits are validated in database order
+    """
+    import os.path as OP
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    execfile(init_filename, variables)
+
+    if not 'validation_priorities' in variables:
+        return None
+    return variables['validation_priorities'].get(str(appid))
+
+def validation_scores(appid, workunit_names):
+    """
+    Scores workunits with the validation_priorities function of the
+    application.
+
+    @param appid: Application ID
+    @type appid: Integer
+    @param workunit_names: Names of the workunits that need validation
+    @type workunit_names: List of Strings
+    @return: List of scores, in the order of workunit_names, or None if the application has no function
+    @rtype: List of Floats
+    """
+    import os.path as OP
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    execfile(init_filename, variables)
+
+    function_name = variables.get('validation_priorities', {}).get(str(appid))
+    if function_name is None:
+        return None
+    scores = variables[function_name](workunit_names)
+    if isinstance(scores, dict):
+        return [float(scores.get(name, 0)) for name in workunit_names]
+    return [float(score) for score in scores]
+
+def successor_counts(processes, descendants=None):
+    """
+    Counts the processes downstream of each of processes, i.e. its
+    children, their children and so on, each counted once. A process is
+    any object with a children list, such as a dag.Process.
+
+    @param processes: Processes to count
+    @type processes: Sequence
+    @param descendants: Set of the successors of each process already seen, which is updated. Passing the same dict for processes of the same DAG saves searching it again.
+    @type descendants: Dict
+    @return: Number of successors of each process
+    @rtype: Dict of process to Integer
+    """
+    if descendants is None:
+        descendants = {}
+    visiting = set()
+    counts = {}
+    for process in processes:
+        # Depth first, so that a process's set is the union of its
+        # children's, rather than a search of its own.
+        stack = [process]
+        while stack:
+            node = stack[-1]
+            if node in descendants:
+                stack.pop()
+                continue
+            visiting.add(node)
+            children = getattr(node, "children", None) or []
+            unseen = [child for child in children if not child in descendants and not child in visiting]
+            if unseen:
+                stack.extend(unseen)
+                continue
+            found = set(children)
+            for child in children:
+                found |= descendants.get(child, set())
+            descendants[node] = found
+            visiting.discard(node)
+            stack.pop()
+        counts[process] = len(descendants[process])
+    return counts
+
+# DAG file path to [modification time, DAG, successors of each process,
+# journal inode, journal offset], see _cached_dag and load_dag
+_dags = {}
+
+def _dag_path(wuname):
+    import dag.boinc
+    return dag.boinc.marker_to_dagpath(dag.boinc.dag_marker_filename(wuname))
+
+def _cached_dag(wuname, dagpath):
+    """
+    Returns the cache entry of the DAG of a workunit, loading the DAG if
+    it is not cached or its file has changed since. States recorded in
+    its journal since it was loaded are not applied; see load_dag.
+    """
+    import os.path as OP
+    import dag.boinc
+
+    try:
+        mtime = OP.getmtime(dagpath)
+    except OSError:
+        mtime = None # result_to_dag raises the exception for a missing DAG
+    cached = _dags.get(dagpath)
+    if cached is None or mtime is None or cached[0] != mtime:
+        cached = [mtime, dag.boinc.result_to_dag("%s_0" % wuname), {}, None, 0]
+        if not cached[1]:
+            return cached
+        _dags[dagpath] = cached
+    return cached
+
+def dag_successor_count(workunit_names):
+    """
+    Scores workunits by the number of DAG jobs that wait on them, for
+    use in the validation_priorities dict, e.g.
+
+    from boinctools import dag_successor_count
+    validation_priorities = {'11': 'dag_successor_count'}
+
+    A DAG job scores one, for itself, plus the number of jobs downstream
+    of it, so that jobs many others wait on are validated first and the
+    last jobs of a DAG still come before workunits outside of any DAG,
+    which score 0. The DAG of each workunit is found through its marker
+    file, as update_dag_job_state does. DAGs are loaded once and kept
+    until their file changes.
+
+    @param workunit_names: Workunit names
+    @type workunit_names: List of Strings
+    @return: Score of each workunit
+    @rtype: List of Integers
+    """
+    scores = []
+    for wuname in workunit_names:
+        try:
+            cached = _cached_dag(wuname, _dag_path(wuname))
+            process = cached[1].get_process(wuname) if cached[1] else None
+            if process is None:
+                scores.append(0)
+            else:
+                scores.append(1 + successor_counts([process], cached[2])[process])
+        except Exception as e:
+            print("Could not score %s: %s" % (wuname, e))
+            scores.append(0)
+    return scores
+
+def dag_journal_path(dagpath):
+    """
+    @param dagpath: Path of a DAG file
+    @type dagpath: String
+    @return: Path of the journal of job states kept next to the DAG file
+    """
+    return dagpath + ".journal"
+
+_dag_journal_settings = None
+
+def dag_journal_settings():
+    """
+    Reads the DAG journal settings from the dag_journal dict of the
+    project init file, once per process. The dict has the keys
+    'compact_size', the size in bytes at which a journal is merged into
+    its DAG file (Default: 1 MB; 0 never merges it), and 'sync', which
+    syncs each state change to disk before update_dag_job_state returns
+    (Default: False).
+
+    @return: Tuple of (compact_size, sync)
+    """
+    global _dag_journal_settings
+    if _dag_journal_settings is None:
+        import os.path as OP
+        init_filename = OP.join(project_path,"boincdag_init.py")
+        variables = {}
+        if OP.isfile(init_filename):
+            execfile(init_filename, variables)
+        settings = variables.get('dag_journal', {})
+        _dag_journal_settings = (int(settings.get('compact_size', 1 << 20)), bool(settings.get('sync', False)))
+    return _dag_journal_settings
+
+def read_dag_journal(path, offset = 0):
+    """
+    Reads the job states recorded in a DAG journal. Each record is a
+    line of the process name and its state, as an Integer, separated by
+    a tab. A later record of a process replaces an earlier one. A last
+    line that has not been completely written is left for the next
+    read.
+
+    DAG tools that read the DAG file while a pass is running should
+    also read its journal with this function, or merge it first with
+    compact_dag_journal, since states are only written to the DAG file
+    when the journal is compacted.
+
+    @param path: Path of the journal, see dag_journal_path
+    @type path: String
+    @param offset: Where to start reading, e.g. the offset returned by an earlier read
+    @type offset: Integer
+    @return: Tuple of (dict of process name to state, offset of the end of the last complete record). The dict is empty if the journal does not exist.
+    """
+    try:
+        with open(path, "rb") as journal:
+            journal.seek(offset)
+            data = journal.read()
+    except IOError as ioe:
+        import errno
+        if ioe.errno != errno.ENOENT:
+            raise
+        return ({}, offset)
+    end = data.rfind("\n") + 1
+    states = {}
+    for line in data[:end].splitlines():
+        (name, tab, state) = line.rpartition("\t")
+        try:
+            states[name] = int(state)
+        except ValueError:
+            print("Malformed DAG journal record in %s: '%s'" % (path, line))
+    return (states, offset + end)
+
+# DAG path to the name of a workunit of the DAG, for each journal
+# appended to since the last compact_dag_journals
+_pending_dag_journals = {}
+
+# journal path to its file descriptor, opened by this process
+_dag_journals = {}
+_dag_journals_pid = None
+_MAX_DAG_JOURNALS = 64
+
+def _dag_journal_fd(path):
+    """
+    Returns a descriptor of the journal at path, open for appending.
+    Descriptors are not shared with forked processes, since flock locks
+    belong to the open file, not to the process.
+    """
+    import os
+    global _dag_journals_pid
+    if _dag_journals_pid != os.getpid() or len(_dag_journals) >= _MAX_DAG_JOURNALS:
+        for fd in _dag_journals.values():
+            os.close(fd)
+        _dag_journals.clear()
+        _dag_journals_pid = os.getpid()
+    fd = _dag_journals.get(path)
+    if fd is None:
+        fd = os.open(path, os.O_WRONLY | os.O_APPEND | os.O_CREAT, 0660)
+        _dag_journals[path] = fd
+    return fd
+
+def append_dag_journal(path, name, state, sync = False):
+    """
+    Appends a state change of the process name to the journal at path,
+    creating it if needed, with one write. If the journal is being
+    compacted, this waits for the compacted journal and appends to it.
+
+    @param path: Path of the journal, see dag_journal_path
+    @type path: String
+    @param name: Process name
+    @type name: String
+    @param state: New state
+    @type state: Integer
+    @param sync: Sync the journal to disk before returning
+    @type sync: Boolean
+    @return: Size of the journal in bytes
+    """
+    import os
+    import fcntl
+
+    record = "%s\t%d\n" % (name, int(state))
+    while True:
+        fd = _dag_journal_fd(path)
+        # Appends share the lock, since each is one write to a file
+        # opened with O_APPEND. compact_dag_journal takes it alone.
+        fcntl.flock(fd, fcntl.LOCK_SH)
+        try:
+            try:
+                replaced = (os.stat(path).st_ino != os.fstat(fd).st_ino)
+            except OSError:
+                replaced = True
+            if not replaced:
+                os.write(fd, record)
+                if sync:
+                    os.fsync(fd)
+                return os.fstat(fd).st_size
+        finally:
+            fcntl.flock(fd, fcntl.LOCK_UN)
+        # compacted since it was opened
+        os.close(fd)
+        del _dag_journals[path]
+
+def update_dag_job_state(wuname, state):
+    """
+    Records the new state of the process of a workunit in the journal of
+    its DAG, rather than rewriting the DAG file, so that the cost of a
+    state change does not grow with the size of the DAG. The journal is
+    merged into the DAG file at the end of the validator or assimilator
+    pass, by compact_dag_journals, or sooner if it reaches the
+    compact_size of dag_journal_settings.
+
+    @param wuname: Workunit name
+    @type wuname: String
+    @param state: New state, e.g. dag.States.SUCCESS
+    @type state: Integer
+    @raise dag.util.NoDagMarkerException: if the workunit has no DAG marker
+    """
+    (compact_size, sync) = dag_journal_settings()
+    dagpath = _dag_path(wuname)
+    size = append_dag_journal(dag_journal_path(dagpath), wuname, state, sync)
+    if compact_size > 0 and size >= compact_size:
+        compact_dag_journal(wuname)
+        _pending_dag_journals.pop(dagpath, None)
+    else:
+        _pending_dag_journals[dagpath] = wuname
+
+def compact_dag_journals():
+    """
+    Merges the journals that update_dag_job_state has appended to since
+    the last call into their DAG files, so that tools that read DAG
+    files directly see the new states. The validator and assimilator
+    call this at the end of each pass. A journal that cannot be merged
+    is tried again on the next call.
+
+    @return: Number of journals merged
+    """
+    pending = _pending_dag_journals.items()
+    _pending_dag_journals.clear()
+    merged = 0
+    for (dagpath, wuname) in pending:
+        try:
+            compact_dag_journal(wuname)
+            merged += 1
+        except Exception as e:
+            print("Could not merge the journal of %s: %s" % (dagpath, e))
+            _pending_dag_journals.setdefault(dagpath, wuname)
+    return merged
+
+def load_dag(wuname):
+    """
+    Returns the DAG of a workunit with the states recorded in its
+    journal applied. The DAG is kept between calls, until its file
+    changes, and only journal records added since the last call are
+    read, so that the validator and clean up code may look up a process
+    in a large DAG for each result. Changes to the DAG other than job
+    states should be saved with the DAG's own save method.
+
+    @param wuname: Workunit name
+    @type wuname: String
+    @return: DAG object, as returned by dag.boinc.result_to_dag
+    """
+    import os
+
+    dagpath = _dag_path(wuname)
+    cached = _cached_dag(wuname, dagpath)
+    if not cached[1]:
+        return cached[1]
+    path = dag_journal_path(dagpath)
+    try:
+        stat = os.stat(path)
+    except OSError:
+        return cached[1]
+    if stat.st_ino != cached[3] or stat.st_size < cached[4]:
+        # A new journal. Its records are newer than the DAG file.
+        cached[3] = stat.st_ino
+        cached[4] = 0
+    if stat.st_size > cached[4]:
+        (states, cached[4]) = read_dag_journal(path, cached[4])
+        for (name, state) in states.iteritems():
+            process = cached[1].get_process(name)
+            if process:
+                process.state = state
+    return cached[1]
+
+def compact_dag_journal(wuname):
+    """
+    Merges the journal of the DAG of a workunit into the DAG file and
+    empties the journal. Appends to the journal wait until it is done.
+    If this is interrupted after the DAG file is saved, the journal is
+    merged again, which does no harm.
+
+    @param wuname: Workunit name
+    @type wuname: String
+    @return: Number of processes whose state was merged
+    """
+    import os
+    import fcntl
+    import dag.boinc
+
+    dagpath = _dag_path(wuname)
+    path = dag_journal_path(dagpath)
+    while True:
+        fd = os.open(path, os.O_RDONLY | os.O_CREAT, 0660)
+        fcntl.flock(fd, fcntl.LOCK_EX)
+        try:
+            if os.stat(path).st_ino == os.fstat(fd).st_ino:
+                break
+        except OSError:
+            pass
+        os.close(fd) # replaced by another compaction
+    try:
+        (states, end) = read_dag_journal(path)
+        if not states:
+            return 0
+        root_dag = dag.boinc.result_to_dag("%s_0" % wuname)
+        for (name, state) in states.iteritems():
+            process = root_dag.get_process(name)
+            if process:
+                process.state = state
+        root_dag.save()
+        # Renamed over the journal, so that appenders waiting on the
+        # lock of the old one see that it has been replaced.
+        new_path = "%s.%d" % (path, os.getpid())
+        os.close(os.open(new_path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0660))
+        os.rename(new_path, path)
+    finally:
+        fcntl.flock(fd, fcntl.LOCK_UN)
+        os.close(fd)
+    _dags.pop(dagpath, None)
+    return len(states)
+
+_artifact_cache_settings = None
+_artifact_cache_settings_read = False
+
+def artifact_cache_settings():
+    """
+    Reads the artifact cache settings from the artifact_cache dict of the
+    project init file, once per process. The dict has the keys 'path'
+    (required), 'budget', the maximum size of the cache file in bytes
+    (Default: 0, unlimited), 'max_contents', the size of the largest
+    output file whose contents, and MD5 digest, are stored in the cache
+    (Default: 0), and 'digests', which also digests larger files, at
+    the cost of reading them once more (Default: False).
+
+    @return: Tuple of (path, budget, max_contents, digests) or None if there is no artifact cache
+    """
+    global _artifact_cache_settings, _artifact_cache_settings_read
+    if not _artifact_cache_settings_read:
+        import os.path as OP
+        init_filename = OP.join(project_path,"boincdag_init.py")
+        variables = {}
+        execfile(init_filename, variables)
+
+        if 'artifact_cache' in variables:
+            settings = variables['artifact_cache']
+            _artifact_cache_settings = (settings['path'], int(settings.get('budget', 0)), int(settings.get('max_contents', 0)),
+                                        int(bool(settings.get('digests', False))))
+        _artifact_cache_settings_read = True
+    return _artifact_cache_settings
+
+def artifact_cache_get(result_id, file_name):
+    """
+    Looks up an output file in the artifact cache, which is filled by the
+    validator when it initializes results.
+
+    @param result_id: ID of the result
+    @type result_id: Integer
+    @param file_name: Physical name of the output file, i.e. the base name of its path
+    @type file_name: String
+    @return: dict with the keys size, mtime, digest (MD5, empty unless the file is small or the digests setting is on), metadata (logical name) and contents (None unless the file is small), or None if the file is not cached
+    """
+    if not _native:
+        return None
+    settings = artifact_cache_settings()
+    if not settings:
+        return None
+    return _native.artifact_cache_get(settings[0], result_id, file_name)
+
+def artifact_cache_stats():
+    """
+    @return: dict of hit, miss, append and eviction counts for this process, and the number of records and bytes in the cache, or None if there is no artifact cache
+    """
+    if not _native:
+        return None
+    settings = artifact_cache_settings()
+    if not settings:
+        return None
+    return _native.artifact_cache_stats(settings[0])
+
 def validate(result1, result2):
     import os.path as OP
     init_filename = OP.join(project_path,"boincdag_init.py")
@@ -248,6 +1295,110 @@ def clean(result):
     function = variables[function_name]
     function(result)
 
+def clean_batch(results):
+    """
+    Runs the clean up code on a batch of results, after the validator
+    has recorded their verdicts. Results whose appid is in the
+    batch_cleaners dict of the project init file are passed to that
+    function as one list per appid. The others are passed one at a time
+    to the function named in the cleaners dict, as with clean. Output
+    appended with append_output is synced at the end of the batch.
+
+    @param results: Results to clean, in the order they were validated
+    @type results: List of BoincResult
+    """
+    import os.path as OP
+
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    execfile(init_filename, variables)
+    batch_cleaners = variables.get('batch_cleaners', {})
+
+    appids = []
+    by_appid = {}
+    for result in results:
+        appid = str(result.appid)
+        if not appid in by_appid:
+            appids.append(appid)
+            by_appid[appid] = []
+        by_appid[appid].append(result)
+
+    for appid in appids:
+        if appid in batch_cleaners:
+            print("Cleaning %d results" % len(by_appid[appid]))
+            variables[batch_cleaners[appid]](by_appid[appid])
+            continue
+        function = variables[variables['cleaners'][appid]]
+        for result in by_appid[appid]:
+            print("Cleaning %s" % result.name)
+            function(result)
+    flush_outputs()
+
+def continue_children_batch(results):
+    """
+    Releases the successors of the workunits that got a canonical result
+    in a pass of the validator, which calls this once at the end of the
+    pass. Results whose appid is in the continue_children dict of the
+    project init file are passed to that function as one list per appid,
+    so that it may find the jobs that have become runnable and submit
+    them together, e.g. with runnable_children and schedule_work_batch.
+    Results of other applications are ignored.
+
+    If this raises an exception, the validator passes the same results
+    again after its next pass, so the functions should not submit a job
+    twice.
+
+    @param results: Canonical results, in the order their workunits were finished
+    @type results: List of BoincResult
+    """
+    import os.path as OP
+
+    init_filename = OP.join(project_path,"boincdag_init.py")
+    variables = {}
+    execfile(init_filename, variables)
+    continuers = variables.get('continue_children', {})
+
+    appids = []
+    by_appid = {}
+    for result in results:
+        appid = str(result.appid)
+        if not appid in continuers:
+            continue
+        if not appid in by_appid:
+            appids.append(appid)
+            by_appid[appid] = []
+        by_appid[appid].append(result)
+
+    for appid in appids:
+        print("Releasing successors of %d workunits" % len(by_appid[appid]))
+        variables[continuers[appid]](by_appid[appid])
+
+def runnable_children(processes, is_finished):
+    """
+    Finds the children of processes whose parents have all finished,
+    e.g. the DAG jobs that may be submitted once processes have been
+    validated. Each child is listed once, however many of its parents
+    are in processes. A process is any object with children and parents
+    lists, such as a dag.Process.
+
+    @param processes: Processes that have just finished
+    @type processes: Sequence
+    @param is_finished: Returns True if the process it is given has finished
+    @type is_finished: Function
+    @return: The runnable children, in the order they were found
+    @rtype: List
+    """
+    runnable = []
+    seen = set()
+    for process in processes:
+        for child in getattr(process, "children", None) or []:
+            if child in seen:
+                continue
+            seen.add(child)
+            if all(is_finished(parent) for parent in getattr(child, "parents", None) or []):
+                runnable.append(child)
+    return runnable
+
 def assimilator(result_list,canonical_result):
     import os.path as OP
 
@@ -277,3 +1428,124 @@ def assimilator(result_list,canonical_result):
     function = variables[function_name]
     function(result_list,canonical_result)
 
+
+# BoincResult fields of handoff records that are floating point numbers
+_HANDOFF_FLOAT_FIELDS = frozenset(["elapsed_time", "flops_estimate", "claimed_credit", "granted_credit", "opaque", "peak_working_set_size", "peak_swap_size", "peak_disk_usage"])
+
+def parse_handoff_record(payload):
+    """
+    Parses a record appended to the handoff queue by the assimilator.
+    The results have the same fields as the BoincResult objects of the
+    assimilator, such as hostid and stderr_out.
+
+    @param payload: Record, as returned by _native.handoff_queue_claim
+    @type payload: String
+    @return: Tuple of (workunit name, list of BoincResult, canonical BoincResult)
+    """
+    wuname = None
+    results = []
+    canonical = None
+    current = None
+    for line in payload.splitlines():
+        fields = line.split("\t")
+        if fields[0] == "wu":
+            wuname = fields[2]
+        elif fields[0] in ["result", "canonical"]:
+            current = BoincResult(fields[2], int(fields[1]), int(fields[3]), int(fields[4]), int(fields[5]), float(fields[6]))
+            if fields[0] == "canonical":
+                canonical = current
+            else:
+                results.append(current)
+        elif fields[0] == "fields" and current:
+            for field in fields[1:]:
+                (name, equals, value) = field.partition("=")
+                if name in _HANDOFF_FLOAT_FIELDS:
+                    setattr(current, name, float(value))
+                elif name == "runtime_outlier":
+                    setattr(current, name, value == "1")
+                else:
+                    setattr(current, name, int(value))
+        elif fields[0] == "text" and current and len(fields) == 3:
+            setattr(current, fields[1], fields[2].decode("string_escape"))
+        elif fields[0] == "file" and current:
+            current.add_output_file(fields[1], fields[2])
+        else:
+            raise BoincException("Malformed handoff record line: '%s'" % line)
+    if canonical is None:
+        raise BoincException("Handoff record for %s has no canonical result" % wuname)
+    return (wuname, results, canonical)
+
+def _drain_handoff_queue(path, lease, max_attempts, poll_interval, once):
+    import time
+
+    num_assimilated = 0
+    failed = [] # kept claimed until the queue is empty, so they are not retried at once
+    while True:
+        item = _native.handoff_queue_claim(path, lease, max_attempts)
+        if item is None:
+            for seq in failed:
+                _native.handoff_queue_release(path, seq)
+            failed = []
+            compact_dag_journals() # the end of a pass
+            if once:
+                return num_assimilated
+            time.sleep(poll_interval)
+            continue
+
+        (seq, payload) = item
+        try:
+            (wuname, results, canonical) = parse_handoff_record(payload)
+            assimilator(results, canonical)
+        except Exception as e:
+            print("Could not assimilate handoff record %d" % seq)
+            dump_traceback(e)
+            failed.append(seq)
+            continue
+        _native.handoff_queue_ack(path, seq)
+        num_assimilated += 1
+
+def drain_handoff_queue(path, workers = 1, lease = 0, max_attempts = 3, poll_interval = 1.0, once = False):
+    """
+    Runs the Python assimilators on the workunits that the assimilator
+    appended to the handoff queue at path, when run with --handoff_queue.
+    A workunit is removed from the queue only after its assimilator
+    returns. If a worker exits, the workunit it was assimilating is
+    handed to another worker.
+
+    @param path: Path of the queue file
+    @type path: String
+    @param workers: Number of worker processes
+    @type workers: Integer
+    @param lease: Seconds after which a workunit being assimilated is handed to another worker. 0 waits for the worker to exit.
+    @type lease: Float
+    @param max_attempts: Number of times a workunit is tried before its record is moved to the dead letter file, path + ".dead", where records are separated by blank lines. 0 retries forever.
+    @type max_attempts: Integer
+    @param poll_interval: Seconds to wait when the queue is empty
+    @type poll_interval: Float
+    @param once: Return once the queue is empty, instead of waiting for more work
+    @type once: Boolean
+    @return: Number of workunits assimilated by this process, or, if workers is more than 1, None
+    @raise BoincException: if the native extension is not built
+    """
+    if not _native:
+        raise BoincException("The handoff queue requires the boinctools._native extension.")
+    if workers <= 1:
+        return _drain_handoff_queue(path, lease, max_attempts, poll_interval, once)
+
+    import multiprocessing
+    processes = [multiprocessing.Process(target = _drain_handoff_queue, args = (path, lease, max_attempts, poll_interval, once)) for i in range(workers)]
+    for process in processes:
+        process.start()
+    for process in processes:
+        process.join()
+    return None
+
+def handoff_queue_stats(path):
+    """
+    @param path: Path of the queue file
+    @type path: String
+    @return: dict with the depth, pending and claimed record counts, oldest_age in seconds, drain_rate in workunits per second, appended, acked and dead counts and size in bytes of the handoff queue, or None if the native extension is not built
+    """
+    if not _native:
+        return None
+    return _native.handoff_queue_stats(path)
@@ -1,6 +1,68 @@
 #!/usr/bin/env python
 
-from distutils.core import setup
+from distutils.core import setup, Extension
+from os import path as OP
+import os
+
+# Native code is shared with the validator and lives in ../src
+src_dir = OP.abspath(OP.join(OP.dirname(__file__), '..', 'src'))
+
+native = Extension('boinctools._native',
+                   sources = [OP.join(src_dir, 'pyboinctools.cpp'),
+                              OP.join(src_dir, 'file_compare.cpp'),
+                              OP.join(src_dir, 'numeric_compare.cpp'),
+                              OP.join(src_dir, 'line_set_compare.cpp'),
+                              OP.join(src_dir, 'decompress.cpp'),
+                              OP.join(src_dir, 'artifact_cache.cpp'),
+                              OP.join(src_dir, 'stage_files.cpp'),
+                              OP.join(src_dir, 'output_writer.cpp'),
+                              OP.join(src_dir, 'handoff_queue.cpp'),
+                              OP.join(src_dir, 'xml_fields.cpp')],
+                   include_dirs = [src_dir],
+                   )
+
+def have_library(header, function, library):
+    """
+    Returns True if a program that includes header and calls function
+    links against library, like configure's checks.
+    """
+    from distutils.ccompiler import new_compiler
+    from distutils.errors import CompileError, LinkError
+    import shutil
+    import tempfile
+    compiler = new_compiler()
+    tmpdir = tempfile.mkdtemp()
+    try:
+        source = OP.join(tmpdir, 'check.c')
+        with open(source, 'w') as check:
+            check.write('#include <%s>\nint main(void) { return (int)(long)&%s; }\n' % (header, function))
+        try:
+            objects = compiler.compile([source], output_dir = tmpdir)
+            compiler.link_executable(objects, OP.join(tmpdir, 'check'), libraries = [library])
+        except (CompileError, LinkError):
+            return False
+        return True
+    finally:
+        shutil.rmtree(tmpdir)
+
+# Compressed output files are decompressed when compared if zlib and
+# libzstd are found. Set BOINCTOOLS_NO_ZLIB or BOINCTOOLS_NO_ZSTD to
+# build without them.
+if not os.environ.get('BOINCTOOLS_NO_ZLIB') and have_library('zlib.h', 'inflate', 'z'):
+    native.define_macros.append(('HAVE_ZLIB', '1'))
+    native.libraries.append('z')
+if not os.environ.get('BOINCTOOLS_NO_ZSTD') and have_library('zstd.h', 'ZSTD_decompressStream', 'zstd'):
+    native.define_macros.append(('HAVE_ZSTD', '1'))
+    native.libraries.append('zstd')
+
+# If BOINC_DIR is set to the prefix of a BOINC installation, the extension
+# also wraps dir_hier_path from BOINC's scheduler library.
+boinc_dir = os.environ.get('BOINC_DIR')
+if boinc_dir:
+    native.define_macros.append(('USE_BOINC', '1'))
+    native.include_dirs += [OP.join(boinc_dir, 'include', 'boinc'), OP.join(boinc_dir, 'include')]
+    native.library_dirs.append(OP.join(boinc_dir, 'lib'))
+    native.libraries += ['sched', 'boinc']
  
 setup (name ='boinctools',
        version = '1.0.2',
@@ -9,4 +71,5 @@ setup (name ='boinctools',
        author_email = 'David.Coss@stjude.org',
        license = 'GPL v3',
        packages = ['boinctools'],
+       ext_modules = [native],
        )
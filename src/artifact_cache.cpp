@@ -0,0 +1,409 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Memory mapped, append-only store of output file information. The
+// validator fills it as it initializes results, so that the assimilator
+// and Python clean up code may look up sizes, digests and small file
+// contents without going back to the upload directory. This code does
+// not depend on BOINC and is shared with the boinctools Python extension.
+//
+// File layout: a sequence of records, each an ARTIFACT_RECORD_HEADER
+// followed by the file name, digest, metadata and contents, padded to a
+// multiple of 8 bytes. Appends are serialized between processes with
+// flock.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "artifact_cache.h"
+
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ARTIFACT_MAGIC 0x43545241 // "ARTC"
+#define ARTIFACT_NO_CONTENTS 0xffffffffu
+
+struct ARTIFACT_RECORD_HEADER {
+  uint32_t magic;
+  uint32_t length;// of the whole record, including padding
+  uint32_t checksum;// of everything that follows this field
+  int32_t result_id;
+  int64_t size;
+  int64_t mtime;
+  uint32_t name_len;
+  uint32_t digest_len;
+  uint32_t metadata_len;
+  uint32_t contents_len;// ARTIFACT_NO_CONTENTS if not stored
+};
+
+#define CHECKSUM_START offsetof(ARTIFACT_RECORD_HEADER,result_id)
+
+// 32 bit FNV-1a
+static uint32_t record_checksum(const char *data, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0;i < len;i++)
+    {
+      hash ^= (unsigned char)data[i];
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+static inline size_t padded(size_t len)
+{
+  return (len + 7) & ~(size_t)7;
+}
+
+static int write_fully(int fd, const char *buf, size_t count)
+{
+  ssize_t nwritten;
+  while(count > 0)
+    {
+      nwritten = write(fd,buf,count);
+      if(nwritten < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      buf += nwritten;
+      count -= nwritten;
+    }
+  return 0;
+}
+
+ARTIFACT_CACHE::ARTIFACT_CACHE() : budget(0), fd(-1), inode(0), map(NULL), mapped_size(0), scanned_size(0)
+{
+}
+
+ARTIFACT_CACHE::~ARTIFACT_CACHE()
+{
+  close();
+}
+
+int ARTIFACT_CACHE::open(const char *the_path, long long the_budget)
+{
+  if(the_path == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  path = the_path;
+  budget = the_budget;
+  return reopen();
+}
+
+void ARTIFACT_CACHE::close()
+{
+  map_file(0);
+  if(fd >= 0)
+    ::close(fd);
+  fd = -1;
+  inode = 0;
+  scanned_size = 0;
+  index.clear();
+}
+
+int ARTIFACT_CACHE::reopen()
+{
+  struct stat st;
+
+  close();
+  fd = ::open(path.c_str(),O_RDWR | O_CREAT,0664);
+  if(fd < 0 && errno == EACCES)
+    fd = ::open(path.c_str(),O_RDONLY);// read only users, e.g. clean up scripts
+  if(fd < 0)
+    return -1;
+  if(fstat(fd,&st))
+    {
+      close();
+      return -1;
+    }
+  inode = st.st_ino;
+  return scan(false);
+}
+
+// Picks up records appended, or a compaction done, by other processes.
+int ARTIFACT_CACHE::refresh()
+{
+  struct stat st;
+
+  if(fd < 0)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  if(stat(path.c_str(),&st) || st.st_ino != inode)
+    return reopen();
+  return scan(false);
+}
+
+int ARTIFACT_CACHE::map_file(size_t size)
+{
+  if(size == mapped_size)
+    return 0;
+  if(map != NULL)
+    munmap(map,mapped_size);
+  map = NULL;
+  mapped_size = 0;
+  if(size == 0)
+    return 0;
+  void *addr = mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+  if(addr == MAP_FAILED)
+    return -1;
+  map = (char*)addr;
+  mapped_size = size;
+  return 0;
+}
+
+// Indexes the records after scanned_size. If truncate_torn is true,
+// which requires holding the lock, an incomplete or corrupt record at
+// the end of the file is removed. Otherwise it may be a record that is
+// still being written, so it is left alone.
+int ARTIFACT_CACHE::scan(bool truncate_torn)
+{
+  struct stat st;
+  ARTIFACT_RECORD_HEADER header;
+  size_t file_size;
+
+  if(fstat(fd,&st))
+    return -1;
+  file_size = st.st_size;
+  if(file_size < scanned_size)
+    {
+      // Truncated by another process. Start over.
+      scanned_size = 0;
+      index.clear();
+    }
+  if(map_file(file_size))
+    return -1;
+
+  while(scanned_size + sizeof(header) <= file_size)
+    {
+      memcpy(&header,map + scanned_size,sizeof(header));
+      if(header.magic != ARTIFACT_MAGIC || header.length < sizeof(header)
+	 || header.length % 8 != 0 || header.length > file_size - scanned_size)
+	break;
+      size_t payload = (size_t)header.name_len + header.digest_len + header.metadata_len;
+      if(header.contents_len != ARTIFACT_NO_CONTENTS)
+	payload += header.contents_len;
+      if(sizeof(header) + payload > header.length)
+	break;
+      if(record_checksum(map + scanned_size + CHECKSUM_START,header.length - CHECKSUM_START) != header.checksum)
+	break;
+
+      std::string name(map + scanned_size + sizeof(header),header.name_len);
+      index[KEY(header.result_id,name)] = scanned_size;
+      scanned_size += header.length;
+    }
+
+  if(truncate_torn && scanned_size < file_size)
+    {
+      fprintf(stderr,"Discarding %lu bytes of incomplete records from %s\n",(unsigned long)(file_size - scanned_size),path.c_str());
+      if(ftruncate(fd,scanned_size) || map_file(scanned_size))
+	return -1;
+    }
+
+  stats.records = index.size();
+  stats.bytes = scanned_size;
+  return 0;
+}
+
+bool ARTIFACT_CACHE::decode(size_t offset, ARTIFACT_INFO& info) const
+{
+  ARTIFACT_RECORD_HEADER header;
+  const char *payload;
+
+  if(offset + sizeof(header) > mapped_size)
+    return false;
+  memcpy(&header,map + offset,sizeof(header));
+  payload = map + offset + sizeof(header) + header.name_len;
+
+  info.size = header.size;
+  info.mtime = header.mtime;
+  info.digest.assign(payload,header.digest_len);
+  payload += header.digest_len;
+  info.metadata.assign(payload,header.metadata_len);
+  payload += header.metadata_len;
+  info.has_contents = (header.contents_len != ARTIFACT_NO_CONTENTS);
+  if(info.has_contents)
+    info.contents.assign(payload,header.contents_len);
+  else
+    info.contents.clear();
+  return true;
+}
+
+int ARTIFACT_CACHE::get(int result_id, const std::string& file_name, ARTIFACT_INFO& info)
+{
+  std::map<KEY, size_t>::const_iterator it;
+
+  if(refresh())
+    return -1;
+  it = index.find(KEY(result_id,file_name));
+  if(it == index.end() || !decode(it->second,info))
+    {
+      stats.misses++;
+      return 1;
+    }
+  stats.hits++;
+  return 0;
+}
+
+int ARTIFACT_CACHE::put(int result_id, const std::string& file_name, const ARTIFACT_INFO& info)
+{
+  ARTIFACT_RECORD_HEADER header;
+  std::string record;
+  struct stat st;
+  size_t payload;
+  int retval = 0;
+
+  if(fd < 0)
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+  memset(&header,0,sizeof(header));
+  header.magic = ARTIFACT_MAGIC;
+  header.result_id = result_id;
+  header.size = info.size;
+  header.mtime = info.mtime;
+  header.name_len = file_name.size();
+  header.digest_len = info.digest.size();
+  header.metadata_len = info.metadata.size();
+  header.contents_len = info.has_contents ? info.contents.size() : ARTIFACT_NO_CONTENTS;
+  payload = file_name.size() + info.digest.size() + info.metadata.size() + (info.has_contents ? info.contents.size() : 0);
+  header.length = padded(sizeof(header) + payload);
+
+  record.reserve(header.length);
+  record.append((const char*)&header,sizeof(header));
+  record.append(file_name);
+  record.append(info.digest);
+  record.append(info.metadata);
+  if(info.has_contents)
+    record.append(info.contents);
+  record.resize(header.length,'\0');
+  header.checksum = record_checksum(record.data() + CHECKSUM_START,record.size() - CHECKSUM_START);
+  memcpy(&record[offsetof(ARTIFACT_RECORD_HEADER,checksum)],&header.checksum,sizeof(header.checksum));
+
+  // Lock the file. If another process compacted it while we waited,
+  // our descriptor refers to the old file, so reopen and try again.
+  while(1)
+    {
+      if(flock(fd,LOCK_EX))
+	return -1;
+      if(stat(path.c_str(),&st) == 0 && st.st_ino == inode)
+	break;
+      flock(fd,LOCK_UN);
+      if(reopen())
+	return -1;
+    }
+
+  if(scan(true))
+    retval = -1;
+  else if(budget > 0 && (long long)(scanned_size + record.size()) > budget)
+    retval = compact(record.size());
+
+  if(retval == 0)
+    {
+      if(lseek(fd,scanned_size,SEEK_SET) < 0 || write_fully(fd,record.data(),record.size()))
+	{
+	  int saved_errno = errno;
+	  if(ftruncate(fd,scanned_size)) {}
+	  errno = saved_errno;
+	  retval = -1;
+	}
+      else
+	{
+	  index[KEY(result_id,file_name)] = scanned_size;
+	  scanned_size += record.size();
+	  stats.appends++;
+	  stats.records = index.size();
+	  stats.bytes = scanned_size;
+	}
+    }
+
+  flock(fd,LOCK_UN);
+  return retval;
+}
+
+// Copies the newest records that fit in half of the budget, leaving room
+// for incoming bytes, to a new file and renames it over the cache file.
+// The caller holds the lock on the current file; on return the lock is
+// held on the new file instead.
+int ARTIFACT_CACHE::compact(size_t incoming)
+{
+  std::vector<std::pair<size_t, KEY> > by_age;
+  std::vector<size_t> kept;
+  std::string tmp_path;
+  char pid_suffix[32];
+  size_t target = budget / 2, total = 0;
+  ARTIFACT_RECORD_HEADER header;
+  struct stat st;
+  int new_fd;
+
+  for(std::map<KEY, size_t>::const_iterator it = index.begin();it != index.end();it++)
+    by_age.push_back(std::make_pair(it->second,it->first));
+  std::sort(by_age.begin(),by_age.end());
+
+  target = (target > incoming) ? target - incoming : 0;
+  for(size_t i = by_age.size();i > 0;i--)
+    {
+      memcpy(&header,map + by_age[i - 1].first,sizeof(header));
+      if(total + header.length > target)
+	break;
+      total += header.length;
+      kept.push_back(by_age[i - 1].first);
+    }
+  std::reverse(kept.begin(),kept.end());
+
+  snprintf(pid_suffix,sizeof(pid_suffix),".%d.tmp",(int)getpid());
+  tmp_path = path + pid_suffix;
+  new_fd = ::open(tmp_path.c_str(),O_RDWR | O_CREAT | O_TRUNC,0664);
+  if(new_fd < 0)
+    return -1;
+  flock(new_fd,LOCK_EX);
+  for(size_t i = 0;i < kept.size();i++)
+    {
+      memcpy(&header,map + kept[i],sizeof(header));
+      if(write_fully(new_fd,map + kept[i],header.length))
+	{
+	  ::close(new_fd);
+	  unlink(tmp_path.c_str());
+	  return -1;
+	}
+    }
+  if(fsync(new_fd) || fstat(new_fd,&st) || rename(tmp_path.c_str(),path.c_str()))
+    {
+      ::close(new_fd);
+      unlink(tmp_path.c_str());
+      return -1;
+    }
+
+  stats.evictions += index.size() - kept.size();
+  map_file(0);
+  ::close(fd);
+  fd = new_fd;
+  inode = st.st_ino;
+  scanned_size = 0;
+  index.clear();
+  return scan(false);
+}
@@ -0,0 +1,103 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef ARTIFACT_CACHE_H
+#define ARTIFACT_CACHE_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <sys/types.h>
+
+/**
+ * What is known about one output file of one result.
+ */
+struct ARTIFACT_INFO {
+  long long size;
+  long long mtime;
+  std::string digest;// e.g. MD5 as hex
+  std::string metadata;// e.g. logical name of the file
+  bool has_contents;
+  std::string contents;// only for small files
+
+  ARTIFACT_INFO() : size(0), mtime(0), has_contents(false) {}
+};
+
+struct ARTIFACT_CACHE_STATS {
+  long hits;
+  long misses;
+  long appends;
+  long evictions;// records dropped by compaction
+  long records;// records currently indexed
+  long long bytes;// size of the cache file
+
+  ARTIFACT_CACHE_STATS() : hits(0), misses(0), appends(0), evictions(0), records(0), bytes(0) {}
+};
+
+/**
+ * Persistent key-value store of ARTIFACT_INFO, keyed by result id and
+ * physical file name, that is shared between processes on one host.
+ *
+ * The store is a single append-only file that is memory mapped for
+ * reading. Each record carries a checksum, so a record torn by a crash
+ * is detected and discarded when the file is next written. If appending
+ * a record would take the file over its budget, the newest records
+ * that fit in half of the budget are copied to a new file, which is
+ * renamed over the old one. Readers in other processes notice the
+ * rename and reopen the file.
+ */
+class ARTIFACT_CACHE {
+public:
+  ARTIFACT_CACHE();
+  ~ARTIFACT_CACHE();
+
+  /**
+   * Opens or creates the cache file at path. budget is the maximum
+   * file size in bytes, or 0 for no limit.
+   *
+   * Returns 0 upon success and -1 otherwise, in which case errno is set.
+   */
+  int open(const char *path, long long budget);
+  void close();
+  bool is_open() const { return fd >= 0; }
+
+  /**
+   * Returns 0 if the file was found, 1 if it was not and -1 upon error.
+   */
+  int get(int result_id, const std::string& file_name, ARTIFACT_INFO& info);
+
+  /**
+   * Appends info for the file, replacing any earlier entry.
+   *
+   * Returns 0 upon success and -1 otherwise, in which case errno is set.
+   */
+  int put(int result_id, const std::string& file_name, const ARTIFACT_INFO& info);
+
+  const ARTIFACT_CACHE_STATS& get_stats() const { return stats; }
+
+private:
+  typedef std::pair<int, std::string> KEY;
+
+  int reopen();
+  int refresh();
+  int map_file(size_t size);
+  int scan(bool truncate_torn);
+  int compact(size_t incoming);
+  bool decode(size_t offset, ARTIFACT_INFO& info) const;
+
+  std::string path;
+  long long budget;
+  int fd;
+  ino_t inode;
+  char *map;
+  size_t mapped_size;
+  size_t scanned_size;
+  std::map<KEY, size_t> index;// offset of the newest record for each key
+  ARTIFACT_CACHE_STATS stats;
+};
+
+#endif
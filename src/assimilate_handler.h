@@ -38,3 +38,8 @@ extern int g_argc;
 extern char** g_argv;
 extern char* results_prefix;
 extern char* transcripts_prefix;
+extern char* handoff_queue_path;
+extern int max_python_failures;
+extern void print_memory_report(size_t max_types);
+extern int compact_dag_journals();
+    // write the DAG job states recorded in this pass to the DAG files
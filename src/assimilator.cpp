@@ -55,6 +55,8 @@ int g_argc;
 char** g_argv;
 char* results_prefix = NULL;
 char* transcripts_prefix = NULL;
+int memory_report_interval = 0;
+long wus_handled = 0;
 
 void usage(char** argv) {
     fprintf(stderr,
@@ -73,6 +75,11 @@ void usage(char** argv) {
         "    [-d | --debug_level N]       Set verbosity level (1 to 4)\n"
         "    [--dont_update_db]    Don't update DB (for testing)\n"
         "    [--noinsert]          Don't insert records in app-specific DB\n"
+        "    [--handoff_queue path]  Queue jobs in the file at path for\n"
+        "                          boinctools.drain_handoff_queue\n"
+        "    [--max_python_failures N]  Retry a job after a Python error,\n"
+        "                          and defer it after N errors (default 3)\n"
+        "    [--memory_report N]   Log memory use after every N jobs\n"
         "    [-h | --help]                 Show this\n"
         "    [-v | --version]      Show version information\n",
         argv[0]
@@ -118,12 +125,6 @@ bool do_pass(APP& app) {
         }
         vector<RESULT> results;     // must be inside while()!
 
-        // for testing purposes, pretend we did nothing
-        //
-        if (update_db) {
-            did_something = true;
-        }
-
         log_messages.printf(MSG_DEBUG,
             "[%s] assimilating WU %d; state=%d\n", wu.name, wu.id, wu.assimilate_state
         );
@@ -165,10 +166,19 @@ bool do_pass(APP& app) {
 
         retval = assimilate_handler(wu, results, canonical_result);
         if (retval && retval != DEFER_ASSIMILATION) {
+            // leave the WU for the next pass, rather than restart
+            // the daemon and meet it again
+            //
             log_messages.printf(MSG_CRITICAL,
-                "[%s] handler error: %s; exiting\n", wu.name, boincerror(retval)
+                "[%s] handler error: %s; will retry\n", wu.name, boincerror(retval)
             );
-            exit(retval);
+            continue;
+        }
+
+        // for testing purposes, pretend we did nothing
+        //
+        if (update_db) {
+            did_something = true;
         }
 
         if (update_db) {
@@ -191,11 +201,15 @@ bool do_pass(APP& app) {
         }
 
         num_assimilated++;
+        if (memory_report_interval && ++wus_handled % memory_report_interval == 0) {
+            print_memory_report(10);
+        }
 
     }
 
     if (did_something) {
         boinc_db.commit_transaction();
+        compact_dag_journals();
     }
 
     if (num_assimilated)  {
@@ -256,6 +270,12 @@ int main(int argc, char** argv) {
 	    results_prefix=argv[++i];
 	} else if (is_arg(argv[i], "transcripts_prefix")) {
             transcripts_prefix=argv[++i];
+        } else if (is_arg(argv[i], "handoff_queue")) {
+            handoff_queue_path=argv[++i];
+        } else if (is_arg(argv[i], "max_python_failures")) {
+            max_python_failures = atoi(argv[++i]);
+        } else if (is_arg(argv[i], "memory_report")) {
+            memory_report_interval = atoi(argv[++i]);
         } else {
             log_messages.printf(MSG_CRITICAL, "Unrecognized arg: %s\n", argv[i]);
             usage(argv);
@@ -0,0 +1,352 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Opens the output files of a result in one batch. With io_uring, an
+// openat for every file is queued in a submission ring and handed to
+// the kernel with a single system call, instead of one blocking call
+// per file. The size is then taken from fstat of each descriptor, so
+// that it is that of the file that was opened, even if the path was
+// replaced meanwhile. liburing is not required; the ring is set up
+// with the raw system calls.
+//
+// If io_uring is unavailable, because of the kernel headers at build
+// time or the running kernel, each file is opened and stat'ed in turn.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "batch_open.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef HAVE_IO_URING
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+// IO_URING_OP_SUPPORTED comes with IORING_REGISTER_PROBE, in Linux 5.6
+#if !defined(__NR_io_uring_setup) || !defined(__NR_io_uring_enter) || !defined(__NR_io_uring_register) || !defined(IO_URING_OP_SUPPORTED)
+#undef HAVE_IO_URING
+#endif
+#endif
+
+// Sets the size of an opened file, closing it upon error.
+static void stat_opened(OPENED_FILE& file)
+{
+  struct stat st;
+
+  if(fstat(file.fd,&st))
+    {
+      file.error = errno;
+      close(file.fd);
+      file.fd = -1;
+      return;
+    }
+  file.size = st.st_size;
+  file.error = 0;
+}
+
+static void open_one(const std::string& path, OPENED_FILE& file)
+{
+  file.fd = open(path.c_str(),O_RDONLY | O_CLOEXEC);
+  if(file.fd < 0)
+    {
+      file.error = errno;
+      return;
+    }
+  stat_opened(file);
+}
+
+#ifdef HAVE_IO_URING
+
+#define RING_ENTRIES 64// one per file
+
+// A submission and completion queue pair shared with the kernel
+struct URING {
+  int fd;
+  unsigned sq_entries;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+enum URING_STATE { URING_UNTRIED, URING_READY, URING_UNAVAILABLE };
+
+static URING ring;
+static URING_STATE ring_state = URING_UNTRIED;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void teardown_ring()
+{
+  if(ring.sqes != NULL)
+    munmap(ring.sqes,ring.sqes_size);
+  if(ring.cq_ring != NULL && ring.cq_ring != ring.sq_ring)
+    munmap(ring.cq_ring,ring.cq_ring_size);
+  if(ring.sq_ring != NULL)
+    munmap(ring.sq_ring,ring.sq_ring_size);
+  if(ring.fd >= 0)
+    close(ring.fd);
+  memset(&ring,0,sizeof(ring));
+  ring.fd = -1;
+  ring_state = URING_UNAVAILABLE;
+}
+
+static bool openat_supported()
+{
+  size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  std::vector<char> buf(size,0);
+  struct io_uring_probe *probe = (struct io_uring_probe*)&buf[0];
+
+  if(syscall(__NR_io_uring_register,ring.fd,IORING_REGISTER_PROBE,probe,IORING_OP_LAST) < 0)
+    return false;
+  return IORING_OP_OPENAT < probe->ops_len && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED);
+}
+
+static int setup_ring()
+{
+  struct io_uring_params params;
+  char *sq, *cq;
+
+  memset(&ring,0,sizeof(ring));
+  memset(&params,0,sizeof(params));
+  ring.fd = syscall(__NR_io_uring_setup,RING_ENTRIES,&params);
+  if(ring.fd < 0)
+    {
+      // ENOSYS on old kernels, EPERM if disabled by sysctl or seccomp
+      ring.fd = -1;
+      ring_state = URING_UNAVAILABLE;
+      return -1;
+    }
+
+  ring.sq_entries = params.sq_entries;
+  ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if(ring.cq_ring_size > ring.sq_ring_size)
+	ring.sq_ring_size = ring.cq_ring_size;
+      ring.cq_ring_size = ring.sq_ring_size;
+    }
+  ring.sq_ring = mmap(NULL,ring.sq_ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ring.fd,IORING_OFF_SQ_RING);
+  if(ring.sq_ring == MAP_FAILED)
+    {
+      ring.sq_ring = NULL;
+      teardown_ring();
+      return -1;
+    }
+  if(params.features & IORING_FEAT_SINGLE_MMAP)
+    ring.cq_ring = ring.sq_ring;
+  else
+    {
+      ring.cq_ring = mmap(NULL,ring.cq_ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ring.fd,IORING_OFF_CQ_RING);
+      if(ring.cq_ring == MAP_FAILED)
+	{
+	  ring.cq_ring = NULL;
+	  teardown_ring();
+	  return -1;
+	}
+    }
+  ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring.sqes = (struct io_uring_sqe*)mmap(NULL,ring.sqes_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ring.fd,IORING_OFF_SQES);
+  if(ring.sqes == MAP_FAILED)
+    {
+      ring.sqes = NULL;
+      teardown_ring();
+      return -1;
+    }
+
+  sq = (char*)ring.sq_ring;
+  cq = (char*)ring.cq_ring;
+  ring.sq_head = (unsigned*)(sq + params.sq_off.head);
+  ring.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+  ring.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+  ring.cq_head = (unsigned*)(cq + params.cq_off.head);
+  ring.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+  ring.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  // Kernels before 5.6 have neither the probe nor IORING_OP_OPENAT. An
+  // EINVAL from an openat is then that file's error.
+  if(!openat_supported())
+    {
+      teardown_ring();
+      return -1;
+    }
+  ring_state = URING_READY;
+  return 0;
+}
+
+static void queue_sqe(const struct io_uring_sqe& sqe)
+{
+  unsigned tail = *ring.sq_tail;
+  unsigned index = tail & *ring.sq_mask;
+  ring.sqes[index] = sqe;
+  ring.sq_array[index] = index;
+  __atomic_store_n(ring.sq_tail,tail + 1,__ATOMIC_RELEASE);
+}
+
+// Opens paths[first, first + count) with one submission. Returns -1 if
+// the ring failed, in which case the caller should open the files of
+// this batch itself.
+static int open_batch(const std::vector<std::string>& paths, size_t first, size_t count, std::vector<OPENED_FILE>& files)
+{
+  struct io_uring_sqe sqe;
+  unsigned to_submit = count, completed = 0, head, tail;
+  int retval;
+
+  for(size_t i = 0;i < count;i++)
+    {
+      memset(&sqe,0,sizeof(sqe));
+      sqe.opcode = IORING_OP_OPENAT;
+      sqe.fd = AT_FDCWD;
+      sqe.addr = (unsigned long)paths[first + i].c_str();
+      sqe.open_flags = O_RDONLY | O_CLOEXEC;
+      sqe.user_data = i;
+      queue_sqe(sqe);
+    }
+
+  while(completed < count)
+    {
+      retval = syscall(__NR_io_uring_enter,ring.fd,to_submit,count - completed,IORING_ENTER_GETEVENTS,NULL,0);
+      if(retval < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  // Operations may still be in flight and referencing our
+	  // buffers, so the ring cannot be reused.
+	  teardown_ring();
+	  return -1;
+	}
+      to_submit -= (retval < (int)to_submit) ? retval : to_submit;
+
+      head = *ring.cq_head;
+      tail = __atomic_load_n(ring.cq_tail,__ATOMIC_ACQUIRE);
+      for(;head != tail;head++)
+	{
+	  const struct io_uring_cqe& cqe = ring.cqes[head & *ring.cq_mask];
+	  OPENED_FILE& file = files[first + cqe.user_data];
+	  file.fd = (cqe.res >= 0) ? cqe.res : -1;
+	  file.error = (cqe.res >= 0) ? 0 : -cqe.res;
+	  completed++;
+	}
+      __atomic_store_n(ring.cq_head,head,__ATOMIC_RELEASE);
+    }
+
+  for(size_t i = 0;i < count;i++)
+    if(files[first + i].fd >= 0)
+      stat_opened(files[first + i]);
+  return 0;
+}
+
+void open_files(const std::vector<std::string>& paths, std::vector<OPENED_FILE>& files)
+{
+  size_t first = 0, count;
+
+  files.assign(paths.size(),OPENED_FILE());
+  if(paths.empty())
+    return;
+
+  pthread_mutex_lock(&ring_lock);
+  if(ring_state == URING_UNTRIED)
+    setup_ring();
+  while(ring_state == URING_READY && first < paths.size())
+    {
+      count = paths.size() - first;
+      if(count > ring.sq_entries)
+	count = ring.sq_entries;
+      if(open_batch(paths,first,count,files))
+	break;
+      first += count;
+    }
+  pthread_mutex_unlock(&ring_lock);
+
+  for(size_t i = first;i < paths.size();i++)
+    {
+      if(files[i].fd >= 0)
+	close(files[i].fd);
+      open_one(paths[i],files[i]);
+    }
+}
+
+bool open_files_uses_io_uring()
+{
+  bool retval;
+  pthread_mutex_lock(&ring_lock);
+  if(ring_state == URING_UNTRIED)
+    setup_ring();
+  retval = (ring_state == URING_READY);
+  pthread_mutex_unlock(&ring_lock);
+  return retval;
+}
+
+#else// no io_uring
+
+void open_files(const std::vector<std::string>& paths, std::vector<OPENED_FILE>& files)
+{
+  files.assign(paths.size(),OPENED_FILE());
+  for(size_t i = 0;i < paths.size();i++)
+    open_one(paths[i],files[i]);
+}
+
+bool open_files_uses_io_uring()
+{
+  return false;
+}
+
+#endif
+
+void close_files(std::vector<OPENED_FILE>& files)
+{
+  for(std::vector<OPENED_FILE>::iterator file = files.begin();file != files.end();file++)
+    {
+      if(file->fd >= 0)
+	close(file->fd);
+      file->fd = -1;
+    }
+}
+
+bool is_transient_open_error(const std::string& path, int error)
+{
+  std::string dir;
+  DIR *dirp;
+
+  switch(error)
+    {
+    case 0:
+      return false;
+    case ENOENT: case ENOTDIR:
+      // As with BOINC's try_fopen, a missing file in a readable
+      // directory is a permanent error. If the directory cannot be
+      // read either, the file system is probably not mounted.
+      dir = path.substr(0,path.rfind('/'));
+      if(path.find('/') == std::string::npos)
+	return false;
+      dirp = opendir(dir.empty() ? "/" : dir.c_str());
+      if(dirp == NULL)
+	return true;
+      closedir(dirp);
+      return false;
+    case EIO: case ESTALE: case ETIMEDOUT: case EINTR: case EAGAIN:
+    case EMFILE: case ENFILE: case ENOMEM: case EBUSY:
+      return true;
+    default:
+      return false;
+    }
+}
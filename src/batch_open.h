@@ -0,0 +1,58 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef BATCH_OPEN_H
+#define BATCH_OPEN_H
+
+#include <string>
+#include <vector>
+
+/**
+ * An output file opened by open_files.
+ */
+struct OPENED_FILE {
+  int fd;// -1 if the file could not be opened
+  long long size;// -1 if unknown
+  int error;// errno of the failed open or stat, 0 upon success
+
+  OPENED_FILE() : fd(-1), size(-1), error(0) {}
+};
+
+/**
+ * Opens each path read only and finds its size. files is resized to
+ * match paths, and a failure for one file is recorded in its error
+ * field rather than stopping the others.
+ *
+ * Where the kernel supports io_uring, the opens of all of the files
+ * are submitted to the kernel in one batch, so that their round trips
+ * to network storage overlap. Otherwise, or if the batch cannot be
+ * submitted, the files are opened one at a time. Sizes are found with
+ * fstat of the opened descriptors.
+ *
+ * The caller owns the descriptors; see close_files.
+ */
+void open_files(const std::vector<std::string>& paths, std::vector<OPENED_FILE>& files);
+
+/**
+ * Closes the descriptors opened by open_files.
+ */
+void close_files(std::vector<OPENED_FILE>& files);
+
+/**
+ * Returns true if a failure to open path with the given errno may go
+ * away if retried later, e.g. because the upload directory's file
+ * system is unavailable. A missing file is only transient if its
+ * directory is missing too.
+ */
+bool is_transient_open_error(const std::string& path, int error);
+
+/**
+ * Returns true if open_files is using io_uring.
+ */
+bool open_files_uses_io_uring();
+
+#endif
@@ -0,0 +1,395 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Native comparators for compare_results. Applications whose validation
+// policy is common, e.g. byte-identical output, may skip the Python
+// validator by naming a comparator in the native_validators dict of the
+// project init file:
+//
+//   native_validators = {}
+//   native_validators['42'] = 'files_equal'
+//
+// Applications without an entry are validated by Python as before.
+//
+// The numeric_text comparator reads its tolerances for each appid from
+// the numeric_tolerances dict of the init file, e.g.
+//
+//   numeric_tolerances = {}
+//   numeric_tolerances['42'] = {'abs_tol': 1e-6, 'rel_tol': 1e-9,
+//                               'columns': {2: {'abs_tol': 1e-3}}}
+//
+// The line_set comparator ignores the order of lines. It reads the
+// similarity it requires for each appid from the line_sets dict, e.g.
+//
+//   line_sets = {}
+//   line_sets['42'] = {'min_similarity': 0.99, 'num_hashes': 512}
+//
+// and otherwise requires the same lines, as many times each.
+//
+
+#include <Python.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "comparators.h"
+#include "file_compare.h"
+#include "decompress.h"
+#include "numeric_compare.h"
+#include "line_set_compare.h"
+#include "artifact_cache.h"
+#include "pyboinc.h"
+#include "validate_util2.h"
+
+#include "boinc/boinc_db_types.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+struct NAMED_COMPARATOR {
+  const char *name;
+  NATIVE_COMPARATOR comparator;
+};
+
+static const NAMED_COMPARATOR native_comparators[] = {
+  {"files_equal", compare_identical_files},
+  {"numeric_text", compare_numeric_text},
+  {"line_set", compare_line_sets},
+  {NULL, NULL}
+};
+
+// Cache of appid to comparator. NULL entries mean "use Python".
+static std::map<int, NATIVE_COMPARATOR> comparator_cache;
+
+// Cache of appid to numeric_text tolerances.
+static std::map<int, NUMERIC_COMPARE_CONFIG> numeric_config_cache;
+
+// Cache of appid to line_set settings.
+static std::map<int, LINE_SET_CONFIG> line_set_config_cache;
+
+// Compares one pair of files, opened by init_result. arg is comparator
+// specific configuration.
+typedef int (*FILE_PAIR_COMPARATOR)(const std::string& path1, const OPENED_FILE& file1, const std::string& path2, const OPENED_FILE& file2, const void *arg, bool& equal);
+
+// True if the file is gzip or zstd compressed, or if that cannot be
+// told, since then its size and digest say nothing of its contents.
+// Leaves the descriptor at the start of the file.
+static bool maybe_compressed(const OPENED_FILE& file)
+{
+  COMPRESSION compression;
+
+  if(file.fd < 0 || lseek(file.fd,0,SEEK_SET) < 0 || fd_compression(file.fd,compression))
+    return true;
+  return compression != COMPRESSION_NONE;
+}
+
+static int identical_pair(const std::string& path1, const OPENED_FILE& file1, const std::string& path2, const OPENED_FILE& file2, const void *arg, bool& equal)
+{
+  if(file1.size >= 0 && file2.size >= 0 && file1.size != file2.size
+     && !maybe_compressed(file1) && !maybe_compressed(file2))
+    {
+      equal = false;
+      return 0;
+    }
+  // The descriptors are shared by every comparison of the result.
+  if(lseek(file1.fd,0,SEEK_SET) < 0 || lseek(file2.fd,0,SEEK_SET) < 0)
+    return -1;
+  return fds_equal(file1.fd,file2.fd,equal);
+}
+
+static int numeric_pair(const std::string& path1, const OPENED_FILE& file1, const std::string& path2, const OPENED_FILE& file2, const void *arg, bool& equal)
+{
+  if(lseek(file1.fd,0,SEEK_SET) < 0 || lseek(file2.fd,0,SEEK_SET) < 0)
+    return -1;
+  return numeric_fds_equal(file1.fd,file2.fd,*(const NUMERIC_COMPARE_CONFIG*)arg,equal);
+}
+
+static int line_set_pair(const std::string& path1, const OPENED_FILE& file1, const std::string& path2, const OPENED_FILE& file2, const void *arg, bool& equal)
+{
+  if(lseek(file1.fd,0,SEEK_SET) < 0 || lseek(file2.fd,0,SEEK_SET) < 0)
+    return -1;
+  return line_set_fds_equal(file1.fd,file2.fd,*(const LINE_SET_CONFIG*)arg,equal);
+}
+
+// Applies compare_pair to each output file of r1 and the output file
+// of r2 in the same position. See compare_identical_files for the
+// handling of missing files.
+static int compare_output_files(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match, FILE_PAIR_COMPARATOR compare_pair, const void *arg)
+{
+  const RESULT_FILES *files1 = (const RESULT_FILES*)data1;
+  const RESULT_FILES *files2 = (const RESULT_FILES*)data2;
+  bool exists1, exists2, equal;
+
+  match = false;
+  if(files1 == NULL || files2 == NULL)
+    {
+      fprintf(stderr,"Missing output file list for %s or %s.\n",r1.name,r2.name);
+      return -1;
+    }
+
+  if(files1->paths.size() != files2->paths.size())
+    return 0;
+
+  for(size_t i = 0;i < files1->paths.size();i++)
+    {
+      const std::string& path1 = files1->paths[i];
+      const std::string& path2 = files2->paths[i];
+      const OPENED_FILE& file1 = files1->files[i];
+      const OPENED_FILE& file2 = files2->files[i];
+
+      exists1 = (file1.fd >= 0);
+      exists2 = (file2.fd >= 0);
+      if(!exists1 && !exists2)
+	continue;
+      if(!exists1 || !exists2)
+	return 0;
+
+      if(compare_pair(path1,file1,path2,file2,arg,equal))
+	{
+	  fprintf(stderr,"Could not compare %s and %s. Reason: %s\n",path1.c_str(),path2.c_str(),strerror(errno));
+	  return -1;
+	}
+      if(!equal)
+	return 0;
+    }
+
+  match = true;
+  return 0;
+}
+
+// Returns true if the artifact cache shows that a pair of output files
+// have different digests, in which case the files need not be read.
+// The digests are of the files as uploaded, so differing digests of
+// compressed files are not a difference.
+static bool cached_digests_differ(RESULT const& r1, void *data1, RESULT const& r2, void *data2)
+{
+  const RESULT_FILES *files1 = (const RESULT_FILES*)data1;
+  const RESULT_FILES *files2 = (const RESULT_FILES*)data2;
+  ARTIFACT_CACHE *cache = get_artifact_cache();
+
+  if(cache == NULL || files1 == NULL || files2 == NULL || files1->paths.size() != files2->paths.size())
+    return false;
+
+  for(size_t i = 0;i < files1->paths.size();i++)
+    {
+      const std::string& path1 = files1->paths[i];
+      const std::string& path2 = files2->paths[i];
+      ARTIFACT_INFO info1, info2;
+      if(cache->get(r1.id,path1.substr(path1.rfind('/') + 1),info1) == 0
+	 && cache->get(r2.id,path2.substr(path2.rfind('/') + 1),info2) == 0
+	 && !info1.digest.empty() && !info2.digest.empty()
+	 && (info1.size != info2.size || info1.digest != info2.digest)
+	 && !maybe_compressed(files1->files[i]) && !maybe_compressed(files2->files[i]))
+	return true;
+    }
+  return false;
+}
+
+int compare_identical_files(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match)
+{
+  if(cached_digests_differ(r1,data1,r2,data2))
+    {
+      match = false;
+      return 0;
+    }
+  return compare_output_files(r1,data1,r2,data2,match,identical_pair,NULL);
+}
+
+// Reads the tolerances for the appid from boinctools.numeric_tolerance,
+// which returns (abs_tol, rel_tol, [(column, abs_tol, rel_tol), ...])
+//
+// Returns NULL upon error.
+static const NUMERIC_COMPARE_CONFIG* get_numeric_config(int appid)
+{
+  std::map<int, NUMERIC_COMPARE_CONFIG>::const_iterator cached;
+  NUMERIC_COMPARE_CONFIG config;
+  PyObject *mod = NULL, *tolerance = NULL, *columns = NULL;
+  int retval = 0;
+
+  cached = numeric_config_cache.find(appid);
+  if(cached != numeric_config_cache.end())
+    return &cached->second;
+
+  mod = PyImport_ImportModule("boinctools");
+  if(mod == NULL)
+    {
+      fprintf(stderr,"Could not import boinctools python module.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+  tolerance = PyObject_CallMethod(mod,(char*)"numeric_tolerance",(char*)"i",appid);
+  Py_DECREF(mod);
+  if(tolerance == NULL)
+    {
+      fprintf(stderr,"Could not look up numeric tolerances for %d.\n",appid);
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+
+  if(!PyArg_ParseTuple(tolerance,"ddO",&config.default_tolerance.abs_tol,&config.default_tolerance.rel_tol,&columns))
+    retval = -1;
+  for(Py_ssize_t i = 0;retval == 0 && i < PySequence_Size(columns);i++)
+    {
+      PyObject *column_tolerance = PySequence_GetItem(columns,i);// new reference
+      int column;
+      double abs_tol, rel_tol;
+      if(column_tolerance == NULL || !PyArg_ParseTuple(column_tolerance,"idd",&column,&abs_tol,&rel_tol))
+	retval = -1;
+      else
+	config.columns[column] = NUMERIC_TOLERANCE(abs_tol,rel_tol);
+      Py_XDECREF(column_tolerance);
+    }
+  Py_DECREF(tolerance);
+
+  if(retval)
+    {
+      fprintf(stderr,"Invalid numeric_tolerances entry for %d.\n",appid);
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+
+  return &(numeric_config_cache[appid] = config);
+}
+
+int compare_numeric_text(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match)
+{
+  const NUMERIC_COMPARE_CONFIG *config;
+
+  match = false;
+  config = get_numeric_config(r1.appid);
+  if(config == NULL)
+    return VALIDATE_RETRY;// not cached, so read again on retry
+  return compare_output_files(r1,data1,r2,data2,match,numeric_pair,config);
+}
+
+// Reads the settings for the appid from boinctools.line_set_config,
+// which returns (min_similarity, num_hashes).
+//
+// Returns NULL upon error.
+static const LINE_SET_CONFIG* get_line_set_config(int appid)
+{
+  std::map<int, LINE_SET_CONFIG>::const_iterator cached;
+  LINE_SET_CONFIG config;
+  PyObject *mod = NULL, *settings = NULL;
+  int num_hashes = 0;
+
+  cached = line_set_config_cache.find(appid);
+  if(cached != line_set_config_cache.end())
+    return &cached->second;
+
+  mod = PyImport_ImportModule("boinctools");
+  if(mod == NULL)
+    {
+      fprintf(stderr,"Could not import boinctools python module.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+  settings = PyObject_CallMethod(mod,(char*)"line_set_config",(char*)"i",appid);
+  Py_DECREF(mod);
+  if(settings == NULL)
+    {
+      fprintf(stderr,"Could not look up line set settings for %d.\n",appid);
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+
+  if(!PyArg_ParseTuple(settings,"di",&config.min_similarity,&num_hashes) || num_hashes <= 0)
+    {
+      Py_DECREF(settings);
+      fprintf(stderr,"Invalid line_sets entry for %d.\n",appid);
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+  Py_DECREF(settings);
+  config.num_hashes = num_hashes;
+
+  return &(line_set_config_cache[appid] = config);
+}
+
+int compare_line_sets(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match)
+{
+  const LINE_SET_CONFIG *config;
+
+  match = false;
+  config = get_line_set_config(r1.appid);
+  if(config == NULL)
+    return VALIDATE_RETRY;// not cached, so read again on retry
+  return compare_output_files(r1,data1,r2,data2,match,line_set_pair,config);
+}
+
+NATIVE_COMPARATOR get_native_comparator(int appid)
+{
+  std::map<int, NATIVE_COMPARATOR>::const_iterator cached;
+  NATIVE_COMPARATOR comparator = NULL;
+  PyObject *mod = NULL, *name_obj = NULL;
+
+  cached = comparator_cache.find(appid);
+  if(cached != comparator_cache.end())
+    return cached->second;
+
+  mod = PyImport_ImportModule("boinctools");
+  if(mod == NULL)
+    {
+      fprintf(stderr,"Could not import boinctools python module.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+
+  name_obj = PyObject_CallMethod(mod,(char*)"native_validator",(char*)"i",appid);
+  Py_DECREF(mod);
+  if(name_obj == NULL)
+    {
+      fprintf(stderr,"Could not look up native validator for %d.\n",appid);
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+
+  if(name_obj != Py_None)
+    {
+      const char *name = PyString_AsString(name_obj);
+      if(name == NULL)
+	{
+	  PyErr_Clear();
+	  fprintf(stderr,"native_validators entry for %d is not a string; validating it with Python.\n",appid);
+	}
+      else
+	{
+	  for(const NAMED_COMPARATOR *it = native_comparators;it->name != NULL;it++)
+	    if(strcmp(it->name,name) == 0)
+	      {
+		comparator = it->comparator;
+		break;
+	      }
+	  if(comparator == NULL)
+	    {
+	      // Cached as NULL below, so this is reported once per appid.
+	      fprintf(stderr,"Unknown native validator '%s' for %d; validating it with Python. Known native validators:",name,appid);
+	      for(const NAMED_COMPARATOR *it = native_comparators;it->name != NULL;it++)
+		fprintf(stderr," %s",it->name);
+	      fprintf(stderr,"\n");
+	    }
+	}
+    }
+  Py_DECREF(name_obj);
+
+  comparator_cache[appid] = comparator;
+  return comparator;
+}
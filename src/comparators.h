@@ -0,0 +1,70 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef COMPARATORS_H
+#define COMPARATORS_H
+
+struct RESULT;
+
+/**
+ * Signature shared by compare_results and the native comparators.
+ * data1 and data2 are the RESULT_FILES set by init_result.
+ */
+typedef int (*NATIVE_COMPARATOR)(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match);
+
+/**
+ * Matches if each output file of r1 is byte-identical to the output file
+ * of r2 in the same position. If a file is missing from both results,
+ * that pair is considered equal. If it is missing from only one, the
+ * results do not match.
+ *
+ * Registered in native_validators as "files_equal".
+ *
+ * Returns 0 upon success and -1 if a file could not be read.
+ */
+int compare_identical_files(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match);
+
+/**
+ * Matches if each output file of r1 agrees with the output file of r2
+ * in the same position according to numeric_files_equal. Tolerances are
+ * read per appid from the numeric_tolerances dict of the project init
+ * file. Missing files are handled as in compare_identical_files.
+ *
+ * Registered in native_validators as "numeric_text".
+ *
+ * Returns 0 upon success, VALIDATE_RETRY if the tolerances could not be
+ * read and -1 if a file could not be read.
+ */
+int compare_numeric_text(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match);
+
+/**
+ * Matches if each output file of r1 holds the same lines as the output
+ * file of r2 in the same position, in any order, according to
+ * line_sets_equal. The similarity required is read per appid from the
+ * line_sets dict of the project init file; without an entry the files
+ * must hold the same lines, as many times each. Missing files are
+ * handled as in compare_identical_files.
+ *
+ * Registered in native_validators as "line_set".
+ *
+ * Returns 0 upon success, VALIDATE_RETRY if the settings could not be
+ * read and -1 if a file could not be read.
+ */
+int compare_line_sets(RESULT& r1, void *data1, RESULT const& r2, void *data2, bool& match);
+
+/**
+ * Looks up the native comparator for the application id by calling
+ * boinctools.native_validator, which reads the native_validators dict
+ * from the project init file. The answer is cached per appid.
+ *
+ * Returns NULL if the application should be validated by Python code.
+ * A name that is not a native comparator is reported on stderr the
+ * first time it is looked up, and the application falls back to Python.
+ */
+NATIVE_COMPARATOR get_native_comparator(int appid);
+
+#endif
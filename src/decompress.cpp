@@ -0,0 +1,372 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Streaming decompression of output files that clients upload gzip or
+// zstd compressed. The format is found from the magic bytes rather than
+// the file name, since BOINC renames uploads. Plain files are passed
+// through: after the first buffer, which was read to look for a magic
+// number, reads go straight into the caller's buffer.
+//
+// zlib and libzstd are optional. configure defines HAVE_ZLIB and
+// HAVE_ZSTD; python/setup.py defines them if it finds the libraries.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "decompress.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+COMPRESSION detect_compression(const unsigned char *magic, size_t length)
+{
+  if(length >= sizeof(gzip_magic) && memcmp(magic,gzip_magic,sizeof(gzip_magic)) == 0)
+    return COMPRESSION_GZIP;
+  if(length >= sizeof(zstd_magic) && memcmp(magic,zstd_magic,sizeof(zstd_magic)) == 0)
+    return COMPRESSION_ZSTD;
+  return COMPRESSION_NONE;
+}
+
+bool compression_supported(COMPRESSION compression)
+{
+  switch(compression)
+    {
+    case COMPRESSION_NONE:
+      return true;
+#ifdef HAVE_ZLIB
+    case COMPRESSION_GZIP:
+      return true;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      return true;
+#endif
+    default:
+      return false;
+    }
+}
+
+int fd_compression(int fd, COMPRESSION& compression)
+{
+  unsigned char magic[sizeof(zstd_magic)];
+  off_t offset;
+  ssize_t nread;
+
+  compression = COMPRESSION_NONE;
+  offset = lseek(fd,0,SEEK_CUR);
+  if(offset < 0)
+    return (errno == ESPIPE) ? 0 : -1;
+  do
+    {
+      nread = pread(fd,magic,sizeof(magic),offset);
+    }
+  while(nread < 0 && errno == EINTR);
+  if(nread < 0)
+    return -1;
+  compression = detect_compression(magic,nread);
+  return 0;
+}
+
+DECOMPRESS_READER::DECOMPRESS_READER() : fd(-1), owns_fd(false), compression(COMPRESSION_NONE), in(NULL), in_pos(0), in_len(0), in_eof(false), stream(NULL), stream_end(false)
+{
+}
+
+DECOMPRESS_READER::~DECOMPRESS_READER()
+{
+  close();
+}
+
+void DECOMPRESS_READER::close()
+{
+  if(stream != NULL)
+    {
+#ifdef HAVE_ZLIB
+      if(compression == COMPRESSION_GZIP)
+	{
+	  inflateEnd((z_stream*)stream);
+	  free(stream);
+	}
+#endif
+#ifdef HAVE_ZSTD
+      if(compression == COMPRESSION_ZSTD)
+	ZSTD_freeDStream((ZSTD_DStream*)stream);
+#endif
+      stream = NULL;
+    }
+  free(in);
+  in = NULL;
+  if(owns_fd && fd >= 0)
+    ::close(fd);
+  fd = -1;
+  owns_fd = false;
+  compression = COMPRESSION_NONE;
+  in_pos = in_len = 0;
+  in_eof = stream_end = false;
+}
+
+int DECOMPRESS_READER::open_file(const char *path)
+{
+  int new_fd, saved_errno;
+
+  close();
+  if(path == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  new_fd = ::open(path,O_RDONLY);
+  if(new_fd < 0)
+    return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(new_fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+  if(open_fd(new_fd))
+    {
+      saved_errno = errno;
+      ::close(new_fd);
+      errno = saved_errno;
+      return -1;
+    }
+  owns_fd = true;
+  return 0;
+}
+
+int DECOMPRESS_READER::open_fd(int the_fd, bool decompress)
+{
+  close();
+  in = (char*)malloc(DECOMPRESS_BUFFER_SIZE);
+  if(in == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  fd = the_fd;
+
+  // A short read, e.g. from a pipe, could split the magic number.
+  while(!in_eof && in_len < sizeof(zstd_magic))
+    if(fill())
+      return -1;
+  if(decompress)
+    compression = detect_compression((const unsigned char*)in,in_len);
+
+  switch(compression)
+    {
+    case COMPRESSION_NONE:
+      return 0;
+#ifdef HAVE_ZLIB
+    case COMPRESSION_GZIP:
+      {
+	z_stream *z = (z_stream*)calloc(1,sizeof(z_stream));
+	if(z == NULL)
+	  {
+	    errno = ENOMEM;
+	    return -1;
+	  }
+	// 16 + MAX_WBITS reads a gzip header and trailer.
+	if(inflateInit2(z,16 + MAX_WBITS) != Z_OK)
+	  {
+	    free(z);
+	    errno = ENOMEM;
+	    return -1;
+	  }
+	stream = z;
+	return 0;
+      }
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      stream = ZSTD_createDStream();
+      if(stream == NULL || ZSTD_isError(ZSTD_initDStream((ZSTD_DStream*)stream)))
+	{
+	  errno = ENOMEM;
+	  return -1;
+	}
+      return 0;
+#endif
+    default:
+      errno = ENOTSUP;
+      return -1;
+    }
+}
+
+// Reads more input after the bytes not yet consumed, which are moved to
+// the start of the buffer.
+int DECOMPRESS_READER::fill()
+{
+  ssize_t nread;
+
+  if(in_pos > 0)
+    {
+      memmove(in,in + in_pos,in_len - in_pos);
+      in_len -= in_pos;
+      in_pos = 0;
+    }
+  do
+    {
+      nread = ::read(fd,in + in_len,DECOMPRESS_BUFFER_SIZE - in_len);
+    }
+  while(nread < 0 && errno == EINTR);
+  if(nread < 0)
+    return -1;
+  if(nread == 0)
+    in_eof = true;
+  in_len += nread;
+  return 0;
+}
+
+ssize_t DECOMPRESS_READER::read(char *buf, size_t count)
+{
+  ssize_t nread;
+
+  if(fd < 0)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  if(count == 0)
+    return 0;
+
+  switch(compression)
+    {
+    case COMPRESSION_GZIP:
+      return read_gzip(buf,count);
+    case COMPRESSION_ZSTD:
+      return read_zstd(buf,count);
+    default:
+      break;
+    }
+
+  if(in_pos < in_len)
+    {
+      size_t n = in_len - in_pos < count ? in_len - in_pos : count;
+      memcpy(buf,in + in_pos,n);
+      in_pos += n;
+      return n;
+    }
+  if(in_eof)
+    return 0;
+  do
+    {
+      nread = ::read(fd,buf,count);
+    }
+  while(nread < 0 && errno == EINTR);
+  if(nread == 0)
+    in_eof = true;
+  return nread;
+}
+
+#ifdef HAVE_ZLIB
+ssize_t DECOMPRESS_READER::read_gzip(char *buf, size_t count)
+{
+  z_stream *z = (z_stream*)stream;
+
+  while(!stream_end)
+    {
+      if(in_pos == in_len && !in_eof && fill())
+	return -1;
+      if(in_pos == in_len && in_eof)
+	{
+	  errno = EIO;// truncated
+	  return -1;
+	}
+
+      z->next_in = (Bytef*)in + in_pos;
+      z->avail_in = in_len - in_pos;
+      z->next_out = (Bytef*)buf;
+      z->avail_out = count;
+      int status = inflate(z,Z_NO_FLUSH);
+      in_pos = in_len - z->avail_in;
+      size_t produced = count - z->avail_out;
+
+      if(status == Z_STREAM_END)
+	{
+	  // Another member may follow, as written by "cat a.gz b.gz".
+	  // Anything else after the member, such as padding, is ignored,
+	  // as gzip does.
+	  while(in_len - in_pos < sizeof(gzip_magic) && !in_eof)
+	    if(fill())
+	      return -1;
+	  if(detect_compression((const unsigned char*)in + in_pos,in_len - in_pos) == COMPRESSION_GZIP)
+	    inflateReset(z);
+	  else
+	    stream_end = true;
+	}
+      else if(status != Z_OK && status != Z_BUF_ERROR)
+	{
+	  errno = EIO;
+	  return -1;
+	}
+      if(produced > 0)
+	return produced;
+    }
+  return 0;
+}
+#else
+ssize_t DECOMPRESS_READER::read_gzip(char*, size_t)
+{
+  errno = ENOTSUP;
+  return -1;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+ssize_t DECOMPRESS_READER::read_zstd(char *buf, size_t count)
+{
+  ZSTD_DStream *zstd = (ZSTD_DStream*)stream;
+
+  while(1)
+    {
+      if(in_pos == in_len && !in_eof && fill())
+	return -1;
+
+      ZSTD_inBuffer input = {in + in_pos, in_len - in_pos, 0};
+      ZSTD_outBuffer output = {buf, count, 0};
+      size_t status = ZSTD_decompressStream(zstd,&output,&input);
+      in_pos += input.pos;
+      if(ZSTD_isError(status))
+	{
+	  errno = EIO;
+	  return -1;
+	}
+      // 0 means that a frame is complete and flushed. Without input,
+      // the decompressor asks for the header of another frame.
+      if(input.pos > 0 || output.pos > 0)
+	stream_end = (status == 0);
+      if(output.pos > 0)
+	return output.pos;
+      if(in_pos == in_len && in_eof)
+	{
+	  if(stream_end)
+	    return 0;
+	  errno = EIO;// truncated
+	  return -1;
+	}
+    }
+}
+#else
+ssize_t DECOMPRESS_READER::read_zstd(char*, size_t)
+{
+  errno = ENOTSUP;
+  return -1;
+}
+#endif
@@ -0,0 +1,99 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <cstddef>
+#include <sys/types.h>
+
+// Size of the buffer of compressed input kept by each reader.
+#define DECOMPRESS_BUFFER_SIZE (64 * 1024)
+
+enum COMPRESSION {
+  COMPRESSION_NONE,
+  COMPRESSION_GZIP,
+  COMPRESSION_ZSTD
+};
+
+/**
+ * Identifies the compression of data from its first bytes.
+ */
+COMPRESSION detect_compression(const unsigned char *magic, size_t length);
+
+/**
+ * True if this build can decompress the format, i.e. it was configured
+ * with zlib for gzip or with libzstd for zstd.
+ */
+bool compression_supported(COMPRESSION compression);
+
+/**
+ * Sets compression to that of the file open as fd, from the bytes at
+ * its current offset, which is not moved. Descriptors that cannot seek,
+ * e.g. pipes, are taken to be uncompressed.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int fd_compression(int fd, COMPRESSION& compression);
+
+/**
+ * Reads a file, decompressing it on the fly if it starts with the magic
+ * bytes of gzip or zstd, so that comparators see the same contents
+ * whether or not the client compressed its output. Concatenated gzip
+ * members and zstd frames are read as one stream.
+ *
+ * Memory is bounded: compressed input is read through a buffer of
+ * DECOMPRESS_BUFFER_SIZE and decompressed into the caller's buffer. The
+ * decompressor keeps its window, 32 kB for gzip and at most 128 MB
+ * for zstd, as set by the frame (8 MB or less below level 20).
+ *
+ * Methods return 0 upon success and -1 otherwise, in which case errno
+ * is set. Corrupt or truncated data sets errno to EIO, and a format
+ * that this build cannot decompress sets it to ENOTSUP.
+ */
+class DECOMPRESS_READER {
+public:
+  DECOMPRESS_READER();
+  ~DECOMPRESS_READER();
+
+  /**
+   * Opens the file at path, which is closed with the reader.
+   */
+  int open_file(const char *path);
+
+  /**
+   * Reads from fd starting at its current offset. fd is not closed. If
+   * decompress is false, the data is read as it is.
+   */
+  int open_fd(int fd, bool decompress = true);
+
+  void close();
+
+  /**
+   * Reads up to count bytes of the contents. Returns the number of
+   * bytes read, 0 at the end of the contents and -1 upon error.
+   */
+  ssize_t read(char *buf, size_t count);
+
+  COMPRESSION get_compression() const { return compression; }
+
+private:
+  int fill();
+  ssize_t read_gzip(char *buf, size_t count);
+  ssize_t read_zstd(char *buf, size_t count);
+
+  int fd;
+  bool owns_fd;
+  COMPRESSION compression;
+  char *in;// compressed input, or the first bytes of plain input
+  size_t in_pos, in_len;
+  bool in_eof;
+  void *stream;// z_stream or ZSTD_DStream
+  bool stream_end;// the last gzip member or zstd frame is complete
+};
+
+#endif
@@ -0,0 +1,177 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Streaming comparison of result output files. Files are never read
+// into memory whole; two fixed size buffers are filled from each file
+// in turn and compared, so multi-gigabyte outputs use the same amount
+// of memory as small ones. This code does not depend on BOINC and is
+// shared by the validator and the boinctools Python extension.
+//
+// Compressed files are compared by their decompressed contents, since
+// two uploads of the same output may be compressed differently, e.g.
+// with another gzip timestamp or zstd level.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "file_compare.h"
+#include "decompress.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define FILE_COMPARE_ALIGNMENT 4096
+
+// Reads until count bytes have been read or the end of file is reached.
+// Returns the number of bytes read or -1 upon error.
+static ssize_t read_fully(DECOMPRESS_READER& reader, char *buf, size_t count)
+{
+  size_t total = 0;
+  ssize_t nread;
+
+  while(total < count)
+    {
+      nread = reader.read(buf + total,count - total);
+      if(nread < 0)
+	return -1;
+      if(nread == 0)
+	break;
+      total += nread;
+    }
+  return (ssize_t)total;
+}
+
+int fds_equal(int fd1, int fd2, bool& equal, size_t chunk_size)
+{
+  struct stat st1, st2;
+  off_t offset1, offset2;
+  bool regular;
+  COMPRESSION compression1, compression2;
+  DECOMPRESS_READER reader1, reader2;
+  bool decompress;
+  char *buf1 = NULL, *buf2 = NULL;
+  ssize_t n1, n2;
+  int retval = 0;
+
+  equal = false;
+
+  if(fstat(fd1,&st1) || fstat(fd2,&st2))
+    return -1;
+  regular = S_ISREG(st1.st_mode) && S_ISREG(st2.st_mode);
+  if(regular)
+    {
+      // Only the bytes after the current offsets are compared.
+      offset1 = lseek(fd1,0,SEEK_CUR);
+      offset2 = lseek(fd2,0,SEEK_CUR);
+      if(offset1 < 0 || offset2 < 0)
+	return -1;
+      if(st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino && offset1 == offset2)
+	{
+	  equal = true;
+	  return 0;
+	}
+    }
+
+  // If this build cannot decompress one of the files, the files are
+  // compared as they are, which finds equal only identical uploads.
+  if(fd_compression(fd1,compression1) || fd_compression(fd2,compression2))
+    return -1;
+  decompress = (compression1 != COMPRESSION_NONE || compression2 != COMPRESSION_NONE)
+    && compression_supported(compression1) && compression_supported(compression2);
+
+  // Sizes are checked first, since it is by far the cheapest way
+  // to find a difference.
+  if(!decompress && regular
+     && (st1.st_size > offset1 ? st1.st_size - offset1 : 0) != (st2.st_size > offset2 ? st2.st_size - offset2 : 0))
+    return 0;
+
+  if(chunk_size < FILE_COMPARE_ALIGNMENT)
+    chunk_size = FILE_COMPARE_ALIGNMENT;
+  chunk_size -= chunk_size % FILE_COMPARE_ALIGNMENT;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd1,0,0,POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fd2,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+
+  if(posix_memalign((void**)&buf1,FILE_COMPARE_ALIGNMENT,chunk_size)
+     || posix_memalign((void**)&buf2,FILE_COMPARE_ALIGNMENT,chunk_size))
+    {
+      free(buf1);
+      errno = ENOMEM;
+      return -1;
+    }
+  if(reader1.open_fd(fd1,decompress) || reader2.open_fd(fd2,decompress))
+    {
+      free(buf1);
+      free(buf2);
+      return -1;
+    }
+
+  while(1)
+    {
+      n1 = read_fully(reader1,buf1,chunk_size);
+      n2 = read_fully(reader2,buf2,chunk_size);
+      if(n1 < 0 || n2 < 0)
+	{
+	  retval = -1;
+	  break;
+	}
+      // memcmp is vectorized by the C library, which is as fast as
+      // a hand written SIMD loop on aligned buffers.
+      if(n1 != n2 || memcmp(buf1,buf2,n1) != 0)
+	break;
+      if(n1 == 0)
+	{
+	  equal = true;
+	  break;
+	}
+    }
+
+  free(buf1);
+  free(buf2);
+  return retval;
+}
+
+int files_equal(const char *path1, const char *path2, bool& equal, size_t chunk_size)
+{
+  int fd1, fd2, retval, saved_errno;
+
+  equal = false;
+  if(path1 == NULL || path2 == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  fd1 = open(path1,O_RDONLY);
+  if(fd1 < 0)
+    return -1;
+  fd2 = open(path2,O_RDONLY);
+  if(fd2 < 0)
+    {
+      saved_errno = errno;
+      close(fd1);
+      errno = saved_errno;
+      return -1;
+    }
+
+  retval = fds_equal(fd1,fd2,equal,chunk_size);
+  saved_errno = errno;
+  close(fd1);
+  close(fd2);
+  errno = saved_errno;
+  return retval;
+}
@@ -0,0 +1,47 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef FILE_COMPARE_H
+#define FILE_COMPARE_H
+
+#include <cstddef>
+
+// Size of each of the two read buffers used when streaming files.
+// Memory used by a comparison is bounded by twice this value.
+#define FILE_COMPARE_CHUNK_SIZE (1 << 20)
+
+/**
+ * Compares the contents of two open file descriptors, byte for byte.
+ *
+ * Only the bytes from the current offset of each descriptor to the end
+ * of its file are compared. The sizes of those remainders are checked
+ * first. If they agree, both files are read in chunk_size blocks into
+ * page aligned buffers and compared with memcmp, stopping at the first
+ * difference. The descriptors are not closed.
+ *
+ * gzip or zstd compressed files are decompressed as they are read, see
+ * DECOMPRESS_READER, and their sizes are not compared. A compressed
+ * file may equal a plain one.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ *
+ * @param fd1
+ * @param fd2
+ * @param equal set to true if the contents are identical
+ * @param chunk_size
+ * @return int
+ */
+int fds_equal(int fd1, int fd2, bool& equal, size_t chunk_size = FILE_COMPARE_CHUNK_SIZE);
+
+/**
+ * Opens the two files and compares them with fds_equal.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int files_equal(const char *path1, const char *path2, bool& equal, size_t chunk_size = FILE_COMPARE_CHUNK_SIZE);
+
+#endif
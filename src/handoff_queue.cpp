@@ -0,0 +1,618 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Persistent queue of records in a memory mapped file. The assimilator
+// appends a record for each workunit and returns, and Python workers
+// claim, process and acknowledge the records. This code does not depend
+// on BOINC and is shared with the boinctools Python extension.
+//
+// File layout: a QUEUE_HEADER page, followed by records, each a
+// QUEUE_RECORD followed by the payload, padded to a multiple of 8
+// bytes. Records in [head, tail) are in the queue. A record is written
+// and synced before tail is moved past it, so a torn append is never
+// seen. Acknowledged records at the head are dropped by moving head.
+// When the space before head is large, the live records are copied to
+// a new file, which is renamed over the old one. Other processes notice
+// the new inode when they next take the lock and reopen the queue.
+//
+// Records that have been tried max_attempts times are copied to the
+// dead letter file, PATH.dead, and dropped like acknowledged ones, so
+// that they do not hold back head or count as queued work.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "handoff_queue.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define QUEUE_MAGIC 0x51464648 // "HFFQ"
+#define QUEUE_RECORD_MAGIC 0x43455248 // "HREC"
+#define QUEUE_VERSION 1
+#define QUEUE_HEADER_SIZE 4096
+#define QUEUE_INITIAL_SIZE (1 << 20)
+#define QUEUE_RATE_WINDOW 60// seconds over which the drain rate is measured
+
+enum RECORD_STATE { RECORD_PENDING, RECORD_CLAIMED, RECORD_ACKED, RECORD_DEAD };
+
+struct QUEUE_HEADER {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t dead;// records moved to the dead letter file
+  uint64_t head;// file offsets
+  uint64_t tail;
+  uint64_t next_seq;
+  uint64_t appended;
+  uint64_t acked;
+  uint64_t window_acks;
+  double window_start;
+  double drain_rate;
+};
+
+struct QUEUE_RECORD {
+  uint32_t magic;
+  uint32_t length;// of the payload
+  uint64_t seq;
+  uint32_t checksum;// of the payload
+  uint32_t state;
+  uint32_t attempts;
+  int32_t pid;// of the claiming process
+  double enqueued;
+  double claimed;
+};
+
+#define HEADER ((QUEUE_HEADER*)map)
+#define RECORD_AT(offset) ((QUEUE_RECORD*)(map + (offset)))
+
+// 32 bit FNV-1a
+static uint32_t payload_checksum(const char *data, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0;i < len;i++)
+    {
+      hash ^= (unsigned char)data[i];
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+static inline size_t record_size(size_t payload_len)
+{
+  return sizeof(QUEUE_RECORD) + ((payload_len + 7) & ~(size_t)7);
+}
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static bool process_exists(int pid)
+{
+  if(pid <= 0 || pid == getpid())
+    return pid > 0;
+  return kill(pid,0) == 0 || errno != ESRCH;
+}
+
+HANDOFF_QUEUE::HANDOFF_QUEUE() : durable(true), fd(-1), map(NULL), map_size(0)
+{
+  pthread_mutex_init(&mutex,NULL);
+}
+
+HANDOFF_QUEUE::~HANDOFF_QUEUE()
+{
+  close();
+  pthread_mutex_destroy(&mutex);
+}
+
+int HANDOFF_QUEUE::map_file()
+{
+  struct stat st;
+  void *addr;
+
+  if(fstat(fd,&st))
+    return -1;
+  if(map != NULL && (size_t)st.st_size == map_size)
+    return 0;
+  unmap_file();
+  if(st.st_size < QUEUE_HEADER_SIZE)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  addr = mmap(NULL,st.st_size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+  if(addr == MAP_FAILED)
+    return -1;
+  map = (char*)addr;
+  map_size = st.st_size;
+  return 0;
+}
+
+void HANDOFF_QUEUE::unmap_file()
+{
+  if(map != NULL)
+    munmap(map,map_size);
+  map = NULL;
+  map_size = 0;
+}
+
+int HANDOFF_QUEUE::sync_range(size_t offset, size_t length)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t start = offset & ~(page - 1);
+
+  if(durable && msync(map + start,offset + length - start,MS_SYNC))
+    {
+      int saved_errno = errno;
+      fprintf(stderr,"[%s:%d] Could not sync %s: %s\n",__FILE__,__LINE__,path.c_str(),strerror(errno));
+      errno = saved_errno;
+      return -1;
+    }
+  return 0;
+}
+
+int HANDOFF_QUEUE::open(const char *filename, bool durable_)
+{
+  struct stat st;
+  QUEUE_HEADER header;
+  int retval = 0;
+
+  close();
+  path = filename;
+  durable = durable_;
+
+  fd = ::open(filename,O_RDWR | O_CREAT | O_CLOEXEC,0660);
+  if(fd < 0)
+    return -1;
+  if(flock(fd,LOCK_EX) || fstat(fd,&st))
+    {
+      int saved_errno = errno;
+      ::close(fd);
+      fd = -1;
+      errno = saved_errno;
+      return -1;
+    }
+
+  if(st.st_size < QUEUE_HEADER_SIZE)
+    {
+      // New queue
+      memset(&header,0,sizeof(header));
+      header.magic = QUEUE_MAGIC;
+      header.version = QUEUE_VERSION;
+      header.head = header.tail = QUEUE_HEADER_SIZE;
+      header.next_seq = 1;
+      if(ftruncate(fd,QUEUE_INITIAL_SIZE) || pwrite(fd,&header,sizeof(header),0) != sizeof(header) || (durable && fdatasync(fd)))
+	retval = -1;
+    }
+  if(retval == 0)
+    retval = map_file();
+  if(retval == 0 && (HEADER->magic != QUEUE_MAGIC || HEADER->version != QUEUE_VERSION))
+    {
+      errno = EINVAL;
+      retval = -1;
+    }
+  if(retval == 0)
+    retval = recover();
+
+  int saved_errno = errno;
+  flock(fd,LOCK_UN);
+  if(retval)
+    {
+      unmap_file();
+      ::close(fd);
+      fd = -1;
+    }
+  errno = saved_errno;
+  return retval;
+}
+
+void HANDOFF_QUEUE::close()
+{
+  unmap_file();
+  if(fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
+
+// Drops records past the first damaged one. Appends sync the record
+// before moving tail, so this only happens if the disk is damaged.
+int HANDOFF_QUEUE::recover()
+{
+  uint64_t offset = HEADER->head;
+
+  if(HEADER->head < QUEUE_HEADER_SIZE || HEADER->tail > map_size || HEADER->head > HEADER->tail)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  while(offset < HEADER->tail)
+    {
+      QUEUE_RECORD *record = RECORD_AT(offset);
+      if(offset + sizeof(QUEUE_RECORD) > HEADER->tail || record->magic != QUEUE_RECORD_MAGIC
+	 || offset + record_size(record->length) > HEADER->tail
+	 || record->checksum != payload_checksum(map + offset + sizeof(QUEUE_RECORD),record->length))
+	{
+	  fprintf(stderr,"[%s:%d] %s is damaged at offset %llu. Dropping %llu bytes.\n",__FILE__,__LINE__,path.c_str(),(unsigned long long)offset,(unsigned long long)(HEADER->tail - offset));
+	  HEADER->tail = offset;
+	  if(sync_range(0,sizeof(QUEUE_HEADER)))
+	    return -1;
+	  break;
+	}
+      offset += record_size(record->length);
+    }
+  advance_head();
+  return 0;
+}
+
+// Takes the locks, following the queue to a new file if it was
+// compacted or grown by another process.
+int HANDOFF_QUEUE::lock()
+{
+  struct stat current, opened;
+
+  if(fd < 0)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  pthread_mutex_lock(&mutex);
+  while(1)
+    {
+      if(flock(fd,LOCK_EX))
+	break;
+      if(stat(path.c_str(),&current) == 0 && fstat(fd,&opened) == 0
+	 && current.st_dev == opened.st_dev && current.st_ino == opened.st_ino)
+	{
+	  if(map_file() == 0)
+	    return 0;
+	  flock(fd,LOCK_UN);
+	  break;
+	}
+      flock(fd,LOCK_UN);
+      std::string filename = path;
+      if(open(filename.c_str(),durable))
+	break;
+    }
+  int saved_errno = errno;
+  pthread_mutex_unlock(&mutex);
+  errno = saved_errno;
+  return -1;
+}
+
+void HANDOFF_QUEUE::unlock()
+{
+  flock(fd,LOCK_UN);
+  pthread_mutex_unlock(&mutex);
+}
+
+// Moves head past acknowledged records. An empty queue starts over at
+// the beginning of the file.
+void HANDOFF_QUEUE::advance_head()
+{
+  uint64_t head = HEADER->head;
+  while(head < HEADER->tail && (RECORD_AT(head)->state == RECORD_ACKED || RECORD_AT(head)->state == RECORD_DEAD))
+    head += record_size(RECORD_AT(head)->length);
+  if(head == HEADER->tail)
+    HEADER->head = HEADER->tail = QUEUE_HEADER_SIZE;
+  else
+    HEADER->head = head;
+}
+
+// Copies the live records to a new file, which replaces the queue file.
+int HANDOFF_QUEUE::compact()
+{
+  std::string tmp_path = path + ".tmp";
+  size_t live = HEADER->tail - HEADER->head;
+  QUEUE_HEADER header = *HEADER;
+  int new_fd, saved_errno;
+
+  new_fd = ::open(tmp_path.c_str(),O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,0660);
+  if(new_fd < 0)
+    return -1;
+  flock(new_fd,LOCK_EX);// before anyone can open it by its final name
+  header.head = QUEUE_HEADER_SIZE;
+  header.tail = QUEUE_HEADER_SIZE + live;
+  if(ftruncate(new_fd,map_size) || pwrite(new_fd,&header,sizeof(header),0) != sizeof(header)
+     || (live > 0 && pwrite(new_fd,map + HEADER->head,live,QUEUE_HEADER_SIZE) != (ssize_t)live)
+     || fdatasync(new_fd) || rename(tmp_path.c_str(),path.c_str()))
+    {
+      saved_errno = errno;
+      unlink(tmp_path.c_str());
+      ::close(new_fd);
+      errno = saved_errno;
+      return -1;
+    }
+
+  flock(fd,LOCK_UN);
+  unmap_file();
+  ::close(fd);
+  fd = new_fd;
+  return map_file();
+}
+
+int HANDOFF_QUEUE::grow(size_t needed)
+{
+  size_t new_size = 2 * map_size;
+  while(new_size < needed)
+    new_size *= 2;
+  if(ftruncate(fd,new_size) || (durable && fdatasync(fd)))
+    return -1;
+  return map_file();
+}
+
+int HANDOFF_QUEUE::append(const std::string& payload)
+{
+  size_t size = record_size(payload.size());
+  QUEUE_RECORD *record;
+  uint64_t offset;
+
+  if(payload.size() > 0xffffffffu)
+    {
+      errno = EFBIG;
+      return -1;
+    }
+  if(lock())
+    return -1;
+
+  if(HEADER->tail + size > map_size && HEADER->head - QUEUE_HEADER_SIZE >= (map_size - QUEUE_HEADER_SIZE) / 2)
+    {
+      if(compact())
+	{
+	  int saved_errno = errno;
+	  unlock();
+	  errno = saved_errno;
+	  return -1;
+	}
+    }
+  if(HEADER->tail + size > map_size && grow(HEADER->tail + size))
+    {
+      int saved_errno = errno;
+      unlock();
+      errno = saved_errno;
+      return -1;
+    }
+
+  offset = HEADER->tail;
+  record = RECORD_AT(offset);
+  memset(record,0,sizeof(QUEUE_RECORD));
+  record->magic = QUEUE_RECORD_MAGIC;
+  record->length = payload.size();
+  record->seq = HEADER->next_seq;
+  record->checksum = payload_checksum(payload.data(),payload.size());
+  record->state = RECORD_PENDING;
+  record->enqueued = now();
+  memcpy(map + offset + sizeof(QUEUE_RECORD),payload.data(),payload.size());
+  if(sync_range(offset,size))
+    {
+      int saved_errno = errno;
+      unlock();
+      errno = saved_errno;
+      return -1;
+    }
+
+  // If the header cannot be synced, the record is taken back out, so
+  // that the caller can append it again later. Should the header reach
+  // the disk anyway, the record is handed out twice rather than lost.
+  HEADER->tail = offset + size;
+  HEADER->next_seq++;
+  HEADER->appended++;
+  if(sync_range(0,sizeof(QUEUE_HEADER)))
+    {
+      int saved_errno = errno;
+      HEADER->tail = offset;
+      HEADER->next_seq--;
+      HEADER->appended--;
+      unlock();
+      errno = saved_errno;
+      return -1;
+    }
+
+  unlock();
+  return 0;
+}
+
+// Appends the payload of the record at offset to the dead letter file,
+// followed by a blank line, and then drops the record from the queue.
+int HANDOFF_QUEUE::bury(uint64_t offset)
+{
+  QUEUE_RECORD *record = RECORD_AT(offset);
+  std::string dead_path = path + ".dead";
+  std::string entry(map + offset + sizeof(QUEUE_RECORD),record->length);
+  int dead_fd, saved_errno;
+
+  if(entry.empty() || entry[entry.size() - 1] != '\n')
+    entry += '\n';
+  entry += '\n';
+  dead_fd = ::open(dead_path.c_str(),O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,0660);
+  if(dead_fd < 0)
+    return -1;
+  if(write(dead_fd,entry.data(),entry.size()) != (ssize_t)entry.size() || (durable && fdatasync(dead_fd)))
+    {
+      saved_errno = errno;
+      ::close(dead_fd);
+      errno = saved_errno;
+      return -1;
+    }
+  ::close(dead_fd);
+
+  record->state = RECORD_DEAD;
+  if(sync_range(offset,sizeof(QUEUE_RECORD)))
+    return -1;
+  HEADER->dead++;
+  return sync_range(0,sizeof(QUEUE_HEADER));
+}
+
+int HANDOFF_QUEUE::claim(double lease, int max_attempts, unsigned long long& seq, std::string& payload)
+{
+  double time_now = now();
+  bool buried = false;
+  int retval = 0;
+
+  if(lock())
+    return -1;
+  for(uint64_t offset = HEADER->head;offset < HEADER->tail;offset += record_size(RECORD_AT(offset)->length))
+    {
+      QUEUE_RECORD *record = RECORD_AT(offset);
+      if(record->state == RECORD_ACKED || record->state == RECORD_DEAD)
+	continue;
+      if(record->state == RECORD_CLAIMED && process_exists(record->pid) && (lease <= 0 || time_now - record->claimed < lease))
+	continue;
+      if(max_attempts > 0 && record->attempts >= (uint32_t)max_attempts)
+	{
+	  // If it cannot be buried, it is skipped and tried again later.
+	  if(bury(offset))
+	    fprintf(stderr,"[%s:%d] Could not move record %llu of %s to the dead letter file: %s\n",__FILE__,__LINE__,(unsigned long long)record->seq,path.c_str(),strerror(errno));
+	  else
+	    buried = true;
+	  continue;
+	}
+
+      QUEUE_RECORD previous = *record;
+      record->state = RECORD_CLAIMED;
+      record->pid = getpid();
+      record->claimed = time_now;
+      record->attempts++;
+      if(sync_range(offset,sizeof(QUEUE_RECORD)))
+	{
+	  *record = previous;
+	  retval = -1;
+	  break;
+	}
+      seq = record->seq;
+      payload.assign(map + offset + sizeof(QUEUE_RECORD),record->length);
+      retval = 1;
+      break;
+    }
+  if(buried)
+    advance_head();// synced with the next change of the header
+  int saved_errno = errno;
+  unlock();
+  errno = saved_errno;
+  return retval;
+}
+
+QUEUE_RECORD* HANDOFF_QUEUE::find(unsigned long long seq)
+{
+  for(uint64_t offset = HEADER->head;offset < HEADER->tail;offset += record_size(RECORD_AT(offset)->length))
+    if(RECORD_AT(offset)->seq == seq)
+      return RECORD_AT(offset);
+  return NULL;
+}
+
+int HANDOFF_QUEUE::ack(unsigned long long seq)
+{
+  QUEUE_RECORD *record;
+  double time_now = now();
+  int retval;
+
+  if(lock())
+    return -1;
+  record = find(seq);
+  if(record == NULL || record->state == RECORD_ACKED || record->state == RECORD_DEAD)
+    {
+      unlock();
+      errno = ENOENT;
+      return -1;
+    }
+  // Until the acknowledgement is on disk, the record stays claimed.
+  record->state = RECORD_ACKED;
+  if(sync_range((char*)record - map,sizeof(QUEUE_RECORD)))
+    {
+      int saved_errno = errno;
+      record->state = RECORD_CLAIMED;
+      unlock();
+      errno = saved_errno;
+      return -1;
+    }
+
+  HEADER->acked++;
+  if(HEADER->window_start == 0)
+    HEADER->window_start = time_now;
+  HEADER->window_acks++;
+  if(time_now - HEADER->window_start >= QUEUE_RATE_WINDOW)
+    {
+      HEADER->drain_rate = HEADER->window_acks / (time_now - HEADER->window_start);
+      HEADER->window_start = time_now;
+      HEADER->window_acks = 0;
+    }
+  advance_head();
+  retval = sync_range(0,sizeof(QUEUE_HEADER));
+  int saved_errno = errno;
+  unlock();
+  errno = saved_errno;
+  return retval;
+}
+
+int HANDOFF_QUEUE::release(unsigned long long seq)
+{
+  QUEUE_RECORD *record;
+  int retval;
+
+  if(lock())
+    return -1;
+  record = find(seq);
+  if(record == NULL || record->state != RECORD_CLAIMED)
+    {
+      unlock();
+      errno = ENOENT;
+      return -1;
+    }
+  record->state = RECORD_PENDING;
+  record->pid = 0;
+  retval = sync_range((char*)record - map,sizeof(QUEUE_RECORD));
+  int saved_errno = errno;
+  unlock();
+  errno = saved_errno;
+  return retval;
+}
+
+int HANDOFF_QUEUE::get_stats(HANDOFF_QUEUE_STATS& stats)
+{
+  double time_now = now();
+
+  if(lock())
+    return -1;
+  stats = HANDOFF_QUEUE_STATS();
+  for(uint64_t offset = HEADER->head;offset < HEADER->tail;offset += record_size(RECORD_AT(offset)->length))
+    {
+      QUEUE_RECORD *record = RECORD_AT(offset);
+      if(record->state == RECORD_ACKED || record->state == RECORD_DEAD)
+	continue;
+      if(stats.depth == 0)
+	stats.oldest_age = time_now - record->enqueued;
+      stats.depth++;
+      if(record->state == RECORD_CLAIMED)
+	stats.claimed++;
+      else
+	stats.pending++;
+    }
+  stats.appended = HEADER->appended;
+  stats.acked = HEADER->acked;
+  stats.dead = HEADER->dead;
+  stats.size = map_size;
+  // Until a full window has passed, use the partial one.
+  stats.drain_rate = HEADER->drain_rate;
+  if(stats.drain_rate == 0 && HEADER->window_start > 0 && time_now > HEADER->window_start)
+    stats.drain_rate = HEADER->window_acks / (time_now - HEADER->window_start);
+  unlock();
+  return 0;
+}
@@ -0,0 +1,109 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef HANDOFF_QUEUE_H
+#define HANDOFF_QUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+struct HANDOFF_QUEUE_STATS {
+  long depth;// records not yet acknowledged
+  long pending;
+  long claimed;
+  double oldest_age;// seconds since the oldest unacknowledged record was appended
+  double drain_rate;// acknowledgements per second
+  long long appended;// over the life of the queue file
+  long long acked;
+  long long dead;// moved to the dead letter file
+  long long size;// of the queue file, in bytes
+
+  HANDOFF_QUEUE_STATS() : depth(0), pending(0), claimed(0), oldest_age(0), drain_rate(0), appended(0), acked(0), dead(0), size(0) {}
+};
+
+/**
+ * A persistent first in, first out queue of records in a memory mapped
+ * file, shared by a producer, such as the assimilator, and any number
+ * of consumer processes.
+ *
+ * A consumer claims a record, processes it and then acknowledges it.
+ * Records stay in the file until they are acknowledged, so none are
+ * lost if a producer or consumer exits. A record claimed by a process
+ * that has exited, or whose lease has expired, is handed out again.
+ * Operations are serialized with an flock on the file.
+ *
+ * If durable is true, appends and acknowledgements are synced to disk
+ * before they return, so that records also survive a crash of the
+ * machine. An operation whose changes cannot be synced fails.
+ *
+ * Methods return 0 upon success and -1 otherwise, in which case errno
+ * is set.
+ */
+class HANDOFF_QUEUE {
+public:
+  HANDOFF_QUEUE();
+  ~HANDOFF_QUEUE();
+
+  /**
+   * Opens the queue at path, creating it if it does not exist.
+   */
+  int open(const char *path, bool durable);
+  void close();
+  bool is_open() const { return map != NULL; }
+
+  int append(const std::string& payload);
+
+  /**
+   * Claims the oldest record that is neither acknowledged nor claimed
+   * by a live process. A claim older than lease seconds is taken over
+   * if lease is positive. If max_attempts is positive, records that
+   * have been claimed max_attempts times are moved to the dead letter
+   * file, the path of the queue followed by ".dead", instead. Their
+   * payloads are written there one after the other, each followed by a
+   * blank line.
+   *
+   * Returns 1 if a record was claimed, 0 if there was none, and -1
+   * upon error.
+   */
+  int claim(double lease, int max_attempts, unsigned long long& seq, std::string& payload);
+
+  /**
+   * Removes a claimed record from the queue. errno is ENOENT if there
+   * is no such record.
+   */
+  int ack(unsigned long long seq);
+
+  /**
+   * Returns a claimed record to the queue, e.g. after a failure.
+   */
+  int release(unsigned long long seq);
+
+  int get_stats(HANDOFF_QUEUE_STATS& stats);
+
+private:
+  int map_file();
+  void unmap_file();
+  int lock();
+  void unlock();
+  int recover();
+  int compact();
+  int grow(size_t needed);
+  int bury(uint64_t offset);
+  int sync_range(size_t offset, size_t length);
+  void advance_head();
+  struct QUEUE_RECORD* find(unsigned long long seq);
+
+  std::string path;
+  bool durable;
+  int fd;
+  char *map;
+  size_t map_size;
+  pthread_mutex_t mutex;// flock does not exclude threads sharing fd
+};
+
+#endif
@@ -0,0 +1,343 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Order insensitive comparison of text files. Each file is read from a
+// fixed size buffer and every line is normalized and hashed as it is
+// read, so that lines are never copied. Exact comparison keeps eight
+// bytes per line, which are radix sorted; similarity keeps a bottom-k
+// sketch of the smallest hashes, which is bounded by k.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "line_set_compare.h"
+#include "decompress.h"
+
+#include <algorithm>
+#include <set>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+
+#define LINE_SET_BUFFER_SIZE (64 * 1024)
+
+// Below this many hashes, std::sort beats the radix sort's histograms.
+#define RADIX_SORT_MIN_SIZE 65536
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// FNV-1a spreads its input poorly over the low bits, which the sketch
+// and the radix sort rely on, so the result is mixed by the finalizer
+// of MurmurHash3.
+static inline uint64_t mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+class LINE_HASHER {
+public:
+  LINE_HASHER() : buf(NULL), pos(0), len(0), eof(false) {}
+  ~LINE_HASHER()
+  {
+    free(buf);
+  }
+
+  int open_file(const char *path)
+  {
+    if(alloc())
+      return -1;
+    return file.open_file(path);
+  }
+
+  // Reads fd from its current offset. fd is not closed.
+  int open_fd(int fd)
+  {
+    if(alloc())
+      return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+    return file.open_fd(fd);
+  }
+
+  // Sets hash to that of the next line that is not blank. Returns 1 if
+  // there was one, 0 at the end of the file and -1 upon error.
+  int next(uint64_t& hash)
+  {
+    uint64_t h = FNV_OFFSET_BASIS;
+    bool empty = true, space = false;
+
+    while(1)
+      {
+	if(pos == len && fill())
+	  return -1;
+	if(pos == len)
+	  break;
+	char c = buf[pos++];
+	if(c == '\n')
+	  {
+	    if(empty)
+	      continue;
+	    break;
+	  }
+	if(is_space(c))
+	  {
+	    space = !empty;
+	    continue;
+	  }
+	if(space)
+	  {
+	    h = (h ^ (unsigned char)' ') * FNV_PRIME;
+	    space = false;
+	  }
+	h = (h ^ (unsigned char)c) * FNV_PRIME;
+	empty = false;
+      }
+
+    if(empty)
+      return 0;
+    hash = mix(h);
+    return 1;
+  }
+
+private:
+  int alloc()
+  {
+    buf = (char*)malloc(LINE_SET_BUFFER_SIZE);
+    if(buf == NULL)
+      {
+	errno = ENOMEM;
+	return -1;
+      }
+    return 0;
+  }
+
+  int fill()
+  {
+    ssize_t nread;
+    pos = len = 0;
+    if(eof)
+      return 0;
+    nread = file.read(buf,LINE_SET_BUFFER_SIZE);
+    if(nread < 0)
+      return -1;
+    if(nread == 0)
+      eof = true;
+    len = nread;
+    return 0;
+  }
+
+  DECOMPRESS_READER file;
+  char *buf;
+  size_t pos, len;
+  bool eof;
+};
+
+// LSD radix sort by 16 bit digits. Digits on which every hash agrees,
+// such as the high ones of a short file, are skipped.
+static void radix_sort(std::vector<uint64_t>& values)
+{
+  std::vector<uint64_t> scratch(values.size());
+  std::vector<size_t> counts(1 << 16);
+
+  for(int shift = 0;shift < 64;shift += 16)
+    {
+      std::fill(counts.begin(),counts.end(),0);
+      for(size_t i = 0;i < values.size();i++)
+	counts[(values[i] >> shift) & 0xffff]++;
+      if(counts[(values[0] >> shift) & 0xffff] == values.size())
+	continue;
+
+      size_t total = 0;
+      for(size_t d = 0;d < counts.size();d++)
+	{
+	  size_t count = counts[d];
+	  counts[d] = total;
+	  total += count;
+	}
+      for(size_t i = 0;i < values.size();i++)
+	scratch[counts[(values[i] >> shift) & 0xffff]++] = values[i];
+      values.swap(scratch);
+    }
+}
+
+static int hash_lines(LINE_HASHER& hasher, std::vector<uint64_t>& hashes)
+{
+  uint64_t hash;
+  int status;
+
+  while((status = hasher.next(hash)) > 0)
+    hashes.push_back(hash);
+  if(status < 0)
+    return -1;
+
+  if(hashes.size() < RADIX_SORT_MIN_SIZE)
+    std::sort(hashes.begin(),hashes.end());
+  else
+    radix_sort(hashes);
+  return 0;
+}
+
+int line_hashes(const char *path, std::vector<uint64_t>& hashes)
+{
+  LINE_HASHER hasher;
+
+  hashes.clear();
+  if(path == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if(hasher.open_file(path))
+    return -1;
+  return hash_lines(hasher,hashes);
+}
+
+int line_hashes_fd(int fd, std::vector<uint64_t>& hashes)
+{
+  LINE_HASHER hasher;
+
+  hashes.clear();
+  if(hasher.open_fd(fd))
+    return -1;
+  return hash_lines(hasher,hashes);
+}
+
+static int sketch_lines(LINE_HASHER& hasher, size_t num_hashes, std::vector<uint64_t>& sketch)
+{
+  std::set<uint64_t> smallest;
+  uint64_t hash;
+  int status;
+
+  while((status = hasher.next(hash)) > 0)
+    {
+      if(smallest.size() == num_hashes)
+	{
+	  std::set<uint64_t>::iterator largest = smallest.end();
+	  if(hash >= *--largest)
+	    continue;
+	  if(!smallest.insert(hash).second)
+	    continue;
+	  smallest.erase(largest);
+	}
+      else
+	smallest.insert(hash);
+    }
+  if(status < 0)
+    return -1;
+  sketch.assign(smallest.begin(),smallest.end());
+  return 0;
+}
+
+int line_sketch(const char *path, size_t num_hashes, std::vector<uint64_t>& sketch)
+{
+  LINE_HASHER hasher;
+
+  sketch.clear();
+  if(path == NULL || num_hashes == 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if(hasher.open_file(path))
+    return -1;
+  return sketch_lines(hasher,num_hashes,sketch);
+}
+
+int line_sketch_fd(int fd, size_t num_hashes, std::vector<uint64_t>& sketch)
+{
+  LINE_HASHER hasher;
+
+  sketch.clear();
+  if(num_hashes == 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if(hasher.open_fd(fd))
+    return -1;
+  return sketch_lines(hasher,num_hashes,sketch);
+}
+
+double sketch_similarity(const std::vector<uint64_t>& sketch1, const std::vector<uint64_t>& sketch2, size_t num_hashes)
+{
+  std::vector<uint64_t>::const_iterator it1 = sketch1.begin(), it2 = sketch2.begin();
+  size_t in_union = 0, in_both = 0;
+
+  // The num_hashes smallest hashes of the union are the smallest of
+  // the two sketches together. Those in both sketches are a sample of
+  // the intersection.
+  while(in_union < num_hashes && (it1 != sketch1.end() || it2 != sketch2.end()))
+    {
+      if(it2 == sketch2.end() || (it1 != sketch1.end() && *it1 < *it2))
+	it1++;
+      else if(it1 == sketch1.end() || *it2 < *it1)
+	it2++;
+      else
+	{
+	  in_both++;
+	  it1++;
+	  it2++;
+	}
+      in_union++;
+    }
+  if(in_union == 0)
+    return 1;
+  return (double)in_both / in_union;
+}
+
+int line_sets_equal(const char *path1, const char *path2, const LINE_SET_CONFIG& config, bool& equal)
+{
+  std::vector<uint64_t> hashes1, hashes2;
+
+  equal = false;
+  if(config.min_similarity < 1)
+    {
+      if(line_sketch(path1,config.num_hashes,hashes1) || line_sketch(path2,config.num_hashes,hashes2))
+	return -1;
+      equal = (sketch_similarity(hashes1,hashes2,config.num_hashes) >= config.min_similarity);
+      return 0;
+    }
+
+  if(line_hashes(path1,hashes1) || line_hashes(path2,hashes2))
+    return -1;
+  equal = (hashes1 == hashes2);
+  return 0;
+}
+
+int line_set_fds_equal(int fd1, int fd2, const LINE_SET_CONFIG& config, bool& equal)
+{
+  std::vector<uint64_t> hashes1, hashes2;
+
+  equal = false;
+  if(config.min_similarity < 1)
+    {
+      if(line_sketch_fd(fd1,config.num_hashes,hashes1) || line_sketch_fd(fd2,config.num_hashes,hashes2))
+	return -1;
+      equal = (sketch_similarity(hashes1,hashes2,config.num_hashes) >= config.min_similarity);
+      return 0;
+    }
+
+  if(line_hashes_fd(fd1,hashes1) || line_hashes_fd(fd2,hashes2))
+    return -1;
+  equal = (hashes1 == hashes2);
+  return 0;
+}
@@ -0,0 +1,87 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef LINE_SET_COMPARE_H
+#define LINE_SET_COMPARE_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Settings of line_sets_equal. If min_similarity is 1, the files must
+ * hold the same lines, each the same number of times, in any order.
+ * Otherwise the files match if the estimated Jaccard similarity of
+ * their sets of lines, |A & B| / |A | B|, is at least min_similarity.
+ * The estimate is made from a sketch of the num_hashes smallest line
+ * hashes of each file, so memory does not grow with the files, and is
+ * exact if a file has no more than num_hashes distinct lines.
+ */
+struct LINE_SET_CONFIG {
+  double min_similarity;
+  size_t num_hashes;
+
+  LINE_SET_CONFIG() : min_similarity(1), num_hashes(256) {}
+  LINE_SET_CONFIG(double s, size_t n) : min_similarity(s), num_hashes(n) {}
+};
+
+/**
+ * Reads the file at path and sets hashes to the 64 bit hash of each of
+ * its lines, in ascending order. Lines are normalized first: leading
+ * and trailing white space is removed and runs of white space become
+ * one space, i.e. " ".join(line.split()) in Python. Blank lines are
+ * skipped.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int line_hashes(const char *path, std::vector<uint64_t>& hashes);
+
+/**
+ * As line_hashes, for an open descriptor, which is read from its
+ * current offset and is not closed.
+ */
+int line_hashes_fd(int fd, std::vector<uint64_t>& hashes);
+
+/**
+ * Sets sketch to the num_hashes smallest distinct line hashes of the
+ * file at path, in ascending order, without keeping the others.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int line_sketch(const char *path, size_t num_hashes, std::vector<uint64_t>& sketch);
+
+/**
+ * As line_sketch, for an open descriptor, which is read from its
+ * current offset and is not closed.
+ */
+int line_sketch_fd(int fd, size_t num_hashes, std::vector<uint64_t>& sketch);
+
+/**
+ * Estimates the Jaccard similarity of two sets from their sketches, as
+ * made by line_sketch with the same num_hashes. Two empty sets are
+ * identical.
+ */
+double sketch_similarity(const std::vector<uint64_t>& sketch1, const std::vector<uint64_t>& sketch2, size_t num_hashes);
+
+/**
+ * Compares the lines of two text files regardless of their order,
+ * according to config, e.g. hit lists written by several threads.
+ * gzip or zstd compressed files are decompressed as they are read.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int line_sets_equal(const char *path1, const char *path2, const LINE_SET_CONFIG& config, bool& equal);
+
+/**
+ * As line_sets_equal, for two open descriptors, which are read from
+ * their current offsets and are not closed.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int line_set_fds_equal(int fd1, int fd2, const LINE_SET_CONFIG& config, bool& equal);
+
+#endif
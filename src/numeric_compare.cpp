@@ -0,0 +1,321 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Tolerant comparison of text files containing tables of numbers.
+// Both files are tokenized in lockstep from fixed size buffers, so
+// neither file is read into memory whole. Numbers are parsed with a
+// fast path for the common case of short decimal numbers, which avoids
+// the locale handling and arbitrary precision fallback of strtod.
+//
+// Blank lines, and whether the last line ends in a newline, are
+// ignored. Otherwise lines must contain the same number of tokens.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "numeric_compare.h"
+#include "decompress.h"
+
+#include <string>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+
+#define NUMERIC_COMPARE_BUFFER_SIZE (64 * 1024)
+
+// Largest integer that a double holds exactly
+#define MAX_EXACT_MANTISSA (((uint64_t)1) << 53)
+
+// Powers of ten that are exactly representable as doubles
+static const double exact_powers_of_ten[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+  1e21, 1e22
+};
+#define MAX_EXACT_POWER_OF_TEN 22
+
+bool NUMERIC_TOLERANCE::agree(double a, double b) const
+{
+  double diff, scale;
+
+  if(a == b)
+    return true;
+  diff = fabs(a - b);
+  if(diff <= abs_tol)
+    return true;
+  scale = fabs(a) > fabs(b) ? fabs(a) : fabs(b);
+  return diff <= rel_tol * scale;
+}
+
+const NUMERIC_TOLERANCE& NUMERIC_COMPARE_CONFIG::tolerance(int column) const
+{
+  std::map<int, NUMERIC_TOLERANCE>::const_iterator it = columns.find(column);
+  if(it == columns.end())
+    return default_tolerance;
+  return it->second;
+}
+
+static inline bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+bool parse_number(const char *begin, const char *end, double& value)
+{
+  const char *p = begin;
+  uint64_t mantissa = 0;
+  int significant_digits = 0, exp10 = 0;
+  bool negative = false, has_digits = false, truncated = false;
+
+  if(p < end && (*p == '+' || *p == '-'))
+    negative = (*p++ == '-');
+
+  for(;p < end && is_digit(*p);p++)
+    {
+      has_digits = true;
+      if(significant_digits < 19)
+	{
+	  mantissa = mantissa * 10 + (*p - '0');
+	  if(mantissa)
+	    significant_digits++;
+	}
+      else
+	{
+	  exp10++;
+	  truncated = true;
+	}
+    }
+
+  if(p < end && *p == '.')
+    {
+      for(p++;p < end && is_digit(*p);p++)
+	{
+	  has_digits = true;
+	  if(significant_digits < 19)
+	    {
+	      mantissa = mantissa * 10 + (*p - '0');
+	      if(mantissa)
+		significant_digits++;
+	      exp10--;
+	    }
+	  else
+	    truncated = true;
+	}
+    }
+
+  if(!has_digits)
+    return false;
+
+  if(p < end && (*p == 'e' || *p == 'E'))
+    {
+      int exponent = 0;
+      bool negative_exponent = false;
+      p++;
+      if(p < end && (*p == '+' || *p == '-'))
+	negative_exponent = (*p++ == '-');
+      if(p == end || !is_digit(*p))
+	return false;
+      for(;p < end && is_digit(*p);p++)
+	if(exponent < 100000)
+	  exponent = exponent * 10 + (*p - '0');
+      exp10 += negative_exponent ? -exponent : exponent;
+    }
+
+  if(p != end)
+    return false;
+
+  if(!truncated && mantissa <= MAX_EXACT_MANTISSA
+     && exp10 >= -MAX_EXACT_POWER_OF_TEN && exp10 <= MAX_EXACT_POWER_OF_TEN)
+    {
+      // Both operands are exact, so a single rounding gives the
+      // correctly rounded result.
+      value = (double)mantissa;
+      if(exp10 < 0)
+	value /= exact_powers_of_ten[-exp10];
+      else
+	value *= exact_powers_of_ten[exp10];
+      if(negative)
+	value = -value;
+      return true;
+    }
+
+  std::string token(begin,end);
+  value = strtod(token.c_str(),NULL);
+  return true;
+}
+
+// Splits a file into whitespace separated tokens. The end of each
+// non-blank line is returned as the token "\n".
+class TOKEN_READER {
+public:
+  TOKEN_READER() : buf(NULL), pos(0), len(0), eof(false), in_line(false) {}
+  ~TOKEN_READER()
+  {
+    free(buf);
+  }
+
+  int open_file(const char *path)
+  {
+    if(alloc())
+      return -1;
+    return file.open_file(path);
+  }
+
+  // Reads fd from its current offset. fd is not closed.
+  int open_fd(int fd)
+  {
+    if(alloc())
+      return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+    return file.open_fd(fd);
+  }
+
+  // Returns 1 if a token was read, 0 at the end of the file and -1 upon error.
+  int next(std::string& token)
+  {
+    token.clear();
+    while(1)
+      {
+	if(pos == len && fill())
+	  return -1;
+	if(pos == len)
+	  break;
+	char c = buf[pos];
+	if(c == ' ' || c == '\t' || c == '\r' || c == '\n')
+	  {
+	    if(!token.empty())
+	      return 1;
+	    pos++;
+	    if(c == '\n' && in_line)
+	      {
+		in_line = false;
+		token = "\n";
+		return 1;
+	      }
+	    continue;
+	  }
+	in_line = true;
+	size_t start = pos;
+	while(pos < len && !(buf[pos] == ' ' || buf[pos] == '\t' || buf[pos] == '\r' || buf[pos] == '\n'))
+	  pos++;
+	token.append(buf + start,pos - start);
+      }
+
+    if(!token.empty())
+      return 1;
+    if(in_line)
+      {
+	in_line = false;
+	token = "\n";
+	return 1;
+      }
+    return 0;
+  }
+
+private:
+  int alloc()
+  {
+    buf = (char*)malloc(NUMERIC_COMPARE_BUFFER_SIZE);
+    if(buf == NULL)
+      {
+	errno = ENOMEM;
+	return -1;
+      }
+    return 0;
+  }
+
+  int fill()
+  {
+    ssize_t nread;
+    pos = len = 0;
+    if(eof)
+      return 0;
+    nread = file.read(buf,NUMERIC_COMPARE_BUFFER_SIZE);
+    if(nread < 0)
+      return -1;
+    if(nread == 0)
+      eof = true;
+    len = nread;
+    return 0;
+  }
+
+  DECOMPRESS_READER file;
+  char *buf;
+  size_t pos, len;
+  bool eof, in_line;
+};
+
+static int tokens_equal(TOKEN_READER& reader1, TOKEN_READER& reader2, const NUMERIC_COMPARE_CONFIG& config, bool& equal)
+{
+  std::string token1, token2;
+  double value1, value2;
+  int status1, status2, column = 0;
+
+  while(1)
+    {
+      status1 = reader1.next(token1);
+      status2 = reader2.next(token2);
+      if(status1 < 0 || status2 < 0)
+	return -1;
+      if(status1 == 0 || status2 == 0)
+	{
+	  equal = (status1 == status2);
+	  return 0;
+	}
+
+      if(token1 == "\n" || token2 == "\n")
+	{
+	  if(token1 != token2)
+	    return 0;
+	  column = 0;
+	  continue;
+	}
+
+      if(parse_number(token1.data(),token1.data() + token1.size(),value1)
+	 && parse_number(token2.data(),token2.data() + token2.size(),value2))
+	{
+	  if(!config.tolerance(column).agree(value1,value2))
+	    return 0;
+	}
+      else if(token1 != token2)
+	return 0;
+      column++;
+    }
+}
+
+int numeric_files_equal(const char *path1, const char *path2, const NUMERIC_COMPARE_CONFIG& config, bool& equal)
+{
+  TOKEN_READER reader1, reader2;
+
+  equal = false;
+  if(path1 == NULL || path2 == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if(reader1.open_file(path1) || reader2.open_file(path2))
+    return -1;
+  return tokens_equal(reader1,reader2,config,equal);
+}
+
+int numeric_fds_equal(int fd1, int fd2, const NUMERIC_COMPARE_CONFIG& config, bool& equal)
+{
+  TOKEN_READER reader1, reader2;
+
+  equal = false;
+  if(reader1.open_fd(fd1) || reader2.open_fd(fd2))
+    return -1;
+  return tokens_equal(reader1,reader2,config,equal);
+}
@@ -0,0 +1,67 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef NUMERIC_COMPARE_H
+#define NUMERIC_COMPARE_H
+
+#include <map>
+
+/**
+ * Two numbers a and b agree if |a - b| <= abs_tol or
+ * |a - b| <= rel_tol * max(|a|,|b|). Zero for both means exact equality.
+ */
+struct NUMERIC_TOLERANCE {
+  double abs_tol;
+  double rel_tol;
+
+  NUMERIC_TOLERANCE() : abs_tol(0), rel_tol(0) {}
+  NUMERIC_TOLERANCE(double a, double r) : abs_tol(a), rel_tol(r) {}
+  bool agree(double a, double b) const;
+};
+
+/**
+ * Tolerances used by numeric_files_equal. Columns are the zero based
+ * index of a whitespace separated token within its line, i.e. the
+ * index into line.split() in Python. Columns without an entry use
+ * default_tolerance.
+ */
+struct NUMERIC_COMPARE_CONFIG {
+  NUMERIC_TOLERANCE default_tolerance;
+  std::map<int, NUMERIC_TOLERANCE> columns;
+
+  const NUMERIC_TOLERANCE& tolerance(int column) const;
+};
+
+/**
+ * Parses the whole of the token [begin, end) as a floating point number.
+ * Decimal numbers that fit in a double exactly are converted without
+ * calling strtod; anything else is handed to strtod.
+ *
+ * Returns true if the token is a number.
+ */
+bool parse_number(const char *begin, const char *end, double& value);
+
+/**
+ * Compares two whitespace separated text files token by token, reading
+ * both in lockstep. Tokens that are numbers in both files must agree
+ * within the tolerance of their column. All other tokens, and the line
+ * structure of the files, must match exactly. gzip or zstd compressed
+ * files are decompressed as they are read.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int numeric_files_equal(const char *path1, const char *path2, const NUMERIC_COMPARE_CONFIG& config, bool& equal);
+
+/**
+ * As numeric_files_equal, for two open descriptors, which are read from
+ * their current offsets and are not closed.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case errno is set.
+ */
+int numeric_fds_equal(int fd1, int fd2, const NUMERIC_COMPARE_CONFIG& config, bool& equal);
+
+#endif
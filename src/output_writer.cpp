@@ -0,0 +1,266 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Aggregates result output into destination files for clean up hooks.
+// Output is copied from file to file in the kernel where possible, so
+// that it is never held in memory, and destinations are kept open and
+// synced in groups instead of being opened, appended and closed for
+// every result. This code does not depend on BOINC and is used by the
+// boinctools Python extension.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "output_writer.h"
+
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define OUTPUT_WRITER_BUFFER_SIZE (1 << 20)
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int pwrite_fully(int fd, const char *buf, size_t count, off_t offset)
+{
+  ssize_t nwritten;
+  while(count > 0)
+    {
+      nwritten = pwrite(fd,buf,count,offset);
+      if(nwritten < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      buf += nwritten;
+      count -= nwritten;
+      offset += nwritten;
+    }
+  return 0;
+}
+
+// Copies all of in to out at offset. Returns 0 upon success and -1
+// otherwise.
+static int copy_to(int in, int out, off_t offset)
+{
+#ifdef SYS_copy_file_range
+  loff_t in_offset = 0, out_offset = offset;
+  ssize_t ncopied;
+  while(1)
+    {
+      ncopied = syscall(SYS_copy_file_range,in,&in_offset,out,&out_offset,(size_t)OUTPUT_WRITER_BUFFER_SIZE * 64,0);
+      if(ncopied > 0)
+	continue;
+      if(ncopied == 0)
+	return 0;
+      if(errno == EINTR)
+	continue;
+      if(in_offset == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+	break;// not supported for these files; copy in user space
+      return -1;
+    }
+#endif
+
+  std::vector<char> buffer(OUTPUT_WRITER_BUFFER_SIZE);
+  off_t in_pos = 0;
+  ssize_t nread;
+  while(1)
+    {
+      nread = pread(in,&buffer[0],buffer.size(),in_pos);
+      if(nread < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if(nread == 0)
+	return 0;
+      if(pwrite_fully(out,&buffer[0],nread,offset))
+	return -1;
+      in_pos += nread;
+      offset += nread;
+    }
+}
+
+OUTPUT_WRITER::OUTPUT_WRITER() : sync_interval(1.0), last_sync(now())
+{
+}
+
+OUTPUT_WRITER::~OUTPUT_WRITER()
+{
+  close();
+}
+
+// Returns the descriptor of path, reopening it if another process has
+// replaced or removed the file since it was opened.
+int OUTPUT_WRITER::open_destination(const std::string& path, mode_t mode, bool& created)
+{
+  std::map<std::string, DESTINATION>::iterator it = destinations.find(path);
+  struct stat st;
+  DESTINATION destination;
+
+  created = false;
+  if(it != destinations.end())
+    {
+      if(stat(path.c_str(),&st) == 0 && st.st_dev == it->second.device && st.st_ino == it->second.inode)
+	return it->second.fd;
+      if(it->second.dirty)
+	fdatasync(it->second.fd);
+      ::close(it->second.fd);
+      destinations.erase(it);
+    }
+
+  if(destinations.size() >= OUTPUT_WRITER_MAX_OPEN)
+    close();
+
+  destination.fd = open(path.c_str(),O_WRONLY | O_CREAT | O_EXCL,mode);
+  if(destination.fd >= 0)
+    {
+      created = true;
+      fchmod(destination.fd,mode);// not limited by the umask
+    }
+  else if(errno == EEXIST)
+    destination.fd = open(path.c_str(),O_WRONLY);
+  if(destination.fd < 0)
+    return -1;
+  if(fstat(destination.fd,&st))
+    {
+      ::close(destination.fd);
+      return -1;
+    }
+  destination.device = st.st_dev;
+  destination.inode = st.st_ino;
+  destination.dirty = false;
+  destinations[path] = destination;
+  stats.opens++;
+  return destination.fd;
+}
+
+int OUTPUT_WRITER::append(const char *source, const char *destination, const std::string& separator, mode_t mode)
+{
+  int in, out, retval = 0, saved_errno;
+  off_t start, offset;
+  bool created;
+
+  if(source == NULL || destination == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  in = open(source,O_RDONLY);
+  if(in < 0)
+    return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(in,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+  out = open_destination(destination,mode,created);
+  if(out < 0)
+    {
+      saved_errno = errno;
+      ::close(in);
+      errno = saved_errno;
+      return -1;
+    }
+
+  if(flock(out,LOCK_EX))
+    {
+      saved_errno = errno;
+      ::close(in);
+      errno = saved_errno;
+      return -1;
+    }
+  start = offset = lseek(out,0,SEEK_END);
+  if(start < 0)
+    retval = -1;
+  if(retval == 0 && !created && !separator.empty())
+    {
+      retval = pwrite_fully(out,separator.data(),separator.size(),offset);
+      offset += separator.size();
+    }
+  if(retval == 0)
+    retval = copy_to(in,out,offset);
+  saved_errno = errno;
+  if(retval == 0)
+    {
+      off_t end = lseek(out,0,SEEK_END);
+      stats.appends++;
+      stats.bytes += (end > start) ? end - start : 0;
+      destinations[destination].dirty = true;
+    }
+  else if(start >= 0 && ftruncate(out,start)) {}
+  flock(out,LOCK_UN);
+  ::close(in);
+  if(retval && created)
+    {
+      // Leave no trace of a failed first append, so that a retry
+      // does not write a separator.
+      unlink(destination);
+      ::close(out);
+      destinations.erase(destination);
+    }
+
+  if(retval)
+    {
+      errno = saved_errno;
+      return -1;
+    }
+  if(sync_interval >= 0 && now() - last_sync >= sync_interval)
+    return sync();
+  return 0;
+}
+
+int OUTPUT_WRITER::sync()
+{
+  int retval = 0, saved_errno = 0;
+  bool synced = false;
+
+  for(std::map<std::string, DESTINATION>::iterator it = destinations.begin();it != destinations.end();it++)
+    {
+      if(!it->second.dirty)
+	continue;
+      if(fdatasync(it->second.fd))
+	{
+	  saved_errno = errno;
+	  retval = -1;
+	  continue;
+	}
+      it->second.dirty = false;
+      stats.files_synced++;
+      synced = true;
+    }
+  if(synced)
+    stats.syncs++;
+  last_sync = now();
+  errno = saved_errno;
+  return retval;
+}
+
+int OUTPUT_WRITER::close()
+{
+  int retval = sync();
+  for(std::map<std::string, DESTINATION>::iterator it = destinations.begin();it != destinations.end();it++)
+    ::close(it->second.fd);
+  destinations.clear();
+  return retval;
+}
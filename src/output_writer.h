@@ -0,0 +1,91 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <map>
+#include <string>
+#include <sys/types.h>
+
+#define OUTPUT_WRITER_MAX_OPEN 256
+
+struct OUTPUT_WRITER_STATS {
+  long appends;
+  long long bytes;
+  long syncs;// group syncs
+  long files_synced;
+  long opens;
+
+  OUTPUT_WRITER_STATS() : appends(0), bytes(0), syncs(0), files_synced(0), opens(0) {}
+};
+
+/**
+ * Appends result output files to aggregate destination files.
+ *
+ * Destinations stay open between appends, and are synced to disk as a
+ * group once sync_interval seconds have passed since the last sync,
+ * rather than after every append. Each append holds an flock on the
+ * destination, so that writers in other processes do not interleave.
+ * A destination that is renamed or removed by another process is
+ * reopened on the next append.
+ */
+class OUTPUT_WRITER {
+public:
+  OUTPUT_WRITER();
+  ~OUTPUT_WRITER();
+
+  /**
+   * Seconds between group syncs. 0 syncs after every append and a
+   * negative value only syncs when sync() or close() is called.
+   */
+  void set_sync_interval(double seconds) { sync_interval = seconds; }
+  double get_sync_interval() const { return sync_interval; }
+
+  /**
+   * Streams the contents of source onto the end of destination. If
+   * destination does not exist, it is created with the given mode.
+   * Otherwise separator is written before the contents.
+   *
+   * If the append fails, the destination is truncated to its previous
+   * length.
+   *
+   * Returns 0 upon success and -1 otherwise, in which case errno is set.
+   */
+  int append(const char *source, const char *destination, const std::string& separator, mode_t mode);
+
+  /**
+   * Syncs all destinations written since the last sync.
+   *
+   * Returns 0 upon success and -1 otherwise, in which case errno is set.
+   */
+  int sync();
+
+  /**
+   * Syncs and closes all destinations.
+   */
+  int close();
+
+  const OUTPUT_WRITER_STATS& get_stats() const { return stats; }
+
+private:
+  struct DESTINATION {
+    int fd;
+    dev_t device;
+    ino_t inode;
+    bool dirty;
+  };
+
+  int open_destination(const std::string& path, mode_t mode, bool& created);
+
+  std::map<std::string, DESTINATION> destinations;
+  double sync_interval;
+  double last_sync;
+  OUTPUT_WRITER_STATS stats;
+};
+
+#endif
@@ -0,0 +1,229 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Background read ahead of result output files. The validator queues the
+// output files of the next few workunits it will handle, and a single
+// thread opens each one and asks the kernel to read it into the page
+// cache. When init_result later opens the file, it is read from memory
+// instead of paying the NFS latency on the critical path.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "prefetch.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+READAHEAD output_readahead;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+READAHEAD::READAHEAD() : running(false), stopping(false), max_bytes(0), bytes_in_flight(0)
+{
+  pthread_mutex_init(&lock,NULL);
+  pthread_cond_init(&work_ready,NULL);
+  pthread_cond_init(&budget_freed,NULL);
+}
+
+READAHEAD::~READAHEAD()
+{
+  stop();
+  pthread_cond_destroy(&budget_freed);
+  pthread_cond_destroy(&work_ready);
+  pthread_mutex_destroy(&lock);
+}
+
+int READAHEAD::start(size_t max_bytes_in_flight)
+{
+  if(running)
+    return 0;
+  max_bytes = max_bytes_in_flight;
+  stopping = false;
+  if(pthread_create(&thread,NULL,thread_main,this))
+    return -1;
+  running = true;
+  return 0;
+}
+
+void READAHEAD::stop()
+{
+  if(!running)
+    return;
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_broadcast(&work_ready);
+  pthread_cond_broadcast(&budget_freed);
+  pthread_mutex_unlock(&lock);
+  pthread_join(thread,NULL);
+  running = false;
+  clear();
+}
+
+void READAHEAD::prefetch(const std::vector<std::string>& paths)
+{
+  if(!running)
+    return;
+  pthread_mutex_lock(&lock);
+  for(std::vector<std::string>::const_iterator path = paths.begin();path != paths.end();path++)
+    {
+      if(entries.find(*path) != entries.end())
+	continue;
+      entries[*path] = ENTRY();
+      queue.push_back(*path);
+      stats.queued++;
+    }
+  pthread_cond_signal(&work_ready);
+  pthread_mutex_unlock(&lock);
+}
+
+void READAHEAD::claim(const std::string& path)
+{
+  std::map<std::string, ENTRY>::iterator it;
+
+  if(!running)
+    return;
+  pthread_mutex_lock(&lock);
+  it = entries.find(path);
+  if(it == entries.end())
+    stats.misses++;
+  else if(it->second.state != DONE)
+    {
+      // Still queued or being read. Leave it for the thread to finish,
+      // which will not count its bytes once the entry is gone.
+      stats.late++;
+      entries.erase(it);
+    }
+  else
+    {
+      stats.hits++;
+      stats.stall_saved += it->second.duration;
+      bytes_in_flight -= it->second.bytes;
+      entries.erase(it);
+      pthread_cond_signal(&budget_freed);
+    }
+  pthread_mutex_unlock(&lock);
+}
+
+void READAHEAD::clear()
+{
+  pthread_mutex_lock(&lock);
+  queue.clear();
+  entries.clear();
+  bytes_in_flight = 0;
+  pthread_cond_broadcast(&budget_freed);
+  pthread_mutex_unlock(&lock);
+}
+
+READAHEAD_STATS READAHEAD::get_stats()
+{
+  READAHEAD_STATS retval;
+  pthread_mutex_lock(&lock);
+  retval = stats;
+  pthread_mutex_unlock(&lock);
+  return retval;
+}
+
+void* READAHEAD::thread_main(void *arg)
+{
+  ((READAHEAD*)arg)->run();
+  return NULL;
+}
+
+void READAHEAD::run()
+{
+  std::string path;
+  struct stat st;
+  size_t bytes;
+  double start_time, duration;
+  int fd;
+
+  pthread_mutex_lock(&lock);
+  while(!stopping)
+    {
+      if(queue.empty())
+	{
+	  pthread_cond_wait(&work_ready,&lock);
+	  continue;
+	}
+      path = queue.front();
+      queue.pop_front();
+      if(entries.find(path) == entries.end())
+	continue;// claimed or cleared before we got to it
+      entries[path].state = READING;
+      pthread_mutex_unlock(&lock);
+
+      start_time = now();
+      bytes = 0;
+      fd = open(path.c_str(),O_RDONLY);
+      if(fd >= 0)
+	{
+	  if(fstat(fd,&st) == 0)
+	    bytes = st.st_size;
+	}
+
+      // Wait for room in the budget. A file larger than the whole budget
+      // is only read ahead up to the budget.
+      pthread_mutex_lock(&lock);
+      if(bytes > max_bytes)
+	bytes = max_bytes;
+      while(!stopping && bytes_in_flight > 0 && bytes_in_flight + bytes > max_bytes)
+	pthread_cond_wait(&budget_freed,&lock);
+      bool wanted = !stopping && entries.find(path) != entries.end();
+      if(wanted)
+	bytes_in_flight += bytes;
+      pthread_mutex_unlock(&lock);
+
+      if(fd >= 0 && wanted && bytes > 0)
+	{
+#ifdef __linux__
+	  // readahead blocks until the data is in the page cache, which
+	  // is what lets us measure the stall that was taken off the
+	  // validator's critical path.
+	  if(readahead(fd,0,bytes))
+	    posix_fadvise(fd,0,bytes,POSIX_FADV_WILLNEED);
+#else
+	  posix_fadvise(fd,0,bytes,POSIX_FADV_WILLNEED);
+#endif
+	}
+      if(fd >= 0)
+	close(fd);
+      duration = now() - start_time;
+
+      pthread_mutex_lock(&lock);
+      if(wanted)
+	{
+	  std::map<std::string, ENTRY>::iterator it = entries.find(path);
+	  if(it == entries.end())
+	    {
+	      // Claimed while we were reading it
+	      bytes_in_flight -= (bytes_in_flight >= bytes) ? bytes : bytes_in_flight;
+	      pthread_cond_signal(&budget_freed);
+	    }
+	  else
+	    {
+	      it->second.state = DONE;
+	      it->second.bytes = bytes;
+	      it->second.duration = duration;
+	    }
+	  stats.prefetched++;
+	  stats.bytes += bytes;
+	}
+    }
+  pthread_mutex_unlock(&lock);
+}
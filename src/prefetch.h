@@ -0,0 +1,94 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+struct READAHEAD_STATS {
+  long queued;// files handed to prefetch()
+  long prefetched;// files read ahead by the background thread
+  long hits;// claimed after their read ahead finished
+  long late;// claimed while still queued or being read
+  long misses;// claimed without having been queued
+  long long bytes;// bytes read ahead
+  double stall_saved;// seconds spent reading ahead files that were later hits
+
+  READAHEAD_STATS() : queued(0), prefetched(0), hits(0), late(0), misses(0), bytes(0), stall_saved(0) {}
+};
+
+/**
+ * Reads output files into the page cache on a background thread, ahead
+ * of the validator opening them. The number of bytes that have been read
+ * ahead but not yet claimed is capped, so that prefetching cannot evict
+ * files before they are used.
+ */
+class READAHEAD {
+public:
+  READAHEAD();
+  ~READAHEAD();
+
+  /**
+   * Starts the background thread.
+   *
+   * Returns 0 upon success and -1 otherwise.
+   */
+  int start(size_t max_bytes_in_flight);
+  void stop();
+  bool is_running() const { return running; }
+
+  /**
+   * Queues files to be read ahead. Does nothing if not running.
+   */
+  void prefetch(const std::vector<std::string>& paths);
+
+  /**
+   * Called just before a file is read. Updates the hit counts and
+   * releases the file's share of the in flight budget.
+   */
+  void claim(const std::string& path);
+
+  /**
+   * Forgets all queued and unclaimed files, e.g. at the end of a pass.
+   */
+  void clear();
+
+  READAHEAD_STATS get_stats();
+
+private:
+  enum STATE { QUEUED, READING, DONE };
+  struct ENTRY {
+    STATE state;
+    size_t bytes;
+    double duration;
+    ENTRY() : state(QUEUED), bytes(0), duration(0) {}
+  };
+
+  static void* thread_main(void *arg);
+  void run();
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;// queue not empty, or stopping
+  pthread_cond_t budget_freed;
+  bool running, stopping;
+  size_t max_bytes, bytes_in_flight;
+  std::deque<std::string> queue;
+  std::map<std::string, ENTRY> entries;
+  READAHEAD_STATS stats;
+};
+
+// Read ahead of output files used by the validator. Started by the
+// --prefetch option; when it is not running, claim() does nothing.
+extern READAHEAD output_readahead;
+
+#endif
@@ -11,19 +11,149 @@
 // in the project init file that maps the appid, as a String, to the function
 // to be called, with the Result as an argument.
 //
+// If the assimilator is run with --handoff_queue PATH, each workunit is
+// appended to a persistent queue instead, and assimilate_handler returns
+// at once. The Python assimilators are then run by workers started with
+// boinctools.drain_handoff_queue(PATH).
+//
+// If the Python assimilator fails, the workunit is left for a later
+// pass. After max_python_failures failures, it is quarantined and its
+// assimilation is deferred.
+//
 
 #include "validate_util.h"
 #include "pyboinc.h"
+#include "handoff_queue.h"
+#include "assimilate_handler.h"
 
 #include "boinc/boinc_db_types.h"
+#include "boinc/error_numbers.h"
 
 #include <Python.h>
 #include <vector>
+#include <sstream>
+#include <ctime>
+
+#define HANDOFF_LOG_INTERVAL 60// seconds between queue statistics
+
+char *handoff_queue_path = NULL;
+static HANDOFF_QUEUE handoff_queue;
+static time_t handoff_last_log = 0;
+
+// Adds a line of the text field name, with backslashes, tabs and line
+// breaks escaped as in Python string literals.
+static void add_handoff_text(std::ostringstream& record, const char *name, const char *text)
+{
+  record << "text\t" << name << '\t';
+  for(;*text != 0;text++)
+    switch(*text)
+      {
+      case '\\': record << "\\\\"; break;
+      case '\t': record << "\\t"; break;
+      case '\n': record << "\\n"; break;
+      case '\r': record << "\\r"; break;
+      default: record << *text; break;
+      }
+  record << '\n';
+}
+
+// Adds a tab separated line for the result, followed by a line of the
+// other fields that BoincResult has, as name=value pairs, a line for
+// each of its text fields and a line for each of its output files. tag
+// is "result" or "canonical".
+static void add_handoff_result(std::ostringstream& record, const char *tag, RESULT& result)
+{
+  std::vector<std::string> paths;
+  std::string logical_name;
+
+  record << tag << '\t' << result.id << '\t' << result.name << '\t' << result.appid << '\t'
+	 << result.exit_status << '\t' << result.validate_state << '\t' << result.cpu_time << '\n';
+  record << "fields"
+	 << "\tworkunitid=" << result.workunitid << "\thostid=" << result.hostid
+	 << "\tuserid=" << result.userid << "\tteamid=" << result.teamid << "\tbatch=" << result.batch
+	 << "\tserver_state=" << result.server_state << "\toutcome=" << result.outcome
+	 << "\tclient_state=" << result.client_state << "\tfile_delete_state=" << result.file_delete_state
+	 << "\tcreate_time=" << result.create_time << "\tsent_time=" << result.sent_time
+	 << "\treceived_time=" << result.received_time << "\treport_deadline=" << result.report_deadline
+	 << "\tapp_version_id=" << result.app_version_id << "\tapp_version_num=" << result.app_version_num
+	 << "\tpriority=" << result.priority << "\tsize_class=" << result.size_class
+	 << "\trandom=" << result.random << "\truntime_outlier=" << (result.runtime_outlier ? 1 : 0)
+	 << "\telapsed_time=" << result.elapsed_time << "\tflops_estimate=" << result.flops_estimate
+	 << "\tclaimed_credit=" << result.claimed_credit << "\tgranted_credit=" << result.granted_credit
+	 << "\topaque=" << result.opaque << "\tpeak_working_set_size=" << result.peak_working_set_size
+	 << "\tpeak_swap_size=" << result.peak_swap_size << "\tpeak_disk_usage=" << result.peak_disk_usage << '\n';
+  add_handoff_text(record,"stderr_out",result.stderr_out);
+  add_handoff_text(record,"xml_doc_out",result.xml_doc_out);
+  add_handoff_text(record,"xml_doc_in",result.xml_doc_in);
+  if(result.id == 0 || get_output_file_paths(result,paths))
+    return;
+  for(std::vector<std::string>::iterator path = paths.begin();path != paths.end();path++)
+    {
+      logical_name.clear();
+      get_logical_name(result,*path,logical_name);
+      record << "file\t" << *path << '\t' << logical_name << '\n';
+    }
+}
+
+// Appends the workunit to the handoff queue. The record is parsed by
+// boinctools.parse_handoff_record. If it cannot be appended and synced,
+// an error is returned, so that do_pass leaves the workunit for the next
+// pass instead of marking it assimilated.
+static int enqueue_workunit(WORKUNIT& wu, std::vector<RESULT>& results, RESULT& canonical_result)
+{
+  std::ostringstream record;
+  HANDOFF_QUEUE_STATS stats;
+
+  if(!handoff_queue.is_open() && handoff_queue.open(handoff_queue_path,true))
+    {
+      fprintf(stderr,"Could not open handoff queue %s: %s\n",handoff_queue_path,strerror(errno));
+      return ERR_FOPEN;
+    }
+
+  record.precision(17);
+  record << "wu\t" << wu.id << '\t' << wu.name << '\n';
+  for(std::vector<RESULT>::iterator result = results.begin();result != results.end();result++)
+    add_handoff_result(record,"result",*result);
+  add_handoff_result(record,"canonical",canonical_result);
+
+  if(handoff_queue.append(record.str()))
+    {
+      fprintf(stderr,"Could not append %s to handoff queue %s: %s\n",wu.name,handoff_queue_path,strerror(errno));
+      return ERR_WRITE;
+    }
+
+  if(time(0) - handoff_last_log >= HANDOFF_LOG_INTERVAL && handoff_queue.get_stats(stats) == 0)
+    {
+      printf("Handoff queue %s: depth %ld (%ld claimed), oldest %.0f s, drain rate %.2f/s, %lld dead\n",
+	     handoff_queue_path,stats.depth,stats.claimed,stats.oldest_age,stats.drain_rate,stats.dead);
+      handoff_last_log = time(0);
+    }
+  return 0;
+}
+
+// Called when the Python assimilator fails for wu.
+static int python_assimilate_error(WORKUNIT& wu)
+{
+  if(PyErr_Occurred())
+    PyErr_Print();
+  if(record_python_failure(wu.id,wu.name))
+    return DEFER_ASSIMILATION;
+  return -1;
+}
 
 int assimilate_handler(WORKUNIT& wu, std::vector<RESULT>& results, RESULT& canonical_result)
 {
   PyObject *retval;
 
+  if(handoff_queue_path != NULL)
+    return enqueue_workunit(wu,results,canonical_result);
+
+  if(is_quarantined(wu.id))
+    {
+      fprintf(stderr,"Workunit %d (%s) is quarantined. Deferring assimilation.\n",wu.id,wu.name);
+      return DEFER_ASSIMILATION;
+    }
+
   initialize_python();
 #if 0// OLD
   retval = py_user_code_on_workunit(results, &canonical_result, "assimilators");
@@ -43,53 +173,61 @@ int assimilate_handler(WORKUNIT& wu, std::vector<RESULT>& results, RESULT& canon
       return 1;
     }
 #else // New
-    std::string command;
-  
-  if(PyRun_SimpleString("import boinctools;results = []"))
+  PyObject *module, *py_results, *py_canonical = NULL, *py_retval = NULL;
+
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
     {
       fprintf(stderr,"Could not import boinctools python module.\n");
-      if(PyErr_Occurred())
-	PyErr_Print();
-      finalize_python();
-      exit(1);
+      return python_assimilate_error(wu);
     }
   
-  // Create Result Class
-  command = "canonical = " + result_init_string(canonical_result);
-  if(PyRun_SimpleString(command.c_str()))
+  // Create Result Objects. They read the RESULTs only when user code
+  // asks for their output files or text fields.
+  py_results = PyList_New(results.size());
+  if(py_results == NULL)
     {
-      fprintf(stderr,"Could not create result object.\n");
-      fprintf(stderr,"Python command: %s",command.c_str());
-      if(PyErr_Occurred())
-	PyErr_Print();
-      finalize_python();
-      exit(1);
+      Py_DECREF(module);
+      return python_assimilate_error(wu);
     }
-
-  for(std::vector<RESULT>::const_iterator result = results.begin();result != results.end();result++)
+  for(size_t i = 0;i < results.size();i++)
     {
-      command = "results.append(" + result_init_string(*result) + ")";
-      if(PyRun_SimpleString(command.c_str()))
+      PyObject *py_result = new_boinc_result(results[i],NULL);
+      if(py_result == NULL)
 	{
-	  fprintf(stderr,"Could not add result object to assimilation result list.\n");
-	  fprintf(stderr,"Python command: %s",command.c_str());
-	  if(PyErr_Occurred())
-	    PyErr_Print();
-	  finalize_python();
-	  exit(1);
+	  fprintf(stderr,"Could not create result object for %s.\n",results[i].name);
+	  goto release;
 	}
+      PyList_SET_ITEM(py_results,i,py_result);// steals the reference
     }
-  
-  command = "boinctools.assimilator(results,canonical)";
-  if(PyRun_SimpleString(command.c_str()))
+  py_canonical = new_boinc_result(canonical_result,NULL);
+  if(py_canonical == NULL)
     {
-      fprintf(stderr,"Could not assimilate result objects.\n");
-      fprintf(stderr,"Python command: %s",command.c_str());
-      if(PyErr_Occurred())
-	PyErr_Print();
-      finalize_python();
-      exit(1);
+      fprintf(stderr,"Could not create result object for %s.\n",canonical_result.name);
+      goto release;
+    }
+
+  py_retval = PyObject_CallMethod(module,(char*)"assimilator",(char*)"(OO)",py_results,py_canonical);
+  if(py_retval == NULL)
+    fprintf(stderr,"Could not assimilate result objects.\n");
+
+ release:
+  // User code may have kept some of the objects, which must then stop
+  // reading the RESULTs.
+  for(Py_ssize_t i = 0;i < PyList_GET_SIZE(py_results);i++)
+    {
+      PyObject *py_result = PyList_GET_ITEM(py_results,i);
+      if(py_result != NULL && (Py_REFCNT(py_result) > 1 || Py_REFCNT(py_results) > 1))
+	detach_boinc_result(py_result);
     }
+  Py_DECREF(py_results);
+  if(py_canonical != NULL)
+    release_boinc_result(py_canonical);
+  Py_DECREF(module);
+  if(py_retval == NULL)
+    return python_assimilate_error(wu);
+  Py_DECREF(py_retval);
+  clear_python_failures(wu.id);
   
 #endif
   return 0;
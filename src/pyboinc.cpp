@@ -24,18 +24,30 @@
 
 #include <Python.h>
 #include <sstream>
+#include <cstring>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
 #include "pyboinc.h"
+#include "artifact_cache.h"
+#include "xml_fields.h"
 
 #include "boinc/validate_util.h"
 #include "boinc/boinc_db_types.h"
+#include "boinc/md5.h"
 
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <structmember.h>
 #include <stdarg.h>
 
@@ -54,30 +66,378 @@
 #endif
 #define DEBUGPRINT2(...)       fprintf(stderr, __VA_ARGS__)
 #define ERRORPRINT(_fmt, ...) DEBUGPRINT2(WHERESTR _fmt, WHEREARG, __VA_ARGS__)
+// Deallocated BoincResults are kept for reuse, as Python does for
+// floats and tuples, along with their output_files lists. An object is
+// only put here once its reference count has dropped to zero, so that
+// no user code can see it again.
+static BoincResult *free_results[BOINCRESULT_FREE_MAX];
+static int num_free_results = 0;
+static BOINCRESULT_POOL_STATS pool_stats;
+
 static void BoincResult_dealloc(BoincResult *self)
 {
   if(self == NULL)
     return;
 
-  printf("Dealloc'ed \n");
-  printf("Name(%s) ref count: %d\n",PyBytes_AsString(self->name),(int)self->name->ob_refcnt);
-  Py_XDECREF(self->name);
-  printf("Output file list ref count: %d\n",(int)self->output_files->ob_refcnt);
+  Py_CLEAR(self->name);
+  Py_CLEAR(self->dict);
+  Py_CLEAR(self->stderr_out);
+  Py_CLEAR(self->xml_doc_out);
+  Py_CLEAR(self->xml_doc_in);
+  for(int i = 0;i < 3;i++)
+    Py_CLEAR(self->xml_fields[i]);
+  // Only a list that nothing else refers to may be refilled.
+  if(self->output_files != NULL && (!PyList_CheckExact(self->output_files) || Py_REFCNT(self->output_files) > 1))
+    Py_CLEAR(self->output_files);
+  // The type may not be subclassed, so every object fits every slot.
+  if(num_free_results < BOINCRESULT_FREE_MAX)
+    {
+      if(self->output_files != NULL && PyList_SetSlice(self->output_files,0,PyList_GET_SIZE(self->output_files),NULL))
+	{
+	  PyErr_Clear();
+	  Py_CLEAR(self->output_files);
+	}
+      free_results[num_free_results++] = self;
+      return;
+    }
   Py_XDECREF(self->output_files);
-  //self->ob_type->tp_free((PyObject*)self);
   Py_TYPE(self)->tp_free((PyObject*)self);
-  
-  
+}
+
+static void clear_free_results()
+{
+  while(num_free_results > 0)
+    {
+      BoincResult *self = free_results[--num_free_results];
+      Py_XDECREF(self->output_files);
+      Py_TYPE(self)->tp_free((PyObject*)self);
+    }
+}
+
+static PyObject* BoincResult_str(BoincResult *self)
+{
+  PyObject *format, *args, *str;
+
+  format = PyBytes_FromString("Name: %s\nID: %s\nApp ID: %s\nExit Status: %s\nValidate State: %s\nCPU Time: %s");
+  if(format == NULL)
+    return NULL;
+  args = Py_BuildValue("(Oiiiid)",self->name ? self->name : Py_None,self->id,self->appid,self->exit_status,self->validate_state,self->cpu_time);
+  if(args == NULL)
+    {
+      Py_DECREF(format);
+      return NULL;
+    }
+  str = PyBytes_Format(format,args);
+  Py_DECREF(format);
+  Py_DECREF(args);
+  return str;
+}
+
+static int load_output_files(BoincResult *self);
+
+// Same as boinctools.BoincResult.add_output_file
+static PyObject* BoincResult_add_output_file(BoincResult *self, PyObject *args)
+{
+  PyObject *path, *logical_name, *file_tuple;
+
+  if(!PyArg_ParseTuple(args,"OO",&path,&logical_name))
+    return NULL;
+  if(load_output_files(self))
+    return NULL;
+  if(self->output_files == NULL)
+    {
+      PyErr_SetString(PyExc_AttributeError,"output_files");
+      return NULL;
+    }
+  file_tuple = PyTuple_Pack(2,path,logical_name);
+  if(file_tuple == NULL)
+    return NULL;
+  if(PyList_Append(self->output_files,file_tuple))
+    {
+      Py_DECREF(file_tuple);
+      return NULL;
+    }
+  Py_DECREF(file_tuple);
+  Py_RETURN_NONE;
 }
 
 static PyMemberDef pyboinc_RESULT_members[] = {
   {"name", T_OBJECT_EX, offsetof(BoincResult,name)},
-  {"output_files", T_OBJECT_EX, offsetof(BoincResult,output_files)},
   {"id", T_INT, offsetof(BoincResult,id)},
   {"appid", T_INT, offsetof(BoincResult,appid)},
   {"exit_status", T_INT, offsetof(BoincResult,exit_status)},
   {"validate_state", T_INT, offsetof(BoincResult,validate_state)},
   {"cpu_time", T_DOUBLE, offsetof(BoincResult,cpu_time)},
+  {"workunitid", T_INT, offsetof(BoincResult,workunitid), READONLY},
+  {"hostid", T_INT, offsetof(BoincResult,hostid), READONLY},
+  {"userid", T_INT, offsetof(BoincResult,userid), READONLY},
+  {"teamid", T_INT, offsetof(BoincResult,teamid), READONLY},
+  {"batch", T_INT, offsetof(BoincResult,batch), READONLY},
+  {"server_state", T_INT, offsetof(BoincResult,server_state), READONLY},
+  {"outcome", T_INT, offsetof(BoincResult,outcome), READONLY},
+  {"client_state", T_INT, offsetof(BoincResult,client_state), READONLY},
+  {"file_delete_state", T_INT, offsetof(BoincResult,file_delete_state), READONLY},
+  {"create_time", T_INT, offsetof(BoincResult,create_time), READONLY},
+  {"sent_time", T_INT, offsetof(BoincResult,sent_time), READONLY},
+  {"received_time", T_INT, offsetof(BoincResult,received_time), READONLY},
+  {"report_deadline", T_INT, offsetof(BoincResult,report_deadline), READONLY},
+  {"app_version_id", T_INT, offsetof(BoincResult,app_version_id), READONLY},
+  {"app_version_num", T_INT, offsetof(BoincResult,app_version_num), READONLY},
+  {"priority", T_INT, offsetof(BoincResult,priority), READONLY},
+  {"size_class", T_INT, offsetof(BoincResult,size_class), READONLY},
+  {"random", T_INT, offsetof(BoincResult,random), READONLY},
+  {"runtime_outlier", T_BOOL, offsetof(BoincResult,runtime_outlier), READONLY},
+  {"elapsed_time", T_DOUBLE, offsetof(BoincResult,elapsed_time), READONLY},
+  {"flops_estimate", T_DOUBLE, offsetof(BoincResult,flops_estimate), READONLY},
+  {"claimed_credit", T_DOUBLE, offsetof(BoincResult,claimed_credit), READONLY},
+  {"granted_credit", T_DOUBLE, offsetof(BoincResult,granted_credit), READONLY},
+  {"opaque", T_DOUBLE, offsetof(BoincResult,opaque), READONLY},
+  {"peak_working_set_size", T_DOUBLE, offsetof(BoincResult,peak_working_set_size), READONLY},
+  {"peak_swap_size", T_DOUBLE, offsetof(BoincResult,peak_swap_size), READONLY},
+  {"peak_disk_usage", T_DOUBLE, offsetof(BoincResult,peak_disk_usage), READONLY},
+  {NULL}
+};
+
+static PyObject* BoincResult_get_output_files(BoincResult *self, void *closure)
+{
+  if(load_output_files(self))
+    return NULL;
+  if(self->output_files == NULL)
+    {
+      PyErr_SetString(PyExc_AttributeError,"output_files");
+      return NULL;
+    }
+  Py_INCREF(self->output_files);
+  return self->output_files;
+}
+
+static int BoincResult_set_output_files(BoincResult *self, PyObject *value, void *closure)
+{
+  PyObject *tmp = self->output_files;
+
+  Py_XINCREF(value);
+  self->output_files = value;
+  self->output_files_loaded = 1;
+  Py_XDECREF(tmp);
+  return 0;
+}
+
+enum RESULT_TEXT {STDERR_OUT, XML_DOC_OUT, XML_DOC_IN};
+
+static PyObject** text_slot(BoincResult *self, long field)
+{
+  switch(field)
+    {
+    case STDERR_OUT: return &self->stderr_out;
+    case XML_DOC_OUT: return &self->xml_doc_out;
+    default: return &self->xml_doc_in;
+    }
+}
+
+// Makes the Python string of a text field, if it has not been made.
+// Returns 0 upon success and -1 if there was a Python error.
+static int load_text(BoincResult *self, long field)
+{
+  PyObject **slot = text_slot(self,field);
+  const char *text = "";
+
+  if(*slot != NULL)
+    return 0;
+  if(self->native != NULL)
+    {
+      switch(field)
+	{
+	case STDERR_OUT: text = self->native->stderr_out; break;
+	case XML_DOC_OUT: text = self->native->xml_doc_out; break;
+	default: text = self->native->xml_doc_in; break;
+	}
+    }
+  *slot = PyBytes_FromString(text);
+  return (*slot == NULL) ? -1 : 0;
+}
+
+static PyObject* BoincResult_get_text(BoincResult *self, void *closure)
+{
+  long field = (long)closure;
+
+  if(load_text(self,field))
+    return NULL;
+  Py_INCREF(*text_slot(self,field));
+  return *text_slot(self,field);
+}
+
+// Finds the values of the tags that are not yet in the cache of the
+// text field, with one pass over the text. The text is read from the
+// RESULT, if there is one, so that no Python string need be made.
+// Returns 0 upon success and -1 if there was a Python error.
+static int load_xml_fields(BoincResult *self, long field, PyObject *tags)
+{
+  PyObject *cache = self->xml_fields[field];
+  std::vector<std::string> missing;
+  std::vector<XML_FIELD> values;
+  const char *doc;
+  size_t length;
+
+  for(Py_ssize_t i = 0;i < PySequence_Fast_GET_SIZE(tags);i++)
+    {
+      PyObject *tag = PySequence_Fast_GET_ITEM(tags,i);
+      if(!PyBytes_Check(tag))
+	{
+	  PyErr_SetString(PyExc_TypeError,"tags must be strings");
+	  return -1;
+	}
+      if(PyDict_GetItem(cache,tag) == NULL)
+	missing.push_back(std::string(PyBytes_AS_STRING(tag),PyBytes_GET_SIZE(tag)));
+    }
+  if(missing.empty())
+    return 0;
+
+  if(self->native != NULL && *text_slot(self,field) == NULL)
+    {
+      switch(field)
+	{
+	case STDERR_OUT: doc = self->native->stderr_out; break;
+	case XML_DOC_OUT: doc = self->native->xml_doc_out; break;
+	default: doc = self->native->xml_doc_in; break;
+	}
+      length = strlen(doc);
+    }
+  else
+    {
+      if(load_text(self,field))
+	return -1;
+      doc = PyBytes_AS_STRING(*text_slot(self,field));
+      length = PyBytes_GET_SIZE(*text_slot(self,field));
+    }
+
+  find_xml_fields(doc,length,missing,values);
+  for(size_t i = 0;i < missing.size();i++)
+    {
+      PyObject *value = Py_None;
+      if(values[i].found)
+	value = PyBytes_FromStringAndSize(values[i].value.data(),values[i].value.size());
+      else
+	Py_INCREF(value);
+      if(value == NULL || PyDict_SetItemString(cache,missing[i].c_str(),value))
+	{
+	  Py_XDECREF(value);
+	  return -1;
+	}
+      Py_DECREF(value);
+    }
+  return 0;
+}
+
+static PyObject* BoincResult_xml_fields(BoincResult *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = {(char*)"tags",(char*)"source",NULL};
+  PyObject *tags, *seq, *fields;
+  const char *source = "stderr_out";
+  long field;
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"O|s",kwlist,&tags,&source))
+    return NULL;
+  if(strcmp(source,"stderr_out") == 0)
+    field = STDERR_OUT;
+  else if(strcmp(source,"xml_doc_out") == 0)
+    field = XML_DOC_OUT;
+  else if(strcmp(source,"xml_doc_in") == 0)
+    field = XML_DOC_IN;
+  else
+    {
+      PyErr_Format(PyExc_ValueError,"Unknown source: %s",source);
+      return NULL;
+    }
+  if(PyBytes_Check(tags) || PyUnicode_Check(tags))
+    {
+      PyErr_SetString(PyExc_TypeError,"tags must be a list of strings");
+      return NULL;
+    }
+  seq = PySequence_Fast(tags,"tags must be a list of strings");
+  if(seq == NULL)
+    return NULL;
+
+  if(self->xml_fields[field] == NULL && (self->xml_fields[field] = PyDict_New()) == NULL)
+    {
+      Py_DECREF(seq);
+      return NULL;
+    }
+  if(load_xml_fields(self,field,seq) || (fields = PyDict_New()) == NULL)
+    {
+      Py_DECREF(seq);
+      return NULL;
+    }
+  for(Py_ssize_t i = 0;i < PySequence_Fast_GET_SIZE(seq);i++)
+    {
+      PyObject *tag = PySequence_Fast_GET_ITEM(seq,i);
+      if(PyDict_SetItem(fields,tag,PyDict_GetItem(self->xml_fields[field],tag)))
+	{
+	  Py_DECREF(fields);
+	  fields = NULL;
+	  break;
+	}
+    }
+  Py_DECREF(seq);
+  return fields;
+}
+
+// Same as boinctools.BoincResult.artifact, read from the artifact cache
+// of this process rather than through boinctools.artifact_cache_get.
+static PyObject* BoincResult_artifact(BoincResult *self, PyObject *args)
+{
+  const char *path = NULL;
+  std::string file_name;
+  ARTIFACT_CACHE *cache;
+  ARTIFACT_INFO info;
+  int retval;
+
+  if(!PyArg_ParseTuple(args,"s",&path))
+    return NULL;
+  file_name = path;
+  file_name = file_name.substr(file_name.rfind('/') + 1);
+  cache = get_artifact_cache();
+  if(cache == NULL)
+    Py_RETURN_NONE;
+
+  retval = cache->get(self->id,file_name,info);
+  if(retval < 0)
+    return PyErr_SetFromErrno(PyExc_IOError);
+  if(retval > 0)
+    Py_RETURN_NONE;
+
+  if(info.has_contents)
+    return Py_BuildValue("{s:L,s:L,s:s#,s:s#,s:s#}",
+			 "size",info.size,"mtime",info.mtime,
+			 "digest",info.digest.data(),(int)info.digest.size(),
+			 "metadata",info.metadata.data(),(int)info.metadata.size(),
+			 "contents",info.contents.data(),(int)info.contents.size());
+  return Py_BuildValue("{s:L,s:L,s:s#,s:s#,s:O}",
+		       "size",info.size,"mtime",info.mtime,
+		       "digest",info.digest.data(),(int)info.digest.size(),
+		       "metadata",info.metadata.data(),(int)info.metadata.size(),
+		       "contents",Py_None);
+}
+
+static PyGetSetDef pyboinc_RESULT_getset[] = {
+  {(char*)"output_files", (getter)BoincResult_get_output_files, (setter)BoincResult_set_output_files, (char*)"List of (path, logical name) tuples", NULL},
+  {(char*)"stderr_out", (getter)BoincResult_get_text, NULL, NULL, (void*)STDERR_OUT},
+  {(char*)"xml_doc_out", (getter)BoincResult_get_text, NULL, NULL, (void*)XML_DOC_OUT},
+  {(char*)"xml_doc_in", (getter)BoincResult_get_text, NULL, NULL, (void*)XML_DOC_IN},
+  {NULL}
+};
+
+static PyMethodDef pyboinc_RESULT_methods[] = {
+  {"add_output_file", (PyCFunction)BoincResult_add_output_file, METH_VARARGS, "Appends a (path, logical name) tuple to output_files."},
+  {"xml_fields", (PyCFunction)BoincResult_xml_fields, METH_VARARGS | METH_KEYWORDS,
+   "xml_fields(tags, source = 'stderr_out')\n\n"
+   "Returns a dict of the value of each of the XML elements named in tags, or None\n"
+   "if it is missing, found in one pass over source, which is stderr_out, xml_doc_out\n"
+   "or xml_doc_in. Values are kept, so that each tag is looked up once per result."},
+  {"artifact", (PyCFunction)BoincResult_artifact, METH_VARARGS,
+   "artifact(path)\n\n"
+   "Returns the artifact cache entry of the output file of this result at path, or\n"
+   "named by the base name of path, as a dict with the keys size, mtime, digest,\n"
+   "metadata and contents, or None if it is not cached."},
   {NULL}
 };
 
@@ -98,7 +458,7 @@ static PyTypeObject pyboinc_RESULT = {
   0,                         /*tp_as_mapping*/
   0,                         /*tp_hash */
   0,                         /*tp_call*/
-  0,                         /*tp_str*/
+  (reprfunc)BoincResult_str,                         /*tp_str*/
   0,                         /*tp_getattro*/
   0,                         /*tp_setattro*/
   0,                         /*tp_as_buffer*/
@@ -106,38 +466,100 @@ static PyTypeObject pyboinc_RESULT = {
   "Boinc Result Object",           /* tp_doc */
 };
 
+static PyObject* BoincResult_new(PyTypeObject *type, PyObject *args, PyObject *kwrds);
+static int BoincResult_init(BoincResult *self, PyObject *args, PyObject *kwds);
+
+// Readies the type once. Returns 0 upon success and -1 otherwise.
+static int ready_boinc_result()
+{
+  if(pyboinc_RESULT.tp_flags & Py_TPFLAGS_READY)
+    return 0;
+
+  pyboinc_RESULT.tp_new = BoincResult_new;
+  pyboinc_RESULT.tp_init = (initproc)BoincResult_init;// __init__
+  pyboinc_RESULT.tp_members = pyboinc_RESULT_members;
+  pyboinc_RESULT.tp_methods = pyboinc_RESULT_methods;
+  pyboinc_RESULT.tp_getset = pyboinc_RESULT_getset;
+  pyboinc_RESULT.tp_dictoffset = offsetof(BoincResult,dict);// as with boinctools.BoincResult, user code may add attributes
+
+  if(PyType_Ready(&pyboinc_RESULT) < 0)
+    {
+      fprintf(stderr,"Could not ready pyboinc_RESULT\n");
+      return -1;
+    }
+  return 0;
+}
+
+// Returns a new BoincResult, with an empty output_files list and all
+// other members zero, taken from the free list if possible.
+static BoincResult* alloc_boinc_result()
+{
+  BoincResult *obj;
+
+  if(ready_boinc_result())
+    return NULL;
+
+  if(num_free_results > 0)
+    {
+      obj = free_results[--num_free_results];
+      _Py_NewReference((PyObject*)obj);
+      pool_stats.reused++;
+    }
+  else
+    {
+      obj = (BoincResult*)pyboinc_RESULT.tp_alloc(&pyboinc_RESULT,0);// zeroed
+      if(obj == NULL)
+	return NULL;
+      pool_stats.allocated++;
+    }
+
+  // Zero everything but the list, which may be kept from a
+  // released object.
+  PyObject *output_files = obj->output_files;
+  memset((char*)obj + sizeof(PyObject),0,sizeof(BoincResult) - sizeof(PyObject));
+  obj->output_files = output_files;
+
+  if(obj->output_files != NULL)
+    pool_stats.lists_reused++;
+  else
+    {
+      obj->output_files = PyList_New(0);
+      if(obj->output_files == NULL)
+	{
+	  printf("Could not initialize the list: output_files\n");
+	  Py_DECREF(obj);
+	  return NULL;
+	}
+      pool_stats.lists_allocated++;
+    }
+
+  return obj;
+}
+
 static PyObject* BoincResult_new(PyTypeObject *type, PyObject *args, PyObject *kwrds)
 {
   BoincResult *obj;
-  obj = (BoincResult*)type->tp_alloc(type,0);
-  if(obj == NULL)
-    return (PyObject*)obj;
 
-  obj->name = PyBytes_FromString("UNINITIALIZED");
-  if(obj->name == NULL)
+  if(type != &pyboinc_RESULT)
     {
-      printf("Could not initialize the string: name\n");
-      Py_DECREF(obj);
-      return NULL;
+      obj = (BoincResult*)type->tp_alloc(type,0);
+      if(obj != NULL)
+	obj->output_files = PyList_New(0);
     }
+  else
+    obj = alloc_boinc_result();
+  if(obj == NULL)
+    return NULL;
 
-  obj->output_files = PyList_New(0);
-  if(obj->output_files == NULL)
+  obj->name = PyBytes_FromString("UNINITIALIZED");
+  obj->output_files_loaded = 1;// there is no native RESULT
+  if(obj->name == NULL || obj->output_files == NULL)
     {
-      printf("Could not initialize the list: output_files\n");
+      printf("Could not initialize BoincResult\n");
       Py_DECREF(obj);
       return NULL;
     }
 
-  obj->appid = 0;
-  obj->id = 0;
-  obj->exit_status = 0;
-  obj->cpu_time = 0.0;
-  obj->validate_state = 0;
-
-  printf("When created, result name (%s) ref count: %d\n",PyBytes_AsString(obj->name),(int)obj->name->ob_refcnt);
-
-  
   return (PyObject *)obj;
   
 }
@@ -148,12 +570,12 @@ static int BoincResult_init(BoincResult *self, PyObject *args, PyObject *kwds)
 {
   
   PyObject *name=NULL,  *tmp = NULL;
-  int id, appid, exit_status,validate_state;
-  double cpu_time;
+  int id = self->id, appid = self->appid, exit_status = self->exit_status, validate_state = self->validate_state;
+  double cpu_time = self->cpu_time;
   static char *kwlist[] = {"name","appid","exit_status","validate_state","id","cpu_time",NULL};
 
 
-  if(!PyArg_ParseTupleAndKeywords(args,kwds,"|Oiiid",kwlist,&name,&appid,&exit_status,&id,&cpu_time))
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"|Oiiiid",kwlist,&name,&appid,&exit_status,&validate_state,&id,&cpu_time))
     return -1;
 
   if(name)
@@ -165,7 +587,7 @@ static int BoincResult_init(BoincResult *self, PyObject *args, PyObject *kwds)
     }
 
   self->appid = appid;
-  self->id = appid;
+  self->id = id;
   self->exit_status = exit_status;
   self->cpu_time = cpu_time;
   self->validate_state = validate_state;
@@ -177,25 +599,18 @@ static int BoincResult_init(BoincResult *self, PyObject *args, PyObject *kwds)
 // Returns a new reference
 PyObject* RESULT2BoincResult(const RESULT& result)
 {
-  PyObject *boincresult, *tmp, *new_name;
-  BoincResult *the_struct = NULL;
+  BoincResult *the_struct = alloc_boinc_result();
 
-  boincresult = BoincResult_new(&pyboinc_RESULT,NULL,NULL);
-  if(boincresult == NULL)
+  if(the_struct == NULL)
     return NULL;
 
-  the_struct = (BoincResult*)boincresult;
-
-    // Set name
-  printf("Initial result name (%s) ref count: %d\n",PyBytes_AsString(the_struct->name),the_struct->name->ob_refcnt);
-  tmp = the_struct->name;
-  new_name = PyBytes_FromString(result.name);
-  printf("When new name is created (%s) ref count: %d\n",PyBytes_AsString(new_name),new_name->ob_refcnt);
-
-  the_struct->name = new_name;
-  printf("New result name (%s) ref count: %d\n",PyBytes_AsString(the_struct->name),the_struct->name->ob_refcnt);
-  Py_INCREF(the_struct->name);
-  Py_XDECREF(tmp);
+  // The new string's one reference passes to the_struct.
+  the_struct->name = PyBytes_FromString(result.name);
+  if(the_struct->name == NULL)
+    {
+      Py_DECREF(the_struct);
+      return NULL;
+    }
 
   // app id
   the_struct->appid = result.appid;
@@ -204,15 +619,130 @@ PyObject* RESULT2BoincResult(const RESULT& result)
   the_struct->validate_state = result.validate_state;
   the_struct->id = result.id;
 
-  return boincresult;
+  the_struct->workunitid = result.workunitid;
+  the_struct->hostid = result.hostid;
+  the_struct->userid = result.userid;
+  the_struct->teamid = result.teamid;
+  the_struct->batch = result.batch;
+  the_struct->server_state = result.server_state;
+  the_struct->outcome = result.outcome;
+  the_struct->client_state = result.client_state;
+  the_struct->file_delete_state = result.file_delete_state;
+  the_struct->create_time = result.create_time;
+  the_struct->sent_time = result.sent_time;
+  the_struct->received_time = result.received_time;
+  the_struct->report_deadline = result.report_deadline;
+  the_struct->app_version_id = result.app_version_id;
+  the_struct->app_version_num = result.app_version_num;
+  the_struct->priority = result.priority;
+  the_struct->size_class = result.size_class;
+  the_struct->random = result.random;
+  the_struct->runtime_outlier = result.runtime_outlier;
+  the_struct->elapsed_time = result.elapsed_time;
+  the_struct->flops_estimate = result.flops_estimate;
+  the_struct->claimed_credit = result.claimed_credit;
+  the_struct->granted_credit = result.granted_credit;
+  the_struct->opaque = result.opaque;
+  the_struct->peak_working_set_size = result.peak_working_set_size;
+  the_struct->peak_swap_size = result.peak_swap_size;
+  the_struct->peak_disk_usage = result.peak_disk_usage;
+
+  the_struct->native = &result;
+
+  return (PyObject*)the_struct;
   
 }
 
+// Appends a (path, logical name) tuple to the output_files of
+// boincresult for each of paths. Returns 0 upon success and -1 if
+// there was a Python error.
+static int add_output_files(PyObject *boincresult, const RESULT& result, const std::vector<std::string>& paths)
+{
+  std::string logical_name,physical_name;
+  RESULT& non_const_res = const_cast<RESULT&>(result);// only read; a copy would move the XML blobs
+  PyObject *file_tuple;
+  int retval;
+
+  for(std::vector<std::string>::const_iterator path = paths.begin();path != paths.end();path++)
+    {
+      physical_name = *path;
+      logical_name.clear();
+      if(get_logical_name(non_const_res,physical_name,logical_name) != 0)
+	printf("WARNING -- Could not get logical name for %s\n",physical_name.c_str());
+      file_tuple = Py_BuildValue("(ss)",path->c_str(),logical_name.c_str());
+      if(file_tuple == NULL)
+	return -1;
+      retval = PyList_Append(((BoincResult*)boincresult)->output_files,file_tuple);
+      Py_DECREF(file_tuple);
+      if(retval)
+	return -1;
+    }
+  return 0;
+}
+
+// Fills output_files from the native RESULT, if that has not been
+// done. Returns 0 upon success and -1 if there was a Python error.
+static int load_output_files(BoincResult *self)
+{
+  std::vector<std::string> paths;
+
+  if(self->output_files_loaded)
+    return 0;
+  self->output_files_loaded = 1;
+  if(self->native == NULL || self->output_files == NULL || !PyList_Check(self->output_files))
+    return 0;
+  if(self->native_paths != NULL)
+    return add_output_files((PyObject*)self,*self->native,*self->native_paths);
+  if(self->native->id == 0)
+    return 0;// e.g. no canonical result
+  if(get_output_file_paths(const_cast<RESULT&>(*self->native),paths))
+    {
+      printf("WARNING -- Could not get output file paths for %s\n",self->native->name);
+      return 0;
+    }
+  return add_output_files((PyObject*)self,*self->native,paths);
+}
+
+PyObject* new_boinc_result(const RESULT& result, const std::vector<std::string> *paths)
+{
+  PyObject *boincresult = RESULT2BoincResult(result);
+
+  if(boincresult != NULL)
+    ((BoincResult*)boincresult)->native_paths = paths;
+  return boincresult;
+}
+
+void detach_boinc_result(PyObject *boincresult)
+{
+  BoincResult *self = (BoincResult*)boincresult;
+
+  if(self->native == NULL)
+    return;
+  if(load_output_files(self) || load_text(self,STDERR_OUT) || load_text(self,XML_DOC_OUT) || load_text(self,XML_DOC_IN))
+    {
+      fprintf(stderr,"Could not copy the result data of %s.\n",self->native->name);
+      PyErr_Print();
+    }
+  self->native = NULL;
+  self->native_paths = NULL;
+}
+
+void release_boinc_result(PyObject *boincresult)
+{
+  if(Py_REFCNT(boincresult) > 1)
+    detach_boinc_result(boincresult);
+  Py_DECREF(boincresult);
+}
+
+const BOINCRESULT_POOL_STATS& get_boincresult_pool_stats()
+{
+  return pool_stats;
+}
+
 // Returns a borrowed reference
 PyObject* import_result(PyObject *module, const char *variable_name, const std::vector<std::string> *paths, const RESULT& result)
 {
   PyObject *retval = NULL;
-  BoincResult *the_struct = NULL;
 
   if(module == NULL || variable_name == NULL)
     {
@@ -221,7 +751,7 @@ PyObject* import_result(PyObject *module, const char *variable_name, const std::
       return Py_None;
     }
 
-  retval = RESULT2BoincResult(result);
+  retval = new_boinc_result(result,paths);
   if(retval == NULL)
     {
       fprintf(stderr,"Error occurred importing result.");
@@ -230,25 +760,8 @@ PyObject* import_result(PyObject *module, const char *variable_name, const std::
       Py_INCREF(Py_None);
       return Py_None;
     }
-  the_struct = (BoincResult*)retval;
-
-  
-  if(paths != NULL)
-    {
-      std::string logical_name,physical_name;
-      RESULT non_const_res = result;
-      PyObject *args;
-      for(std::vector<std::string>::const_iterator path = paths->begin();path != paths->end();path++)
-	{
-	  physical_name = *path;
-	  if(get_logical_name(non_const_res,physical_name,logical_name) != 0)
-	    printf("WARNING -- Could not get logical name for %s\n",physical_name.c_str());
-	  printf("GOT PATHS: %s, %s\n",path->c_str(),logical_name.c_str());
-	  args = Py_BuildValue("(ss)",path->c_str(),logical_name.c_str());
-	  PyList_Append(the_struct->output_files,args);
-	  Py_XDECREF(args);
-	}
-    }
+  // Its owner, the module, may outlive result.
+  detach_boinc_result(retval);
 
   PyModule_AddObject(module,variable_name,retval);
 
@@ -268,18 +781,8 @@ int init_boinc_result(PyObject *module)
   if(item != NULL)
     return 0;// already loaded
   
-  pyboinc_RESULT.tp_new = BoincResult_new;
-  pyboinc_RESULT.tp_init = (initproc)BoincResult_init;// __init__
-  pyboinc_RESULT.tp_members = pyboinc_RESULT_members;
-
-  if(PyType_Ready(&pyboinc_RESULT) < 0)
-    {
-      fprintf(stderr,"Could not ready pyboinc_RESULT\n");
-      return -1;
-    }
-
-  if(module == NULL)
-    return 0;
+  if(ready_boinc_result())
+    return -1;
 
   Py_INCREF(&pyboinc_RESULT);
   PyModule_AddObject(module, pyboinc_RESULT.tp_name, (PyObject *)&pyboinc_RESULT);
@@ -288,177 +791,240 @@ int init_boinc_result(PyObject *module)
 
 }
 
-PyObject *py_user_code_on_results(int num_results, const RESULT *r1, void* _data1, RESULT const *r2, void* _data2, const char *function_dict_name)
+// Opens the project init file. Returns NULL and prints the reason
+// upon error.
+static FILE* open_init_file(const char *init_filename)
 {
-  int retval = 0;
-  PyObject *main_module = NULL, *main_dict = NULL, *validator_funct = NULL, *funct_name = NULL, *funct_dict = NULL, *valid_value = NULL, *appid_obj = NULL;
-  PyObject *pyresult1, *pyresult2;
-  FILE *init_file = NULL;
-  const char init_filename[] = "/boinc/projects/stjudeathome/boincdag_init.py";
-  
-  if(function_dict_name == NULL)
+  FILE *init_file = fopen(init_filename,"r");
+  if(init_file == NULL)
     {
-      fprintf(stderr,"Missing function name\n"); 
-      Py_INCREF(Py_None);
-      return Py_None;
+      char cwd[FILENAME_MAX];
+      int error = errno;
+      strcpy(cwd,"UNKNOWN");
+      if(getcwd(cwd,FILENAME_MAX) == NULL)
+	{
+	  fprintf(stderr,"Could not get current working directory. Reason: %s\n",strerror(errno));
+	}
+      fprintf(stderr,"Could not open %s for reading.\nCWD: %s\n",init_filename,cwd);
+      fprintf(stderr,"Reason: %s\n",strerror(error));
     }
-  if(num_results < 1 || num_results > 2)
+  return init_file;
+}
+
+// Returns a new reference to the function named for appid in the dict
+// function_dict_name of module, or NULL if there is none.
+static PyObject* get_user_function(PyObject *module, const char *function_dict_name, int appid)
+{
+  PyObject *funct_dict, *appid_obj, *funct_name, *funct;
+
+  funct_dict = PyObject_GetAttrString(module,function_dict_name);// new reference. dict that maps app ids to function names
+  if(funct_dict == NULL)
     {
-      fprintf(stderr,"Invalid number of results for py_user_code_on_results.\n");
-      Py_INCREF(Py_None);
-      return Py_None;
+      PyErr_Clear();
+      ERRORPRINT("Missing %s dict.\n",function_dict_name);
+      return NULL;
     }
-  if(r1 == NULL || _data1 == NULL)
+  appid_obj = PyBytes_FromFormat("%d",appid);
+  funct_name = (appid_obj != NULL) ? PyDict_GetItem(funct_dict,appid_obj) : NULL;// borrowed reference
+  Py_XDECREF(appid_obj);
+  if(funct_name == NULL)
     {
-      fprintf(stderr,"Missing result or data value.\n");
-      Py_INCREF(Py_None);
-      return Py_None;
+      DEBUGPRINT("Missing %s for %d.\n",function_dict_name,appid);
+      Py_DECREF(funct_dict);
+      return NULL;
     }
-  if(num_results == 2 && (r2 == NULL || _data2 == NULL))
+  funct = PyObject_GetAttr(module,funct_name);// new reference
+  if(funct == NULL)
     {
-      fprintf(stderr,"Missing second result or data value.\n");
-      Py_INCREF(Py_None);
-      return Py_None;
+      PyErr_Clear();
+      ERRORPRINT("Missing %s function '%s' for %d.\n",function_dict_name,PyBytes_AsString(funct_name),appid);
     }
-
-  init_file = fopen(init_filename,"r");
-  if(init_file == NULL)
+  else if(!PyCallable_Check(funct))
     {
-      char cwd[FILENAME_MAX];
-      strcpy(cwd,"UNKNOWN");
-      if(getcwd(cwd,FILENAME_MAX))
-	{
-	  fprintf(stderr,"Could not get current working directory. Reason: %s\n",strerror(errno));
-	}
-      fprintf(stderr,"Could not open %s for reading.\nCWD: %s\n",init_filename,cwd);
-      fprintf(stderr,"Reason: %s\n",strerror(errno));
-      Py_INCREF(Py_None);
-      return Py_None;
+      fprintf(stderr,"Object is not callable.\n");
+      Py_CLEAR(funct);
     }
+  Py_DECREF(funct_dict);// funct_name is not used after this
+  return funct;
+}
 
-  main_module = PyImport_AddModule("__main__");
-  if(main_module == NULL)
-    {
-      fprintf(stderr,"Could not add module __main__\n");
-      if(errno)
-	fprintf(stderr,"Reason: %s\n",strerror(errno));
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
+// Calls funct with args, which is released. Returns a new reference
+// to the return value or NULL if there was a Python error, which is
+// printed.
+static PyObject* call_user_function(PyObject *funct, PyObject *args, const char *function_dict_name)
+{
+  PyObject *value;
 
-  init_boinc_result(main_module);
-    
-  main_dict = PyModule_GetDict(main_module);
-  if(main_dict == NULL)
+  if(args == NULL)
     {
-      fprintf(stderr,"Could not get globals.\n");
-      if(errno)
-	fprintf(stderr,"Reason: %s\n",strerror(errno));
-      Py_INCREF(Py_None);
-      return Py_None;
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
     }
-
-  pyresult1 = import_result(main_module,"result1",(const std::vector<std::string>*)_data1,*r1);
-  if(num_results == 2)
-    pyresult2 = import_result(main_module,"result2",(const std::vector<std::string>*)_data2,*r2);
-    
-  retval = PyRun_SimpleFile(init_file,init_filename);
-  fclose(init_file);init_file = NULL;
-  if(retval)
+  value = PyObject_CallObject(funct,args);
+  Py_DECREF(args);
+  if(value == NULL)
     {
-      fprintf(stderr,"Error running %s.\n",init_filename);
-      Py_INCREF(Py_None);
-      return Py_None;
+      PyObject *name_obj = PyObject_GetAttrString(funct,"__name__");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      fprintf(stderr,"Error running %s (%s).\n",function_dict_name,(name_obj != NULL) ? PyBytes_AsString(name_obj) : "NULL");
+      Py_XDECREF(name_obj);
     }
+  return value;
+}
+
+// Returns the name of the exception that is set, ignoring the
+// traceback, or "" if there is none.
+static std::string exception_name()
+{
+  PyObject *exception = PyErr_Occurred();// borrowed reference
+  PyObject *name_obj;
+  std::string name;
+
+  if(exception == NULL)
+    return name;
+  name_obj = PyObject_GetAttrString(exception,"__name__");
+  if(name_obj != NULL && PyBytes_Check(name_obj))
+    name = PyBytes_AsString(name_obj);
+  Py_XDECREF(name_obj);
+  return name;
+}
+
+PyObject *py_user_code_on_results(int num_results, const RESULT *r1, void* _data1, RESULT const *r2, void* _data2, const char *function_dict_name)
+{
+  int retval = 0;
+  PyObject *main_module = NULL, *validator_funct = NULL, *valid_value = NULL;
+  PyObject *pyresult1 = NULL, *pyresult2 = NULL;
+  FILE *init_file = NULL;
+  const char init_filename[] = "/boinc/projects/stjudeathome/boincdag_init.py";
   
-  funct_dict = PyObject_GetAttrString(main_module,function_dict_name);// dictionary that maps app ids to function names
-  if(funct_dict == NULL)
+  if(function_dict_name == NULL)
     {
-      ERRORPRINT("Missing %s dict.\n",function_dict_name);
-      Py_INCREF(Py_None);
-      return Py_None;
+      fprintf(stderr,"Missing function name\n"); 
+      Py_RETURN_NONE;
     }
-  appid_obj = PyUnicode_FromFormat("%d",r1->appid);
-  funct_name = PyDict_GetItem(funct_dict, appid_obj);// function name for this appid
-  Py_DECREF(funct_dict);
-  Py_XDECREF(appid_obj);
-  if(funct_name == NULL)
+  if(num_results < 1 || num_results > 2)
     {
-      fprintf(stderr,"Missing %s for %d.\n",function_dict_name,r1->appid);
-      Py_INCREF(Py_None);
-      return Py_None;
+      fprintf(stderr,"Invalid number of results for py_user_code_on_results.\n");
+      Py_RETURN_NONE;
     }
-  validator_funct = PyObject_GetAttr(main_module, funct_name);
-  Py_XDECREF(funct_name);
-  if(validator_funct == NULL)
+  if(r1 == NULL || _data1 == NULL)
     {
-      fprintf(stderr,"Missing %s function '%s' for %d.\n",function_dict_name,PyBytes_AsString(funct_name),r1->appid);
-      Py_INCREF(Py_None);
-      return Py_None;
+      fprintf(stderr,"Missing result or data value.\n");
+      Py_RETURN_NONE;
     }
-  if(!PyCallable_Check(validator_funct))
+  if(num_results == 2 && (r2 == NULL || _data2 == NULL))
     {
-      fprintf(stderr,"Object is not callable.\n");
-      Py_XDECREF(validator_funct);
-      Py_INCREF(Py_None);
-      return Py_None;
+      fprintf(stderr,"Missing second result or data value.\n");
+      Py_RETURN_NONE;
     }
 
-  if(num_results == 2)
+  main_module = PyImport_AddModule("__main__");// borrowed reference
+  if(main_module == NULL)
     {
-      PyObject *args = Py_BuildValue("(OO)",pyresult1, pyresult2);
-      valid_value = PyObject_CallObject(validator_funct,args);
-      Py_XDECREF(args);
+      fprintf(stderr,"Could not add module __main__\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      Py_RETURN_NONE;
     }
-  else
+
+  init_boinc_result(main_module);
+
+  // Borrowed references, owned by __main__
+  pyresult1 = import_result(main_module,"result1",&((const RESULT_FILES*)_data1)->paths,*r1);
+  if(num_results == 2)
+    pyresult2 = import_result(main_module,"result2",&((const RESULT_FILES*)_data2)->paths,*r2);
+  if(pyresult1 == Py_None || pyresult2 == Py_None)
     {
-      PyObject *args = Py_BuildValue("(O)",pyresult1);
-      valid_value = PyObject_CallObject(validator_funct,args);
-      Py_XDECREF(args);
+      // import_result returned a new reference to None
+      if(pyresult1 == Py_None)
+	Py_DECREF(Py_None);
+      if(pyresult2 == Py_None)
+	Py_DECREF(Py_None);
+      goto done;
     }
 
-  if(PyErr_Occurred())
+  init_file = open_init_file(init_filename);
+  if(init_file == NULL)
+    goto done;
+  retval = PyRun_SimpleFile(init_file,init_filename);
+  fclose(init_file);
+  if(retval)
     {
-      Py_XDECREF(validator_funct);
-      Py_XDECREF(valid_value);
-      PyErr_Print();
-      Py_INCREF(Py_None);
-      return Py_None;
+      fprintf(stderr,"Error running %s.\n",init_filename);
+      goto done;
     }
 
+  validator_funct = get_user_function(main_module,function_dict_name,r1->appid);
+  if(validator_funct == NULL)
+    goto done;
+
+  if(num_results == 2)
+    valid_value = call_user_function(validator_funct,Py_BuildValue("(OO)",pyresult1,pyresult2),function_dict_name);
+  else
+    valid_value = call_user_function(validator_funct,Py_BuildValue("(O)",pyresult1),function_dict_name);
+
+ done:
+  Py_XDECREF(validator_funct);
+  del_main_variable("result1");
+  del_main_variable("result2");
   if(valid_value == NULL)
+    Py_RETURN_NONE;
+  return valid_value;// returning new reference
+}
+
+// Returns a new reference to a BoincResult of result that does not
+// refer to result, since the user code it is passed to may keep it.
+static PyObject* detached_boinc_result(const RESULT& result)
+{
+  PyObject *boincresult = new_boinc_result(result,NULL);
+  if(boincresult != NULL)
+    detach_boinc_result(boincresult);
+  return boincresult;
+}
+
+// Returns a new reference to a list of the BoincResults of results,
+// or NULL upon error.
+static PyObject* BoincResult_list(const std::vector<RESULT>& results)
+{
+  PyObject *boinc_results = PyList_New(0);
+  if(boinc_results == NULL)
+    return NULL;
+  for(std::vector<RESULT>::const_iterator res_it = results.begin();res_it != results.end();res_it++)
     {
-      PyObject *name_obj = PyObject_GetAttrString(validator_funct,"__name__");
-      if(name_obj == NULL)
-	name_obj = PyBytes_FromString("NULL");
-      fprintf(stderr,"Error running %s (%s).\n",function_dict_name,PyBytes_AsString(name_obj));
-      Py_XDECREF(name_obj);
-      Py_XDECREF(validator_funct);
-      Py_XDECREF(valid_value);
-      Py_INCREF(Py_None);
-      return Py_None;
+      PyObject *pyresult = detached_boinc_result(*res_it);
+      if(pyresult == NULL || PyList_Append(boinc_results,pyresult))// PyList_Append does not steal pyresult
+	{
+	  Py_XDECREF(pyresult);
+	  Py_DECREF(boinc_results);
+	  return NULL;
+	}
+      Py_DECREF(pyresult);
     }
-  Py_XDECREF(validator_funct);
+  return boinc_results;
+}
 
-  return valid_value;// returning new reference
+// Returns a new reference to the BoincResult of canonical_result, or
+// to None if it is NULL.
+static PyObject* BoincResult_or_none(const RESULT *canonical_result)
+{
+  if(canonical_result == NULL)
+    Py_RETURN_NONE;
+  return detached_boinc_result(*canonical_result);
 }
 
 PyObject *py_user_code_on_workunit(std::vector<RESULT>& results, RESULT *canonical_result, const char *function_dict_name)
 {
   int retval = 0, appid;
-  PyObject *main_module = NULL, *main_dict = NULL, *funct_to_run = NULL, *funct_name = NULL, *funct_dict = NULL,*valid_value = NULL, *boinctools_mod = NULL, *args = NULL, *appid_obj = NULL;
-  PyObject *boinctools_name = NULL;
+  PyObject *main_module = NULL, *funct_to_run = NULL, *valid_value = NULL, *boinctools_mod = NULL;
   PyObject *boinc_results = NULL;// List of boinc results corresponding to results argument
   PyObject *pycanonical = NULL;// BoincResult for canonical result.
-  std::vector<RESULT>::const_iterator res_it;
   FILE *init_file = NULL;
   const char init_filename[] = "/boinc/projects/stjudeathome/boincdag_init.py";
   
   if(function_dict_name == NULL)
-    {
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
+    Py_RETURN_NONE;
 
   if(canonical_result != NULL)
     appid = canonical_result->appid;
@@ -466,223 +1032,94 @@ PyObject *py_user_code_on_workunit(std::vector<RESULT>& results, RESULT *canonic
     appid = results[0].appid;
   else
     appid = -1;
-  
-  init_file = fopen(init_filename,"r");
-  if(init_file == NULL)
-    {
-      char cwd[FILENAME_MAX];
-      strcpy(cwd,"UNKNOWN");
-      if(getcwd(cwd,FILENAME_MAX))
-	{
-	  fprintf(stderr,"Could not get current working directory. Reason: %s\n",strerror(errno));
-	}
-      fprintf(stderr,"Could not open %s for reading.\nCWD: %s\n",init_filename,cwd);
-      fprintf(stderr,"Reason: %s\n",strerror(errno));
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
 
-  main_module = PyImport_AddModule("__main__");
+  main_module = PyImport_AddModule("__main__");// borrowed reference
   if(main_module == NULL)
     {
       fprintf(stderr,"Could not add module __main__\n");
-      if(errno)
-	fprintf(stderr,"Reason: %s\n",strerror(errno));
-     
-      Py_INCREF(Py_None);
-      return Py_None;
+      goto done;
     }
 
   init_boinc_result(main_module);
-    
-  main_dict = PyModule_GetDict(main_module);
-  if(main_dict == NULL)
-    {
-      fprintf(stderr,"Could not get globals.\n");
-      if(errno)
-	fprintf(stderr,"Reason: %s\n",strerror(errno));
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
 
-  boinctools_name = PyBytes_FromString("boinctools");
-  boinctools_mod = PyImport_Import(boinctools_name);
-  Py_XDECREF(boinctools_name);boinctools_name = NULL;
+  boinctools_mod = PyImport_ImportModule("boinctools");
   if(boinctools_mod == NULL)
     {
       fprintf(stderr,"ERROR - Could not load boinctools python module.\n");
-      exit(1);
+      goto done;
     }
 
-  // Create result list
-  boinc_results = PyList_New(0);
+  boinc_results = BoincResult_list(results);
   if(boinc_results == NULL)
     {
       fprintf(stderr,"Could not create result list in assimilate_handler.\n");
-      if(PyErr_Occurred())
-	PyErr_Print();
-      Py_DECREF(boinctools_mod);
-      Py_INCREF(Py_None);
-      return Py_None;
+      goto done;
     }
-  for(res_it = results.begin();res_it != results.end();res_it++)
+  pycanonical = BoincResult_or_none(canonical_result);
+  if(pycanonical == NULL)
     {
-      PyObject *pyresult = RESULT2BoincResult(*res_it);
-      if(pyresult == NULL)
-	{
-	  fprintf(stderr,"Error occurred importing result.");
-	  if(PyErr_Occurred())
-	    PyErr_Print();
-
-	  Py_DECREF(boinc_results);
-	  Py_DECREF(boinctools_mod);
-	  Py_INCREF(Py_None);
-	  return Py_None;
-	}
-      PyList_Append(boinc_results,pyresult);
+      fprintf(stderr,"Error occurred importing result.");
+      goto done;
     }
 
-  if(canonical_result == NULL)
-    {
-      Py_INCREF(Py_None);
-      pycanonical = Py_None;
-    }
-  else
-    {
-      // CHECK THIS FOR Py_INC/DECREF
-      pycanonical = RESULT2BoincResult(*canonical_result);
-    }
-    
+  init_file = open_init_file(init_filename);
+  if(init_file == NULL)
+    goto done;
   retval = PyRun_SimpleFile(init_file,init_filename);
-  fclose(init_file);init_file = NULL;
+  fclose(init_file);
   if(retval)
     {
       fprintf(stderr,"Error running %s.\n",init_filename);
-      Py_DECREF(boinc_results);
-      Py_DECREF(boinctools_mod);
-      Py_INCREF(Py_None);
-      return Py_None;
+      goto done;
     }
-  
-  funct_dict = PyObject_GetAttrString(main_module,function_dict_name);// new reference. dict that maps app ids to function names
-  if(funct_dict == NULL)
-    {
-      ERRORPRINT("Missing %s dict.\n",function_dict_name);
-      Py_DECREF(boinc_results);
-      Py_DECREF(boinctools_mod);
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
-  appid_obj = PyUnicode_FromFormat("%d",appid);
-  funct_name = PyDict_GetItem(funct_dict, appid_obj);// borrowed reference
-  Py_DECREF(funct_dict);
-  Py_XDECREF(appid_obj);
-  if(funct_name == NULL)
-    {
-      DEBUGPRINT("Missing %s for %d.\n",function_dict_name,appid);
-      Py_DECREF(boinc_results);
-      Py_DECREF(boinctools_mod);
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
-  funct_to_run = PyObject_GetAttr(main_module, funct_name);// new reference
+
+  funct_to_run = get_user_function(main_module,function_dict_name,appid);
   if(funct_to_run == NULL)
-    {
-      ERRORPRINT("Missing %s function '%s' for %d.\n",function_dict_name,PyBytes_AsString(funct_name),appid);
-      Py_DECREF(funct_name);
-      Py_DECREF(boinctools_mod);
-      Py_DECREF(boinc_results);
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
-  Py_DECREF(funct_name);
+    goto done;
 
-  if(!PyCallable_Check(funct_to_run))
-    {
-      fprintf(stderr,"Object is not callable.\n");
-      Py_DECREF(funct_to_run);
-      Py_DECREF(boinc_results);
-      Py_DECREF(boinctools_mod);
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
+  valid_value = call_user_function(funct_to_run,Py_BuildValue("(OO)",boinc_results,pycanonical),function_dict_name);
 
-  args = Py_BuildValue("(OO)",boinc_results,pycanonical);
-  valid_value = PyObject_CallObject(funct_to_run,args);
-  Py_XDECREF(args);
+ done:
   if(PyErr_Occurred())
-    {
-      Py_XDECREF(valid_value);
-      PyErr_Print();
-      Py_DECREF(funct_to_run);
-      Py_DECREF(boinc_results);
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
-
+    PyErr_Print();
+  Py_XDECREF(funct_to_run);
+  Py_XDECREF(pycanonical);
+  Py_XDECREF(boinc_results);
+  Py_XDECREF(boinctools_mod);
   if(valid_value == NULL)
-    {
-      PyObject *name_obj = PyObject_GetAttrString(funct_to_run,"__name__");
-      if(name_obj == NULL)
-	name_obj = PyBytes_FromString("NULL");
-      fprintf(stderr,"Error running %s (%s).\n",function_dict_name,PyBytes_AsString(name_obj));
-      Py_XDECREF(name_obj);
-      Py_DECREF(funct_to_run);
-      Py_DECREF(boinctools_mod);
-      Py_DECREF(boinc_results);
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
-
-  Py_DECREF(funct_to_run);
-  Py_DECREF(boinctools_mod);
-  Py_DECREF(boinc_results);
-  Py_DECREF(pycanonical);
-
+    Py_RETURN_NONE;
   return valid_value;
 }
 
 
 PyObject* py_boinctools_on_result(const RESULT& r, const char *function_name)
 {
-  PyObject *mod = NULL, *mod_name = NULL;
+  PyObject *mod = NULL, *funct = NULL;
   PyObject *result = NULL;
-  const char *module_name = "boinctools";
 
   if(function_name == NULL)
+    Py_RETURN_NONE;
+
+  mod = PyImport_ImportModule("boinctools");
+  if(mod == NULL)
     {
-      Py_INCREF(Py_None);
-      return Py_None;
+      PyErr_Print();
+      return NULL;
     }
-
-  mod_name = PyBytes_FromString(module_name);
-  mod = PyImport_Import(mod_name);
-  Py_XDECREF(mod_name);mod_name = NULL;
-  if(mod != NULL)
+  funct = PyObject_GetAttrString(mod,function_name);
+  Py_DECREF(mod);
+  if(funct == NULL || !PyCallable_Check(funct))
     {
-      PyObject *dict, *funct;
-      dict = PyModule_GetDict(mod);
-      funct = PyDict_GetItemString(dict,function_name);
-      if(funct != NULL)
-	{
-	  if(PyCallable_Check(funct))
-	    {
-	      PyObject *exception = NULL;
-	      result = PyObject_CallFunction(funct,"(s)",r.name);
-	      if((exception = PyErr_Occurred()) != NULL)
-		{
-		  const char *exc_name = PyBytes_AsString(PyObject_GetAttrString(exception,"__name__"));
-		  if(exc_name == NULL || strcmp(exc_name,"NoSuchProcess") != 0)
-		    {
-		      Py_XDECREF(result);
-		      Py_XDECREF(mod);
-		      Py_INCREF(Py_None);
-		      return Py_None;
-		    }
-		}
-	    }
-	}
-      Py_XDECREF(mod);
+      PyErr_Clear();
+      Py_XDECREF(funct);
+      return NULL;
+    }
+  result = PyObject_CallFunction(funct,(char*)"(s)",r.name);
+  Py_DECREF(funct);
+  if(result == NULL && exception_name() != "NoSuchProcess")
+    {
+      PyErr_Print();
+      Py_RETURN_NONE;
     }
 
   return result;
@@ -691,84 +1128,44 @@ PyObject* py_boinctools_on_result(const RESULT& r, const char *function_name)
 
 PyObject* py_boinctools_on_workunit(const std::vector<RESULT>& results, const RESULT *canonical_result, const char *function_name)
 {
-  PyObject *mod = NULL, *module_name_obj = NULL;
+  PyObject *mod = NULL, *funct = NULL;
   PyObject *boinc_results = NULL, *pycanonical = NULL;
   PyObject *result = NULL;
-  const char *module_name = "boinctools";
-  std::vector<RESULT>::const_iterator res_it;
 
   if(function_name == NULL)
-    {
-      Py_INCREF(Py_None);
-      return Py_None;
-    }
+    Py_RETURN_NONE;
 
-  // Create result list
-  boinc_results = PyList_New(0);
-  if(boinc_results == NULL)
+  boinc_results = BoincResult_list(results);
+  pycanonical = (boinc_results != NULL) ? BoincResult_or_none(canonical_result) : NULL;
+  if(pycanonical == NULL)
     {
       fprintf(stderr,"Could not create result list in assimilate_handler.\n");
       if(PyErr_Occurred())
 	PyErr_Print();
-      return Py_None;
-    }
-  for(res_it = results.begin();res_it != results.end();res_it++)
-    {
-      PyObject *pyresult = RESULT2BoincResult(*res_it);
-      if(pyresult == NULL)
-	{
-	  fprintf(stderr,"Error occurred importing result.");
-	  if(PyErr_Occurred())
-	    PyErr_Print();
-	  Py_DECREF(boinc_results);
-	  Py_INCREF(Py_None);
-	  return Py_None;
-	}
-      PyList_Append(boinc_results,pyresult);
+      Py_XDECREF(boinc_results);
+      Py_RETURN_NONE;
     }
 
-  if(canonical_result == NULL)
-    {
-      pycanonical = Py_None;
-      Py_INCREF(pycanonical);
-    }
-  else
+  mod = PyImport_ImportModule("boinctools");
+  if(mod != NULL)
     {
-      pycanonical = RESULT2BoincResult(*canonical_result);
+      funct = PyObject_GetAttrString(mod,function_name);
+      Py_DECREF(mod);
     }
-
-  module_name_obj = PyBytes_FromString(module_name);
-  mod = PyImport_Import(module_name_obj);
-  Py_DECREF(module_name_obj);
-  if(mod != NULL)
+  if(funct != NULL && PyCallable_Check(funct))
     {
-      PyObject *dict, *funct;
-      dict = PyModule_GetDict(mod);
-      funct = PyDict_GetItemString(dict,function_name);
-      if(funct != NULL)
+      result = PyObject_CallFunction(funct,(char*)"(OO)",boinc_results,pycanonical);
+      if(result == NULL && exception_name() != "NoSuchProcess")
 	{
-	  if(PyCallable_Check(funct))
-	    {
-	      PyObject *exception = NULL;
-	      result = PyObject_CallFunction(funct,"(OO)",boinc_results,pycanonical);
-	      if((exception = PyErr_Occurred()) != NULL)
-		{
-		  const char *exc_name = PyBytes_AsString(PyObject_GetAttrString(exception,"__name__"));
-		  if(exc_name == NULL || strcmp(exc_name,"NoSuchProcess") != 0)
-		    {
-		      Py_XDECREF(pycanonical);
-		      Py_DECREF(boinc_results);
-		      Py_XDECREF(mod);
-		      Py_XDECREF(result);
-		      Py_INCREF(Py_None);
-		      return Py_None;
-		    }
-		}
-	    }
+	  PyErr_Print();
+	  Py_INCREF(Py_None);
+	  result = Py_None;
 	}
     }
-  Py_XDECREF(mod);
-  Py_XDECREF(pycanonical);
+  else
+    PyErr_Clear();
+  Py_XDECREF(funct);
+  Py_DECREF(pycanonical);
   Py_DECREF(boinc_results);
 
   return result;
@@ -788,44 +1185,295 @@ void finalize_python()
   if(!Py_IsInitialized())
     return;
   
+  clear_free_results();
   Py_Finalize();
 }
 
-std::string result_init_string(const RESULT& res)
+void del_main_variable(const char *variable_name)
 {
-  std::ostringstream buffer;
-  buffer << " boinctools.BoincResult(\"" << res.name << "\", " << res.id << ", " << res.appid << ", " << res.exit_status << ", " << res.validate_state << ", " << res.cpu_time << ") ";
-  return buffer.str();
+  PyObject *main_module = PyImport_AddModule("__main__");// borrowed reference
+  if(main_module == NULL)
+    {
+      PyErr_Clear();
+      return;
+    }
+  if(PyObject_HasAttrString(main_module,variable_name) && PyObject_DelAttrString(main_module,variable_name))
+    PyErr_Clear();
 }
 
-void load_paths(const std::string& variable_name, const RESULT& res, void *data)
+long long resident_set_size()
 {
-  std::vector<std::string> *paths = (std::vector<std::string>*)data;
+  long long pages, resident = -1;
+  FILE *statm = fopen("/proc/self/statm","r");
 
-  if(paths != NULL)
+  if(statm == NULL)
+    return -1;
+  if(fscanf(statm,"%lld %lld",&pages,&resident) != 2)
+    resident = -1;
+  fclose(statm);
+  return (resident < 0) ? -1 : resident * sysconf(_SC_PAGESIZE);
+}
+
+static bool by_count(const std::pair<std::string, long>& a, const std::pair<std::string, long>& b)
+{
+  return a.second > b.second;
+}
+
+void print_memory_report(size_t max_types)
+{
+  PyObject *gc_module, *objects = NULL, *garbage = NULL;
+  std::map<std::string, long> counts;
+  std::vector<std::pair<std::string, long> > sorted_counts;
+  Py_ssize_t num_objects = 0;
+
+  printf("Memory: RSS %.1f MB\n",resident_set_size()/1048576.0);
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2,33)
+  struct mallinfo2 heap = mallinfo2();
+#else
+  struct mallinfo heap = mallinfo();
+#endif
+  printf("Memory: malloc arena %.1f MB, mmapped %.1f MB, in use %.1f MB, free %.1f MB\n",
+	 heap.arena/1048576.0,heap.hblkhd/1048576.0,heap.uordblks/1048576.0,heap.fordblks/1048576.0);
+#endif
+
+  if(!Py_IsInitialized())
+    return;
+
+  // Objects tracked by the garbage collector, i.e. containers and
+  // instances, but not strings or numbers.
+  gc_module = PyImport_ImportModule("gc");
+  if(gc_module != NULL)
     {
-      std::string logical_name,physical_name;
-      std::ostringstream buffer;
-      RESULT non_const_res = res;
-      for(std::vector<std::string>::const_iterator path = paths->begin();path != paths->end();path++)
-	{
-	  physical_name = *path;
-	  if(get_logical_name(non_const_res,physical_name,logical_name) != 0)
-	    printf("WARNING -- Could not get logical name for %s\n",physical_name.c_str());
-	  buffer.clear();buffer.str("");
-	  buffer << variable_name << ".output_files.append((\"" << path->c_str() << "\", \"" << logical_name.c_str() << "\"))";
-	  if(PyRun_SimpleString(buffer.str().c_str()))
-	    {
-	      fprintf(stderr,"Could not create result object.\n");
-	      fprintf(stderr,"Python Command: %s",buffer.str().c_str());
-	      if(PyErr_Occurred())
-		PyErr_Print();
-	      finalize_python();
-	      exit(1);	      
-	    }
-	}
+      objects = PyObject_CallMethod(gc_module,(char*)"get_objects",NULL);
+      garbage = PyObject_GetAttrString(gc_module,"garbage");
+      Py_DECREF(gc_module);
+    }
+  if(objects == NULL || !PyList_Check(objects))
+    {
+      PyErr_Clear();
+      Py_XDECREF(objects);
+      Py_XDECREF(garbage);
+      return;
+    }
+  num_objects = PyList_GET_SIZE(objects);
+  for(Py_ssize_t i = 0;i < num_objects;i++)
+    {
+      PyObject *object = PyList_GET_ITEM(objects,i);
+      if(PyInstance_Check(object))// old style class, e.g. boinctools.BoincResult
+	counts[PyBytes_AsString(((PyInstanceObject*)object)->in_class->cl_name)]++;
+      else
+	counts[Py_TYPE(object)->tp_name]++;
+    }
+  Py_DECREF(objects);
+
+  sorted_counts.assign(counts.begin(),counts.end());
+  std::sort(sorted_counts.begin(),sorted_counts.end(),by_count);
+  printf("Memory: %ld Python objects tracked, %ld uncollectable\n",(long)num_objects,
+	 (garbage != NULL && PyList_Check(garbage)) ? (long)PyList_GET_SIZE(garbage) : 0L);
+  for(size_t i = 0;i < sorted_counts.size() && i < max_types;i++)
+    printf("Memory:   %8ld %s\n",sorted_counts[i].second,sorted_counts[i].first.c_str());
+  Py_XDECREF(garbage);
+
+  // The project init file is run for every call, so an init file that
+  // appends to sys.path or imports under new names grows these.
+  PyObject *sys_path = PySys_GetObject((char*)"path"), *sys_modules = PySys_GetObject((char*)"modules");// borrowed
+  printf("Memory: sys.path %ld entries, sys.modules %ld entries\n",
+	 (sys_path != NULL && PyList_Check(sys_path)) ? (long)PyList_GET_SIZE(sys_path) : 0L,
+	 (sys_modules != NULL && PyDict_Check(sys_modules)) ? (long)PyDict_Size(sys_modules) : 0L);
+  printf("Memory: BoincResult %ld allocated, %ld reused, %ld free; output_files %ld allocated, %ld reused\n",
+	 pool_stats.allocated,pool_stats.reused,(long)num_free_results,pool_stats.lists_allocated,pool_stats.lists_reused);
+  PyErr_Clear();
+}
+
+int max_python_failures = 3;
+static std::map<int, int> python_failures;// workunit id to number of failures
+static std::set<int> quarantined_workunits;
+
+bool record_python_failure(int wuid, const char *name)
+{
+  int failures = ++python_failures[wuid];
+
+  if(max_python_failures > 0 && failures >= max_python_failures)
+    {
+      if(quarantined_workunits.insert(wuid).second)
+	fprintf(stderr,"Quarantined workunit %d (%s) after %d Python failures.\n",wuid,name,failures);
+      return true;
+    }
+  fprintf(stderr,"Python failure %d for workunit %d (%s). It will be retried.\n",failures,wuid,name);
+  return false;
+}
+
+bool is_quarantined(int wuid)
+{
+  return quarantined_workunits.find(wuid) != quarantined_workunits.end();
+}
+
+void clear_python_failures(int wuid)
+{
+  python_failures.erase(wuid);
+}
+
+int compact_dag_journals()
+{
+  PyObject *module, *retval;
+
+  // Only Python code records DAG job states.
+  if(!Py_IsInitialized())
+    return 0;
+
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
+    {
+      fprintf(stderr,"Could not import boinctools python module.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return -1;
+    }
+  retval = PyObject_CallMethod(module,(char*)"compact_dag_journals",NULL);
+  Py_DECREF(module);
+  if(retval == NULL)
+    {
+      fprintf(stderr,"Could not merge DAG journals.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return -1;
+    }
+  Py_DECREF(retval);
+  return 0;
+}
+
+#define ARTIFACT_READ_SIZE (64 * 1024)
+
+static ARTIFACT_CACHE artifact_cache;
+static bool artifact_cache_configured = false;
+static long long artifact_max_contents = 0;
+static int artifact_digests = 0;// digest files larger than artifact_max_contents
+
+ARTIFACT_CACHE* get_artifact_cache()
+{
+  PyObject *mod = NULL, *settings = NULL;
+  const char *path = NULL;
+  long long budget = 0;
+
+  if(artifact_cache_configured)
+    return artifact_cache.is_open() ? &artifact_cache : NULL;
+  artifact_cache_configured = true;
+
+  mod = PyImport_ImportModule("boinctools");
+  if(mod == NULL)
+    {
+      fprintf(stderr,"Could not import boinctools python module.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
+    }
+  settings = PyObject_CallMethod(mod,(char*)"artifact_cache_settings",NULL);
+  Py_DECREF(mod);
+  if(settings == NULL)
+    {
+      fprintf(stderr,"Could not read artifact cache settings.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return NULL;
     }
+  if(settings == Py_None)
+    {
+      Py_DECREF(settings);
+      return NULL;
+    }
+
+  if(!PyArg_ParseTuple(settings,"sLLi",&path,&budget,&artifact_max_contents,&artifact_digests))
+    {
+      fprintf(stderr,"Invalid artifact cache settings.\n");
+      PyErr_Print();
+    }
+  else if(artifact_cache.open(path,budget))
+    fprintf(stderr,"Could not open artifact cache %s. Reason: %s\n",path,strerror(errno));
+  Py_DECREF(settings);
+
+  return artifact_cache.is_open() ? &artifact_cache : NULL;
 }
 
+// Reads the file from offset 0 with pread, so the shared offset of fd
+// is left alone, and sets digest to its MD5 digest. The bytes are also
+// kept in contents, if that is not NULL.
+static int read_artifact(int fd, std::string& digest, std::string *contents)
+{
+  std::vector<char> buf(ARTIFACT_READ_SIZE);
+  md5_state_t state;
+  md5_byte_t binary[16];
+  char hex[33];
+  off_t offset = 0;
+  ssize_t nread;
+
+  md5_init(&state);
+  while(1)
+    {
+      nread = pread(fd,&buf[0],buf.size(),offset);
+      if(nread < 0 && errno == EINTR)
+	continue;
+      if(nread < 0)
+	return -1;
+      if(nread == 0)
+	break;
+      md5_append(&state,(const md5_byte_t*)&buf[0],nread);
+      if(contents != NULL)
+	contents->append(&buf[0],nread);
+      offset += nread;
+    }
+  md5_finish(&state,binary);
+  for(int i = 0;i < 16;i++)
+    snprintf(hex + 2 * i,3,"%02x",binary[i]);
+  digest = hex;
+  return 0;
+}
 
+int cache_output_files(const RESULT& result, const std::vector<std::string>& paths, const std::vector<OPENED_FILE>& files)
+{
+  ARTIFACT_CACHE *cache = get_artifact_cache();
+  RESULT& non_const_res = const_cast<RESULT&>(result);// only read by get_logical_name
+  int retval = 0;
 
+  if(cache == NULL)
+    return 0;
+
+  for(size_t i = 0;i < paths.size() && i < files.size();i++)
+    {
+      ARTIFACT_INFO info, cached;
+      std::string physical_name = paths[i], logical_name, file_name;
+      struct stat st;
+      bool keep_contents;
+
+      // missing output files are the comparator's business
+      if(files[i].fd < 0 || fstat(files[i].fd,&st))
+	continue;
+
+      file_name = physical_name.substr(physical_name.rfind('/') + 1);
+      if(cache->get(result.id,file_name,cached) == 0 && cached.size == st.st_size && cached.mtime == st.st_mtime)
+	continue;
+
+      info.size = st.st_size;
+      info.mtime = st.st_mtime;
+      if(get_logical_name(non_const_res,physical_name,logical_name) == 0)
+	info.metadata = logical_name;
+      // Small files are read once for both their contents and digest.
+      // Larger ones are only read if the project asked for digests.
+      keep_contents = (st.st_size <= artifact_max_contents);
+      if((keep_contents || artifact_digests) && read_artifact(files[i].fd,info.digest,keep_contents ? &info.contents : NULL))
+	{
+	  fprintf(stderr,"Could not read %s. Reason: %s\n",physical_name.c_str(),strerror(errno));
+	  retval = -1;
+	  continue;
+	}
+      info.has_contents = keep_contents;
+
+      if(cache->put(result.id,file_name,info))
+	{
+	  fprintf(stderr,"Could not add %s to the artifact cache. Reason: %s\n",physical_name.c_str(),strerror(errno));
+	  retval = -1;
+	}
+    }
+
+  return retval;
+}
@@ -12,19 +12,91 @@
 #include <string>
 #include <vector>
 
+#include "batch_open.h"
+
+struct RESULT;
+
 typedef struct {
   PyObject_HEAD
   PyObject *name;
-  PyObject *output_files;
+  PyObject *output_files;// filled on first access; see native
   int id; // RESULT id
   int appid;
   int exit_status;
   int validate_state;
   double cpu_time;// in seconds
+  PyObject *dict;// attributes set by user code, created on first use
+
+  // Further RESULT fields, read only. They are copied when the object
+  // is built; Python numbers are made only when they are read.
+  int workunitid, hostid, userid, teamid, batch;
+  int server_state, outcome, client_state, file_delete_state;
+  int create_time, sent_time, received_time, report_deadline;
+  int app_version_id, app_version_num, priority, size_class, random;
+  char runtime_outlier;
+  double elapsed_time, flops_estimate, claimed_credit, granted_credit, opaque;
+  double peak_working_set_size, peak_swap_size, peak_disk_usage;
+
+  // Copied from native on first access
+  PyObject *stderr_out, *xml_doc_out, *xml_doc_in;
+
+  // Values found by the xml_fields method in each of the text fields
+  // above, in the same order, as dicts of tag to value or None.
+  PyObject *xml_fields[3];
+
+  // The RESULT, and its output file paths, that the object was built
+  // from. These are borrowed, so the object reads them only until
+  // detach_boinc_result is called. native_paths may be NULL, in which
+  // case the paths are looked up when output_files is first read.
+  const RESULT *native;
+  const std::vector<std::string> *native_paths;
+  char output_files_loaded;
   
 }BoincResult;
 
-struct RESULT;
+// Number of deallocated BoincResults kept for reuse
+#define BOINCRESULT_FREE_MAX 256
+
+struct BOINCRESULT_POOL_STATS {
+  long allocated;// new objects
+  long reused;// objects taken from the free list
+  long lists_allocated;// new output_files lists
+  long lists_reused;
+
+  BOINCRESULT_POOL_STATS() : allocated(0), reused(0), lists_allocated(0), lists_reused(0) {}
+};
+
+class ARTIFACT_CACHE;
+
+/**
+ * Copies anything that result may still read from its native RESULT,
+ * such as stderr_out and the logical names of its output files, and
+ * forgets the RESULT, so that the RESULT may be changed or freed while
+ * Python code keeps the object.
+ */
+void detach_boinc_result(PyObject *boincresult);
+
+/**
+ * Releases a reference to a BoincResult built by new_boinc_result. If
+ * anything else still refers to it, it is detached first.
+ */
+void release_boinc_result(PyObject *boincresult);
+
+/**
+ * Data set by init_result for each result: the paths of its output
+ * files and, in the same order, their descriptors and sizes, which are
+ * reused by the native comparators, and the BoincResult built for the
+ * Python validator on the first comparison. The descriptors are closed
+ * and the object released when this is deleted by cleanup_result.
+ */
+struct RESULT_FILES {
+  std::vector<std::string> paths;
+  std::vector<OPENED_FILE> files;
+  PyObject *py_result;
+
+  RESULT_FILES() : py_result(NULL) {}
+  ~RESULT_FILES() { close_files(files); if(py_result != NULL) release_boinc_result(py_result); }
+};
 
 void initialize_python();
 void finalize_python();
@@ -72,15 +144,101 @@ PyObject*  py_boinctools_on_result(const RESULT& r, const char *function_name);
 PyObject* py_boinctools_on_workunit(const std::vector<RESULT>& results, const RESULT *canonical_result , const char *function_name);
 
 /**
- * Returns a string that represents a Python BoincResult class
- * initialization for the provided Result.
+ * Removes variable_name from __main__, if it is there, so that objects
+ * passed to user code through __main__ are released after the call.
+ */
+void del_main_variable(const char *variable_name);
+
+/**
+ * Returns the resident set size of the process in bytes, or -1 if it
+ * is not known.
+ */
+long long resident_set_size();
+
+/**
+ * Prints the resident set size, malloc heap statistics and the number
+ * of Python objects tracked by the garbage collector, for the
+ * max_types most common types, so that the memory use of a long
+ * running daemon can be followed in its log.
+ */
+void print_memory_report(size_t max_types);
+
+/**
+ * Returns a new reference to a BoincResult of result. The object is
+ * built in C, rather than by running Python code, and is taken from a
+ * free list of deallocated objects when one is available. Only objects
+ * that no longer have any references are reused, so user code that
+ * keeps a BoincResult, or its output_files list, never sees it change.
+ *
+ * The text fields, such as stderr_out, and output_files are read from
+ * result when they are first accessed, so that results that nobody
+ * inspects cost nothing extra. output_files holds a (path, logical
+ * name) tuple for each of paths, or, if paths is NULL, for each path
+ * given by get_output_file_paths. result and paths are borrowed: before
+ * either goes away, the object must be released with
+ * release_boinc_result or detached with detach_boinc_result.
+ *
+ * Returns NULL if there was a Python error, which is left set.
+ */
+PyObject* new_boinc_result(const RESULT& result, const std::vector<std::string> *paths);
+
+/**
+ * Counts of BoincResults and output_files lists that were allocated
+ * and reused since the process started.
+ */
+const BOINCRESULT_POOL_STATS& get_boincresult_pool_stats();
+
+/**
+ * Number of times user Python code may fail for a workunit before the
+ * workunit is quarantined. 0 never quarantines.
+ */
+extern int max_python_failures;
+
+/**
+ * Counts a failure of user Python code while handling workunit wuid.
+ * Rather than exit, the validator and assimilator retry the workunit
+ * later, until it has failed max_python_failures times. It is then
+ * added to the quarantine list and true is returned.
  */
-std::string result_init_string(const RESULT& res);
+bool record_python_failure(int wuid, const char *name);
+bool is_quarantined(int wuid);
 
 /**
- * For the given variable_name, output file info data is appended to 
- * the variable's "output_files" list.
+ * Forgets the failures of workunit wuid, e.g. once it has been
+ * assimilated. Quarantined workunits stay quarantined.
+ */
+void clear_python_failures(int wuid);
+
+/**
+ * Merges the DAG journals that Python code appended job states to since
+ * the last call into their DAG files, with
+ * boinctools.compact_dag_journals, so that tools that read DAG files
+ * see the states. Called at the end of each validator and assimilator
+ * pass.
+ *
+ * Returns 0 upon success, including when Python has not been started,
+ * and -1 otherwise.
+ */
+int compact_dag_journals();
+
+/**
+ * Returns the artifact cache described by the artifact_cache dict of the
+ * project init file, opening it on first use. Returns NULL if the project
+ * does not use an artifact cache or it could not be opened.
+ */
+ARTIFACT_CACHE* get_artifact_cache();
+
+/**
+ * Records the size, logical name and, for files no larger than the
+ * max_contents setting, the contents and MD5 digest of each output file
+ * of the result in the artifact cache. Larger files are only digested
+ * if the digests setting is true. Files are read through the
+ * descriptors in files, opened by open_files for paths, and files that
+ * are already cached with the same size and modification time are not
+ * read again.
+ *
+ * Returns 0 upon success, including when there is no cache, and -1 otherwise.
  */
-void load_paths(const std::string& variable_name, const RESULT& res, void *data);
+int cache_output_files(const RESULT& result, const std::vector<std::string>& paths, const std::vector<OPENED_FILE>& files);
 
 #endif
@@ -0,0 +1,726 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// This source code defines boinctools._native, a Python extension module
+// that gives boinctools access to the native routines used by the
+// validator. It is built by python/setup.py. boinctools falls back to
+// pure Python code if the extension has not been built.
+//
+// If setup.py is given a BOINC installation, USE_BOINC is defined and
+// the extension also wraps BOINC's dir_hier_path.
+//
+
+#include <Python.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "file_compare.h"
+#include "numeric_compare.h"
+#include "line_set_compare.h"
+#include "artifact_cache.h"
+#include "stage_files.h"
+#include "output_writer.h"
+#include "handoff_queue.h"
+#include "xml_fields.h"
+
+#ifdef USE_BOINC
+#include <sys/param.h>
+#include "sched_util_basic.h"
+#endif
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <unistd.h>
+
+// Destinations of append_output, kept open between calls
+static OUTPUT_WRITER output_writer;
+
+// Artifact caches opened by this process, by path
+static std::map<std::string, ARTIFACT_CACHE*> artifact_caches;
+
+// Returns NULL, with a Python exception set, upon error.
+static ARTIFACT_CACHE* open_artifact_cache(const char *path)
+{
+  std::map<std::string, ARTIFACT_CACHE*>::iterator it = artifact_caches.find(path);
+  if(it != artifact_caches.end())
+    return it->second;
+
+  ARTIFACT_CACHE *cache = new ARTIFACT_CACHE;
+  if(cache->open(path,0))
+    {
+      delete cache;
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+      return NULL;
+    }
+  artifact_caches[path] = cache;
+  return cache;
+}
+
+// Handoff queues opened by this process, by path. flock is shared with
+// forked children through the descriptor, so a child opens its own.
+static std::map<std::string, HANDOFF_QUEUE*> handoff_queues;
+static pid_t handoff_queues_pid = 0;
+
+// Returns NULL, with a Python exception set, upon error.
+static HANDOFF_QUEUE* open_handoff_queue(const char *path)
+{
+  if(handoff_queues_pid != getpid())
+    {
+      for(std::map<std::string, HANDOFF_QUEUE*>::iterator it = handoff_queues.begin();it != handoff_queues.end();it++)
+	delete it->second;
+      handoff_queues.clear();
+      handoff_queues_pid = getpid();
+    }
+
+  std::map<std::string, HANDOFF_QUEUE*>::iterator it = handoff_queues.find(path);
+  if(it != handoff_queues.end())
+    return it->second;
+
+  HANDOFF_QUEUE *queue = new HANDOFF_QUEUE;
+  if(queue->open(path,true))
+    {
+      delete queue;
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+      return NULL;
+    }
+  handoff_queues[path] = queue;
+  return queue;
+}
+
+static PyObject* native_files_equal(PyObject *self, PyObject *args)
+{
+  const char *path1 = NULL, *path2 = NULL;
+  bool equal = false;
+  int retval, saved_errno;
+
+  if(!PyArg_ParseTuple(args,"ss",&path1,&path2))
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = files_equal(path1,path2,equal);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    {
+      errno = saved_errno;
+      return PyErr_SetFromErrno(PyExc_IOError);
+    }
+
+  return PyBool_FromLong(equal);
+}
+
+static PyObject* native_numeric_files_equal(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *path1 = NULL, *path2 = NULL;
+  PyObject *columns = NULL;
+  NUMERIC_COMPARE_CONFIG config;
+  bool equal = false;
+  int retval, saved_errno;
+  static char *kwlist[] = {"path1","path2","abs_tol","rel_tol","columns",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"ss|ddO",kwlist,&path1,&path2,&config.default_tolerance.abs_tol,&config.default_tolerance.rel_tol,&columns))
+    return NULL;
+
+  if(columns != NULL && columns != Py_None)
+    {
+      Py_ssize_t num_columns = PySequence_Size(columns);
+      if(num_columns < 0)
+	return NULL;
+      for(Py_ssize_t i = 0;i < num_columns;i++)
+	{
+	  PyObject *column_tolerance = PySequence_GetItem(columns,i);// new reference
+	  int column;
+	  double abs_tol, rel_tol;
+	  if(column_tolerance == NULL)
+	    return NULL;
+	  if(!PyArg_ParseTuple(column_tolerance,"idd",&column,&abs_tol,&rel_tol))
+	    {
+	      Py_DECREF(column_tolerance);
+	      return NULL;
+	    }
+	  Py_DECREF(column_tolerance);
+	  config.columns[column] = NUMERIC_TOLERANCE(abs_tol,rel_tol);
+	}
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = numeric_files_equal(path1,path2,config,equal);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    {
+      errno = saved_errno;
+      return PyErr_SetFromErrno(PyExc_IOError);
+    }
+
+  return PyBool_FromLong(equal);
+}
+
+static PyObject* native_line_sets_equal(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *path1 = NULL, *path2 = NULL;
+  LINE_SET_CONFIG config;
+  int num_hashes = (int)config.num_hashes;
+  bool equal = false;
+  int retval, saved_errno;
+  static char *kwlist[] = {"path1","path2","min_similarity","num_hashes",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"ss|di",kwlist,&path1,&path2,&config.min_similarity,&num_hashes))
+    return NULL;
+  if(num_hashes <= 0)
+    {
+      PyErr_SetString(PyExc_ValueError,"num_hashes must be positive");
+      return NULL;
+    }
+  config.num_hashes = num_hashes;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = line_sets_equal(path1,path2,config,equal);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    {
+      errno = saved_errno;
+      return PyErr_SetFromErrno(PyExc_IOError);
+    }
+
+  return PyBool_FromLong(equal);
+}
+
+static PyObject* native_line_set_similarity(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *path1 = NULL, *path2 = NULL;
+  std::vector<uint64_t> sketch1, sketch2;
+  int num_hashes = (int)LINE_SET_CONFIG().num_hashes;
+  int retval, saved_errno;
+  static char *kwlist[] = {"path1","path2","num_hashes",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"ss|i",kwlist,&path1,&path2,&num_hashes))
+    return NULL;
+  if(num_hashes <= 0)
+    {
+      PyErr_SetString(PyExc_ValueError,"num_hashes must be positive");
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = line_sketch(path1,num_hashes,sketch1);
+  if(retval == 0)
+    retval = line_sketch(path2,num_hashes,sketch2);
+  saved_errno = errno;
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    {
+      errno = saved_errno;
+      return PyErr_SetFromErrno(PyExc_IOError);
+    }
+
+  return PyFloat_FromDouble(sketch_similarity(sketch1,sketch2,num_hashes));
+}
+
+static PyObject* native_artifact_cache_get(PyObject *self, PyObject *args)
+{
+  const char *path = NULL, *file_name = NULL;
+  int result_id, retval;
+  ARTIFACT_CACHE *cache;
+  ARTIFACT_INFO info;
+
+  if(!PyArg_ParseTuple(args,"sis",&path,&result_id,&file_name))
+    return NULL;
+  cache = open_artifact_cache(path);
+  if(cache == NULL)
+    return NULL;
+
+  retval = cache->get(result_id,file_name,info);
+  if(retval < 0)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+  if(retval > 0)
+    Py_RETURN_NONE;
+
+  if(info.has_contents)
+    return Py_BuildValue("{s:L,s:L,s:s#,s:s#,s:s#}",
+			 "size",info.size,"mtime",info.mtime,
+			 "digest",info.digest.data(),(int)info.digest.size(),
+			 "metadata",info.metadata.data(),(int)info.metadata.size(),
+			 "contents",info.contents.data(),(int)info.contents.size());
+  return Py_BuildValue("{s:L,s:L,s:s#,s:s#,s:O}",
+		       "size",info.size,"mtime",info.mtime,
+		       "digest",info.digest.data(),(int)info.digest.size(),
+		       "metadata",info.metadata.data(),(int)info.metadata.size(),
+		       "contents",Py_None);
+}
+
+static PyObject* native_artifact_cache_stats(PyObject *self, PyObject *args)
+{
+  const char *path = NULL;
+  ARTIFACT_CACHE *cache;
+
+  if(!PyArg_ParseTuple(args,"s",&path))
+    return NULL;
+  cache = open_artifact_cache(path);
+  if(cache == NULL)
+    return NULL;
+
+  const ARTIFACT_CACHE_STATS& stats = cache->get_stats();
+  return Py_BuildValue("{s:l,s:l,s:l,s:l,s:l,s:L}",
+		       "hits",stats.hits,"misses",stats.misses,
+		       "appends",stats.appends,"evictions",stats.evictions,
+		       "records",stats.records,"bytes",stats.bytes);
+}
+
+static PyObject* native_handoff_queue_append(PyObject *self, PyObject *args)
+{
+  const char *path = NULL, *payload = NULL;
+  int payload_len, retval;
+  HANDOFF_QUEUE *queue;
+
+  if(!PyArg_ParseTuple(args,"ss#",&path,&payload,&payload_len))
+    return NULL;
+  queue = open_handoff_queue(path);
+  if(queue == NULL)
+    return NULL;
+
+  std::string record(payload,payload_len);
+  Py_BEGIN_ALLOW_THREADS
+  retval = queue->append(record);
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+  Py_RETURN_NONE;
+}
+
+static PyObject* native_handoff_queue_claim(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *path = NULL;
+  double lease = 0;
+  int max_attempts = 0, retval;
+  unsigned long long seq;
+  std::string payload;
+  HANDOFF_QUEUE *queue;
+  static char *kwlist[] = {"path","lease","max_attempts",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"s|di",kwlist,&path,&lease,&max_attempts))
+    return NULL;
+  queue = open_handoff_queue(path);
+  if(queue == NULL)
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = queue->claim(lease,max_attempts,seq,payload);
+  Py_END_ALLOW_THREADS
+
+  if(retval < 0)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+  if(retval == 0)
+    Py_RETURN_NONE;
+  return Py_BuildValue("(Ks#)",seq,payload.data(),(int)payload.size());
+}
+
+// Acknowledges (release false) or returns a claimed record.
+static PyObject* finish_handoff_record(PyObject *args, bool release)
+{
+  const char *path = NULL;
+  unsigned long long seq;
+  int retval;
+  HANDOFF_QUEUE *queue;
+
+  if(!PyArg_ParseTuple(args,"sK",&path,&seq))
+    return NULL;
+  queue = open_handoff_queue(path);
+  if(queue == NULL)
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = release ? queue->release(seq) : queue->ack(seq);
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+  Py_RETURN_NONE;
+}
+
+static PyObject* native_handoff_queue_ack(PyObject *self, PyObject *args)
+{
+  return finish_handoff_record(args,false);
+}
+
+static PyObject* native_handoff_queue_release(PyObject *self, PyObject *args)
+{
+  return finish_handoff_record(args,true);
+}
+
+static PyObject* native_handoff_queue_stats(PyObject *self, PyObject *args)
+{
+  const char *path = NULL;
+  int retval;
+  HANDOFF_QUEUE *queue;
+  HANDOFF_QUEUE_STATS stats;
+
+  if(!PyArg_ParseTuple(args,"s",&path))
+    return NULL;
+  queue = open_handoff_queue(path);
+  if(queue == NULL)
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = queue->get_stats(stats);
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)path);
+  return Py_BuildValue("{s:l,s:l,s:l,s:d,s:d,s:L,s:L,s:L,s:L}",
+		       "depth",stats.depth,"pending",stats.pending,"claimed",stats.claimed,
+		       "oldest_age",stats.oldest_age,"drain_rate",stats.drain_rate,
+		       "appended",stats.appended,"acked",stats.acked,"dead",stats.dead,"size",stats.size);
+}
+
+static PyObject* native_stage_files(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  PyObject *pairs = NULL, *fast = NULL, *retval = NULL;
+  PyObject *overwrite = NULL, *set_grp_perms = NULL, *hard_link = NULL;
+  std::vector<std::string> sources, destinations;
+  std::vector<STAGE_RESULT> results;
+  STAGE_OPTIONS options;
+  static char *kwlist[] = {"pairs","overwrite","set_grp_perms","hard_link","threads",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"O|OOOi",kwlist,&pairs,&overwrite,&set_grp_perms,&hard_link,&options.threads))
+    return NULL;
+  if(overwrite != NULL)
+    options.overwrite = PyObject_IsTrue(overwrite);
+  if(set_grp_perms != NULL)
+    options.set_grp_perms = PyObject_IsTrue(set_grp_perms);
+  if(hard_link != NULL)
+    options.hard_link = PyObject_IsTrue(hard_link);
+
+  fast = PySequence_Fast(pairs,"pairs must be a sequence of (source, destination) tuples");// new reference
+  if(fast == NULL)
+    return NULL;
+  for(Py_ssize_t i = 0;i < PySequence_Fast_GET_SIZE(fast);i++)
+    {
+      const char *source = NULL, *destination = NULL;
+      if(!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(fast,i),"ss",&source,&destination))
+	{
+	  Py_DECREF(fast);
+	  return NULL;
+	}
+      sources.push_back(source);
+      destinations.push_back(destination);
+    }
+  Py_DECREF(fast);
+
+  Py_BEGIN_ALLOW_THREADS
+  stage_files(sources,destinations,options,results);
+  Py_END_ALLOW_THREADS
+
+  retval = PyList_New(results.size());
+  if(retval == NULL)
+    return NULL;
+  for(size_t i = 0;i < results.size();i++)
+    {
+      PyObject *result = Py_BuildValue("(si)",stage_method_name(results[i].method),results[i].error);
+      if(result == NULL)
+	{
+	  Py_DECREF(retval);
+	  return NULL;
+	}
+      PyList_SET_ITEM(retval,i,result);// steals the reference
+    }
+  return retval;
+}
+
+static PyObject* native_append_output(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *source = NULL, *destination = NULL, *separator = "\n";
+  int mode = 0660, retval;
+  static char *kwlist[] = {"source","destination","separator","mode",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"ss|si",kwlist,&source,&destination,&separator,&mode))
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = output_writer.append(source,destination,separator,mode);
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    return PyErr_SetFromErrnoWithFilename(PyExc_IOError,(char*)destination);
+  Py_RETURN_NONE;
+}
+
+static PyObject* native_sync_outputs(PyObject *self, PyObject *args)
+{
+  int retval;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = output_writer.sync();
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    return PyErr_SetFromErrno(PyExc_IOError);
+  Py_RETURN_NONE;
+}
+
+static PyObject* native_close_outputs(PyObject *self, PyObject *args)
+{
+  int retval;
+
+  Py_BEGIN_ALLOW_THREADS
+  retval = output_writer.close();
+  Py_END_ALLOW_THREADS
+
+  if(retval)
+    return PyErr_SetFromErrno(PyExc_IOError);
+  Py_RETURN_NONE;
+}
+
+static PyObject* native_set_output_sync_interval(PyObject *self, PyObject *args)
+{
+  double seconds;
+
+  if(!PyArg_ParseTuple(args,"d",&seconds))
+    return NULL;
+  output_writer.set_sync_interval(seconds);
+  Py_RETURN_NONE;
+}
+
+static PyObject* native_output_writer_stats(PyObject *self, PyObject *args)
+{
+  const OUTPUT_WRITER_STATS& stats = output_writer.get_stats();
+  return Py_BuildValue("{s:l,s:L,s:l,s:l,s:l}",
+		       "appends",stats.appends,
+		       "bytes",stats.bytes,
+		       "syncs",stats.syncs,
+		       "files_synced",stats.files_synced,
+		       "opens",stats.opens);
+}
+
+static PyObject* native_xml_fields(PyObject *self, PyObject *args)
+{
+  const char *doc = NULL;
+  int length = 0;
+  PyObject *tags, *fast, *fields;
+  std::vector<std::string> names;
+  std::vector<XML_FIELD> values;
+
+  if(!PyArg_ParseTuple(args,"s#O",&doc,&length,&tags))
+    return NULL;
+  fast = PySequence_Fast(tags,"tags must be a sequence of strings");
+  if(fast == NULL)
+    return NULL;
+  for(Py_ssize_t i = 0;i < PySequence_Fast_GET_SIZE(fast);i++)
+    {
+      PyObject *tag = PySequence_Fast_GET_ITEM(fast,i);
+      if(!PyString_Check(tag))
+	{
+	  Py_DECREF(fast);
+	  PyErr_SetString(PyExc_TypeError,"tags must be a sequence of strings");
+	  return NULL;
+	}
+      names.push_back(std::string(PyString_AS_STRING(tag),PyString_GET_SIZE(tag)));
+    }
+
+  find_xml_fields(doc,length,names,values);
+
+  fields = PyDict_New();
+  for(size_t i = 0;fields != NULL && i < names.size();i++)
+    {
+      PyObject *value = Py_None;
+      if(values[i].found)
+	value = PyString_FromStringAndSize(values[i].value.data(),values[i].value.size());
+      else
+	Py_INCREF(value);
+      if(value == NULL || PyDict_SetItem(fields,PySequence_Fast_GET_ITEM(fast,i),value))
+	Py_CLEAR(fields);
+      Py_XDECREF(value);
+    }
+  Py_DECREF(fast);
+  return fields;
+}
+
+#ifdef USE_BOINC
+// Sets path to the location of filename in the hierarchy under root.
+// Returns -1, with a Python exception set, upon error.
+static int hier_path(const char *filename, const char *root, int fanout, bool create, char *path)
+{
+  int retval;
+
+  errno = 0;
+  retval = dir_hier_path(filename,root,fanout,path,create);
+  if(retval)
+    {
+      if(errno)
+	PyErr_SetFromErrnoWithFilename(PyExc_OSError,(char*)filename);
+      else
+	PyErr_Format(PyExc_OSError,"dir_hier_path failed for %s (error %d)",filename,retval);
+      return -1;
+    }
+  return 0;
+}
+
+static PyObject* native_dir_hier_path(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *filename = NULL, *root = NULL;
+  int fanout;
+  PyObject *create = NULL;
+  char path[MAXPATHLEN];
+  static char *kwlist[] = {"filename","root","fanout","create",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"ssi|O",kwlist,&filename,&root,&fanout,&create))
+    return NULL;
+  if(hier_path(filename,root,fanout,create != NULL && PyObject_IsTrue(create),path))
+    return NULL;
+  return PyString_FromString(path);
+}
+
+static PyObject* native_dir_hier_paths(PyObject *self, PyObject *args, PyObject *kwds)
+{
+  const char *root = NULL;
+  int fanout;
+  bool do_create;
+  PyObject *filenames = NULL, *create = NULL, *fast = NULL, *paths = NULL;
+  char path[MAXPATHLEN];
+  static char *kwlist[] = {"filenames","root","fanout","create",NULL};
+
+  if(!PyArg_ParseTupleAndKeywords(args,kwds,"Osi|O",kwlist,&filenames,&root,&fanout,&create))
+    return NULL;
+  do_create = (create != NULL && PyObject_IsTrue(create));
+
+  fast = PySequence_Fast(filenames,"filenames must be a sequence");// new reference
+  if(fast == NULL)
+    return NULL;
+  Py_ssize_t num_files = PySequence_Fast_GET_SIZE(fast);
+  paths = PyList_New(num_files);
+  if(paths == NULL)
+    {
+      Py_DECREF(fast);
+      return NULL;
+    }
+  for(Py_ssize_t i = 0;i < num_files;i++)
+    {
+      const char *filename = PyString_AsString(PySequence_Fast_GET_ITEM(fast,i));
+      PyObject *pypath;
+      if(filename == NULL || hier_path(filename,root,fanout,do_create,path)
+	 || (pypath = PyString_FromString(path)) == NULL)
+	{
+	  Py_DECREF(paths);
+	  Py_DECREF(fast);
+	  return NULL;
+	}
+      PyList_SET_ITEM(paths,i,pypath);// steals the reference
+    }
+  Py_DECREF(fast);
+  return paths;
+}
+#endif
+
+static PyMethodDef native_methods[] = {
+  {"files_equal", native_files_equal, METH_VARARGS,
+   "files_equal(path1, path2) -> bool\n\n"
+   "Streams both files and returns True if their contents are identical."},
+  {"numeric_files_equal", (PyCFunction)native_numeric_files_equal, METH_VARARGS | METH_KEYWORDS,
+   "numeric_files_equal(path1, path2, abs_tol=0, rel_tol=0, columns=()) -> bool\n\n"
+   "Compares two text files token by token. Numbers must agree within\n"
+   "the tolerance of their column; other tokens must match exactly.\n"
+   "columns is a sequence of (column, abs_tol, rel_tol) tuples."},
+  {"line_sets_equal", (PyCFunction)native_line_sets_equal, METH_VARARGS | METH_KEYWORDS,
+   "line_sets_equal(path1, path2, min_similarity=1.0, num_hashes=256) -> bool\n\n"
+   "Compares the lines of two text files regardless of their order, after\n"
+   "normalizing white space and skipping blank lines. If min_similarity\n"
+   "is 1, the files must hold the same lines, as many times each.\n"
+   "Otherwise the MinHash estimate of the Jaccard similarity of their\n"
+   "sets of lines, from num_hashes hashes, must be at least min_similarity."},
+  {"line_set_similarity", (PyCFunction)native_line_set_similarity, METH_VARARGS | METH_KEYWORDS,
+   "line_set_similarity(path1, path2, num_hashes=256) -> float\n\n"
+   "MinHash estimate of the Jaccard similarity of the sets of lines of\n"
+   "two text files, as used by line_sets_equal."},
+  {"artifact_cache_get", native_artifact_cache_get, METH_VARARGS,
+   "artifact_cache_get(path, result_id, file_name) -> dict or None\n\n"
+   "Looks up an output file in the artifact cache at path. The dict has\n"
+   "the keys size, mtime, digest, metadata and contents (None if the\n"
+   "contents were not stored)."},
+  {"artifact_cache_stats", native_artifact_cache_stats, METH_VARARGS,
+   "artifact_cache_stats(path) -> dict\n\n"
+   "Hit, miss, append and eviction counts of this process for the\n"
+   "artifact cache at path, and its current number of records and size."},
+  {"handoff_queue_append", native_handoff_queue_append, METH_VARARGS,
+   "handoff_queue_append(path, payload)\n\n"
+   "Appends a record to the handoff queue at path, creating the queue if\n"
+   "needed. The record is on disk when this returns."},
+  {"handoff_queue_claim", (PyCFunction)native_handoff_queue_claim, METH_VARARGS | METH_KEYWORDS,
+   "handoff_queue_claim(path, lease=0, max_attempts=0) -> (seq, payload) or None\n\n"
+   "Claims the oldest record that is not acknowledged or claimed by a live\n"
+   "process. Claims older than lease seconds are taken over if lease is\n"
+   "positive. Records claimed max_attempts times are moved to the file\n"
+   "path + '.dead' if max_attempts is positive."},
+  {"handoff_queue_ack", native_handoff_queue_ack, METH_VARARGS,
+   "handoff_queue_ack(path, seq)\n\n"
+   "Removes a claimed record from the queue."},
+  {"handoff_queue_release", native_handoff_queue_release, METH_VARARGS,
+   "handoff_queue_release(path, seq)\n\n"
+   "Returns a claimed record to the queue."},
+  {"handoff_queue_stats", native_handoff_queue_stats, METH_VARARGS,
+   "handoff_queue_stats(path) -> dict\n\n"
+   "Depth, pending and claimed record counts, age in seconds of the oldest\n"
+   "record, drain rate in records per second, lifetime append,\n"
+   "acknowledgement and dead letter counts and file size of the queue at\n"
+   "path."},
+  {"stage_files", (PyCFunction)native_stage_files, METH_VARARGS | METH_KEYWORDS,
+   "stage_files(pairs, overwrite=True, set_grp_perms=True, hard_link=False, threads=4) -> list\n\n"
+   "Copies each (source, destination) pair on a pool of threads, by\n"
+   "reflink or copy_file_range, or by hard link if hard_link is True.\n"
+   "Returns a (method, errno) tuple for each pair, where method is one of\n"
+   "skipped, linked, cloned, copied or failed."},
+  {"append_output", (PyCFunction)native_append_output, METH_VARARGS | METH_KEYWORDS,
+   "append_output(source, destination, separator='\\n', mode=0660)\n\n"
+   "Appends the contents of source to destination, under an flock, and\n"
+   "keeps destination open for later appends. If destination does not\n"
+   "exist, it is created with mode; otherwise separator is written first.\n"
+   "Destinations are synced as a group on the sync interval."},
+  {"sync_outputs", native_sync_outputs, METH_NOARGS,
+   "sync_outputs()\n\n"
+   "Syncs every destination appended to since the last sync."},
+  {"close_outputs", native_close_outputs, METH_NOARGS,
+   "close_outputs()\n\n"
+   "Syncs and closes every destination."},
+  {"set_output_sync_interval", native_set_output_sync_interval, METH_VARARGS,
+   "set_output_sync_interval(seconds)\n\n"
+   "Seconds between group syncs of destinations (Default: 1). 0 syncs\n"
+   "after every append and a negative value only when sync_outputs or\n"
+   "close_outputs is called."},
+  {"output_writer_stats", native_output_writer_stats, METH_NOARGS,
+   "output_writer_stats() -> dict\n\n"
+   "Append, byte, group sync, file sync and open counts of this process."},
+  {"xml_fields", native_xml_fields, METH_VARARGS,
+   "xml_fields(text, tags) -> dict\n\n"
+   "Value of the first element of each name in tags, or None if there is\n"
+   "none, found in one pass over text. Values are stripped of white space,\n"
+   "CDATA and entities, as by BOINC's XML_PARSER::parse_str."},
+#ifdef USE_BOINC
+  {"dir_hier_path", (PyCFunction)native_dir_hier_path, METH_VARARGS | METH_KEYWORDS,
+   "dir_hier_path(filename, root, fanout, create=False) -> str\n\n"
+   "Path of filename in the directory hierarchy under root, as given by\n"
+   "BOINC's dir_hier_path. If create is True, the directory is created."},
+  {"dir_hier_paths", (PyCFunction)native_dir_hier_paths, METH_VARARGS | METH_KEYWORDS,
+   "dir_hier_paths(filenames, root, fanout, create=False) -> list\n\n"
+   "dir_hier_path for each of a sequence of file names."},
+#endif
+  {NULL, NULL, 0, NULL}
+};
+
+PyMODINIT_FUNC init_native(void)
+{
+  Py_InitModule3("_native",native_methods,"Native routines for boinctools");
+}
@@ -22,6 +22,12 @@
 #include <structmember.h>
 #include <vector>
 #include <string>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <utility>
+#include <map>
+#include <algorithm>
 
 #include "boinc/error_numbers.h"
 #include "boinc/boinc_db.h"
@@ -29,6 +35,9 @@
 #include "boinc/validate_util.h"
 
 #include "pyboinc.h"
+#include "validate_util2.h"
+#include "comparators.h"
+#include "prefetch.h"
 
 
 /**
@@ -37,33 +46,126 @@
  * This function then calls the Python functions boinctools.update_process,
  * with the result as an argument. This allows users to perform any
  * initialization functions they may wish to use.
+ *
+ * If the project uses an artifact cache, the output files are recorded
+ * in it for use by the comparators, assimilator and clean up code.
+ *
+ * The output files are opened in one batch, see open_files, and kept
+ * open for the comparators. If a file cannot be opened because its
+ * file system is unavailable, ERR_OPENDIR is returned so that the
+ * validator retries later. Other errors, except for a missing file,
+ * are permanent. Missing files are left for the validator to judge.
  * 
  */
 int init_result(RESULT& result, void*& data) 
 {
-  OUTPUT_FILE_INFO fi;
-  std::vector<std::string> *paths;
+  RESULT_FILES *files;
 
   int retval = 0;
   
-  paths = new std::vector<std::string>;
+  files = new RESULT_FILES;
+
+  get_output_file_paths(result,files->paths);
+  for(std::vector<std::string>::const_iterator path = files->paths.begin();path != files->paths.end();path++)
+    output_readahead.claim(*path);
 
-  get_output_file_paths(result,*paths);
+  open_files(files->paths,files->files);
+  for(size_t i = 0;i < files->files.size();i++)
+    {
+      int error = files->files[i].error;
+      if(error == 0)
+	continue;
+      if(is_transient_open_error(files->paths[i],error))
+	{
+	  fprintf(stderr,"Could not open %s, will retry. Reason: %s\n",files->paths[i].c_str(),strerror(error));
+	  retval = ERR_OPENDIR;
+	  break;
+	}
+      if(error != ENOENT)
+	{
+	  fprintf(stderr,"Could not open %s. Reason: %s\n",files->paths[i].c_str(),strerror(error));
+	  retval = ERR_FOPEN;
+	}
+    }
+  if(retval)
+    {
+      delete files;
+      data = NULL;
+      return retval;
+    }
 
-  data = (void*)paths;
+  data = (void*)files;
+
+  initialize_python();
+  if(cache_output_files(result,files->paths,files->files))
+    fprintf(stderr,"Could not cache output files of %s.\n",result.name);
 
   return retval;
 }
 
 
+/**
+ * Returns a new reference to the BoincResult of r. The object is built
+ * on first use and kept in the result's RESULT_FILES, so that a result
+ * that is compared several times, such as the canonical result in
+ * check_pair, is converted once. It reads r and its output paths until
+ * the RESULT_FILES is deleted.
+ *
+ * Returns NULL if there was a Python error.
+ */
+static PyObject* python_result(const RESULT& r, void *data)
+{
+  RESULT_FILES *files = (RESULT_FILES*)data;
+
+  // The cached object is only used for the RESULT it was built from.
+  if(files == NULL || (files->py_result != NULL && ((BoincResult*)files->py_result)->native != &r))
+    {
+      // Nothing would detach it before r goes away.
+      PyObject *py_result = new_boinc_result(r,(files != NULL) ? &files->paths : NULL);
+      if(py_result != NULL)
+	detach_boinc_result(py_result);
+      return py_result;
+    }
+  if(files->py_result == NULL)
+    files->py_result = new_boinc_result(r,&files->paths);
+  Py_XINCREF(files->py_result);
+  return files->py_result;
+}
+
+/**
+ * Called when the Python validator fails while comparing r1. The
+ * workunit is retried later, unless it has failed max_python_failures
+ * times, in which case it is quarantined and r1 is given a validate
+ * error.
+ */
+static int python_validate_error(RESULT& r1)
+{
+  if(PyErr_Occurred())
+    PyErr_Print();
+  if(!is_quarantined(r1.workunitid) && !record_python_failure(r1.workunitid,r1.name))
+    return VALIDATE_RETRY;
+  r1.outcome = RESULT_OUTCOME_VALIDATE_ERROR;
+  r1.validate_state = VALIDATE_STATE_INVALID;
+  return -1;
+}
+
 /**
  * Using the application id (appid) and the validators dict from the users Python code, this routine decides which user Python code to run to validate two results.
+ *
+ * If the native_validators dict names a native comparator for the appid,
+ * that comparator is used instead and Python validation code is skipped.
  */
 int compare_results(RESULT& r1, void* _data1, RESULT const&  r2, void* _data2, bool& match) 
 {
   PyObject *retval;
+  NATIVE_COMPARATOR native_compare;
 
   initialize_python();
+
+  native_compare = get_native_comparator(r1.appid);
+  if(native_compare != NULL)
+    return native_compare(r1,_data1,r2,_data2,match);
+
 #if 0 // OLD
   retval = py_user_code_on_results(2,&r1,_data1,&r2,_data2,"validators");
   if(retval == Py_None || retval == NULL)
@@ -82,161 +184,399 @@ int compare_results(RESULT& r1, void* _data1, RESULT const&  r2, void* _data2, b
 
   Py_XDECREF(retval);
 #else// NEW
-  std::string command;
-  
+  PyObject *module, *py_r1, *py_r2, *result;
+
+  if(is_quarantined(r1.workunitid))
+    return python_validate_error(r1);
+
   // Import Module
-  if(PyRun_SimpleString("import boinctools"))
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
     {
       fprintf(stderr,"Could not import boinctools python module.\n");
-      if(PyErr_Occurred())
-	PyErr_Print();
-      finalize_python();
-      exit(1);
+      return python_validate_error(r1);
     }
   
-  // Create Result Class
-  command = "res1 = " + result_init_string(r1);
-  if(PyRun_SimpleString(command.c_str()))
+  py_r1 = python_result(r1,_data1);
+  py_r2 = (py_r1 != NULL) ? python_result(r2,_data2) : NULL;
+  if(py_r2 == NULL)
     {
-      fprintf(stderr,"Could not create result object.\n");
-      fprintf(stderr,"Python command: %s",command.c_str());
-      if(PyErr_Occurred())
-	PyErr_Print();
-      finalize_python();
-      exit(1);
+      fprintf(stderr,"Could not create result objects.\n");
+      Py_XDECREF(py_r1);
+      Py_DECREF(module);
+      return python_validate_error(r1);
     }
-  load_paths("res1",r1,_data1);
 
-  command = "res2 = " + result_init_string(r2);
-  if(PyRun_SimpleString(command.c_str()))
+  result = PyObject_CallMethod(module,(char*)"validate",(char*)"(OO)",py_r1,py_r2);
+  Py_DECREF(py_r1);
+  Py_DECREF(py_r2);
+  Py_DECREF(module);
+  if(result == NULL)
     {
-      fprintf(stderr,"Could not create result object.\n");
-      fprintf(stderr,"Python command: %s",command.c_str());
+      fprintf(stderr,"Could not validate result objects.\n");
+      return python_validate_error(r1);
+    }
+
+  PyObject *str = PyObject_Str(result);
+  if(str)
+    printf("Valid? %s\n",PyString_AsString(str));
+  Py_XDECREF(str);
+  PyErr_Clear();
+  int truth = PyObject_IsTrue(result);
+  Py_DECREF(result);
+  if(truth < 0)
+    {
+      fprintf(stderr,"Could not check validity of results.\n");
+      return python_validate_error(r1);
+    }
+  match = truth;
+
+#endif
+
+  return 0;
+}
+
+// A result whose Python clean up has been deferred. Its BoincResult is
+// built when it is queued, so that RESULT and its data may be freed.
+struct DEFERRED_CLEAN {
+  int wuid;
+  std::string name;
+  PyObject *result;// owned by deferred_cleans
+};
+
+static std::vector<DEFERRED_CLEAN> deferred_cleans;
+static int clean_failures = 0;// consecutive failures of boinctools.clean_batch
+
+static void clear_deferred_cleans()
+{
+  for(std::vector<DEFERRED_CLEAN>::iterator clean = deferred_cleans.begin();clean != deferred_cleans.end();clean++)
+    Py_XDECREF(clean->result);
+  deferred_cleans.clear();
+}
+
+/**
+ * Frees the memory corresponding to the address stored in "data" and
+ * queues the result for the Python function boinctools.clean_batch,
+ * which is run by flush_cleanups. This keeps the Python clean up code,
+ * which may copy files and update DAGs, out of check_set and
+ * check_pair, so that the validator records its verdicts first.
+ */
+int cleanup_result(RESULT const& r, void* data) 
+{
+  DEFERRED_CLEAN clean;
+  RESULT_FILES *files = (RESULT_FILES*)data;
+
+  initialize_python();
+  clean.wuid = r.workunitid;
+  clean.name = r.name;
+  // A new object, rather than the one that was compared, so that the
+  // clean up code sees the result as it is now, e.g. its validate_state.
+  // It is detached, since r is gone by the time it is cleaned up.
+  clean.result = new_boinc_result(r,(files != NULL) ? &files->paths : NULL);
+  if(clean.result != NULL)
+    detach_boinc_result(clean.result);
+  delete files;
+  data = NULL;
+  if(clean.result == NULL)
+    {
+      // This will not work any better later.
+      fprintf(stderr,"Could not create result object. Skipping clean up of %s.\n",r.name);
       if(PyErr_Occurred())
 	PyErr_Print();
-      finalize_python();
-      exit(1);
+      return 0;
     }
-  load_paths("res2",r2,_data2);
+  deferred_cleans.push_back(clean);
 
-  command = "is_valid = boinctools.validate(res1,res2)";
-  if(PyRun_SimpleString(command.c_str()))
+  return 0;
+}
+
+size_t deferred_cleanups()
+{
+  return deferred_cleans.size();
+}
+
+/**
+ * Passes the results queued by cleanup_result to the Python function
+ * boinctools.clean_batch, in the order they were queued.
+ *
+ * If the Python code fails, the results stay queued and are passed
+ * again on the next call, so their clean up functions may run more than
+ * once. After max_python_failures failures in a row, the results are
+ * dropped from the queue. Returns 0 upon success and -1 otherwise.
+ */
+int flush_cleanups()
+{
+  PyObject *module, *clean_results, *retval;
+
+  if(deferred_cleans.empty())
+    return 0;
+
+  initialize_python();
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
     {
-      fprintf(stderr,"Could not validate result objects.\n");
-      fprintf(stderr,"Python command: %s",command.c_str());
+      fprintf(stderr,"Could not import boinctools python module.\n");
       if(PyErr_Occurred())
 	PyErr_Print();
-      finalize_python();
-      exit(1);
+      return -1;
     }
 
-  PyObject *m = PyImport_AddModule("__main__");
-  PyObject *result = PyObject_GetAttrString(m,"is_valid");
-  if(result != NULL)
+  clean_results = PyList_New(deferred_cleans.size());
+  if(clean_results == NULL)
     {
-      PyObject *str = PyObject_Str(result);
-      if(str)
-	printf("Valid? %s\n",PyString_AsString(str));
-      match = PyObject_IsTrue(result);
-      Py_XDECREF(str);
+      Py_DECREF(module);
+      PyErr_Print();
+      return -1;
     }
-  else
+  for(size_t i = 0;i < deferred_cleans.size();i++)
     {
-      fprintf(stderr,"Could not check validity of results.\n");
+      Py_INCREF(deferred_cleans[i].result);
+      PyList_SET_ITEM(clean_results,i,deferred_cleans[i].result);// steals the reference
+    }
+
+  retval = PyObject_CallMethod(module,(char*)"clean_batch",(char*)"(O)",clean_results);
+  Py_DECREF(clean_results);
+  Py_DECREF(module);
+  if(retval == NULL)
+    {
+      fprintf(stderr,"Could not clean result objects.\n");
       if(PyErr_Occurred())
 	PyErr_Print();
-      finalize_python();
-      exit(1);
+      if(max_python_failures <= 0 || ++clean_failures < max_python_failures)
+	return -1;
+      for(std::vector<DEFERRED_CLEAN>::const_iterator clean = deferred_cleans.begin();clean != deferred_cleans.end();clean++)
+	fprintf(stderr,"Giving up clean up of %s (workunit %d).\n",clean->name.c_str(),clean->wuid);
+      clear_deferred_cleans();
+      clean_failures = 0;
+      return -1;
     }
-  Py_XDECREF(result);
-
-#endif
+  Py_DECREF(retval);
+  clear_deferred_cleans();
+  clean_failures = 0;
 
   return 0;
 }
 
+// Canonical results of the workunits finished since the last call to
+// continue_children, in the order they were finished.
+static std::vector<PyObject*> finished_results;
+static int continue_failures = 0;// consecutive failures of boinctools.continue_children_batch
+
+static void clear_finished_results()
+{
+  for(std::vector<PyObject*>::iterator result = finished_results.begin();result != finished_results.end();result++)
+    Py_XDECREF(*result);
+  finished_results.clear();
+}
+
 /**
- * This function does two things. First, it calls the Python function
- * boinctools.continue_children. This function may be used to start processes
- * after the work unit has finished. Second, it frees the memory corresponding
- * to the address stored in "data". 
+ * Queues the canonical result of a workunit that has just been given
+ * one, so that its successors are released by continue_children along
+ * with those of the other workunits finished in the pass. The result
+ * object is detached, since canonical is gone by then.
  */
-int cleanup_result(RESULT const& r, void* data) 
+void queue_finished_workunit(RESULT const& canonical)
 {
-  PyObject *retval = NULL;
-  PyObject *result = NULL;
+  PyObject *result;
 
   initialize_python();
-#if 0// OLD
+  result = new_boinc_result(canonical,NULL);
+  if(result == NULL)
+    {
+      fprintf(stderr,"Could not create result object. Successors of %s are not released.\n",canonical.name);
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return;
+    }
+  detach_boinc_result(result);
+  finished_results.push_back(result);
+}
 
-  retval = py_user_code_on_results(1,&r,data,NULL,NULL,"cleaners");
+size_t finished_workunits()
+{
+  return finished_results.size();
+}
 
-  if(retval == Py_None || retval == NULL)
+/**
+ * Passes the canonical results queued by queue_finished_workunit to the
+ * Python function boinctools.continue_children_batch in one call, so
+ * that the successors of every workunit finished in a pass are found
+ * and submitted together. It is called at the end of each pass, after
+ * flush_cleanups, so that the output of the finished workunits is in
+ * place before their successors are created.
+ *
+ * If the Python code fails, the results stay queued for the next pass,
+ * as in flush_cleanups, so the batch functions should skip successors
+ * that have already been submitted. Returns 0 upon success and -1
+ * otherwise.
+ */
+int continue_children()
+{
+  PyObject *module, *results, *retval;
+
+  if(finished_results.empty())
+    return 0;
+
+  initialize_python();
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
     {
-      fprintf(stderr,"There was a python error when cleaning %s.\nExiting.\n",r.name);
-      finalize_python();
-      exit(1);
+      fprintf(stderr,"Could not import boinctools python module.\n");
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return -1;
     }
-  Py_DECREF(retval);
-  
-  result = py_boinctools_on_result(r,"continue_children");
-  Py_XDECREF(result);
-    
-  if(PyErr_Occurred())
+
+  results = PyList_New(finished_results.size());
+  if(results == NULL)
     {
-      printf("%s.%s failed\n","boinctools","continue_children");
+      Py_DECREF(module);
       PyErr_Print();
-      if(data != NULL)
+      return -1;
+    }
+  for(size_t i = 0;i < finished_results.size();i++)
+    {
+      Py_INCREF(finished_results[i]);
+      PyList_SET_ITEM(results,i,finished_results[i]);// steals the reference
+    }
+
+  retval = PyObject_CallMethod(module,(char*)"continue_children_batch",(char*)"(O)",results);
+  Py_DECREF(results);
+  Py_DECREF(module);
+  if(retval == NULL)
+    {
+      fprintf(stderr,"Could not release successors of %d workunits.\n",(int)finished_results.size());
+      if(PyErr_Occurred())
+	PyErr_Print();
+      if(max_python_failures <= 0 || ++continue_failures < max_python_failures)
+	return -1;
+      for(std::vector<PyObject*>::const_iterator result = finished_results.begin();result != finished_results.end();result++)
 	{
-	  delete (std::vector<std::string>*)data;
-	  data = NULL;
+	  PyObject *name = ((BoincResult*)*result)->name;
+	  fprintf(stderr,"Giving up releasing successors of %s.\n",(name != NULL) ? PyString_AsString(name) : "a result");
 	}
-
-      return 1;
+      clear_finished_results();
+      continue_failures = 0;
+      return -1;
     }
-  
-#else// New
-  std::string command;
-  
-  if(PyRun_SimpleString("import boinctools"))
+  Py_DECREF(retval);
+  clear_finished_results();
+  continue_failures = 0;
+
+  return 0;
+}
+
+static std::map<int, bool> validation_priority_cache;
+
+/**
+ * Returns true if the validation_priorities dict of the init file names
+ * a function that orders the workunits of appid. The answer is kept for
+ * the life of the validator, as native_validators entries are.
+ */
+bool has_validation_priority(int appid)
+{
+  std::map<int, bool>::const_iterator cached;
+  PyObject *module, *name;
+  bool has_priority;
+
+  cached = validation_priority_cache.find(appid);
+  if(cached != validation_priority_cache.end())
+    return cached->second;
+
+  initialize_python();
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
     {
       fprintf(stderr,"Could not import boinctools python module.\n");
       if(PyErr_Occurred())
 	PyErr_Print();
-      finalize_python();
-      exit(1);
+      return false;
     }
-  
-  // Create Result Class
-  command = "res1 = " + result_init_string(r);
-  if(PyRun_SimpleString(command.c_str()))
+  name = PyObject_CallMethod(module,(char*)"validation_priority",(char*)"i",appid);
+  Py_DECREF(module);
+  if(name == NULL)
     {
-      fprintf(stderr,"Could not create result object.\n");
-      fprintf(stderr,"Python command: %s",command.c_str());
+      fprintf(stderr,"Could not look up validation priority for %d.\n",appid);
       if(PyErr_Occurred())
 	PyErr_Print();
-      finalize_python();
-      exit(1);
+      return false;
     }
-  load_paths("res1",r,data);
-  
-  if(PyRun_SimpleString("boinctools.clean(res1)"))
+  has_priority = (name != Py_None);
+  Py_DECREF(name);
+
+  validation_priority_cache[appid] = has_priority;
+  return has_priority;
+}
+
+// Sorts indices by descending score, keeping ties in their original order.
+struct BY_SCORE {
+  const std::vector<double>& scores;
+
+  BY_SCORE(const std::vector<double>& s) : scores(s) {}
+  bool operator()(size_t a, size_t b) const {return scores[a] > scores[b];}
+};
+
+/**
+ * Scores the workunits named in names with the Python function
+ * boinctools.validation_scores and sets order to the indices of names,
+ * highest score first. Workunits with equal scores keep their order.
+ *
+ * Returns 0 upon success and -1 otherwise, in which case order is the
+ * indices in their original order.
+ */
+int order_workunits(int appid, const std::vector<std::string>& names, std::vector<size_t>& order)
+{
+  PyObject *module, *py_names, *py_scores;
+  std::vector<double> scores;
+  int retval = 0;
+
+  order.resize(names.size());
+  for(size_t i = 0;i < names.size();i++)
+    order[i] = i;
+  if(names.size() < 2)
+    return 0;
+
+  initialize_python();
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
     {
-      fprintf(stderr,"Could not clean result objects.\n");
-      fprintf(stderr,"Python command: %s",command.c_str());
+      fprintf(stderr,"Could not import boinctools python module.\n");
       if(PyErr_Occurred())
 	PyErr_Print();
-      finalize_python();
-      exit(1);
+      return -1;
     }
+  py_names = PyList_New(names.size());
+  if(py_names == NULL)
+    {
+      Py_DECREF(module);
+      PyErr_Print();
+      return -1;
+    }
+  for(size_t i = 0;i < names.size();i++)
+    PyList_SET_ITEM(py_names,i,PyString_FromString(names[i].c_str()));// steals the reference
 
-#endif
-
-  if(data != NULL)
+  py_scores = PyObject_CallMethod(module,(char*)"validation_scores",(char*)"(iO)",appid,py_names);
+  Py_DECREF(py_names);
+  Py_DECREF(module);
+  if(py_scores == NULL || py_scores == Py_None || PySequence_Size(py_scores) != (Py_ssize_t)names.size())
+    retval = -1;
+  for(size_t i = 0;retval == 0 && i < names.size();i++)
     {
-      delete (std::vector<std::string>*)data;
-      data = NULL;
+      PyObject *score = PySequence_GetItem(py_scores,i);// new reference
+      scores.push_back((score != NULL) ? PyFloat_AsDouble(score) : -1);
+      Py_XDECREF(score);
+      if(PyErr_Occurred())
+	retval = -1;
+    }
+  Py_XDECREF(py_scores);
+  if(retval)
+    {
+      fprintf(stderr,"Could not score workunits of %d for validation.\n",appid);
+      if(PyErr_Occurred())
+	PyErr_Print();
+      return -1;
     }
 
+  std::stable_sort(order.begin(),order.end(),BY_SCORE(scores));
   return 0;
 }
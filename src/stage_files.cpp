@@ -0,0 +1,280 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Copies workunit input files into the download hierarchy. Files are
+// handed out to a small pool of threads, so that the latency of network
+// storage overlaps, and each copy is done in the kernel where possible.
+// This code does not depend on BOINC and is used by the boinctools
+// Python extension.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "stage_files.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+#define STAGE_BUFFER_SIZE (1 << 20)
+#define STAGE_MAX_THREADS 64
+
+#define GROUP_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
+
+struct STAGE_BATCH {
+  const std::vector<std::string> *sources;
+  const std::vector<std::string> *destinations;
+  const STAGE_OPTIONS *options;
+  std::vector<STAGE_RESULT> *results;
+  size_t next;// index of the next file to hand out
+  pthread_mutex_t lock;
+};
+
+// Copies in the kernel. Returns 0 upon success, 1 if copy_file_range
+// is not supported for this pair of files and -1 upon error.
+static int kernel_copy(int in, int out, off_t size)
+{
+#ifdef SYS_copy_file_range
+  ssize_t ncopied;
+  off_t total = 0;
+
+  while(total < size)
+    {
+      ncopied = syscall(SYS_copy_file_range,in,NULL,out,NULL,(size_t)(size - total),0);
+      if(ncopied < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  if(total == 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+	    return 1;
+	  return -1;
+	}
+      if(ncopied == 0)
+	break;// source was truncated
+      total += ncopied;
+    }
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+static int user_copy(int in, int out)
+{
+  std::vector<char> buffer(STAGE_BUFFER_SIZE);
+  ssize_t nread, nwritten;
+
+  while(1)
+    {
+      nread = read(in,&buffer[0],buffer.size());
+      if(nread < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if(nread == 0)
+	return 0;
+      for(ssize_t offset = 0;offset < nread;offset += nwritten)
+	{
+	  nwritten = write(out,&buffer[offset],nread - offset);
+	  if(nwritten < 0)
+	    {
+	      if(errno == EINTR)
+		{
+		  nwritten = 0;
+		  continue;
+		}
+	      return -1;
+	    }
+	}
+    }
+}
+
+static void stage_one(const std::string& source, const std::string& destination, const STAGE_OPTIONS& options, STAGE_RESULT& result)
+{
+  struct stat st;
+  int in, out, retval;
+
+  result.method = STAGE_FAILED;
+  result.error = 0;
+
+  if(!options.overwrite && access(destination.c_str(),F_OK) == 0)
+    {
+      result.method = STAGE_SKIPPED;
+      return;
+    }
+
+  if(options.hard_link)
+    {
+      if(options.overwrite && unlink(destination.c_str()) && errno != ENOENT)
+	{
+	  result.error = errno;
+	  return;
+	}
+      if(link(source.c_str(),destination.c_str()) == 0)
+	{
+	  if(options.set_grp_perms && chmod(destination.c_str(),GROUP_PERMS))
+	    {
+	      result.error = errno;
+	      return;
+	    }
+	  result.method = STAGE_LINKED;
+	  return;
+	}
+      // e.g. EXDEV across file systems. Copy instead.
+    }
+
+  in = open(source.c_str(),O_RDONLY);
+  if(in < 0 || fstat(in,&st))
+    {
+      result.error = errno;
+      if(in >= 0)
+	close(in);
+      return;
+    }
+  // Staged earlier as a hard link. Truncating it would destroy the source.
+  struct stat dest_st;
+  if(stat(destination.c_str(),&dest_st) == 0 && dest_st.st_dev == st.st_dev && dest_st.st_ino == st.st_ino)
+    {
+      close(in);
+      if(options.set_grp_perms && chmod(destination.c_str(),GROUP_PERMS))
+	{
+	  result.error = errno;
+	  return;
+	}
+      result.method = STAGE_LINKED;
+      return;
+    }
+  // As with cp, a new file gets the mode of the source and an existing
+  // one keeps its own, unless set_grp_perms overrides both.
+  out = open(destination.c_str(),O_WRONLY | O_CREAT | O_TRUNC,st.st_mode & 0777);
+  if(out < 0)
+    {
+      result.error = errno;
+      close(in);
+      return;
+    }
+
+  retval = 1;
+#ifdef FICLONE
+  if(ioctl(out,FICLONE,in) == 0)
+    {
+      result.method = STAGE_CLONED;
+      retval = 0;
+    }
+#endif
+  if(retval > 0)
+    {
+      retval = kernel_copy(in,out,st.st_size);
+      if(retval > 0)
+	retval = user_copy(in,out);
+      if(retval == 0)
+	result.method = STAGE_COPIED;
+    }
+  if(retval == 0 && options.set_grp_perms && fchmod(out,GROUP_PERMS))
+    retval = -1;
+
+  if(retval)
+    {
+      result.method = STAGE_FAILED;
+      result.error = errno;
+    }
+  if(close(out) && retval == 0)
+    {
+      result.method = STAGE_FAILED;
+      result.error = errno;
+    }
+  close(in);
+}
+
+static void* stage_worker(void *arg)
+{
+  STAGE_BATCH *batch = (STAGE_BATCH*)arg;
+  size_t index;
+
+  while(1)
+    {
+      pthread_mutex_lock(&batch->lock);
+      index = batch->next++;
+      pthread_mutex_unlock(&batch->lock);
+      if(index >= batch->sources->size())
+	break;
+      stage_one((*batch->sources)[index],(*batch->destinations)[index],*batch->options,(*batch->results)[index]);
+    }
+  return NULL;
+}
+
+int stage_files(const std::vector<std::string>& sources, const std::vector<std::string>& destinations, const STAGE_OPTIONS& options, std::vector<STAGE_RESULT>& results)
+{
+  STAGE_BATCH batch;
+  std::vector<pthread_t> threads;
+  int num_threads, failures = 0;
+
+  results.assign(sources.size(),STAGE_RESULT());
+  if(destinations.size() != sources.size())
+    {
+      for(size_t i = 0;i < results.size();i++)
+	results[i].error = EINVAL;
+      return results.size();
+    }
+
+  batch.sources = &sources;
+  batch.destinations = &destinations;
+  batch.options = &options;
+  batch.results = &results;
+  batch.next = 0;
+  pthread_mutex_init(&batch.lock,NULL);
+
+  num_threads = options.threads;
+  if(num_threads > STAGE_MAX_THREADS)
+    num_threads = STAGE_MAX_THREADS;
+  if((size_t)num_threads > sources.size())
+    num_threads = sources.size();
+
+  // The calling thread works too, so that nothing is lost if threads
+  // cannot be created.
+  for(int i = 1;i < num_threads;i++)
+    {
+      pthread_t thread;
+      if(pthread_create(&thread,NULL,stage_worker,&batch))
+	break;
+      threads.push_back(thread);
+    }
+  stage_worker(&batch);
+  for(size_t i = 0;i < threads.size();i++)
+    pthread_join(threads[i],NULL);
+  pthread_mutex_destroy(&batch.lock);
+
+  for(size_t i = 0;i < results.size();i++)
+    if(results[i].method == STAGE_FAILED)
+      failures++;
+  return failures;
+}
+
+const char* stage_method_name(STAGE_METHOD method)
+{
+  switch(method)
+    {
+    case STAGE_SKIPPED: return "skipped";
+    case STAGE_LINKED: return "linked";
+    case STAGE_CLONED: return "cloned";
+    case STAGE_COPIED: return "copied";
+    default: return "failed";
+    }
+}
@@ -0,0 +1,57 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef STAGE_FILES_H
+#define STAGE_FILES_H
+
+#include <string>
+#include <vector>
+
+enum STAGE_METHOD {
+  STAGE_FAILED,
+  STAGE_SKIPPED,// destination existed and overwrite was false
+  STAGE_LINKED,// hard link
+  STAGE_CLONED,// reflink, sharing blocks copy on write
+  STAGE_COPIED// copy_file_range, or read and write
+};
+
+struct STAGE_OPTIONS {
+  bool overwrite;// replace existing destinations
+  bool set_grp_perms;// make destinations user and group read/write only
+  bool hard_link;// hard link when possible instead of copying
+  int threads;
+
+  STAGE_OPTIONS() : overwrite(true), set_grp_perms(true), hard_link(false), threads(4) {}
+};
+
+struct STAGE_RESULT {
+  STAGE_METHOD method;
+  int error;// errno if method is STAGE_FAILED
+
+  STAGE_RESULT() : method(STAGE_FAILED), error(0) {}
+};
+
+/**
+ * Copies each sources[i] to destinations[i] on a pool of threads.
+ *
+ * A file is reflinked if the file system supports it, and otherwise
+ * copied in the kernel with copy_file_range, falling back to read and
+ * write. With hard_link, a hard link is tried first. A linked file
+ * shares its permissions with the source, so set_grp_perms changes
+ * the source too. Permissions are set on the open destination, in the
+ * same pass as the copy.
+ *
+ * results is resized to match sources. A failure for one file does not
+ * stop the others.
+ *
+ * Returns the number of files that failed.
+ */
+int stage_files(const std::vector<std::string>& sources, const std::vector<std::string>& destinations, const STAGE_OPTIONS& options, std::vector<STAGE_RESULT>& results);
+
+const char* stage_method_name(STAGE_METHOD method);
+
+#endif
@@ -37,6 +37,83 @@
 
 using std::vector;
 
+// Compares results i and j, counting the comparison.
+// A comparison that fails counts as a mismatch.
+// If compare_results() asks for the WU to be retried, retry is set.
+//
+static bool results_match(
+    vector<RESULT>& results, vector<void*>& data, int i, int j,
+    int& ncompares, bool& retry
+) {
+    bool match = false;
+    int retval;
+
+    ++ncompares;
+    retval = compare_results(results[i], data[i], results[j], data[j], match);
+    if (retval) {
+        log_messages.printf(MSG_CRITICAL,
+            "results_match: compare_results([RESULT#%d %s], [RESULT#%d %s]) failed%s\n",
+            results[i].id, results[i].name, results[j].id, results[j].name,
+            retval == VALIDATE_RETRY ? "; will retry" : ""
+        );
+        if (retval == VALIDATE_RETRY) retry = true;
+        return false;
+    }
+    return match;
+}
+
+// check_set() for --transitive_compare, where compare_results()
+// is an equivalence relation.
+// The results are partitioned into disjoint sets of matching results.
+// Each result is compared with the representative (first member)
+// of each set until it matches one, and joins that set;
+// otherwise it becomes the representative of a new set.
+// Representatives never match each other,
+// so a set is never merged with another and each result's parent
+// is its representative.
+// As soon as a set reaches quorum, its representative is canonical,
+// the members of other sets are invalid,
+// and the results not yet placed are compared with the canonical result only.
+//
+static void check_classes(
+    vector<RESULT>& results, vector<void*>& data, vector<bool>& had_error,
+    int min_valid, int& canonicalid, int& ncompares, bool& retry
+) {
+    int n = results.size();
+    vector<int> parent(n, -1);
+    vector<int> set_size(n, 0);
+    vector<int> reps;
+    int i, j, quorum = -1;
+
+    for (i=0; i<n && quorum<0; i++) {
+        if (had_error[i]) continue;
+        parent[i] = i;
+        for (j=0; j<(int)reps.size(); j++) {
+            if (results_match(results, data, i, reps[j], ncompares, retry)) {
+                parent[i] = reps[j];
+                break;
+            }
+            if (retry) return;
+        }
+        if (parent[i] == i) reps.push_back(i);
+        if (++set_size[parent[i]] >= min_valid) quorum = parent[i];
+    }
+    if (quorum < 0) return;
+
+    for (; i<n; i++) {
+        if (had_error[i]) continue;
+        if (results_match(results, data, i, quorum, ncompares, retry)) {
+            parent[i] = quorum;
+        }
+        if (retry) return;
+    }
+    for (j=0; j<n; j++) {
+        if (had_error[j]) continue;
+        results[j].validate_state = parent[j] == quorum ? VALIDATE_STATE_VALID : VALIDATE_STATE_INVALID;
+    }
+    canonicalid = results[quorum].id;
+}
+
 // Given a set of results, check for a canonical result,
 // i.e. a set of at least min_quorum/2+1 results for which
 // that are equivalent according to check_pair().
@@ -53,7 +130,7 @@ int check_set(
 ) {
     vector<void*> data;
     vector<bool> had_error;
-    int i, j, neq = 0, n, retval;
+    int i, j, neq = 0, n, retval, ncompares = 0;
     int min_valid = wu.min_quorum/2+1;
 
     retry = false;
@@ -92,6 +169,10 @@ int check_set(
 
     // Compare results
 
+    if (transitive_compare) {
+        check_classes(results, data, had_error, min_valid, canonicalid, ncompares, retry);
+        goto report;
+    }
     for (i=0; i<n; i++) {
         if (had_error[i]) continue;
         vector<bool> matches;
@@ -99,20 +180,13 @@ int check_set(
         neq = 0;
         for (j=0; j!=n; j++) {
             if (had_error[j]) continue;
-            bool match = false;
-            if (i == j) {
-                ++neq;
-                matches[j] = true;
-            } else if (compare_results(results[i], data[i], results[j], data[j], match)) {
-                log_messages.printf(MSG_CRITICAL,
-                    "generic_check_set: check_pair_with_data([RESULT#%d %s], [RESULT#%d %s]) failed\n",
-                    results[i].id, results[i].name, results[j].id, results[j].name
-                );
-            } else if (match) {
+            if (i == j || results_match(results, data, i, j, ncompares, retry)) {
                 ++neq;
                 matches[j] = true;
             }
+            if (retry) break;
         }
+        if (retry) break;
         if (neq >= min_valid) {
 
             // set validate state for each result
@@ -126,6 +200,13 @@ int check_set(
         }
     }
 
+report:
+    log_messages.printf(MSG_NORMAL,
+        "[WU#%d %s] check_set: %d results, %d comparisons%s\n",
+        wu.id, wu.name, good_results, ncompares,
+        transitive_compare ? " (transitive)" : ""
+    );
+
 cleanup:
 
     for (i=0; i<n; i++) {
@@ -134,13 +215,29 @@ cleanup:
     return 0;
 }
 
+// The canonical result of the WU being handled.
+// check_pair() initializes it on first use and reuses it for each new
+// result, so that its files are opened and its Python object built
+// once per WU. release_canonical_result() cleans it up.
+//
+static RESULT canonical_result;
+static void* canonical_data = NULL;
+static bool have_canonical = false;
+
+void release_canonical_result() {
+    if (!have_canonical) return;
+    cleanup_result(canonical_result, canonical_data);
+    canonical_data = NULL;
+    have_canonical = false;
+}
+
 // r1 is the new result; r2 is canonical result
 //
 void check_pair(RESULT& r1, RESULT& r2, bool& retry) {
     void* data1;
     void* data2;
     int retval;
-    bool match;
+    bool match = false;
 
     retry = false;
     retval = init_result(r1, data1);
@@ -161,28 +258,42 @@ void check_pair(RESULT& r1, RESULT& r2, bool& retry) {
         return;
     }
 
-    retval = init_result(r2, data2);
-    if (retval == ERR_OPENDIR) {
+    if (!have_canonical || !r2.id || r2.id != canonical_result.id) {
+        release_canonical_result();
+        retval = init_result(r2, data2);
+        if (retval == ERR_OPENDIR) {
+            log_messages.printf(MSG_CRITICAL,
+                "check_pair: init_result([RESULT#%d %s]) transient failure 2\n",
+                r2.id, r2.name
+            );
+            cleanup_result(r1, data1);
+            retry = true;
+            return;
+        } else if (retval) {
+            log_messages.printf(MSG_CRITICAL,
+                "check_pair: init_result([RESULT#%d %s]) perm failure2\n",
+                r2.id, r2.name
+            );
+            cleanup_result(r1, data1);
+            r1.outcome = RESULT_OUTCOME_VALIDATE_ERROR;
+            r1.validate_state = VALIDATE_STATE_INVALID;
+            return;
+        }
+        canonical_result = r2;
+        canonical_data = data2;
+        have_canonical = true;
+    }
+
+    retval = compare_results(r1, data1, r2, canonical_data, match);
+    if (retval == VALIDATE_RETRY) {
         log_messages.printf(MSG_CRITICAL,
-            "check_pair: init_result([RESULT#%d %s]) transient failure 2\n",
-            r2.id, r2.name
+            "check_pair: compare_results([RESULT#%d %s]) failed; will retry\n",
+            r1.id, r1.name
         );
-        cleanup_result(r1, data1);
         retry = true;
-        return;
-    } else if (retval) {
-        log_messages.printf(MSG_CRITICAL,
-            "check_pair: init_result([RESULT#%d %s]) perm failure2\n",
-            r2.id, r2.name
-        );
-        cleanup_result(r1, data1);
-        r1.outcome = RESULT_OUTCOME_VALIDATE_ERROR;
-        r1.validate_state = VALIDATE_STATE_INVALID;
-        return;
+    } else {
+        r1.validate_state = match?VALIDATE_STATE_VALID:VALIDATE_STATE_INVALID;
     }
-
-    retval = compare_results(r1, data1, r2, data2, match);
-    r1.validate_state = match?VALIDATE_STATE_VALID:VALIDATE_STATE_INVALID;
     cleanup_result(r1, data1);
-    cleanup_result(r2, data2);
+    if (!r2.id) release_canonical_result();
 }
@@ -18,17 +18,47 @@
 #ifndef _VALIDATE_UTIL2_
 #define _VALIDATE_UTIL2_
 
+#include <string>
 #include <vector>
 
 #include "boinc/boinc_db.h"
 
+#define VALIDATE_RETRY 123322
+    // if compare_results() returns this, e.g. because the Python
+    // validator raised an exception, the WU is retried later
+
 extern int init_result(RESULT&, void*&);
 extern int compare_results(RESULT &, void*, RESULT const&, void*, bool&);
 extern int cleanup_result(RESULT const&, void*);
+extern size_t deferred_cleanups();
+    // number of results whose clean up is waiting for flush_cleanups()
+extern int flush_cleanups();
+extern void queue_finished_workunit(RESULT const& canonical);
+    // queue a WU that got a canonical result for continue_children()
+extern size_t finished_workunits();
+extern int continue_children();
+    // pass the queued WUs to boinctools.continue_children_batch
+extern int max_python_failures;
+    // the --max_python_failures cmdline arg
+extern void clear_python_failures(int wuid);
+    // forget the Python failures of a WU that was handled without a retry
+extern bool has_validation_priority(int appid);
+    // whether the validation_priorities dict names a function for appid
+extern int order_workunits(
+    int appid, const std::vector<std::string>& names,
+    std::vector<size_t>& order
+);
+    // set order to the indices of names, highest validation_scores first
+extern void print_memory_report(size_t max_types);
+    // log RSS, heap and Python object counts
+extern int compact_dag_journals();
+    // write the DAG job states recorded in this pass to the DAG files
 extern double compute_granted_credit(WORKUNIT&, std::vector<RESULT>& results);
 extern int check_set(
     std::vector<RESULT>& results, WORKUNIT& wu,
     int& canonicalid, double& credit_deprecated, bool& retry
 );
 extern void check_pair(RESULT& r1, RESULT& r2, bool& retry);
+extern void release_canonical_result();
+    // clean up the canonical result kept by check_pair()
 #endif
@@ -27,13 +27,27 @@
 // compare_results()
 // cleanup_result()
 
-//  --app appname
+//  --app appname               may be repeated to validate several apps
+//  [--all_apps]                validate all apps that are not deprecated
+//  [--app_weight appname W]    give appname W turns for each turn of
+//                              the other apps (default 1)
 //  [-d N] [--debug_level N]    log verbosity (1=least, 4=most)
 //  [--one_pass_N_WU N]         Validate only N WU in one pass, then exit
 //  [--one_pass]                make one pass through WU table, then exit
 //  [--mod n i]                 process only WUs with (id mod n) == i
 //  [--max_granted_credit X]    limit maximum granted credit to X
 //  [--update_credited_job]     add userid/wuid pair to credited_job table
+//  [--prefetch N]              read ahead output files of the next N WUs
+//  [--prefetch_mb X]           read ahead at most X MB not yet validated
+//  [--clean_batch N]           run Python clean up once N results are waiting
+//  [--transitive_compare]      compare_results() is an equivalence relation;
+//                              compare each result with one result per class
+//  [--max_python_failures N]   quarantine a WU after N Python errors
+//  [--memory_report N]         log memory use after every N WUs
+//  [--workers N]               validate on N worker processes,
+//                              each with its own DB connection
+//  [--wu_group N]              hand WUs to the workers N at a time
+//                              (default 8)
 //
 //  credit options.  The default is to grant credit using an
 //  adaptive scheme that provides devices neutrality
@@ -48,11 +62,17 @@
 #include "config.h"
 #include <unistd.h>
 #include <climits>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
 #include <cmath>
 #include <vector>
+#include <deque>
+#include <map>
 #include <cstdlib>
 #include <string>
 #include <signal.h>
+#include <sys/wait.h>
 
 #include "boinc_db.h"
 #include "util.h"
@@ -69,6 +89,8 @@
 #include "validator.h"
 #include "validate_util.h"
 #include "validate_util2.h"
+#include "prefetch.h"
+#include "work_pool.h"
 #ifdef GCL_SIMULATOR
 #include "gcl_simulator.h"
 #endif
@@ -78,6 +100,8 @@
 
 #define SELECT_LIMIT    1000
 #define SLEEP_PERIOD    5
+#define MAX_WORK_RANGES 10000
+    // WU groups handed to the workers in one pass
 
 int sleep_interval = SLEEP_PERIOD;
 
@@ -88,8 +112,12 @@ typedef enum {
     NO_CHANGE
 } TRANSITION_TIME;
 
-char app_name[256];
+vector<std::string> app_names;
+bool all_apps = false;
+std::map<std::string, int> app_weights;
+    // turns of each app in a pass, from --app_weight (default 1)
 DB_APP app;
+    // the app being validated
 int wu_id_modulus=0;
 int wu_id_remainder=0;
 int wu_id_min=0;
@@ -104,6 +132,15 @@ bool credit_from_runtime = false;
 double max_runtime = 0;
 bool no_credit = false;
 bool dry_run = false;
+int prefetch_depth = 0;
+double prefetch_mb = 256;
+int clean_batch = 1;
+bool transitive_compare = false;
+int memory_report_interval = 0;
+int num_workers = 0;
+int wu_group = 8;
+static WORK_POOL work_pool;
+long wus_handled = 0;
 int g_argc;
 char **g_argv;
 
@@ -181,7 +218,8 @@ int handle_wu(
     DB_VALIDATOR_ITEM_SET& validator, std::vector<VALIDATOR_ITEM>& items
 ) {
     int canonical_result_index = -1;
-    bool update_result, retry;
+    RESULT* finished = NULL;    // canonical result, if found here
+    bool update_result, retry = false;
     TRANSITION_TIME transition_time = NO_CHANGE;
     int retval = 0, canonicalid = 0, x;
     double credit = 0;
@@ -410,7 +448,13 @@ int handle_wu(
                 );
                 return retval;
             }
-            if (retry) transition_time = DELAYED;
+            if (retry) {
+                // e.g. the Python validator failed;
+                // leave the results as they are and try again later.
+                //
+                transition_time = DELAYED;
+                goto leave;
+            }
 
             // if we found a canonical instance, decide on credit
             //
@@ -600,6 +644,11 @@ int handle_wu(
                 wu.canonical_resultid = canonicalid;
                 wu.canonical_credit = credit;
                 wu.assimilate_state = ASSIMILATE_READY;
+                for (i=0; i<items.size(); i++) {
+                    if (items[i].res.id == canonicalid) {
+                        finished = &items[i].res;
+                    }
+                }
 
                 // don't need to send any more results
                 //
@@ -649,6 +698,7 @@ int handle_wu(
 
 leave:
     --log_messages;
+    release_canonical_result();
 
     switch (transition_time) {
     case IMMEDIATE:
@@ -678,63 +728,509 @@ leave:
             );
             return retval;
         }
+
+        // release the WU's successors once the pass is over
+        //
+        if (finished) queue_finished_workunit(*finished);
+
+        // the results are written; earlier Python failures
+        // no longer count towards quarantine
+        //
+        if (!retry) clear_python_failures(wu.id);
     }
     return 0;
 }
 
-// make one pass through the workunits with need_validate set.
+// queue the output files of a WU's successful results for read ahead
+//
+static void prefetch_wu(std::vector<VALIDATOR_ITEM>& items) {
+    std::vector<std::string> paths;
+
+    for (unsigned int i=0; i<items.size(); i++) {
+        RESULT& result = items[i].res;
+        if (result.outcome != RESULT_OUTCOME_SUCCESS) continue;
+        if (get_output_file_paths(result, paths)) continue;
+        output_readahead.prefetch(paths);
+    }
+}
+
+static void log_prefetch_stats() {
+    READAHEAD_STATS stats = output_readahead.get_stats();
+    long claimed = stats.hits + stats.late + stats.misses;
+
+    log_messages.printf(MSG_NORMAL,
+        "prefetch: %ld files read ahead (%.1f MB); %ld hits, %ld late, %ld misses (hit rate %.1f%%); %.3f s of reads taken off the critical path\n",
+        stats.prefetched, stats.bytes/1e6, stats.hits, stats.late,
+        stats.misses, claimed ? 100.0*stats.hits/claimed : 0.0,
+        stats.stall_saved
+    );
+}
+
+static void end_prefetch_pass(bool found) {
+    if (!prefetch_depth) return;
+    if (found) log_prefetch_stats();
+    output_readahead.clear();
+}
+
+// get the next WU of app from the DB into items.
+// return false if there are no more
+//
+static bool enumerate_wu(
+    DB_VALIDATOR_ITEM_SET& validator, int nresult_limit, int id_min, int id_max,
+    std::vector<VALIDATOR_ITEM>& items
+) {
+    int retval = validator.enumerate(
+        app.id, nresult_limit, wu_id_modulus, wu_id_remainder,
+        id_min, id_max, items
+    );
+    if (retval) {
+        if (retval != ERR_DB_NOT_FOUND) {
+            log_messages.printf(MSG_DEBUG,
+                "DB connection lost, exiting\n"
+            );
+            exit(0);
+        }
+        return false;
+    }
+    return true;
+}
+
+// put the WUs of page in the order given by
+// the app's validation_priorities function.
+// If it fails, they are left in DB order.
+//
+static void order_page(std::vector<std::vector<VALIDATOR_ITEM> >& page) {
+    std::vector<std::vector<VALIDATOR_ITEM> > ordered(page.size());
+    std::vector<std::string> names;
+    std::vector<size_t> order;
+
+    for (unsigned int i=0; i<page.size(); i++) {
+        names.push_back(page[i][0].wu.name);
+    }
+    if (order_workunits(app.id, names, order)) return;
+    for (unsigned int i=0; i<order.size(); i++) {
+        ordered[i].swap(page[order[i]]);
+    }
+    page.swap(ordered);
+}
+
+// handle the workunits of app with need_validate set
+// and ids in [id_min, id_max] (0 for no limit),
+// looking at no more than nresult_limit results.
 // return true if there were any
 //
-bool do_validate_scan() {
+// With --prefetch N, up to N WUs are enumerated ahead of the one
+// being handled, so that their output files can be read ahead.
+// The enumeration reads from a stored query result,
+// so handling a WU does not disturb the WUs queued after it.
+//
+// If the app has a validation_priorities function,
+// the whole page of WUs is read first and handled in its order,
+// e.g. WUs with the most DAG jobs waiting on them first.
+//
+static bool scan_wus(int nresult_limit, int id_min, int id_max) {
     DB_VALIDATOR_ITEM_SET validator;
     std::vector<VALIDATOR_ITEM> items;
-    bool found=false;
+    std::deque<std::vector<VALIDATOR_ITEM> > lookahead;
+    std::vector<std::vector<VALIDATOR_ITEM> > page;
+    unsigned int next_in_page = 0;
+    bool found=false, db_done=false;
+    bool ordered = has_validation_priority(app.id);
     int retval, i=0;
 
+    if (ordered) {
+        while (enumerate_wu(validator, nresult_limit, id_min, id_max, items)) {
+            page.push_back(items);
+        }
+        order_page(page);
+    }
+
     // loop over entries that need to be checked
     //
     while (1) {
-        retval = validator.enumerate(
-            app.id, SELECT_LIMIT, wu_id_modulus, wu_id_remainder,
-            wu_id_min, wu_id_max, items
-        );
-        if (retval) {
-            if (retval != ERR_DB_NOT_FOUND) {
-                log_messages.printf(MSG_DEBUG,
-                    "DB connection lost, exiting\n"
-                );
-                exit(0);
+        while (!db_done && (int)lookahead.size() <= prefetch_depth) {
+            if (ordered) {
+                if (next_in_page == page.size()) {
+                    db_done = true;
+                    break;
+                }
+                items.swap(page[next_in_page++]);
+            } else if (!enumerate_wu(validator, nresult_limit, id_min, id_max, items)) {
+                db_done = true;
+                break;
             }
-            break;
+            if (prefetch_depth) prefetch_wu(items);
+            lookahead.push_back(items);
         }
+        if (lookahead.empty()) break;
+        items = lookahead.front();
+        lookahead.pop_front();
+
         retval = handle_wu(validator, items);
         if (!retval) found = true;
+
+        // clean up once the WU's results have been updated
+        //
+        if ((int)deferred_cleanups() >= clean_batch) flush_cleanups();
+        if (memory_report_interval && ++wus_handled % memory_report_interval == 0) {
+            print_memory_report(10);
+        }
         if (++i == one_pass_N_WU) break;
     }
+    flush_cleanups();
     return found;
 }
 
-int main_loop() {
-    int retval;
-    bool did_something;
-    char buf[256];
+// make one pass through the workunits of app with need_validate set,
+// looking at no more than nresult_limit results,
+// then release the successors of the WUs that got a canonical result
+// and write the DAG job states of the pass to the DAG files.
+// return true if there were any
+//
+bool do_validate_scan(int nresult_limit) {
+    bool found = scan_wus(nresult_limit, wu_id_min, wu_id_max);
+    continue_children();
+    compact_dag_journals();
+    end_prefetch_pass(found);
+    return found;
+}
+
+static int open_db() {
+    int retval = boinc_db.open(
+        config.db_name, config.db_host, config.db_user, config.db_passwd
+    );
+    if (retval) {
+        log_messages.printf(MSG_CRITICAL,
+            "boinc_db.open failed: %s\n", boincerror(retval)
+        );
+    }
+    return retval;
+}
 
-    sprintf(buf, "where name='%s'", app_name);
+// With --workers N, the main process is a dispatcher:
+// each pass, it looks up the ids of the app's WUs that need validating,
+// and hands them to N worker processes in groups of --wu_group WUs.
+// Each worker has its own DB connection, Python interpreter
+// and app_versions cache, whose PFC statistics it merges into the DB
+// when it runs out of work.
+// A worker that finishes its own groups takes groups from the others,
+// so one slow WU doesn't hold up the pass.
+// Processes are used, rather than threads, because the Python
+// validators need the interpreter lock, and BOINC's DB code keeps
+// its connection in the global boinc_db.
+
+// the body of worker process number worker, which never returns.
+// It exits when the dispatcher does.
+//
+static void worker_main(int worker, pid_t parent) {
+    WORK_RANGE range;
+    int retval, tag, appid = 0;
+    bool did_work = false, found;
+
+    // The dispatcher's connection was inherited;
+    // closing it would close it for the dispatcher too,
+    // so it is dropped and a new one is opened.
+    //
+    boinc_db.mysql = 0;
+    if (open_db()) exit(1);
+    if (prefetch_depth && output_readahead.start((size_t)(prefetch_mb*1024*1024))) {
+        log_messages.printf(MSG_CRITICAL,
+            "[worker %d] can't start prefetch thread; continuing without it\n",
+            worker
+        );
+        prefetch_depth = 0;
+    }
+    log_messages.printf(MSG_NORMAL,
+        "[worker %d] started, pid %d\n", worker, (int)getpid()
+    );
 
     while (1) {
         check_stop_daemons();
+        if (getppid() != parent) exit(0);
 
-        // look up app within the loop,
+        retval = work_pool.next(worker, 1.0, range, tag);
+        if (retval < 0) {
+            log_messages.printf(MSG_CRITICAL,
+                "[worker %d] can't get work: %s\n", worker, strerror(errno)
+            );
+            exit(1);
+        }
+        if (retval == 0) {
+            // out of work; end the pass
+            //
+            if (did_work) {
+                continue_children();
+                compact_dag_journals();
+                end_prefetch_pass(true);
+                write_modified_app_versions(app_versions);
+                did_work = false;
+            }
+            continue;
+        }
+
+        // look up the app at the start of each pass,
         // in case its min_avg_pfc has been changed by the feeder
         //
-        retval = app.lookup(buf);
+        if (!did_work || tag != appid) {
+            retval = app.lookup_id(tag);
+            if (retval) {
+                log_messages.printf(MSG_CRITICAL,
+                    "[worker %d] can't find app %d: %s\n",
+                    worker, tag, boincerror(retval)
+                );
+                work_pool.done(worker, false);
+                continue;
+            }
+            appid = tag;
+        }
+        found = scan_wus(SELECT_LIMIT, range.first, range.last);
+        work_pool.done(worker, found);
+        did_work = true;
+    }
+}
+
+// fork worker process number worker.
+//
+static int start_worker(int worker) {
+    pid_t parent = getpid(), pid;
+
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid < 0) {
+        log_messages.printf(MSG_CRITICAL,
+            "can't start worker %d: %s\n", worker, strerror(errno)
+        );
+        return -1;
+    }
+    if (pid == 0) worker_main(worker, parent);
+    work_pool.set_pid(worker, pid);
+    return 0;
+}
+
+// replace workers that have exited.
+// Their current groups are dropped from the pass;
+// those WUs still need validating, so the next pass finds them again.
+//
+static void reap_workers() {
+    int status, worker;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        worker = work_pool.find_worker(pid);
+        if (worker < 0) continue;
+        log_messages.printf(MSG_CRITICAL,
+            "worker %d (pid %d) exited with status %d; restarting it\n",
+            worker, (int)pid, status
+        );
+        work_pool.worker_exited(worker);
+        start_worker(worker);
+    }
+}
+
+// get the ids and names, in order of id,
+// of up to limit WUs of app that need validating
+//
+static int enumerate_wus(int limit, vector<int>& ids, vector<std::string>& names) {
+    char query[512], clause[256], buf[64];
+    MYSQL_RES* rp;
+    MYSQL_ROW row;
+    int retval;
+
+    strcpy(clause, "");
+    if (wu_id_modulus) {
+        sprintf(buf, " and id %% %d = %d", wu_id_modulus, wu_id_remainder);
+        strcat(clause, buf);
+    }
+    if (wu_id_min) {
+        sprintf(buf, " and id >= %d", wu_id_min);
+        strcat(clause, buf);
+    }
+    if (wu_id_max) {
+        sprintf(buf, " and id <= %d", wu_id_max);
+        strcat(clause, buf);
+    }
+    sprintf(query,
+        "select id, name from workunit where appid=%d and need_validate>0%s order by id limit %d",
+        app.id, clause, limit
+    );
+
+    ids.clear();
+    names.clear();
+    retval = boinc_db.do_query(query);
+    if (retval) return retval;
+    rp = mysql_store_result(boinc_db.mysql);
+    if (!rp) return mysql_errno(boinc_db.mysql);
+    while ((row = mysql_fetch_row(rp))) {
+        ids.push_back(atoi(row[0]));
+        names.push_back(row[1]);
+    }
+    mysql_free_result(rp);
+    return 0;
+}
+
+// make one pass through the workunits of app with need_validate set
+// on the worker processes.
+// return true if there were any
+//
+// If the app has a validation_priorities function,
+// the WUs are handed out one at a time in its order,
+// dealt round the workers so that each starts with
+// the WUs that are wanted first.
+//
+static bool dispatch_validate_scan(int nresult_limit) {
+    vector<int> ids;
+    vector<std::string> names;
+    vector<size_t> order;
+    vector<WORK_RANGE> ranges;
+    WORK_POOL_STATS before, after;
+    bool found = false;
+    bool ordered = has_validation_priority(app.id);
+    int retval, limit;
+    unsigned int i, last;
+
+    limit = std::min(nresult_limit, work_pool.get_max_ranges()*(ordered ? 1 : wu_group));
+    if (one_pass_N_WU && one_pass_N_WU < limit) limit = one_pass_N_WU;
+    retval = enumerate_wus(limit, ids, names);
+    if (retval) {
+        log_messages.printf(MSG_DEBUG,
+            "DB connection lost, exiting\n"
+        );
+        exit(0);
+    }
+    if (ids.empty()) return false;
+
+    if (ordered) {
+        order_workunits(app.id, names, order);
+        for (i=0; i<order.size(); i++) {
+            ranges.push_back(WORK_RANGE(ids[order[i]], ids[order[i]]));
+        }
+    } else {
+        for (i=0; i<ids.size(); i+=wu_group) {
+            last = std::min((unsigned int)ids.size(), i + wu_group) - 1;
+            ranges.push_back(WORK_RANGE(ids[i], ids[last]));
+        }
+    }
+    before = work_pool.get_stats();
+    if (work_pool.dispatch(ranges, app.id, ordered)) {
+        log_messages.printf(MSG_CRITICAL,
+            "can't hand out WUs to workers: %s\n", strerror(errno)
+        );
+        return false;
+    }
+    while ((retval = work_pool.wait_done(1.0, found)) == 0) {
+        check_stop_daemons();
+        reap_workers();
+    }
+    if (retval < 0) {
+        log_messages.printf(MSG_CRITICAL,
+            "can't wait for workers: %s\n", strerror(errno)
+        );
+        exit(1);
+    }
+    after = work_pool.get_stats();
+    log_messages.printf(MSG_NORMAL,
+        "[%s] %d WUs in %d groups on %d workers; %ld groups stolen\n",
+        app.name, (int)ids.size(), (int)ranges.size(), num_workers,
+        after.stolen - before.stolen
+    );
+    return found;
+}
+
+// look up the apps given with --app, or all apps with --all_apps
+//
+static int lookup_apps(vector<DB_APP>& apps) {
+    DB_APP a;
+    char buf[256];
+    unsigned int i;
+    int retval;
+
+    apps.clear();
+    if (all_apps) {
+        while (1) {
+            retval = a.enumerate("where deprecated=0");
+            if (retval) {
+                if (retval != ERR_DB_NOT_FOUND) {
+                    log_messages.printf(MSG_CRITICAL,
+                        "app enumeration failed: %s\n", boincerror(retval)
+                    );
+                    return retval;
+                }
+                break;
+            }
+            apps.push_back(a);
+        }
+        return 0;
+    }
+    for (i=0; i<app_names.size(); i++) {
+        sprintf(buf, "where name='%s'", app_names[i].c_str());
+        retval = a.lookup(buf);
         if (retval) {
-            log_messages.printf(MSG_CRITICAL, "can't find app %s\n", app_name);
-            exit(1);
+            log_messages.printf(MSG_CRITICAL,
+                "can't find app %s\n", app_names[i].c_str()
+            );
+            return retval;
+        }
+        apps.push_back(a);
+    }
+    return 0;
+}
+
+// Each pass scans the apps in turn, in one process,
+// so that they share the Python interpreter, the DB connection
+// and the app_versions cache.
+// The apps share a pass by weighted round-robin:
+// a turn is one scan of at most SELECT_LIMIT results,
+// and an app of weight W gets W turns in each round,
+// interleaved with the other apps' turns,
+// so busy apps share the validator in proportion to their weights.
+// An app sits out the rest of the pass once a scan finds nothing,
+// so an app with nothing to validate costs one query.
+//
+int main_loop() {
+    int retval, turn, max_turns;
+    bool did_something;
+    vector<DB_APP> apps;
+    vector<int> turns;
+        // turns of each app in a pass, i.e. its weight
+    vector<bool> idle;
+    unsigned int i;
+
+    while (1) {
+        check_stop_daemons();
+
+        // look up apps within the loop,
+        // in case their min_avg_pfc has been changed by the feeder
+        //
+        retval = lookup_apps(apps);
+        if (retval) exit(1);
+
+        did_something = false;
+        turns.assign(apps.size(), 1);
+        idle.assign(apps.size(), false);
+        max_turns = 1;
+        for (i=0; i<apps.size(); i++) {
+            if (app_weights.count(apps[i].name)) {
+                turns[i] = app_weights[apps[i].name];
+            }
+            max_turns = std::max(max_turns, turns[i]);
+        }
+        for (turn=0; turn<max_turns; turn++) {
+            for (i=0; i<apps.size(); i++) {
+                if (idle[i] || turn >= turns[i]) continue;
+                app = apps[i];
+                if (num_workers > 1
+                    ? dispatch_validate_scan(SELECT_LIMIT)
+                    : do_validate_scan(SELECT_LIMIT)
+                ) {
+                    did_something = true;
+                } else {
+                    idle[i] = true;
+                    write_modified_app_versions(app_versions);
+                }
+            }
         }
-        did_something = do_validate_scan();
         if (!did_something) {
-            write_modified_app_versions(app_versions);
             if (one_pass) break;
 #ifdef GCL_SIMULATOR
             char nameforsim[64];
@@ -759,9 +1255,11 @@ int main(int argc, char** argv) {
     int i, retval;
 
     const char *usage = 
-      "\nUsage: %s --app <app-name> [OPTIONS]\n"
-      "Start validator for application <app-name>\n\n"
+      "\nUsage: %s --app <app-name> [--app <app-name> ...] [OPTIONS]\n"
+      "Start validator for the given applications\n\n"
       "Optional arguments:\n"
+      "  --all_apps              Validate all applications that are not deprecated\n"
+      "  --app_weight name W     Give application name W turns for each turn of the others (default 1)\n"
       "  --one_pass_N_WU N       Validate at most N WUs, then exit\n"
       "  --one_pass              Make one pass through WU table, then exit\n"
       "  --dry_run               Don't update db, just write logs (for debugging)\n"
@@ -774,6 +1272,14 @@ int main(int argc, char** argv) {
       "  --credit_from_runtime X  Grant credit based on runtime (max X seconds)and estimated FLOPS\n"
       "  --no_credit             Don't grant credit\n"
       "  --sleep_interval n      Set sleep-interval to n\n"
+      "  --prefetch N            Read ahead output files of the next N WUs\n"
+      "  --prefetch_mb X         Read ahead at most X MB of unvalidated output (default 256)\n"
+      "  --clean_batch N         Run Python clean up once N results are waiting (default 1)\n"
+      "  --transitive_compare    Results that match are equivalent; compare each result with one result per class\n"
+      "  --max_python_failures N Retry a WU after a Python error, and quarantine it after N errors (default 3)\n"
+      "  --memory_report N       Log memory use and Python object counts after every N WUs\n"
+      "  --workers N             Validate on N worker processes, each with its own DB connection\n"
+      "  --wu_group N            Hand WUs to the workers N at a time (default 8)\n"
       "  -d n, --debug_level n   Set log verbosity level, 1-4\n"
       "  -h | --help             Show this\n"
       "  -v | --version          Show version information\n";
@@ -801,7 +1307,19 @@ int main(int argc, char** argv) {
         } else if (is_arg(argv[i], "one_pass")) {
             one_pass = true;
         } else if (is_arg(argv[i], "app")) {
-            safe_strcpy(app_name, argv[++i]);
+            app_names.push_back(argv[++i]);
+        } else if (is_arg(argv[i], "all_apps")) {
+            all_apps = true;
+        } else if (is_arg(argv[i], "app_weight")) {
+            if (i+2 >= argc || atoi(argv[i+2]) <= 0) {
+                log_messages.printf(MSG_CRITICAL,
+                    "--app_weight needs an app name and a positive number of turns\n"
+                );
+                printf (usage, argv[0] );
+                exit(1);
+            }
+            app_weights[argv[i+1]] = atoi(argv[i+2]);
+            i += 2;
         } else if (is_arg(argv[i], "d") || is_arg(argv[i], "debug_level")) {
             debug_level = atoi(argv[++i]);
             log_messages.set_debug_level(debug_level);
@@ -824,6 +1342,22 @@ int main(int argc, char** argv) {
             max_runtime = atof(argv[++i]);
         } else if (is_arg(argv[i], "no_credit")) {
             no_credit = true;
+        } else if (is_arg(argv[i], "prefetch")) {
+            prefetch_depth = atoi(argv[++i]);
+        } else if (is_arg(argv[i], "prefetch_mb")) {
+            prefetch_mb = atof(argv[++i]);
+        } else if (is_arg(argv[i], "clean_batch")) {
+            clean_batch = atoi(argv[++i]);
+        } else if (is_arg(argv[i], "transitive_compare")) {
+            transitive_compare = true;
+        } else if (is_arg(argv[i], "max_python_failures")) {
+            max_python_failures = atoi(argv[++i]);
+        } else if (is_arg(argv[i], "memory_report")) {
+            memory_report_interval = atoi(argv[++i]);
+        } else if (is_arg(argv[i], "workers")) {
+            num_workers = atoi(argv[++i]);
+        } else if (is_arg(argv[i], "wu_group")) {
+            wu_group = atoi(argv[++i]);
         } else {
             //log_messages.printf(MSG_CRITICAL, "unrecognized arg: %s\n", argv[i]);
         }
@@ -831,9 +1365,9 @@ int main(int argc, char** argv) {
     g_argc = argc;
     g_argv = argv;
 
-    if (app_name[0] == 0) {
+    if (app_names.empty() && !all_apps) {
         log_messages.printf(MSG_CRITICAL,
-            "must use '--app' to specify an application\n"
+            "must use '--app' or '--all_apps' to specify applications\n"
         );
         printf (usage, argv[0] );
         exit(1);      
@@ -847,15 +1381,7 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    retval = boinc_db.open(
-        config.db_name, config.db_host, config.db_user, config.db_passwd
-    );
-    if (retval) {
-        log_messages.printf(MSG_CRITICAL,
-            "boinc_db.open failed: %s\n", boincerror(retval)
-        );
-        exit(1);
-    }
+    if (open_db()) exit(1);
 
     log_messages.printf(MSG_NORMAL,
         "Starting validator, debug level %d\n", log_messages.debug_level
@@ -883,8 +1409,47 @@ int main(int argc, char** argv) {
         );
     }
 
+    if (wu_group < 1) wu_group = 1;
+    if (num_workers > 1) {
+        if (work_pool.create(num_workers, MAX_WORK_RANGES)) {
+            log_messages.printf(MSG_CRITICAL,
+                "can't create worker pool: %s\n", strerror(errno)
+            );
+            exit(1);
+        }
+        log_messages.printf(MSG_NORMAL,
+            "%d workers, %d WUs per group\n", num_workers, wu_group
+        );
+    }
+
+    if (prefetch_depth > 0 && num_workers > 1) {
+        // the workers start their own prefetch threads
+        log_messages.printf(MSG_NORMAL,
+            "prefetching %d WUs ahead in each worker, at most %.0f MB\n",
+            prefetch_depth, prefetch_mb
+        );
+    } else if (prefetch_depth > 0) {
+        if (output_readahead.start((size_t)(prefetch_mb*1024*1024))) {
+            log_messages.printf(MSG_CRITICAL,
+                "can't start prefetch thread; continuing without it\n"
+            );
+            prefetch_depth = 0;
+        } else {
+            log_messages.printf(MSG_NORMAL,
+                "prefetching %d WUs ahead, at most %.0f MB\n",
+                prefetch_depth, prefetch_mb
+            );
+        }
+    } else {
+        prefetch_depth = 0;
+    }
+
     install_stop_signal_handler();
 
+    for (i=0; i<num_workers && num_workers>1; i++) {
+        if (start_worker(i)) exit(1);
+    }
+
     main_loop();
 }
 
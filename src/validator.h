@@ -25,5 +25,8 @@ extern WORKUNIT* g_wup;
     // you can access this in your init_result() etc. functions
     // (which are passed RESULT but not WORKUNIT)
 
+extern bool transitive_compare;
+    // the --transitive_compare cmdline arg
+
 extern int g_argc;
 extern char** g_argv;
@@ -0,0 +1,358 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Work stealing pool of processes. The validator runs Python and uses
+// BOINC's database code, which keeps its connection in a global, so its
+// workers are processes rather than threads: each has its own
+// interpreter and database connection. The deques live in an anonymous
+// shared mapping and are guarded by one process shared mutex. A range
+// holds several workunits, each taking milliseconds to validate, so the
+// lock is taken rarely. The mutex is robust, so that a worker killed
+// while holding it does not stop the pool.
+//
+// The deque of each worker is the span [head, tail) of the pass's
+// ranges. The owner takes ranges from head and thieves from tail.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "work_pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <sys/mman.h>
+
+struct WORK_POOL_SHARED {
+  pthread_mutex_t mutex;
+  pthread_cond_t work_ready;// a pass has started
+  pthread_cond_t pass_done;
+  int tag;
+  int busy;// workers handling a range
+  bool active;// a pass has started and wait_done has not seen it finish
+  bool found;
+  WORK_POOL_STATS stats;
+};
+
+struct WORK_POOL_WORKER {
+  pid_t pid;
+  int head, tail;
+  bool busy;
+};
+
+// Rounds up to a multiple of 16 bytes
+#define ALIGNED(size) (((size) + 15) & ~(size_t)15)
+
+static void deadline_after(double timeout, struct timespec& deadline)
+{
+  clock_gettime(CLOCK_REALTIME,&deadline);
+  deadline.tv_sec += (time_t)timeout;
+  deadline.tv_nsec += (long)((timeout - (time_t)timeout) * 1e9);
+  if(deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+}
+
+// Returns ETIMEDOUT if the deadline passed.
+static int timed_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec& deadline)
+{
+  int retval = pthread_cond_timedwait(cond,mutex,&deadline);
+
+  if(retval == EOWNERDEAD)
+    {
+      pthread_mutex_consistent(mutex);
+      retval = 0;
+    }
+  return retval;
+}
+
+WORK_POOL::WORK_POOL() : shared(NULL), workers(NULL), ranges(NULL), map_size(0), num_workers(0), max_ranges(0)
+{
+}
+
+WORK_POOL::~WORK_POOL()
+{
+  destroy();
+}
+
+int WORK_POOL::create(int num_workers, int max_ranges)
+{
+  pthread_mutexattr_t mutex_attr;
+  pthread_condattr_t cond_attr;
+  char *map;
+
+  if(num_workers <= 0 || max_ranges <= 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  destroy();
+
+  map_size = ALIGNED(sizeof(WORK_POOL_SHARED)) + ALIGNED(num_workers * sizeof(WORK_POOL_WORKER)) + max_ranges * sizeof(WORK_RANGE);
+  map = (char*)mmap(NULL,map_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_ANONYMOUS,-1,0);
+  if(map == MAP_FAILED)
+    return -1;
+  shared = (WORK_POOL_SHARED*)map;
+  workers = (WORK_POOL_WORKER*)(map + ALIGNED(sizeof(WORK_POOL_SHARED)));
+  ranges = (WORK_RANGE*)(map + ALIGNED(sizeof(WORK_POOL_SHARED)) + ALIGNED(num_workers * sizeof(WORK_POOL_WORKER)));
+  this->num_workers = num_workers;
+  this->max_ranges = max_ranges;
+
+  // The mapping is zero filled, which is an idle pool with no stats.
+  pthread_mutexattr_init(&mutex_attr);
+  pthread_mutexattr_setpshared(&mutex_attr,PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mutex_attr,PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&shared->mutex,&mutex_attr);
+  pthread_mutexattr_destroy(&mutex_attr);
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setpshared(&cond_attr,PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&shared->work_ready,&cond_attr);
+  pthread_cond_init(&shared->pass_done,&cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+  return 0;
+}
+
+// Leaves the mutex and condition variables alone, since workers that
+// are still running may be using them.
+void WORK_POOL::destroy()
+{
+  if(shared == NULL)
+    return;
+  munmap(shared,map_size);
+  shared = NULL;
+  workers = NULL;
+  ranges = NULL;
+  map_size = 0;
+  num_workers = max_ranges = 0;
+}
+
+int WORK_POOL::lock()
+{
+  int retval = pthread_mutex_lock(&shared->mutex);
+
+  if(retval == EOWNERDEAD)
+    {
+      // A worker died holding the lock. Every change made under it is
+      // complete once its fields are written, so the state is usable.
+      pthread_mutex_consistent(&shared->mutex);
+      return 0;
+    }
+  if(retval)
+    {
+      errno = retval;
+      return -1;
+    }
+  return 0;
+}
+
+void WORK_POOL::unlock()
+{
+  pthread_mutex_unlock(&shared->mutex);
+}
+
+// Called with the lock held
+bool WORK_POOL::pass_finished()
+{
+  if(shared->busy > 0)
+    return false;
+  for(int i = 0;i < num_workers;i++)
+    if(workers[i].head < workers[i].tail)
+      return false;
+  return true;
+}
+
+int WORK_POOL::dispatch(const std::vector<WORK_RANGE>& pass_ranges, int tag, bool interleave)
+{
+  int num_ranges = (int)pass_ranges.size();
+
+  if(shared == NULL || num_ranges > max_ranges)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  if(lock())
+    return -1;
+  if(shared->active)
+    {
+      unlock();
+      errno = EBUSY;
+      return -1;
+    }
+
+  if(interleave)
+    {
+      // Worker i gets ranges i, i + num_workers, ... in its span.
+      int next = 0;
+      for(int i = 0;i < num_workers;i++)
+	{
+	  workers[i].head = next;
+	  for(int j = i;j < num_ranges;j += num_workers)
+	    ranges[next++] = pass_ranges[j];
+	  workers[i].tail = next;
+	}
+    }
+  else
+    {
+      std::copy(pass_ranges.begin(),pass_ranges.end(),ranges);
+      for(int i = 0;i < num_workers;i++)
+	{
+	  workers[i].head = (int)((long)i * num_ranges / num_workers);
+	  workers[i].tail = (int)((long)(i + 1) * num_ranges / num_workers);
+	}
+    }
+  shared->tag = tag;
+  shared->found = false;
+  shared->active = (num_ranges > 0);
+  shared->stats.passes++;
+  pthread_cond_broadcast(&shared->work_ready);
+  unlock();
+  return 0;
+}
+
+int WORK_POOL::wait_done(double timeout, bool& found)
+{
+  struct timespec deadline;
+  int retval = 0;
+
+  found = false;
+  if(shared == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  deadline_after(timeout,deadline);
+  if(lock())
+    return -1;
+  while(shared->active && !pass_finished())
+    if(timed_wait(&shared->pass_done,&shared->mutex,deadline) == ETIMEDOUT)
+      break;
+  if(!shared->active || pass_finished())
+    {
+      found = shared->active && shared->found;
+      shared->active = false;
+      retval = 1;
+    }
+  unlock();
+  return retval;
+}
+
+void WORK_POOL::set_pid(int worker, pid_t pid)
+{
+  if(shared == NULL || worker < 0 || worker >= num_workers || lock())
+    return;
+  workers[worker].pid = pid;
+  unlock();
+}
+
+int WORK_POOL::find_worker(pid_t pid)
+{
+  int worker = -1;
+
+  if(shared == NULL || lock())
+    return -1;
+  for(int i = 0;i < num_workers;i++)
+    if(workers[i].pid == pid)
+      worker = i;
+  unlock();
+  return worker;
+}
+
+void WORK_POOL::worker_exited(int worker)
+{
+  if(shared == NULL || worker < 0 || worker >= num_workers || lock())
+    return;
+  if(workers[worker].busy)
+    {
+      workers[worker].busy = false;
+      shared->busy--;
+    }
+  workers[worker].pid = 0;
+  shared->stats.worker_deaths++;
+  if(pass_finished())
+    pthread_cond_broadcast(&shared->pass_done);
+  unlock();
+}
+
+int WORK_POOL::next(int worker, double timeout, WORK_RANGE& range, int& tag)
+{
+  struct timespec deadline;
+
+  if(shared == NULL || worker < 0 || worker >= num_workers)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  deadline_after(timeout,deadline);
+  if(lock())
+    return -1;
+  while(1)
+    {
+      WORK_POOL_WORKER& self = workers[worker];
+      if(self.head < self.tail)
+	range = ranges[self.head++];
+      else
+	{
+	  int victim = -1;
+	  for(int i = 0;i < num_workers;i++)
+	    if(workers[i].tail - workers[i].head > 0
+	       && (victim < 0 || workers[i].tail - workers[i].head > workers[victim].tail - workers[victim].head))
+	      victim = i;
+	  if(victim >= 0)
+	    {
+	      range = ranges[--workers[victim].tail];
+	      shared->stats.stolen++;
+	    }
+	  else if(timed_wait(&shared->work_ready,&shared->mutex,deadline) == ETIMEDOUT)
+	    {
+	      unlock();
+	      return 0;
+	    }
+	  else
+	    continue;
+	}
+      self.busy = true;
+      shared->busy++;
+      shared->stats.ranges++;
+      tag = shared->tag;
+      unlock();
+      return 1;
+    }
+}
+
+void WORK_POOL::done(int worker, bool found)
+{
+  if(shared == NULL || worker < 0 || worker >= num_workers || lock())
+    return;
+  if(workers[worker].busy)
+    {
+      workers[worker].busy = false;
+      shared->busy--;
+      if(found)
+	shared->found = true;
+    }
+  if(pass_finished())
+    pthread_cond_broadcast(&shared->pass_done);
+  unlock();
+}
+
+WORK_POOL_STATS WORK_POOL::get_stats()
+{
+  WORK_POOL_STATS stats;
+
+  if(shared == NULL || lock())
+    return stats;
+  stats = shared->stats;
+  unlock();
+  return stats;
+}
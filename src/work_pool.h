@@ -0,0 +1,122 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * A group of workunits, given by the first and last of their ids.
+ */
+struct WORK_RANGE {
+  int first;
+  int last;
+
+  WORK_RANGE() : first(0), last(0) {}
+  WORK_RANGE(int f, int l) : first(f), last(l) {}
+};
+
+struct WORK_POOL_STATS {
+  long passes;
+  long ranges;// handed out, over all passes
+  long stolen;// of which were taken from another worker's deque
+  long worker_deaths;
+
+  WORK_POOL_STATS() : passes(0), ranges(0), stolen(0), worker_deaths(0) {}
+};
+
+/**
+ * Hands ranges of workunits from a dispatcher process to a fixed number
+ * of forked worker processes. The state is kept in shared memory, so the
+ * pool must be created before the workers are forked.
+ *
+ * Each pass, the ranges are split into one contiguous deque per worker.
+ * A worker takes ranges from the front of its own deque and, once that
+ * is empty, steals from the back of the longest deque of another worker,
+ * so that a worker held up by a slow workunit does not hold up the pass.
+ *
+ * Methods return 0 upon success and -1 otherwise, in which case errno
+ * is set, unless noted.
+ */
+class WORK_POOL {
+public:
+  WORK_POOL();
+  ~WORK_POOL();
+
+  /**
+   * Maps the shared state for num_workers workers and passes of at most
+   * max_ranges ranges.
+   */
+  int create(int num_workers, int max_ranges);
+  void destroy();
+  bool is_created() const { return shared != NULL; }
+  int get_num_workers() const { return num_workers; }
+  int get_max_ranges() const { return max_ranges; }
+
+  /**
+   * Dispatcher: starts a pass over ranges, which should be sorted. tag,
+   * e.g. an application id, is passed to the workers with each range.
+   * errno is EBUSY if the previous pass has not finished.
+   *
+   * If interleave is true, the ranges are in order of priority and are
+   * dealt round the workers, so that each worker's deque starts with
+   * its share of the first ranges, rather than split into spans.
+   */
+  int dispatch(const std::vector<WORK_RANGE>& ranges, int tag, bool interleave = false);
+
+  /**
+   * Dispatcher: waits up to timeout seconds for the pass to finish.
+   * Returns 1 if it has, in which case found is true if any worker
+   * reported finding work, 0 if it has not, and -1 upon error.
+   */
+  int wait_done(double timeout, bool& found);
+
+  /**
+   * Dispatcher: records the pid of a worker that has been forked for
+   * slot worker, and returns the slot of the worker with pid, or -1.
+   */
+  void set_pid(int worker, pid_t pid);
+  int find_worker(pid_t pid);
+
+  /**
+   * Dispatcher: called when a worker has exited. The range it was
+   * working on is dropped from the pass; the rest of its deque is left
+   * for the other workers, or for the worker that replaces it.
+   */
+  void worker_exited(int worker);
+
+  /**
+   * Worker: takes the next range, waiting up to timeout seconds for a
+   * pass to start. Returns 1 if a range was taken, 0 if there was none,
+   * and -1 upon error.
+   */
+  int next(int worker, double timeout, WORK_RANGE& range, int& tag);
+
+  /**
+   * Worker: reports that the range taken by next has been handled.
+   */
+  void done(int worker, bool found);
+
+  WORK_POOL_STATS get_stats();
+
+private:
+  int lock();
+  void unlock();
+  bool pass_finished();
+
+  struct WORK_POOL_SHARED *shared;
+  struct WORK_POOL_WORKER *workers;
+  WORK_RANGE *ranges;
+  size_t map_size;
+  int num_workers;
+  int max_ranges;
+};
+
+#endif
@@ -0,0 +1,151 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+
+//
+// Extraction of element values from the XML documents of a result,
+// such as stderr_out and xml_doc_out. Rather than parse the document,
+// as XML_PARSER does, the text is scanned once for the start and end
+// tags of the wanted elements, so that the usual stderr_out, which is
+// free text around a few tags, may be searched for several fields at
+// the cost of one memchr pass.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "xml_fields.h"
+
+#include <cstring>
+
+#define CDATA_START "<![CDATA["
+#define CDATA_END "]]>"
+
+static bool is_name_char(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+    || c == '_' || c == '-' || c == '.' || c == ':';
+}
+
+static bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Returns the first occurrence of the NUL terminated needle in
+// [begin, end), or end if there is none.
+static const char* find(const char *begin, const char *end, const char *needle)
+{
+  size_t needle_length = strlen(needle);
+
+  while(begin < end && (begin = (const char*)memchr(begin,needle[0],end - begin)) != NULL)
+    {
+      if((size_t)(end - begin) < needle_length)
+	break;
+      if(memcmp(begin,needle,needle_length) == 0)
+	return begin;
+      begin++;
+    }
+  return end;
+}
+
+// Sets value to the trimmed text [begin, end), unwrapping CDATA and
+// replacing entities.
+static void set_value(const char *begin, const char *end, std::string& value)
+{
+  static const size_t cdata_start_length = strlen(CDATA_START), cdata_end_length = strlen(CDATA_END);
+
+  while(begin < end && is_space(*begin))
+    begin++;
+  while(end > begin && is_space(end[-1]))
+    end--;
+
+  if((size_t)(end - begin) >= cdata_start_length + cdata_end_length
+     && memcmp(begin,CDATA_START,cdata_start_length) == 0 && memcmp(end - cdata_end_length,CDATA_END,cdata_end_length) == 0)
+    {
+      value.assign(begin + cdata_start_length,end - cdata_end_length);
+      return;
+    }
+
+  value.clear();
+  value.reserve(end - begin);
+  while(begin < end)
+    {
+      const char *amp = (const char*)memchr(begin,'&',end - begin);
+      if(amp == NULL)
+	amp = end;
+      value.append(begin,amp);
+      if(amp == end)
+	break;
+      begin = amp;
+      if(end - begin >= 4 && memcmp(begin,"&lt;",4) == 0) {value += '<'; begin += 4;}
+      else if(end - begin >= 4 && memcmp(begin,"&gt;",4) == 0) {value += '>'; begin += 4;}
+      else if(end - begin >= 5 && memcmp(begin,"&amp;",5) == 0) {value += '&'; begin += 5;}
+      else if(end - begin >= 6 && memcmp(begin,"&quot;",6) == 0) {value += '"'; begin += 6;}
+      else if(end - begin >= 6 && memcmp(begin,"&apos;",6) == 0) {value += '\''; begin += 6;}
+      else {value += '&'; begin++;}
+    }
+}
+
+size_t find_xml_fields(const char *doc, size_t length, const std::vector<std::string>& tags, std::vector<XML_FIELD>& fields)
+{
+  std::vector<const char*> starts(tags.size(),(const char*)NULL);// start of the value of each open element
+  const char *p = doc, *end = doc + length;
+  size_t num_found = 0;
+
+  fields.assign(tags.size(),XML_FIELD());
+  while(num_found < tags.size() && p < end && (p = (const char*)memchr(p,'<',end - p)) != NULL)
+    {
+      const char *lt = p++;
+
+      if(p < end && *p == '!')
+	{
+	  if(end - lt >= 4 && memcmp(lt,"<!--",4) == 0)
+	    p = find(lt + 4,end,"-->");
+	  else if((size_t)(end - lt) >= strlen(CDATA_START) && memcmp(lt,CDATA_START,strlen(CDATA_START)) == 0)
+	    p = find(lt + strlen(CDATA_START),end,CDATA_END);
+	  continue;
+	}
+
+      bool closing = (p < end && *p == '/');
+      if(closing)
+	p++;
+      const char *name = p;
+      while(p < end && is_name_char(*p))
+	p++;
+      size_t name_length = p - name;
+      if(name_length == 0 || (p < end && *p != '>' && *p != '/' && !is_space(*p)))
+	continue;
+
+      const char *gt = NULL;
+      for(size_t i = 0;i < tags.size();i++)
+	{
+	  if(fields[i].found || tags[i].size() != name_length || memcmp(tags[i].data(),name,name_length) != 0)
+	    continue;
+	  if(gt == NULL && (gt = (const char*)memchr(p,'>',end - p)) == NULL)
+	    return num_found;
+	  if(closing)
+	    {
+	      if(starts[i] == NULL)
+		continue;
+	      set_value(starts[i],lt,fields[i].value);
+	    }
+	  else if(starts[i] != NULL)
+	    continue;// nested element of the same name
+	  else if(gt[-1] != '/')
+	    {
+	      starts[i] = gt + 1;
+	      continue;
+	    }
+	  fields[i].found = true;
+	  num_found++;
+	}
+      if(gt != NULL)
+	p = gt + 1;
+    }
+  return num_found;
+}
@@ -0,0 +1,39 @@
+//
+// ServerTools
+// Copyright (C) 2012 David Coss, PhD
+//
+// You should have received a copy of the GNU General Public License
+// in the file COPYING.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef XML_FIELDS_H
+#define XML_FIELDS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct XML_FIELD {
+  bool found;
+  std::string value;
+
+  XML_FIELD() : found(false) {}
+};
+
+/**
+ * Finds the values of the elements named in tags in one pass over the
+ * length bytes of doc, which need not be well formed XML, e.g. the
+ * stderr_out of a result. The value of an element is the text between
+ * the first <tag> (which may have attributes) and the next </tag>, with
+ * leading and trailing white space removed, a CDATA section unwrapped
+ * and the predefined entities (&lt; etc.) replaced, as BOINC's
+ * XML_PARSER::parse_str does. <tag/> has an empty value. Comments and
+ * CDATA sections are skipped while looking for tags.
+ *
+ * fields is resized to the size of tags, with fields[i] holding the
+ * value of tags[i]. Scanning stops once every tag has been found.
+ *
+ * Returns the number of tags that were found.
+ */
+size_t find_xml_fields(const char *doc, size_t length, const std::vector<std::string>& tags, std::vector<XML_FIELD>& fields);
+
+#endif
@@ -0,0 +1,555 @@
+"""
+Benchmarks for the native boinctools routines.
+
+Usage: python benchmark.py <benchmark> [options]
+
+The native extension must be built first, e.g. in the python/ directory
+run "python setup.py build_ext --inplace". Run without arguments to list
+the available benchmarks.
+"""
+
+import os
+import sys
+import time
+import resource
+import shutil
+import tempfile
+from os import path as OP
+
+sys.path.insert(0, OP.join(OP.dirname(OP.abspath(__file__)), "..", "python"))
+sys.path.insert(0, OP.dirname(OP.abspath(__file__)))
+if not OP.isfile(OP.join(OP.dirname(OP.abspath(__file__)), "local_boinc_settings.py")):
+    with open(OP.join(OP.dirname(OP.abspath(__file__)), "local_boinc_settings.py"), "w") as settings:
+        settings.write("project_path = '%s'\n" % OP.dirname(OP.abspath(__file__)))
+
+import boinctools
+
+
+def max_rss_mb():
+    return resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024.0
+
+
+def timed(label, function, *args):
+    start = time.time()
+    retval = function(*args)
+    elapsed = time.time() - start
+    print("%-40s %10.3f s  max RSS %8.1f MB  returned %s" % (label, elapsed, max_rss_mb(), retval))
+    return (retval, elapsed)
+
+
+def write_random_file(filename, size_mb):
+    block = os.urandom(1 << 20)
+    with open(filename, "wb") as output:
+        for i in range(size_mb):
+            output.write(block)
+
+
+def bench_append_output(num_results="2000", size_kb="64", num_destinations="10"):
+    """
+    Appends num_results output files of size_kb kilobytes to
+    num_destinations aggregate files, by reading each file into memory
+    and appending it as the trident clean hook did, with and without an
+    fsync, and with boinctools.append_output, which syncs as a group.
+    """
+    num_results = int(num_results)
+    size_kb = int(size_kb)
+    num_destinations = int(num_destinations)
+    workdir = tempfile.mkdtemp()
+    try:
+        block = os.urandom(size_kb << 10)
+        sources = []
+        for i in range(num_results):
+            sources.append(OP.join(workdir, "result_%d" % i))
+            with open(sources[-1], "wb") as output:
+                output.write(block)
+        print("Appending %d files of %d KB to %d destinations" % (num_results, size_kb, num_destinations))
+
+        def read_loop(prefix, sync):
+            for (i, source) in enumerate(sources):
+                destination = OP.join(workdir, "%s_%d" % (prefix, i % num_destinations))
+                if not OP.isfile(destination):
+                    shutil.copy(source, destination)
+                else:
+                    with open(destination, "a") as old_file:
+                        old_file.write("\n")
+                        old_file.write(open(source, "r").read())
+                        if sync:
+                            old_file.flush()
+                            os.fsync(old_file.fileno())
+            return num_results
+        (count, elapsed) = timed("read and append per file", read_loop, "read", False)
+        print("%-40s %10.1f files/s" % ("", num_results / elapsed))
+        (count, elapsed) = timed("read, append and fsync per file", read_loop, "synced", True)
+        print("%-40s %10.1f files/s" % ("", num_results / elapsed))
+
+        def append_loop(prefix):
+            for (i, source) in enumerate(sources):
+                boinctools.append_output(source, OP.join(workdir, "%s_%d" % (prefix, i % num_destinations)))
+            boinctools.flush_outputs()
+            return num_results
+        (count, elapsed) = timed("boinctools.append_output", append_loop, "append")
+        print("%-40s %10.1f files/s" % ("", num_results / elapsed))
+        if boinctools._native:
+            print(boinctools._native.output_writer_stats())
+    finally:
+        shutil.rmtree(workdir)
+
+
+def bench_files_equal(size_mb="1024"):
+    """
+    Compares two identical files of size_mb megabytes with the native
+    streaming comparison and with a whole-file read in Python.
+    """
+    size_mb = int(size_mb)
+    workdir = tempfile.mkdtemp()
+    file1 = OP.join(workdir, "a")
+    file2 = OP.join(workdir, "b")
+    try:
+        write_random_file(file1, size_mb)
+        shutil.copyfile(file1, file2)
+        print("Comparing two %d MB files" % size_mb)
+        if boinctools._native:
+            (equal, elapsed) = timed("native files_equal", boinctools._native.files_equal, file1, file2)
+            print("%-40s %10.1f MB/s" % ("", 2 * size_mb / elapsed))
+        (equal, elapsed) = timed("python read().==", lambda a, b: open(a, "rb").read() == open(b, "rb").read(), file1, file2)
+        print("%-40s %10.1f MB/s" % ("", 2 * size_mb / elapsed))
+    finally:
+        for filename in (file1, file2):
+            if OP.isfile(filename):
+                os.unlink(filename)
+        os.rmdir(workdir)
+
+
+def bench_compressed_outputs(size_mb="256"):
+    """
+    Compares two gzip compressed tables of size_mb MB, compressed at
+    different levels so that their bytes differ: natively, streaming
+    both; by decompressing to temporary files first; and by reading
+    both into memory. Run natively first, so that its max RSS is not
+    the Python peak.
+    """
+    import gzip
+    size = int(size_mb) << 20
+    workdir = tempfile.mkdtemp()
+    file1 = OP.join(workdir, "a.gz")
+    file2 = OP.join(workdir, "b.gz")
+    try:
+        with gzip.open(file1, "wb", 6) as table1:
+            with gzip.open(file2, "wb", 1) as table2:
+                written = i = 0
+                while written < size:
+                    line = "%d %.6f %.6e %d\n" % (i, i * 0.618034 % 1, i * 1.5e-3, i % 97)
+                    table1.write(line)
+                    table2.write(line)
+                    written += len(line)
+                    i += 1
+        print("Comparing two gzip tables of %d MB (%.1f and %.1f MB compressed)"
+              % (size >> 20, OP.getsize(file1) / 1048576.0, OP.getsize(file2) / 1048576.0))
+        timed("native files_equal", boinctools.files_equal, file1, file2)
+        timed("native numeric_files_equal", boinctools.numeric_files_equal, file1, file2)
+
+        def via_temp_files():
+            plain = []
+            for path in (file1, file2):
+                plain.append(path[:-3])
+                with gzip.open(path, "rb") as compressed:
+                    with open(plain[-1], "wb") as out:
+                        shutil.copyfileobj(compressed, out, 1 << 20)
+            try:
+                return boinctools.files_equal(plain[0], plain[1])
+            finally:
+                for path in plain:
+                    os.unlink(path)
+        timed("gunzip to temp files, files_equal", via_temp_files)
+
+        def in_memory():
+            with gzip.open(file1, "rb") as compressed1:
+                with gzip.open(file2, "rb") as compressed2:
+                    return compressed1.read() == compressed2.read()
+        timed("gzip.open().read() in memory", in_memory)
+    finally:
+        for filename in (file1, file2):
+            if OP.isfile(filename):
+                os.unlink(filename)
+        os.rmdir(workdir)
+
+
+def bench_numeric_files_equal(num_lines="1000000"):
+    """
+    Compares two tables of num_lines lines of floating point numbers that
+    differ by rounding, natively and with float() in Python.
+    """
+    import random
+    num_lines = int(num_lines)
+    workdir = tempfile.mkdtemp()
+    file1 = OP.join(workdir, "a")
+    file2 = OP.join(workdir, "b")
+    tolerance = {'abs_tol': 1e-6, 'rel_tol': 1e-6, 'columns': {0: {'abs_tol': 0, 'rel_tol': 0}}}
+    try:
+        with open(file1, "w") as table1:
+            with open(file2, "w") as table2:
+                for i in range(num_lines):
+                    values = [random.uniform(-1e3, 1e3) for j in range(4)]
+                    table1.write("%d %.10f %.10f %.10e %.10e\n" % tuple([i] + values))
+                    table2.write("%d %.8f %.8f %.8e %.8e\n" % tuple([i] + values))
+        print("Comparing two tables of %d lines" % num_lines)
+        native = boinctools._native
+        if native:
+            timed("native numeric_files_equal", boinctools.numeric_files_equal, file1, file2, tolerance)
+        boinctools._native = None
+        try:
+            timed("python float()", boinctools.numeric_files_equal, file1, file2, tolerance)
+        finally:
+            boinctools._native = native
+    finally:
+        for filename in (file1, file2):
+            if OP.isfile(filename):
+                os.unlink(filename)
+        os.rmdir(workdir)
+
+
+def bench_line_sets_equal(num_lines="2000000"):
+    """
+    Compares two hit lists of num_lines lines in different orders,
+    natively by hashes and by sketch, and by sorting the lines in Python.
+    Run natively first, so that its max RSS is not the Python peak.
+    """
+    import random
+    num_lines = int(num_lines)
+    workdir = tempfile.mkdtemp()
+    file1 = OP.join(workdir, "a")
+    file2 = OP.join(workdir, "b")
+    try:
+        line = lambda i: "hit %d\tscore %.6f\tframe %d\n" % (i, (i * 0.618034) % 1, i % 6)
+        order = range(num_lines)
+        with open(file1, "w") as hits:
+            for i in order:
+                hits.write(line(i))
+        random.shuffle(order)
+        with open(file2, "w") as hits:
+            for i in order:
+                hits.write(line(i))
+        del order
+        print("Comparing two hit lists of %d lines (%.1f MB)" % (num_lines, OP.getsize(file1) / 1048576.0))
+        native = boinctools._native
+        if native:
+            timed("native line_sets_equal", boinctools.line_sets_equal, file1, file2)
+            timed("native min_similarity=0.99", boinctools.line_sets_equal, file1, file2, 0.99)
+        boinctools._native = None
+        try:
+            timed("python sorted()", boinctools.line_sets_equal, file1, file2)
+        finally:
+            boinctools._native = native
+    finally:
+        for filename in (file1, file2):
+            if OP.isfile(filename):
+                os.unlink(filename)
+        os.rmdir(workdir)
+
+
+def bench_schedule_work(appname, wu_tmpl, res_tmpl, count="100", *input_filenames):
+    """
+    Creates count workunits of appname with schedule_work in a loop, and
+    another count with one call to schedule_work_batch, in the project in
+    local_boinc_settings.py. The workunits are real; cancel them with
+    bin/cancel_jobs afterwards. The input files must already be staged.
+    """
+    count = int(count)
+    prefix = "benchmark_%d" % int(time.time())
+    loop_jobs = [(appname, "%s_loop_%d" % (prefix, i), wu_tmpl, res_tmpl, list(input_filenames)) for i in range(count)]
+    batch_jobs = [(appname, "%s_batch_%d" % (prefix, i), wu_tmpl, res_tmpl, list(input_filenames)) for i in range(count)]
+    print("Creating %d workunits, named %s_*" % (count, prefix))
+
+    def loop(jobs):
+        for job in jobs:
+            boinctools.schedule_work(*job)
+        return len(jobs)
+    (created, elapsed) = timed("schedule_work loop", loop, loop_jobs)
+    print("%-40s %10.1f workunits/s" % ("", count / elapsed))
+    (errors, elapsed) = timed("schedule_work_batch", lambda jobs: len([error for error in boinctools.schedule_work_batch(jobs) if error]), batch_jobs)
+    print("%-40s %10.1f workunits/s (returned the number of failed jobs)" % ("", count / elapsed))
+
+
+def bench_stage_files(num_files="2000", size_kb="64"):
+    """
+    Stages num_files files of size_kb kilobytes into a scratch directory,
+    with cp and chmod for each file as boinctools.stage_files does without
+    the native extension, and with one call to the native stage_files.
+    """
+    import stat
+    import subprocess
+    num_files = int(num_files)
+    size_kb = int(size_kb)
+    workdir = tempfile.mkdtemp()
+    source_dir = OP.join(workdir, "source")
+    os.mkdir(source_dir)
+    try:
+        block = os.urandom(size_kb << 10)
+        sources = []
+        for i in range(num_files):
+            sources.append(OP.join(source_dir, "input_%d" % i))
+            with open(sources[-1], "wb") as output:
+                output.write(block)
+        print("Staging %d files of %d KB" % (num_files, size_kb))
+
+        def cp_loop(destination_dir):
+            os.mkdir(destination_dir)
+            for source in sources:
+                destination = OP.join(destination_dir, OP.basename(source))
+                subprocess.check_call(["cp", source, destination])
+                os.chmod(destination, stat.S_IRUSR | stat.S_IWUSR | stat.S_IRGRP | stat.S_IWGRP)
+            return num_files
+        (count, elapsed) = timed("cp subprocess per file", cp_loop, OP.join(workdir, "cp"))
+        print("%-40s %10.1f files/s" % ("", num_files / elapsed))
+
+        if boinctools._native:
+            def native(destination_dir, hard_link):
+                os.mkdir(destination_dir)
+                results = boinctools._native.stage_files([(source, OP.join(destination_dir, OP.basename(source))) for source in sources], hard_link=hard_link)
+                methods = {}
+                for (method, error) in results:
+                    methods[method] = methods.get(method, 0) + 1
+                return methods
+            (methods, elapsed) = timed("native stage_files", native, OP.join(workdir, "native"), False)
+            print("%-40s %10.1f files/s" % ("", num_files / elapsed))
+            (methods, elapsed) = timed("native stage_files, hard_link", native, OP.join(workdir, "linked"), True)
+            print("%-40s %10.1f files/s" % ("", num_files / elapsed))
+    finally:
+        shutil.rmtree(workdir)
+
+
+def bench_dag_journal(num_jobs="100000", num_updates="200"):
+    """
+    Records num_updates job state changes in a DAG of num_jobs jobs,
+    stored as a text file of one line per job, by reading, changing and
+    rewriting the whole file, as update_dag_job_state did with
+    dag.save, and by appending to the DAG's journal. Then times reading
+    the journal back and merging it into the DAG file, as
+    compact_dag_journal does.
+    """
+    num_jobs = int(num_jobs)
+    num_updates = int(num_updates)
+    workdir = tempfile.mkdtemp()
+    dagpath = OP.join(workdir, "jobs.dag")
+    try:
+        with open(dagpath, "w") as dag_file:
+            for i in range(num_jobs):
+                dag_file.write("job_%d 0 /path/to/job_%d/input /path/to/job_%d/output arguments\n" % (i, i, i))
+        print("DAG of %d jobs, %.1f MB" % (num_jobs, OP.getsize(dagpath) / 1e6))
+
+        def load():
+            jobs = {}
+            order = []
+            with open(dagpath) as dag_file:
+                for line in dag_file:
+                    fields = line.split(" ", 2)
+                    jobs[fields[0]] = [int(fields[1]), fields[2]]
+                    order.append(fields[0])
+            return (jobs, order)
+        def save(jobs, order):
+            with open(dagpath + ".new", "w") as dag_file:
+                for name in order:
+                    dag_file.write("%s %d %s" % (name, jobs[name][0], jobs[name][1]))
+            os.rename(dagpath + ".new", dagpath)
+        def rewrite():
+            for i in range(num_updates):
+                (jobs, order) = load()
+                jobs["job_%d" % i][0] = 1
+                save(jobs, order)
+            return num_updates
+        def journal():
+            path = boinctools.dag_journal_path(dagpath)
+            for i in range(num_updates):
+                boinctools.append_dag_journal(path, "job_%d" % i, 2)
+            return num_updates
+        def compact():
+            (states, end) = boinctools.read_dag_journal(boinctools.dag_journal_path(dagpath))
+            (jobs, order) = load()
+            for (name, state) in states.items():
+                jobs[name][0] = state
+            save(jobs, order)
+            return len(states)
+        for (label, function) in (("rewrite DAG per update", rewrite), ("append to journal", journal)):
+            (count, elapsed) = timed(label, function)
+            print("%-40s %10.3f ms/update" % ("", elapsed * 1e3 / num_updates))
+        timed("read journal and merge into DAG", compact)
+    finally:
+        shutil.rmtree(workdir)
+
+
+def bench_dir_hier_path(num_files="1000"):
+    """
+    Resolves num_files names in the download hierarchy of the project in
+    local_boinc_settings.py, by running bin/dir_hier_path for each name
+    and with one call to the native dir_hier_paths. The project needs
+    config.xml and bin/dir_hier_path.
+    """
+    num_files = int(num_files)
+    if not OP.isfile(OP.join(boinctools.project_path, "config.xml")) or not OP.isfile(OP.join(boinctools.project_path, "bin", "dir_hier_path")):
+        print("%s has no config.xml or bin/dir_hier_path" % boinctools.project_path)
+        return
+    names = ["benchmark_%d" % i for i in range(num_files)]
+    paths = {}
+    def resolve(label, function):
+        paths[label] = function(names)
+        return len(paths[label])
+    print("Resolving %d file names" % num_files)
+    (count, elapsed) = timed("subprocess bin/dir_hier_path", resolve, "subprocess", lambda names: [boinctools._dir_hier_path_subprocess(name) for name in names])
+    print("%-40s %10.1f files/s" % ("", num_files / elapsed))
+    if boinctools._native_dir_hier_path():
+        (count, elapsed) = timed("native dir_hier_paths", resolve, "native", boinctools.dir_hier_paths)
+        print("%-40s %10.1f files/s" % ("", num_files / elapsed))
+        if paths["native"] != paths["subprocess"]:
+            print("WARNING: native and subprocess paths differ")
+    else:
+        print("boinctools._native was not built with BOINC_DIR set.")
+
+
+def bench_xml_fields(num_results="2000", size_kb="16", num_tags="4"):
+    """
+    Looks up num_tags fields in the stderr_out of num_results results,
+    of size_kb kilobytes of log text with the fields at the end, with a
+    Python regex per field, as validators did, and with
+    boinctools.xml_fields, which scans the text once for every field.
+    Each result is compared twice, as in check_set, so the lookup is
+    also timed on results that keep their values.
+    """
+    import re
+    num_results = int(num_results)
+    num_tags = int(num_tags)
+    tags = ["field_%d" % i for i in range(num_tags)]
+    line = "Iteration 12345: residual 1.234e-05 < tolerance, step 0.5\n"
+    log = line * ((int(size_kb) << 10) // len(line))
+    texts = ["<stderr_txt>\n%s%s</stderr_txt>\n" % (log, "".join("<%s>%d</%s>\n" % (tag, i, tag) for tag in tags)) for i in range(num_results)]
+    patterns = [re.compile(r"<%s>(.*?)</%s>" % (tag, tag), re.DOTALL) for tag in tags]
+    def regex():
+        for text in texts:
+            for compare in range(2):
+                fields = dict((tag, pattern.search(text).group(1).strip()) for (tag, pattern) in zip(tags, patterns))
+        return len(fields)
+    def one_pass():
+        for text in texts:
+            for compare in range(2):
+                fields = boinctools.xml_fields(text, tags)
+        return len(fields)
+    def cached():
+        results = []
+        for text in texts:
+            result = boinctools.BoincResult("result", 0, 0, 0, 0, 0)
+            result.stderr_out = text
+            results.append(result)
+        for result in results:
+            for compare in range(2):
+                fields = result.xml_fields(tags)
+        return len(fields)
+    print("%d results, %d KB of stderr_out, %d fields" % (num_results, len(texts[0]) >> 10, num_tags))
+    for (label, function) in (("regex per field", regex), ("xml_fields", one_pass), ("BoincResult.xml_fields", cached)):
+        (count, elapsed) = timed(label, function)
+        print("%-40s %10.1f us/compare" % ("", elapsed * 1e6 / (2 * num_results)))
+
+
+def bench_validation_order(num_dags="10", depth="20", width="4", backlog="2000", runtime="10"):
+    """
+    Simulates validating num_dags DAGs of depth layers of width jobs,
+    each job depending on two jobs of the layer above, behind backlog
+    independent workunits that were submitted first. The validator
+    handles one workunit per time step, and a job runs for runtime steps
+    once its parents are validated. Reports the makespan of the DAGs and
+    of all the work with workunits taken in order of id, as
+    do_validate_scan does by default, and in order of their successor
+    counts, as with dag_successor_count.
+    """
+    import heapq
+    import random
+    (num_dags, depth, width, backlog, runtime) = [int(x) for x in (num_dags, depth, width, backlog, runtime)]
+    random.seed(1)
+
+    class Job:
+        def __init__(self, in_dag):
+            self.in_dag = in_dag
+            self.children = []
+            self.parents = []
+    leaves = [Job(False) for i in range(backlog)]
+    roots = []
+    dag_jobs = []
+    for dag_index in range(num_dags):
+        layer = [Job(True) for i in range(width)]
+        roots.extend(layer)
+        dag_jobs.extend(layer)
+        for level in range(1, depth):
+            next_layer = [Job(True) for i in range(width)]
+            for job in next_layer:
+                job.parents = random.sample(layer, min(2, width))
+                for parent in job.parents:
+                    parent.children.append(job)
+            dag_jobs.extend(next_layer)
+            layer = next_layer
+    counts = {}
+    def count():
+        counts.update(boinctools.successor_counts(dag_jobs + leaves))
+        return len(counts)
+    timed("successor_counts", count)
+    print("%d DAG jobs, %d backlog workunits" % (len(dag_jobs), backlog))
+
+    def simulate(key):
+        ids = {}
+        waiting = dict((job, len(job.parents)) for job in dag_jobs)
+        pending = []
+        arrivals = []
+        for job in leaves + roots:
+            ids[job] = len(ids)
+            if job.in_dag:
+                heapq.heappush(arrivals, (runtime, ids[job], job))
+            else:
+                heapq.heappush(pending, (key(job, ids[job]), job))
+        t = 0
+        dag_makespan = 0
+        while pending or arrivals:
+            if not pending:
+                t = max(t, arrivals[0][0])
+            while arrivals and arrivals[0][0] <= t:
+                job = heapq.heappop(arrivals)[2]
+                heapq.heappush(pending, (key(job, ids[job]), job))
+            job = heapq.heappop(pending)[1]
+            t += 1
+            if job.in_dag:
+                dag_makespan = t
+            for child in job.children:
+                waiting[child] -= 1
+                if waiting[child] == 0:
+                    ids[child] = len(ids)
+                    heapq.heappush(arrivals, (t + runtime, ids[child], child))
+        return (dag_makespan, t)
+
+    fifo = simulate(lambda job, id: (id,))
+    # scored as by dag_successor_count
+    scored = simulate(lambda job, id: (-(counts[job] + job.in_dag), id))
+    print("%-40s %10s %10s" % ("", "DAGs", "all work"))
+    print("%-40s %10d %10d" % ("by id", fifo[0], fifo[1]))
+    print("%-40s %10d %10d" % ("by successor count", scored[0], scored[1]))
+    print("%-40s %9.1f%% %9.1f%%" % ("change", 100.0 * (scored[0] - fifo[0]) / fifo[0], 100.0 * (scored[1] - fifo[1]) / fifo[1]))
+
+
+benchmarks = {
+    'append_output': bench_append_output,
+    'compressed_outputs': bench_compressed_outputs,
+    'dag_journal': bench_dag_journal,
+    'dir_hier_path': bench_dir_hier_path,
+    'files_equal': bench_files_equal,
+    'line_sets_equal': bench_line_sets_equal,
+    'numeric_files_equal': bench_numeric_files_equal,
+    'schedule_work': bench_schedule_work,
+    'stage_files': bench_stage_files,
+    'validation_order': bench_validation_order,
+    'xml_fields': bench_xml_fields,
+    }
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] not in benchmarks:
+        print(__doc__)
+        for name in sorted(benchmarks):
+            print("%s:%s" % (name, benchmarks[name].__doc__))
+        sys.exit(1)
+    if not boinctools._native:
+        print("WARNING: boinctools._native is not built. Only Python code will be timed.")
+    benchmarks[sys.argv[1]](*sys.argv[2:])
@@ -1,6 +1,8 @@
 from sys import path
 import os
-path.append(os.getcwd())
+# This file is run for every validation, so add the path only once.
+if not os.getcwd() in path:
+    path.append(os.getcwd())
 
 if not "validators" in globals():
     validators = {}
@@ -8,6 +10,10 @@ if not "cleaners" in globals():
     cleaners = {}
 if not "assimilators" in globals():
     assimilators = {}
+if not "validation_priorities" in globals():
+    validation_priorities = {}
+if not "continue_children" in globals():
+    continue_children = {}
 
 
 from test_validator import validate as test_validate
@@ -16,6 +22,12 @@ validators['42'] = 'test_validate'
 from test_validator import cleaner as test_cleaner
 cleaners['42'] = 'test_cleaner'
 
+from test_validator import priority as test_priority
+validation_priorities['42'] = 'test_priority'
+
+from test_validator import continue_children as test_continue
+continue_children['42'] = 'test_continue'
+
 def sim_assim(results,canonical_result):
     # do nothing
     return
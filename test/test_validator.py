@@ -8,3 +8,21 @@ def cleaner(result):
     print("Cleaning %s" % result.name)
 
     return True
+
+
+def priority(workunit_names):
+    # Workunits named ..._N are scored N; others are left out, i.e. 0.
+    scores = {}
+    for name in workunit_names:
+        suffix = name.split("_")[-1]
+        if suffix.isdigit():
+            scores[name] = int(suffix)
+    return scores
+
+
+released = [] # names of the results passed to continue_children
+
+def continue_children(results):
+    for result in results:
+        print("Releasing successors of %s" % result.name)
+        released.append(result.name)
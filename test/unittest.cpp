@@ -1,12 +1,43 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <Python.h>
 #include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "boinc/error_numbers.h"
 #include "boinc/boinc_db.h"
 #include "boinc/sched_util.h"
 #include "boinc/validate_util.h"
 #include "assimilate_handler.h"
+#include "file_compare.h"
+#include "numeric_compare.h"
+#include "line_set_compare.h"
+#include "decompress.h"
+#include "artifact_cache.h"
+#include "prefetch.h"
+#include "batch_open.h"
+#include "stage_files.h"
+#include "output_writer.h"
+#include "handoff_queue.h"
+#include "xml_fields.h"
+#include "work_pool.h"
+#include "pyboinc.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 WORKUNIT wu;
 RESULT result1,result2;
@@ -89,16 +120,240 @@ int test_validator_compare_result()
   return retval || match;
 }
 
+// Runs the validator's init_result, compare_results and cleanup_result
+// cycle on the test results, and checks that the resident set size
+// stays flat once the interpreter has warmed up.
+int test_validator_soak(long cycles)
+{
+  extern int init_result(RESULT& result, void*& data);
+  extern int compare_results(RESULT& r1, void* _data1, RESULT const& r2, void* _data2, bool& match);
+  extern int cleanup_result(RESULT const& r, void* data);
+  extern int flush_cleanups();
+  extern long long resident_set_size();
+  extern void print_memory_report(size_t max_types);
+  const long long max_growth = 4 << 20;
+  long long start_rss = -1, end_rss;
+  void *soak_data1 = NULL, *soak_data2 = NULL;
+  bool match;
+
+  printf("Testing memory use over %ld validation cycles\n",cycles);
+
+  for(long i = 0;i < cycles;i++)
+    {
+      if(i == cycles/10)
+	start_rss = resident_set_size();
+      if(init_result(result1,soak_data1) || init_result(result2,soak_data2))
+	return 1;
+      match = false;
+      if(compare_results(result1,soak_data1,result2,soak_data2,match) || !match)
+	return 1;
+      if(cleanup_result(result1,soak_data1) || cleanup_result(result2,soak_data2))
+	return 1;
+      if(i % 100 == 99 && flush_cleanups())
+	return 1;
+    }
+  if(flush_cleanups())
+    return 1;
+  end_rss = resident_set_size();
+
+  print_memory_report(10);
+  if(start_rss < 0 || end_rss < 0)
+    return 0;// not known on this system
+  printf("RSS after warm up: %.1f MB. At end: %.1f MB\n",start_rss/1048576.0,end_rss/1048576.0);
+  return end_rss - start_rss > max_growth;
+}
+
+// BoincResults are reused once they are released. One that is still
+// referenced, or whose output_files list is, must not be touched.
+int test_boincresult_reuse()
+{
+  std::vector<std::string> paths(1,"test_output.txt");
+  PyObject *kept, *released, *reused, *kept_files, *files;
+  long reused_before = get_boincresult_pool_stats().reused;
+  int retval = 0;
+
+  printf("Testing BoincResult reuse\n");
+
+  kept = new_boinc_result(result1,&paths);
+  released = new_boinc_result(result2,&paths);
+  if(kept == NULL || released == NULL)
+    return 1;
+  kept_files = PyObject_GetAttrString(released,"output_files");
+  if(kept_files == NULL)
+    return 1;
+  Py_DECREF(released);
+
+  reused = new_boinc_result(result2,&paths);
+  if(reused == NULL)
+    return 1;
+  if(get_boincresult_pool_stats().reused <= reused_before)
+    retval = 1;// not taken from the free list
+  files = PyObject_GetAttrString(reused,"output_files");
+  if(files == NULL || files == kept_files || PyList_Size(kept_files) != 1 || PyList_Size(files) != 1)
+    retval = 1;
+  Py_XDECREF(files);
+  files = PyObject_GetAttrString(kept,"output_files");
+  if(files == NULL || PyList_Size(files) != 1)
+    retval = 1;
+  Py_XDECREF(files);
+  if(strcmp(PyBytes_AsString(((BoincResult*)kept)->name),result1.name) != 0)
+    retval = 1;
+
+  Py_DECREF(kept);
+  Py_DECREF(kept_files);
+  Py_DECREF(reused);
+  return retval;
+}
+
+// The RESULT fields beyond those of boinctools.BoincResult, and the
+// text fields, which must survive the RESULT once detached.
+int test_boincresult_fields()
+{
+  RESULT *native = new RESULT;
+  PyObject *py_result, *value;
+  int retval = 0;
+
+  printf("Testing BoincResult fields\n");
+
+  *native = result1;
+  native->hostid = 17;
+  native->elapsed_time = 2.5;
+  strcpy(native->stderr_out,"<stderr_txt>done</stderr_txt>");
+  py_result = new_boinc_result(*native,NULL);
+  if(py_result == NULL)
+    {
+      delete native;
+      return 1;
+    }
+
+  value = PyObject_GetAttrString(py_result,"hostid");
+  if(value == NULL || PyInt_AsLong(value) != 17)
+    retval = 1;
+  Py_XDECREF(value);
+  value = PyObject_GetAttrString(py_result,"elapsed_time");
+  if(value == NULL || PyFloat_AsDouble(value) != 2.5)
+    retval = 1;
+  Py_XDECREF(value);
+  // The test project has no artifact cache.
+  value = PyObject_CallMethod(py_result,(char*)"artifact",(char*)"(s)","upload/hid_UTR.fasta.out");
+  if(value != Py_None)
+    retval = 1;
+  Py_XDECREF(value);
+
+  detach_boinc_result(py_result);
+  memset(native,0,sizeof(RESULT));
+  delete native;
+  value = PyObject_GetAttrString(py_result,"stderr_out");
+  if(value == NULL || strcmp(PyBytes_AsString(value),"<stderr_txt>done</stderr_txt>") != 0)
+    retval = 1;
+  Py_XDECREF(value);
+  value = PyObject_GetAttrString(py_result,"xml_doc_in");
+  if(value == NULL || strstr(PyBytes_AsString(value),"hid_UTR.fasta.out") == NULL)
+    retval = 1;
+  Py_XDECREF(value);
+  if(PyErr_Occurred())
+    PyErr_Print();
+
+  Py_DECREF(py_result);
+  return retval;
+}
+
+int test_xml_fields()
+{
+  const char *doc = "<stderr_txt>\n<!-- <exit_code>9</exit_code> -->\n"
+    "x < y\n<exit_code> 0 </exit_code>\n<note a=\"1\">&lt;ok&gt; &amp; done</note>\n"
+    "<empty/><raw><![CDATA[a<b]]></raw>\n</stderr_txt>\n";
+  std::vector<std::string> tags;
+  std::vector<XML_FIELD> fields;
+  RESULT *native = new RESULT;
+  PyObject *py_result, *values, *list, *value;
+  int retval = 0;
+
+  printf("Testing xml_fields\n");
+
+  tags.push_back("exit_code");
+  tags.push_back("note");
+  tags.push_back("empty");
+  tags.push_back("raw");
+  tags.push_back("missing");
+  if(find_xml_fields(doc,strlen(doc),tags,fields) != 4 || fields[0].value != "0" || fields[1].value != "<ok> & done"
+     || !fields[2].found || !fields[2].value.empty() || fields[3].value != "a<b" || fields[4].found)
+    return 1;
+
+  // Values are kept by the result, so a second call does not scan the
+  // text, which is changed here to show it.
+  *native = result1;
+  strcpy(native->stderr_out,doc);
+  py_result = new_boinc_result(*native,NULL);
+  if(py_result == NULL)
+    {
+      delete native;
+      return 1;
+    }
+  list = Py_BuildValue("[ss]","exit_code","missing");
+  values = PyObject_CallMethod(py_result,(char*)"xml_fields","(O)",list);
+  if(values == NULL || PyDict_Size(values) != 2 || strcmp(PyBytes_AsString(PyDict_GetItemString(values,"exit_code")),"0") != 0
+     || PyDict_GetItemString(values,"missing") != Py_None)
+    retval = 1;
+  Py_XDECREF(values);
+  strcpy(native->stderr_out,"<exit_code>1</exit_code>");
+  values = PyObject_CallMethod(py_result,(char*)"xml_fields","(O)",list);
+  value = (values != NULL) ? PyDict_GetItemString(values,"exit_code") : NULL;
+  if(value == NULL || strcmp(PyBytes_AsString(value),"0") != 0)
+    retval = 1;
+  Py_XDECREF(values);
+  Py_XDECREF(list);
+  if(PyErr_Occurred())
+    PyErr_Print();
+
+  release_boinc_result(py_result);
+  delete native;
+  return retval;
+}
+
 int test_validator_clean_result()
 {
   extern int cleanup_result(RESULT const& r, void* data);
+  extern int flush_cleanups();
 
   printf("Testing cleanup_result in pyvalidator.cpp\n");
   
-  return cleanup_result(result1, data1) || cleanup_result(result2, data2);
+  return cleanup_result(result1, data1) || cleanup_result(result2, data2) || flush_cleanups();
 }
 
 
+int test_continue_children()
+{
+  extern void queue_finished_workunit(RESULT const& canonical);
+  extern size_t finished_workunits();
+  extern int continue_children();
+  PyObject *module, *released;
+  int retval = 0;
+
+  printf("Testing continue_children\n");
+
+  // Both workunits are released by one call, after the RESULTs are gone.
+  RESULT *canonical = new RESULT(result1);
+  queue_finished_workunit(*canonical);
+  strcpy(canonical->name,"other-workunit_1");
+  queue_finished_workunit(*canonical);
+  delete canonical;
+  if(finished_workunits() != 2 || continue_children() || finished_workunits() != 0)
+    return 1;
+
+  module = PyImport_ImportModule("test_validator");
+  released = (module != NULL) ? PyObject_GetAttrString(module,"released") : NULL;
+  if(released == NULL || PyList_Size(released) != 2
+     || strcmp(PyString_AsString(PyList_GetItem(released,0)),"test-workunit_0") != 0
+     || strcmp(PyString_AsString(PyList_GetItem(released,1)),"other-workunit_1") != 0)
+    retval = 1;
+  Py_XDECREF(released);
+  Py_XDECREF(module);
+  if(PyErr_Occurred())
+    PyErr_Print();
+  return retval;
+}
+
 int test_assimilate_handler()
 {
   int retval;
@@ -111,10 +366,760 @@ int test_assimilate_handler()
   return retval;
 }
 
+int write_test_file(const char *filename, const char *contents)
+{
+  FILE *file = fopen(filename,"w");
+  if(file == NULL)
+    return 1;
+  fputs(contents,file);
+  fclose(file);
+  return 0;
+}
+
+int test_files_equal()
+{
+  bool equal = false;
+  int retval = 0;
+
+  printf("Testing files_equal\n");
+
+  if(write_test_file("compare_a.txt","1 2 3\n") || write_test_file("compare_b.txt","1 2 3\n") || write_test_file("compare_c.txt","1 2 4\n"))
+    return 1;
+
+  printf("Comparing same files...\n");
+  if(files_equal("compare_a.txt","compare_b.txt",equal) || !equal)
+    retval = 1;
+
+  printf("Comparing different files...\n");
+  if(!retval && (files_equal("compare_a.txt","compare_c.txt",equal) || equal))
+    retval = 1;
+
+  printf("Comparing missing file...\n");
+  if(!retval && files_equal("compare_a.txt","compare_missing.txt",equal) == 0)
+    retval = 1;
+
+  // Descriptors are compared from their current offsets.
+  printf("Comparing descriptors at different offsets...\n");
+  if(!retval && write_test_file("compare_d.txt","x1 2 3\n"))
+    retval = 1;
+  int fd1 = open("compare_a.txt",O_RDONLY), fd2 = open("compare_a.txt",O_RDONLY), fd3 = open("compare_d.txt",O_RDONLY);
+  if(!retval && (fd1 < 0 || fd2 < 0 || fd3 < 0 || lseek(fd2,1,SEEK_SET) != 1
+		 || fds_equal(fd1,fd2,equal) || equal))
+    retval = 1;
+  if(!retval && (lseek(fd3,1,SEEK_SET) != 1 || fds_equal(fd1,fd3,equal) || !equal))
+    retval = 1;
+  if(fd1 >= 0)
+    close(fd1);
+  if(fd2 >= 0)
+    close(fd2);
+  if(fd3 >= 0)
+    close(fd3);
+
+  unlink("compare_a.txt");
+  unlink("compare_b.txt");
+  unlink("compare_c.txt");
+  unlink("compare_d.txt");
+  return retval;
+}
+
+int test_numeric_files_equal()
+{
+  NUMERIC_COMPARE_CONFIG config;
+  bool equal = false;
+  int retval = 0;
+
+  printf("Testing numeric_files_equal\n");
+
+  if(write_test_file("numeric_a.txt","x 1.0 2.5e3\ny 0.1 -7\n") || write_test_file("numeric_b.txt","x 1.00001 2500.1\n\ny 0.1 -7") || write_test_file("numeric_c.txt","z 1.0 2.5e3\ny 0.1 -7\n"))
+    return 1;
+
+  config.default_tolerance = NUMERIC_TOLERANCE(1e-4,0);
+  config.columns[2] = NUMERIC_TOLERANCE(0,1e-4);
+
+  printf("Comparing files within tolerance...\n");
+  if(numeric_files_equal("numeric_a.txt","numeric_b.txt",config,equal) || !equal)
+    retval = 1;
+
+  printf("Comparing files outside tolerance...\n");
+  config.columns[2] = NUMERIC_TOLERANCE(0,1e-6);
+  if(!retval && (numeric_files_equal("numeric_a.txt","numeric_b.txt",config,equal) || equal))
+    retval = 1;
+
+  printf("Comparing files with different text...\n");
+  if(!retval && (numeric_files_equal("numeric_a.txt","numeric_c.txt",config,equal) || equal))
+    retval = 1;
+
+  printf("Comparing open descriptors...\n");
+  int fd1 = open("numeric_a.txt",O_RDONLY), fd2 = open("numeric_b.txt",O_RDONLY);
+  config.columns[2] = NUMERIC_TOLERANCE(0,1e-4);
+  for(int pass = 0;!retval && pass < 2;pass++)
+    if(fd1 < 0 || fd2 < 0 || lseek(fd1,0,SEEK_SET) || lseek(fd2,0,SEEK_SET)
+       || numeric_fds_equal(fd1,fd2,config,equal) || !equal)
+      retval = 1;
+  if(fd1 >= 0)
+    close(fd1);
+  if(fd2 >= 0)
+    close(fd2);
+
+  // nan and inf are text to both the native and the Python comparison.
+  printf("Comparing nan and inf in C++ and Python...\n");
+  const char *pairs[][3] = {{"nan 1\n","2 1\n","0"}, {"nan 1\n","nan 1\n","1"}, {"inf\n","1e999\n","0"}, {"1e999\n","1e999\n","1"}, {"1e999\n","-1e999\n","0"}};
+  PyObject *module = PyImport_ImportModule("boinctools"), *native = NULL;
+  if(module == NULL || (native = PyObject_GetAttrString(module,"_native")) == NULL)
+    retval = 1;
+  for(size_t i = 0;!retval && i < sizeof(pairs)/sizeof(*pairs);i++)
+    {
+      bool expected = (pairs[i][2][0] == '1');
+      if(write_test_file("numeric_a.txt",pairs[i][0]) || write_test_file("numeric_b.txt",pairs[i][1])
+	 || numeric_files_equal("numeric_a.txt","numeric_b.txt",NUMERIC_COMPARE_CONFIG(),equal) || equal != expected)
+	retval = 1;
+      PyObject_SetAttrString(module,"_native",Py_None);
+      PyObject *fallback = PyObject_CallMethod(module,(char*)"numeric_files_equal",(char*)"(ss)","numeric_a.txt","numeric_b.txt");
+      PyObject_SetAttrString(module,"_native",native);
+      if(fallback == NULL || PyObject_IsTrue(fallback) != expected)
+	{
+	  printf("Python disagrees on \"%s\" and \"%s\"\n",pairs[i][0],pairs[i][1]);
+	  retval = 1;
+	}
+      Py_XDECREF(fallback);
+    }
+  if(PyErr_Occurred())
+    {
+      PyErr_Print();
+      retval = 1;
+    }
+  Py_XDECREF(native);
+  Py_XDECREF(module);
+
+  unlink("numeric_a.txt");
+  unlink("numeric_b.txt");
+  unlink("numeric_c.txt");
+  return retval;
+}
+
+int test_line_sets_equal()
+{
+  LINE_SET_CONFIG config;
+  std::string forward, backward, twice, near;
+  char line[64];
+  bool equal = false;
+  int retval = 0;
+  const int num_lines = 70000;// enough to be radix sorted
+
+  printf("Testing line_sets_equal\n");
+
+  for(int i = 0;i < num_lines;i++)
+    {
+      snprintf(line,sizeof(line),"hit %d\t%d\n",i,i % 7);
+      forward += line;
+      snprintf(line,sizeof(line),"  hit %d  %d\r\n\n",num_lines - 1 - i,(num_lines - 1 - i) % 7);
+      backward += line;
+      snprintf(line,sizeof(line),"hit %d %d\n",i,i % 100 ? i % 7 : -1);
+      near += line;
+    }
+  twice = forward + "hit 0 0\n";
+  if(write_test_file("lines_a.txt",forward.c_str()) || write_test_file("lines_b.txt",backward.c_str())
+     || write_test_file("lines_c.txt",twice.c_str()) || write_test_file("lines_d.txt",near.c_str()))
+    return 1;
+
+  printf("Comparing reordered lines...\n");
+  if(line_sets_equal("lines_a.txt","lines_b.txt",config,equal) || !equal)
+    retval = 1;
+
+  printf("Comparing a duplicated line...\n");
+  if(!retval && (line_sets_equal("lines_a.txt","lines_c.txt",config,equal) || equal))
+    retval = 1;
+
+  // One line in a hundred differs, for a Jaccard similarity of 99/101.
+  printf("Comparing near-equal lines...\n");
+  if(!retval && (line_sets_equal("lines_a.txt","lines_d.txt",config,equal) || equal))
+    retval = 1;
+  config = LINE_SET_CONFIG(0.95,512);
+  if(!retval && (line_sets_equal("lines_a.txt","lines_d.txt",config,equal) || !equal))
+    retval = 1;
+  config = LINE_SET_CONFIG(0.999,512);
+  if(!retval && (line_sets_equal("lines_a.txt","lines_d.txt",config,equal) || equal))
+    retval = 1;
+
+  // The descriptors are left open, so they can be compared again.
+  printf("Comparing open descriptors...\n");
+  int fd1 = open("lines_a.txt",O_RDONLY), fd2 = open("lines_b.txt",O_RDONLY);
+  config = LINE_SET_CONFIG();
+  for(int pass = 0;!retval && pass < 2;pass++)
+    if(fd1 < 0 || fd2 < 0 || lseek(fd1,0,SEEK_SET) || lseek(fd2,0,SEEK_SET)
+       || line_set_fds_equal(fd1,fd2,config,equal) || !equal)
+      retval = 1;
+  if(fd1 >= 0)
+    close(fd1);
+  if(fd2 >= 0)
+    close(fd2);
+
+  unlink("lines_a.txt");
+  unlink("lines_b.txt");
+  unlink("lines_c.txt");
+  unlink("lines_d.txt");
+  return retval;
+}
+
+int write_binary_file(const char *filename, const std::string& contents)
+{
+  FILE *file = fopen(filename,"wb");
+  if(file == NULL)
+    return 1;
+  fwrite(contents.data(),1,contents.size(),file);
+  fclose(file);
+  return 0;
+}
+
+int test_decompress()
+{
+  static const unsigned char gzip_header[] = {0x1f, 0x8b, 0x08, 0x00};
+  std::string text, reordered;
+  char line[64];
+  bool equal = false;
+  int retval = 0;
+  const int num_lines = 20000;// several buffers of input and output
+
+  printf("Testing DECOMPRESS_READER (gzip: %s, zstd: %s)\n",
+	 compression_supported(COMPRESSION_GZIP) ? "yes" : "no",compression_supported(COMPRESSION_ZSTD) ? "yes" : "no");
+
+  if(detect_compression(gzip_header,sizeof(gzip_header)) != COMPRESSION_GZIP
+     || detect_compression((const unsigned char*)"1 2 3\n",6) != COMPRESSION_NONE)
+    return 1;
+
+  for(int i = 0;i < num_lines;i++)
+    {
+      snprintf(line,sizeof(line),"hit %d %.3f\n",i,i * 0.001);
+      text += line;
+    }
+  for(int i = num_lines - 1;i >= 0;i--)
+    {
+      snprintf(line,sizeof(line),"hit %d %.3f\n",i,i * 0.001);
+      reordered += line;
+    }
+  if(write_binary_file("decompress_plain.txt",text) || write_binary_file("decompress_reordered.txt",reordered))
+    return 1;
+
+#ifdef HAVE_ZLIB
+  {
+    // Written as two gzip members, as by "cat a.gz b.gz".
+    gzFile gz = gzopen("decompress_a.gz","wb");
+    if(gz == NULL || gzwrite(gz,text.data(),text.size() / 2) <= 0 || gzclose(gz) != Z_OK)
+      return 1;
+    gz = gzopen("decompress_a.gz","ab9");
+    if(gz == NULL || gzwrite(gz,text.data() + text.size() / 2,text.size() - text.size() / 2) <= 0 || gzclose(gz) != Z_OK)
+      return 1;
+
+    printf("Comparing gzip and plain files...\n");
+    if(files_equal("decompress_a.gz","decompress_plain.txt",equal) || !equal)
+      retval = 1;
+    if(!retval && (numeric_files_equal("decompress_plain.txt","decompress_a.gz",NUMERIC_COMPARE_CONFIG(),equal) || !equal))
+      retval = 1;
+    if(!retval && (line_sets_equal("decompress_a.gz","decompress_reordered.txt",LINE_SET_CONFIG(),equal) || !equal))
+      retval = 1;
+    if(!retval && (files_equal("decompress_a.gz","decompress_reordered.txt",equal) || equal))
+      retval = 1;
+
+    printf("Reading a truncated gzip file...\n");
+    std::string truncated;
+    FILE *file = fopen("decompress_a.gz","rb");
+    if(file == NULL)
+      return 1;
+    while((size_t)fread(line,1,sizeof(line),file) == sizeof(line))
+      truncated.append(line,sizeof(line));
+    fclose(file);
+    if(write_binary_file("decompress_b.gz",truncated))
+      return 1;
+    errno = 0;
+    if(!retval && (files_equal("decompress_b.gz","decompress_plain.txt",equal) == 0 || errno != EIO))
+      retval = 1;
+
+    unlink("decompress_a.gz");
+    unlink("decompress_b.gz");
+  }
+#endif
+
+#ifdef HAVE_ZSTD
+  {
+    std::string compressed(ZSTD_compressBound(text.size()),'\0');
+    size_t size = ZSTD_compress(&compressed[0],compressed.size(),text.data(),text.size(),3);
+    if(ZSTD_isError(size))
+      return 1;
+    compressed.resize(size);
+    if(write_binary_file("decompress_c.zst",compressed))
+      return 1;
+
+    printf("Comparing zstd and plain files...\n");
+    if(!retval && (files_equal("decompress_plain.txt","decompress_c.zst",equal) || !equal))
+      retval = 1;
+    if(!retval && (line_sets_equal("decompress_reordered.txt","decompress_c.zst",LINE_SET_CONFIG(),equal) || !equal))
+      retval = 1;
+
+    unlink("decompress_c.zst");
+  }
+#endif
+
+  unlink("decompress_plain.txt");
+  unlink("decompress_reordered.txt");
+  return retval;
+}
+
+int test_artifact_cache()
+{
+  ARTIFACT_CACHE cache, reader;
+  ARTIFACT_INFO info, found;
+  const char cache_path[] = "artifact_cache.test";
+  int retval = 0;
+
+  printf("Testing ARTIFACT_CACHE\n");
+  unlink(cache_path);
+
+  info.size = 6;
+  info.mtime = 1234;
+  info.digest = "d41d8cd98f00b204e9800998ecf8427e";
+  info.metadata = "hid_UTR.fasta.out";
+  info.has_contents = true;
+  info.contents = "1 2 3\n";
+
+  if(cache.open(cache_path,0) || cache.put(1,"result_0_0",info))
+    return 1;
+
+  printf("Reading from a second instance...\n");
+  if(reader.open(cache_path,0) || reader.get(1,"result_0_0",found) != 0
+     || found.size != 6 || found.digest != info.digest || found.contents != info.contents)
+    retval = 1;
+  if(!retval && reader.get(2,"result_0_0",found) != 1)
+    retval = 1;
+
+  printf("Recovering from a torn append...\n");
+  if(!retval)
+    {
+      FILE *file = fopen(cache_path,"a");
+      fputs("torn record",file);
+      fclose(file);
+      info.metadata = "replaced";
+      if(cache.put(1,"result_0_0",info) || reader.get(1,"result_0_0",found) != 0 || found.metadata != "replaced")
+	retval = 1;
+    }
+
+  printf("Evicting old entries...\n");
+  if(!retval)
+    {
+      ARTIFACT_CACHE small;
+      char name[32];
+      if(small.open(cache_path,2048))
+	retval = 1;
+      for(int i = 0;!retval && i < 100;i++)
+	{
+	  snprintf(name,sizeof(name),"file_%d",i);
+	  if(small.put(i,name,info))
+	    retval = 1;
+	}
+      if(!retval && (small.get_stats().evictions == 0 || small.get_stats().bytes > 2048
+		     || small.get(99,"file_99",found) != 0 || small.get(0,"file_0",found) != 1))
+	retval = 1;
+      if(!retval && (reader.get(99,"file_99",found) != 0 || reader.get(1,"result_0_0",found) != 1))
+	retval = 1;
+    }
+
+  cache.close();
+  reader.close();
+  unlink(cache_path);
+  return retval;
+}
+
+int test_readahead()
+{
+  READAHEAD readahead;
+  READAHEAD_STATS stats;
+  std::vector<std::string> paths;
+  int retval = 0;
+
+  printf("Testing READAHEAD\n");
+
+  if(write_test_file("prefetch_a.txt","1 2 3\n") || write_test_file("prefetch_b.txt","4 5 6\n"))
+    return 1;
+  paths.push_back("prefetch_a.txt");
+  paths.push_back("prefetch_b.txt");
+
+  if(readahead.start(1024))
+    return 1;
+  readahead.prefetch(paths);
+
+  // Wait for the background thread to read both files.
+  for(int i = 0;i < 100 && readahead.get_stats().prefetched < 2;i++)
+    usleep(10000);
+
+  readahead.claim("prefetch_a.txt");
+  readahead.claim("prefetch_b.txt");
+  readahead.claim("prefetch_missing.txt");
+  stats = readahead.get_stats();
+  printf("%ld queued, %ld prefetched, %ld hits, %ld misses\n",stats.queued,stats.prefetched,stats.hits,stats.misses);
+  if(stats.queued != 2 || stats.prefetched != 2 || stats.hits != 2 || stats.misses != 1 || stats.bytes != 12)
+    retval = 1;
+
+  readahead.stop();
+  unlink("prefetch_a.txt");
+  unlink("prefetch_b.txt");
+  return retval;
+}
+
+int test_open_files()
+{
+  std::vector<std::string> paths;
+  std::vector<OPENED_FILE> files;
+  bool io_uring = open_files_uses_io_uring();
+  int retval = 0;
+
+  printf("Testing open_files (io_uring: %s)\n",io_uring ? "yes" : "no");
+
+  if(write_test_file("open_a.txt","1 2 3\n"))
+    return 1;
+  paths.push_back("open_a.txt");
+  paths.push_back("open_missing.txt");
+  paths.push_back("missing_directory/open_a.txt");
+
+  open_files(paths,files);
+  if(files.size() != 3 || files[0].fd < 0 || files[0].size != 6
+     || files[1].fd >= 0 || files[1].error != ENOENT
+     || files[2].fd >= 0)
+    retval = 1;
+  // Files that fail to open do not turn io_uring off.
+  if(open_files_uses_io_uring() != io_uring)
+    retval = 1;
+
+  printf("Classifying errors...\n");
+  if(!retval && (is_transient_open_error("./open_missing.txt",ENOENT)
+		 || !is_transient_open_error("missing_directory/open_a.txt",ENOENT)
+		 || is_transient_open_error("open_a.txt",EACCES)))
+    retval = 1;
+
+  close_files(files);
+  unlink("open_a.txt");
+  return retval;
+}
+
+int test_stage_files()
+{
+  std::vector<std::string> sources, destinations;
+  std::vector<STAGE_RESULT> results;
+  STAGE_OPTIONS options;
+  struct stat st;
+  bool equal = false;
+  int retval = 0;
+
+  printf("Testing stage_files\n");
+
+  if(write_test_file("stage_a.txt","1 2 3\n") || write_test_file("stage_b.txt","4 5 6\n") || write_test_file("staged_b.txt","old\n"))
+    return 1;
+  sources.push_back("stage_a.txt");
+  destinations.push_back("staged_a.txt");
+  sources.push_back("stage_b.txt");
+  destinations.push_back("staged_b.txt");
+  sources.push_back("stage_missing.txt");
+  destinations.push_back("staged_missing.txt");
+
+  printf("Staging without overwriting...\n");
+  options.overwrite = false;
+  if(stage_files(sources,destinations,options,results) != 1
+     || results[0].method == STAGE_FAILED || results[1].method != STAGE_SKIPPED
+     || results[2].method != STAGE_FAILED || results[2].error != ENOENT)
+    retval = 1;
+  if(!retval && (files_equal("stage_a.txt","staged_a.txt",equal) || !equal))
+    retval = 1;
+  if(!retval && (stat("staged_a.txt",&st) || (st.st_mode & 0777) != 0660))
+    retval = 1;
+
+  printf("Staging with overwriting...\n");
+  options.overwrite = true;
+  if(!retval && (stage_files(sources,destinations,options,results) != 1
+		 || files_equal("stage_b.txt","staged_b.txt",equal) || !equal))
+    retval = 1;
+
+  unlink("stage_a.txt");
+  unlink("stage_b.txt");
+  unlink("staged_a.txt");
+  unlink("staged_b.txt");
+  return retval;
+}
+
+int test_output_writer()
+{
+  OUTPUT_WRITER writer;
+  struct stat st;
+  bool equal = false;
+  int retval = 0;
+
+  printf("Testing OUTPUT_WRITER\n");
+
+  if(write_test_file("append_a.txt","aaa\n") || write_test_file("append_b.txt","bbb\n") || write_test_file("appended_expected.txt","aaa\n\nbbb\n"))
+    return 1;
+  unlink("appended.txt");
+  writer.set_sync_interval(-1);
+
+  printf("Appending...\n");
+  if(writer.append("append_a.txt","appended.txt","\n",0660) || writer.append("append_b.txt","appended.txt","\n",0660))
+    retval = 1;
+  if(!retval && (files_equal("appended.txt","appended_expected.txt",equal) || !equal))
+    retval = 1;
+  if(!retval && (stat("appended.txt",&st) || (st.st_mode & 0777) != 0660))
+    retval = 1;
+
+  printf("Appending a missing file...\n");
+  if(!retval && (writer.append("append_missing.txt","appended.txt","\n",0660) == 0 || errno != ENOENT))
+    retval = 1;
+
+  printf("Syncing...\n");
+  if(!retval && (writer.close() || writer.get_stats().appends != 2 || writer.get_stats().files_synced != 1 || writer.get_stats().opens != 1))
+    retval = 1;
+
+  unlink("append_a.txt");
+  unlink("append_b.txt");
+  unlink("appended.txt");
+  unlink("appended_expected.txt");
+  return retval;
+}
+
+int test_handoff_queue()
+{
+  HANDOFF_QUEUE queue;
+  HANDOFF_QUEUE_STATS stats;
+  unsigned long long seq = 0, first_seq = 0;
+  std::string payload;
+  bool equal = false;
+  int retval = 0;
+
+  printf("Testing HANDOFF_QUEUE\n");
+
+  unlink("handoff.queue");
+  if(queue.open("handoff.queue",false) || queue.append("first") || queue.append("second"))
+    return 1;
+
+  printf("Claiming and releasing...\n");
+  if(queue.claim(0,0,first_seq,payload) != 1 || payload != "first" || queue.release(first_seq))
+    retval = 1;
+  if(!retval && (queue.claim(0,0,seq,payload) != 1 || seq != first_seq || queue.ack(seq)))
+    retval = 1;
+  if(!retval && (queue.ack(seq) == 0 || errno != ENOENT))
+    retval = 1;
+
+  printf("Reopening...\n");
+  queue.close();
+  if(!retval && queue.open("handoff.queue",false))
+    retval = 1;
+  if(!retval && (queue.get_stats(stats) || stats.depth != 1 || stats.appended != 2 || stats.acked != 1))
+    retval = 1;
+  if(!retval && (queue.claim(0,0,seq,payload) != 1 || payload != "second" || queue.ack(seq)))
+    retval = 1;
+  if(!retval && (queue.claim(0,0,seq,payload) != 0 || queue.get_stats(stats) || stats.depth != 0))
+    retval = 1;
+
+  // A record out of attempts goes to the dead letter file and no longer
+  // counts as queued.
+  printf("Exhausting attempts...\n");
+  unlink("handoff.queue.dead");
+  if(!retval && (queue.append("third\n") || queue.claim(0,1,seq,payload) != 1 || queue.release(seq)))
+    retval = 1;
+  if(!retval && (queue.claim(0,1,seq,payload) != 0 || queue.get_stats(stats) || stats.depth != 0 || stats.dead != 1))
+    retval = 1;
+  if(!retval && (write_test_file("handoff_dead_expected.txt","third\n\n") || files_equal("handoff.queue.dead","handoff_dead_expected.txt",equal) || !equal))
+    retval = 1;
+
+  queue.close();
+  unlink("handoff.queue");
+  unlink("handoff.queue.dead");
+  unlink("handoff_dead_expected.txt");
+  return retval;
+}
+
+int test_work_pool()
+{
+  WORK_POOL pool;
+  WORK_POOL_STATS stats;
+  std::vector<WORK_RANGE> ranges;
+  std::vector<int> counts(60,0);
+  int fds[2], first, retval = 0;
+  bool found = false;
+
+  printf("Testing WORK_POOL\n");
+
+  for(int i = 0;i < 60;i++)
+    ranges.push_back(WORK_RANGE(10 * i,10 * i + 9));
+  if(pool.create(3,100) || pipe(fds) || pool.dispatch(ranges,7))
+    return 1;
+  for(int worker = 0;worker < 3;worker++)
+    {
+      pid_t pid = fork();
+      if(pid == 0)
+	{
+	  WORK_RANGE range;
+	  int tag;
+	  close(fds[0]);
+	  while(pool.next(worker,0.2,range,tag) == 1)
+	    {
+	      if(worker == 0)
+		usleep(20000);// slow, so the others steal its ranges
+	      if(tag != 7 || write(fds[1],&range.first,sizeof(int)) != sizeof(int))
+		_exit(1);
+	      pool.done(worker,true);
+	    }
+	  _exit(0);
+	}
+      pool.set_pid(worker,pid);
+    }
+  close(fds[1]);
+
+  if(pool.wait_done(10,found) != 1 || !found)
+    retval = 1;
+  while(read(fds[0],&first,sizeof(int)) == sizeof(int))
+    if(first % 10 == 0 && first / 10 < 60)
+      counts[first / 10]++;
+  close(fds[0]);
+  for(int worker = 0;worker < 3;worker++)
+    {
+      int status;
+      if(wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	retval = 1;
+    }
+
+  // Every range is handled once, and the fast workers took some of the
+  // slow worker's share.
+  for(int i = 0;i < 60;i++)
+    if(counts[i] != 1)
+      retval = 1;
+  stats = pool.get_stats();
+  printf("%ld ranges, %ld stolen\n",stats.ranges,stats.stolen);
+  if(stats.ranges != 60 || stats.stolen == 0)
+    retval = 1;
+  return retval;
+}
+
+int test_validation_order()
+{
+  extern bool has_validation_priority(int appid);
+  extern int order_workunits(int appid, const std::vector<std::string>& names, std::vector<size_t>& order);
+  const char *names_array[] = {"wu_1", "wu_5", "wu_nodag", "wu_3", "wu_5b", "wu_5"};
+  std::vector<std::string> names(names_array,names_array + 6);
+  std::vector<size_t> order;
+  const size_t expected[] = {1, 5, 3, 0, 2, 4};// highest first, ties in order
+  WORK_POOL pool;
+  std::vector<WORK_RANGE> ranges;
+  WORK_RANGE range;
+  int tag;
+
+  printf("Testing validation order\n");
+
+  if(!has_validation_priority(42) || has_validation_priority(43))
+    return 1;
+  if(order_workunits(42,names,order) || order.size() != names.size())
+    return 1;
+  for(size_t i = 0;i < order.size();i++)
+    if(order[i] != expected[i])
+      return 1;
+
+  // Interleaved, each worker starts with its share of the first ranges.
+  for(int i = 0;i < 5;i++)
+    ranges.push_back(WORK_RANGE(i,i));
+  if(pool.create(2,10) || pool.dispatch(ranges,42,true))
+    return 1;
+  if(pool.next(0,0,range,tag) != 1 || range.first != 0)
+    return 1;
+  if(pool.next(1,0,range,tag) != 1 || range.first != 1)
+    return 1;
+  if(pool.next(0,0,range,tag) != 1 || range.first != 2)
+    return 1;
+  return 0;
+}
+
+int test_dag_journal()
+{
+  PyObject *module, *size, *read;
+  FILE *journal;
+  int retval = 0;
+
+  printf("Testing DAG journal\n");
+
+  unlink("test.dag.journal");
+  module = PyImport_ImportModule("boinctools");
+  if(module == NULL)
+    return 1;
+  for(int i = 0;i < 3;i++)
+    {
+      const char *names[] = {"wu_1", "wu_2", "wu_1"};
+      size = PyObject_CallMethod(module,(char*)"append_dag_journal",(char*)"(ssi)","test.dag.journal",names[i],i + 1);
+      if(size == NULL || PyInt_AsLong(size) != 7 * (i + 1))// records are "wu_N\tS\n"
+	retval = 1;
+      Py_XDECREF(size);
+    }
+
+  // A record cut short by a crash is not read.
+  journal = fopen("test.dag.journal","a");
+  if(journal == NULL)
+    retval = 1;
+  else
+    {
+      fputs("wu_3\t",journal);
+      fclose(journal);
+    }
+
+  // The last record of wu_1 wins. Reading from the end returns nothing.
+  read = PyObject_CallMethod(module,(char*)"read_dag_journal",(char*)"(s)","test.dag.journal");
+  if(read == NULL)
+    retval = 1;
+  else
+    {
+      PyObject *states = PyTuple_GetItem(read,0), *rest;
+      if(PyDict_Size(states) != 2 || PyInt_AsLong(PyDict_GetItemString(states,"wu_1")) != 3
+	 || PyInt_AsLong(PyDict_GetItemString(states,"wu_2")) != 2 || PyInt_AsLong(PyTuple_GetItem(read,1)) != 21)
+	retval = 1;
+      rest = PyObject_CallMethod(module,(char*)"read_dag_journal",(char*)"(sO)","test.dag.journal",PyTuple_GetItem(read,1));
+      if(rest == NULL || PyDict_Size(PyTuple_GetItem(rest,0)) != 0)
+	retval = 1;
+      Py_XDECREF(rest);
+    }
+  Py_XDECREF(read);
+  if(PyErr_Occurred())
+    {
+      PyErr_Print();
+      retval = 1;
+    }
+  Py_DECREF(module);
+  unlink("test.dag.journal");
+  return retval;
+}
+
+int test_python_failures()
+{
+  extern int max_python_failures;
+  extern bool record_python_failure(int wuid, const char *name);
+  extern bool is_quarantined(int wuid);
+  extern void clear_python_failures(int wuid);
+  const int wuid = 1234567;
+
+  printf("Testing Python failure counts\n");
+
+  max_python_failures = 3;
+  if(record_python_failure(wuid,"failing-workunit") || record_python_failure(wuid,"failing-workunit") || is_quarantined(wuid))
+    return 1;
+  clear_python_failures(wuid);
+  if(record_python_failure(wuid,"failing-workunit") || record_python_failure(wuid,"failing-workunit"))
+    return 1;
+  if(!record_python_failure(wuid,"failing-workunit") || !is_quarantined(wuid) || is_quarantined(wuid + 1))
+    return 1;
+  clear_python_failures(wuid);
+  return !is_quarantined(wuid);
+}
+
 int main(int argc, char **argv)
 {
   int retval;
   int pass_counter = 0;
+  long soak_cycles = 1000;
+
+  // make soak runs a million cycles
+  for(int i = 1;i < argc;i++)
+    if(strcmp(argv[i],"--soak") == 0 && i + 1 < argc)
+      soak_cycles = atol(argv[++i]);
 
   if((retval = test_module_found()) != 0)
     {
@@ -149,6 +1154,50 @@ int main(int argc, char **argv)
       pass_counter++;
     }
 
+  if((retval = test_validator_soak(soak_cycles)) != 0)
+    {
+      printf("FAILED: Validator memory use\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_boincresult_reuse()) != 0)
+    {
+      printf("FAILED: BoincResult reuse\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_boincresult_fields()) != 0)
+    {
+      printf("FAILED: BoincResult fields\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_xml_fields()) != 0)
+    {
+      printf("FAILED: xml_fields\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
   if((retval = test_validator_clean_result()) != 0)
     {
       printf("FAILED: Validator clean_result\n");
@@ -160,6 +1209,171 @@ int main(int argc, char **argv)
       pass_counter++;
     }
 
+  if((retval = test_files_equal()) != 0)
+    {
+      printf("FAILED: files_equal\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_numeric_files_equal()) != 0)
+    {
+      printf("FAILED: numeric_files_equal\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_line_sets_equal()) != 0)
+    {
+      printf("FAILED: line_sets_equal\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_decompress()) != 0)
+    {
+      printf("FAILED: DECOMPRESS_READER\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_artifact_cache()) != 0)
+    {
+      printf("FAILED: ARTIFACT_CACHE\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_readahead()) != 0)
+    {
+      printf("FAILED: READAHEAD\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_open_files()) != 0)
+    {
+      printf("FAILED: open_files\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_stage_files()) != 0)
+    {
+      printf("FAILED: stage_files\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_output_writer()) != 0)
+    {
+      printf("FAILED: OUTPUT_WRITER\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_handoff_queue()) != 0)
+    {
+      printf("FAILED: HANDOFF_QUEUE\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_work_pool()) != 0)
+    {
+      printf("FAILED: WORK_POOL\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_validation_order()) != 0)
+    {
+      printf("FAILED: Validation order\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_dag_journal()) != 0)
+    {
+      printf("FAILED: DAG journal\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_continue_children()) != 0)
+    {
+      printf("FAILED: continue_children\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
+  if((retval = test_python_failures()) != 0)
+    {
+      printf("FAILED: Python failure counts\n");
+      return retval;
+    }
+  else
+    {
+      printf("PASSED\n\n");
+      pass_counter++;
+    }
+
   if((retval = test_assimilate_handler()) != 0)
     {
       printf("FAILED: Validator clean_result\n");